@@ -44,10 +44,54 @@ Config::~Config() {
     _json.clear();
 }
 
+// Returns the child of `node` with the (escaped) JSON pointer reference token
+// path[start:end], or nullptr if there is none.
+static const json* find_child(const json* node, const std::string& path, size_t start,
+                              size_t end) {
+    std::string token;
+    for (size_t i = start; i < end; i++) {
+        if (path[i] == '~' && i + 1 < end && (path[i + 1] == '0' || path[i + 1] == '1')) {
+            token += (path[i + 1] == '0') ? '~' : '/';
+            i++;
+        } else {
+            token += path[i];
+        }
+    }
+
+    if (node->is_object()) {
+        auto it = node->find(token);
+        return it == node->end() ? nullptr : &*it;
+    }
+    if (node->is_array() && !token.empty()
+        && token.find_first_not_of("0123456789") == std::string::npos
+        && (token.size() == 1 || token[0] != '0')) {
+        size_t index = std::stoul(token);
+        return index < node->size() ? &(*node)[index] : nullptr;
+    }
+    return nullptr;
+}
+
+// Returns the value at `path` relative to `node`, or nullptr if there is none.
+// The path is a JSON pointer, but the leading slash is optional, and "/" is `node` itself.
+static const json* find_below(const json* node, const std::string& path) {
+    if (path == "/")
+        return node;
+    size_t start = (!path.empty() && path[0] == '/') ? 1 : 0;
+    while (node != nullptr && start <= path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos)
+            end = path.size();
+        node = find_child(node, path, start, end);
+        start = end + 1;
+    }
+    return node;
+}
+
 void Config::parse_file(const std::string& file_name) {
     try {
         std::ifstream config_file_stream(file_name);
         config_file_stream >> _json;
+        _generation++;
     } catch (std::exception const& ex) {
         WARN_NON_OO("Could not parse json file: {:s}, error: {:s}", file_name, ex.what());
         throw;
@@ -56,6 +100,7 @@ void Config::parse_file(const std::string& file_name) {
 
 void Config::update_config(json updates) {
     _json = updates;
+    _generation++;
 }
 
 int32_t Config::num_links_per_gpu(const int32_t& gpu_id) const {
@@ -71,51 +116,42 @@ int32_t Config::num_links_per_gpu(const int32_t& gpu_id) const {
     return gpus_in_link;
 }
 
-json Config::get_value(const std::string& base_path, const std::string& name) const {
-    std::string search_path = base_path;
-    for (;;) {
-
-        if (search_path == "" && exists("/", name)) {
-            json::json_pointer value_pointer(fmt::format(fmt("/{:s}"), name));
-            return _json.at(value_pointer);
-        }
-
-        if (search_path == "")
+const json* Config::find_value(const std::string& base_path, const std::string& name) const {
+    // The blocks along base_path, starting from the root
+    vector<const json*> blocks = {&_json};
+    size_t start = (!base_path.empty() && base_path[0] == '/') ? 1 : 0;
+    while (start < base_path.size()) {
+        size_t end = base_path.find('/', start);
+        if (end == std::string::npos)
+            end = base_path.size();
+        const json* block = find_child(blocks.back(), base_path, start, end);
+        if (block == nullptr)
             break;
+        blocks.push_back(block);
+        start = end + 1;
+    }
 
-        if (search_path == "/" && exists(search_path, name)) {
-            json::json_pointer value_pointer(search_path + name);
-            return _json.at(value_pointer);
-        }
-
-        if (exists(search_path, name)) {
-            json::json_pointer value_pointer(fmt::format(fmt("{:s}/{:s}"), search_path, name));
-            return _json.at(value_pointer);
-        }
-
-        std::size_t last_slash = search_path.find_last_of("/");
-        search_path = search_path.substr(0, last_slash);
+    // Search from the innermost block outwards
+    for (auto block = blocks.rbegin(); block != blocks.rend(); ++block) {
+        const json* value = find_below(*block, name);
+        if (value != nullptr)
+            return value;
     }
-    throw std::runtime_error(
-        fmt::format(fmt("The config option: {:s} is required, but was not found in the path: {:s}"),
-                    name, base_path));
+    return nullptr;
 }
 
-bool Config::exists(const std::string& base_path, const std::string& name) const {
-    std::string search_path;
-    if (base_path == "/") {
-        search_path = base_path + name;
-    } else {
-        search_path = fmt::format(fmt("{:s}/{:s}"), base_path, name);
-    }
+const json& Config::get_value(const std::string& base_path, const std::string& name) const {
+    const json* value = find_value(base_path, name);
+    if (value == nullptr)
+        throw std::runtime_error(fmt::format(
+            fmt("The config option: {:s} is required, but was not found in the path: {:s}"), name,
+            base_path));
+    return *value;
+}
 
-    json::json_pointer search_pointer(search_path);
-    try {
-        _json.at(search_pointer);
-    } catch (std::exception const& ex) {
-        return false;
-    }
-    return true;
+bool Config::exists(const std::string& base_path, const std::string& name) const {
+    const json* block = find_below(&_json, base_path);
+    return block != nullptr && find_below(block, name) != nullptr;
 }
 
 vector<json> Config::get_value(const std::string& name) const {
@@ -11,13 +11,14 @@
 #include "fmt.hpp"  // for format, fmt
 #include "json.hpp" // for json
 
+#include <atomic>      // for atomic
 #include <complex>     // for complex  // IWYU pragma: keep
 #include <cxxabi.h>    // for __cxa_demangle
 #include <exception>   // for exception
 #include <list>        // for list
 #include <regex>       // for regex, cmatch, regex_match, sregex_token_iterator
 #include <stdexcept>   // for runtime_error
-#include <stdint.h>    // for int32_t
+#include <stdint.h>    // for int32_t, uint64_t
 #include <string>      // for string, operator==, allocator, stod
 #include <type_traits> // for is_arithmetic, enable_if, is_same
 #include <typeinfo>    // for type_info
@@ -57,7 +58,7 @@ public:
              typename std::enable_if<std::is_arithmetic<T>::value && !std::is_same<bool, T>::value,
                                      T>::type* = nullptr>
     T get(const std::string& base_path, const std::string& name) const {
-        nlohmann::json json_value = get_value(base_path, name);
+        const nlohmann::json& json_value = get_value(base_path, name);
         T value;
         try {
             // If the expected type is a number and the value
@@ -95,7 +96,7 @@ public:
              typename std::enable_if<!std::is_arithmetic<T>::value || std::is_same<bool, T>::value,
                                      T>::type* = nullptr>
     T get(const std::string& base_path, const std::string& name) const {
-        nlohmann::json json_value = get_value(base_path, name);
+        const nlohmann::json& json_value = get_value(base_path, name);
         T value;
         try {
             value = json_value.get<T>();
@@ -159,9 +160,11 @@ public:
      *                      /vdif_cap/disk_write
      * @param name          The name of the property i.e. num_frequencies
      *
-     * @return              The value that was found.
+     * @return              The value that was found. It is only valid until the
+     *                      config is next changed.
      **/
-    nlohmann::json get_value(const std::string& base_pointer, const std::string& name) const;
+    const nlohmann::json& get_value(const std::string& base_pointer,
+                                    const std::string& name) const;
 
     /**
      * @brief Finds all values with key "name". Searches the whole config tree.
@@ -212,6 +215,15 @@ public:
     std::string get_md5sum() const;
 #endif
 
+    /**
+     * @brief Returns a counter which changes every time the config is changed.
+     *
+     * Used by @c ConfigValue to know when to read its value again.
+     */
+    uint64_t get_generation() const {
+        return _generation.load(std::memory_order_acquire);
+    }
+
     /**
      * @brief Returns the full json data structure (for internal framework use)
      * @warning This shouldn't be called outside of the core framework
@@ -228,6 +240,16 @@ private:
     /// Internal json object
     nlohmann::json _json;
 
+    /// Counts the changes to @c _json
+    std::atomic<uint64_t> _generation{0};
+
+    /**
+     * @brief Finds the value @c get_value would return, without throwing.
+     *
+     * @return A pointer to the value, or nullptr if it wasn't found.
+     */
+    const nlohmann::json* find_value(const std::string& base_path, const std::string& name) const;
+
     /**
      * @brief Finds all values with key "name". Searches the given json.
      *
@@ -285,6 +307,7 @@ void Config::update_value(const std::string& base_path, const std::string& name,
 
     try {
         _json.at(path) = value;
+        _generation++;
     } catch (std::exception const& ex) {
         throw std::runtime_error(fmt::format(
             fmt("Failed to update config value at: {:s} message: {:s}"), update_path, ex.what()));
@@ -294,6 +317,9 @@ void Config::update_value(const std::string& base_path, const std::string& name,
 template<typename T>
 T Config::get_default(const std::string& base_path, const std::string& name,
                       T default_value) const {
+    // Missing values are common, so don't throw and catch for them
+    if (find_value(base_path, name) == nullptr)
+        return default_value;
     try {
         T value = get<T>(base_path, name);
         return value;
@@ -308,7 +334,7 @@ Config::configEval<Type>::configEval(const Config& _config, const std::string& b
     config(_config),
     unique_name(base_path) {
 
-    nlohmann::json value = config.get_value(base_path, name);
+    const nlohmann::json& value = config.get_value(base_path, name);
 
     if (!(value.is_string() || value.is_number())) {
         throw std::runtime_error(fmt::format(
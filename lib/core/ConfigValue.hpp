@@ -0,0 +1,110 @@
+/*****************************************
+@file
+@brief A config value which is looked up once and cached
+- ConfigValue<T>
+*****************************************/
+#ifndef CONFIG_VALUE_HPP
+#define CONFIG_VALUE_HPP
+
+#include "Config.hpp" // for Config
+
+#include <stdint.h> // for uint64_t
+#include <string>   // for string
+
+namespace kotekan {
+
+/**
+ * @class ConfigValue
+ * @brief A config value which is looked up once, and again only when the config changes.
+ *
+ * Looking up a value with @c Config::get searches the config tree from the stage's
+ * path up to the root and converts the JSON to @c T, which is too slow to do for every
+ * frame.  A @c ConfigValue does that once when it is constructed, and then only reads
+ * the value again if the config has changed since (see @c Config::get_generation), so
+ * it still follows updates made with @c Config::update_value.
+ *
+ * It has the same rules as @c Config::get and @c Config::get_default: the value is
+ * searched for from @c base_path up to the root, and arithmetic types may be given as
+ * expressions.  A required value which is missing throws @c std::runtime_error, from
+ * the constructor or from a later refresh if it is removed from the config.
+ *
+ * Like the rest of the config, a value should only be read from one thread at a time.
+ *
+ * @code
+ * ConfigValue<std::vector<int>> cpu_affinity(config, unique_name, "cpu_affinity", {});
+ * for (auto cpu : cpu_affinity.get()) ...
+ * @endcode
+ */
+template<typename T>
+class ConfigValue {
+public:
+    /**
+     * @brief Look up a required value.
+     *
+     * @param config     The config to read the value from.
+     * @param base_path  Where to start searching for the value, usually the stage's
+     *                   unique name.
+     * @param name       The name of the value.
+     */
+    ConfigValue(const Config& config, const std::string& base_path, const std::string& name) :
+        _config(config),
+        _base_path(base_path),
+        _name(name),
+        _required(true) {
+        refresh();
+    }
+
+    /**
+     * @brief Look up an optional value.
+     *
+     * @param config         The config to read the value from.
+     * @param base_path      Where to start searching for the value.
+     * @param name           The name of the value.
+     * @param default_value  The value to use if it isn't in the config.
+     */
+    ConfigValue(const Config& config, const std::string& base_path, const std::string& name,
+                const T& default_value) :
+        _config(config),
+        _base_path(base_path),
+        _name(name),
+        _required(false),
+        _default_value(default_value) {
+        refresh();
+    }
+
+    /// Returns the value, reading it again first if the config has changed.
+    const T& get() {
+        if (_config.get_generation() != _generation)
+            refresh();
+        return _value;
+    }
+
+    /// Same as @c get()
+    operator const T&() {
+        return get();
+    }
+
+private:
+    void refresh() {
+        // Read the generation first, so a change made while reading is picked up next time
+        _generation = _config.get_generation();
+        if (_required)
+            _value = _config.get<T>(_base_path, _name);
+        else
+            _value = _config.get_default<T>(_base_path, _name, _default_value);
+    }
+
+    const Config& _config;
+    const std::string _base_path;
+    const std::string _name;
+    const bool _required;
+    const T _default_value = T();
+
+    /// The config generation the value was read in
+    uint64_t _generation;
+    T _value;
+};
+
+} // namespace kotekan
+
+#endif // CONFIG_VALUE_HPP
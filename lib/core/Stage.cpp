@@ -1,8 +1,9 @@
 #include "Stage.hpp"
 
 #include "Config.hpp"          // for Config
-#include "buffer.h"            // for Buffer
+#include "buffer.h"            // for Buffer, register_consumer, register_producer
 #include "bufferContainer.hpp" // for bufferContainer
+#include "kotekanTrace.hpp"    // for TraceSpan, kotekan_trace_intern, kotekan_trace_set_thre...
 #include "util.h"              // for string_tail
 
 #include "fmt.hpp" // for format
@@ -60,6 +61,22 @@ std::vector<struct Buffer*> Stage::get_buffer_array(const std::string& name) {
     return bufs;
 }
 
+int Stage::register_as_consumer(struct Buffer* buf) {
+    int consumer_id = register_consumer(buf, unique_name.c_str());
+    if (consumer_id == -1)
+        throw std::runtime_error(fmt::format(fmt("Could not register {:s} as a consumer of {:s}"),
+                                             unique_name, buf->buffer_name));
+    return consumer_id;
+}
+
+int Stage::register_as_producer(struct Buffer* buf) {
+    int producer_id = register_producer(buf, unique_name.c_str());
+    if (producer_id == -1)
+        throw std::runtime_error(fmt::format(fmt("Could not register {:s} as a producer of {:s}"),
+                                             unique_name, buf->buffer_name));
+    return producer_id;
+}
+
 void Stage::apply_cpu_affinity() {
 
     std::lock_guard<std::mutex> lock(cpu_affinity_lock);
@@ -105,6 +122,8 @@ void Stage::start() {
         pid_t tid = syscall(SYS_gettid);
         register_tid(tid);
 #endif
+        kotekan_trace_set_thread_name(unique_name.c_str());
+        TraceSpan span("main_thread", "stage", "stage", kotekan_trace_intern(unique_name.c_str()));
         main_thread_fn(std::ref(*this));
 #if !defined(MAC_OSX)
         unregister_tid(tid);
@@ -99,6 +99,22 @@ protected:
      */
     std::vector<struct Buffer*> get_buffer_array(const std::string& name);
 
+    /**
+     * @brief Registers this stage as a consumer of a buffer.
+     *
+     * @param buf The buffer to consume frames from.
+     * @return The handle to use with the @c consumer_* buffer functions.
+     */
+    int register_as_consumer(struct Buffer* buf);
+
+    /**
+     * @brief Registers this stage as a producer of a buffer.
+     *
+     * @param buf The buffer to produce frames into.
+     * @return The handle to use with the @c producer_* buffer functions.
+     */
+    int register_as_producer(struct Buffer* buf);
+
     bufferContainer& buffer_container;
 
 private:
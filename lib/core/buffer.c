@@ -1,9 +1,10 @@
 #include "buffer.h"
 
-#include "errors.h"    // for CHECK_ERROR_F, ERROR_F, CHECK_MEM_F, INFO_F, DEBUG_F, WARN_F
-#include "metadata.h"  // for metadataContainer, decrement_metadata_ref_count, increment_...
-#include "nt_memset.h" // for nt_memset
-#include "util.h"      // for e_time
+#include "errors.h"       // for CHECK_ERROR_F, ERROR_F, CHECK_MEM_F, INFO_F, DEBUG_F, WARN_F
+#include "kotekanTrace.h" // for kotekan_trace_enabled, kotekan_trace_intern, kotekan_trace_...
+#include "metadata.h"     // for metadataContainer, decrement_metadata_ref_count, increment_...
+#include "nt_memset.h"    // for nt_memset
+#include "util.h"         // for e_time
 #ifdef WITH_HSA
 #include "hsaBase.h" // for hsa_host_free, hsa_host_malloc
 #endif
@@ -12,15 +13,19 @@
 // IWYU pragma: no_include <asm/mman.h>
 #include <assert.h>   // for assert
 #include <errno.h>    // for errno, ETIMEDOUT
+#include <limits.h>   // for INT_MAX
 #include <sched.h>    // for cpu_set_t, CPU_SET, CPU_ZERO
 #include <stdio.h>    // for snprintf
-#include <stdlib.h>   // for free, malloc
+#include <stdlib.h>   // for free, malloc, calloc
 #include <string.h>   // for memset, strerror, memcpy, strdup, strncmp, strncpy
 #include <sys/mman.h> // for mlock, mmap, munmap, MAP_FAILED
 #ifndef MAC_OSX
-#include <linux/mman.h> // for MAP_HUGE_2MB
+#include <linux/futex.h> // for FUTEX_WAIT_BITSET_PRIVATE, FUTEX_WAKE_PRIVATE, FUTEX_CLOCK_...
+#include <linux/mman.h>  // for MAP_HUGE_2MB
+#include <sys/syscall.h> // for SYS_futex
+#include <unistd.h>      // for syscall
 #endif
-#include <time.h> // for NULL, size_t, timespec
+#include <time.h> // for NULL, size_t, timespec, clock_gettime, CLOCK_MONOTONIC_RAW
 #ifdef WITH_NUMA
 #include <numa.h>   // for numa_allocate_nodemask, numa_bitmask_free, numa_bitmask_setbit
 #include <numaif.h> // for set_mempolicy, mbind, MPOL_BIND, MPOL_DEFAULT, MPOL_MF_STRICT
@@ -29,12 +34,79 @@
 // It is assumed this is a power of two in the code.
 #define HUGE_PAGE_SIZE 2097152
 
-struct zero_frames_thread_args {
-    struct Buffer* buf;
-    int ID;
+// Layout of the lock free frame state words, see Buffer::frame_state
+#define LF_CONSUMER_BITS ((1u << MAX_CONSUMERS) - 1u)
+#define LF_PRODUCER_SHIFT MAX_CONSUMERS
+#define LF_PRODUCER_BITS (((1u << MAX_PRODUCERS) - 1u) << LF_PRODUCER_SHIFT)
+#define LF_FULL_BIT (1u << 30)
+#define LF_SHUTDOWN_BIT (1u << 31)
+// The state words are padded out to a 64 byte cache line each
+#define LF_STATE_STRIDE 16
+#define LF_STATE(buf, ID) (&(buf)->frame_state[(ID)*LF_STATE_STRIDE])
+#define LF_WAITERS(buf, ID) (&(buf)->frame_waiters[(ID)*LF_STATE_STRIDE])
+
+struct bufferZeroPool {
+    // Protects the queue, the workers and the totals
+    pthread_mutex_t lock;
+    // Signals the workers that a frame has been queued, or that they should stop
+    pthread_cond_t cond;
+
+    // The policy and threads, fixed once the workers have started
+    enum ZeroPolicy policy;
+    size_t region_size;
+    size_t region_stride;
+    int num_threads;
+    int* cpu_affinity;
+    int num_cpus;
+
+    // NULL until zero_frames starts the workers
+    pthread_t* threads;
+    int stop;
+
+    // A frame can only be queued once until it is zeroed, so the queue never holds more than
+    // num_frames entries.
+    int* queue;
+    int queue_head;
+    int queue_len;
+    // The number of frames being zeroed right now
+    int active;
+
+    uint64_t num_frames_zeroed;
+    uint64_t num_bytes;
+    uint64_t busy_time;
+
+    // The range of each frame declared dirty, [dirty_start, dirty_end), empty if start >= end.
+    // Updated with atomics, since several stages can hold a frame at once.
+    size_t* dirty_start;
+    size_t* dirty_end;
 };
 
-void* private_zero_frames(void* args);
+struct bufferEventSlot {
+    // The index of the event in the slot plus one, or 0 while it is being written
+    uint64_t seq;
+    struct BufferEvent event;
+};
+
+// Allocates the zeroing pool, with the default policy, but doesn't start the workers
+void private_create_zero_pool(struct Buffer* buf);
+
+// Stops and joins the zeroing workers and frees the pool
+void private_delete_zero_pool(struct Buffer* buf);
+
+// The zeroing worker thread, `args` is the buffer
+void* private_zero_worker(void* args);
+
+// Zeros frame `ID` under the zeroing policy, returns the number of bytes zeroed
+size_t private_zero_frame(struct Buffer* buf, const int ID);
+
+// Zeros `len` bytes with non-temporal stores where it can, for any alignment of `dest`
+void private_zero_region(uint8_t* dest, size_t len);
+
+// Hands a zeroed frame back to the producers
+void private_finish_zero_frame(struct Buffer* buf, const int ID);
+
+// Queues frame `ID` for the zeroing workers
+void private_queue_zero_frame(struct Buffer* buf, const int ID);
 
 // Returns -1 if there is no consumer with that name
 int private_get_consumer_id(struct Buffer* buf, const char* name);
@@ -42,11 +114,17 @@ int private_get_consumer_id(struct Buffer* buf, const char* name);
 // Returns -1 if there is no producer with that name
 int private_get_producer_id(struct Buffer* buf, const char* name);
 
-// Marks the consumer named by `name` as done for the given ID
-void private_mark_consumer_done(struct Buffer* buf, const char* name, const int ID);
+// Looks up the handle for the functions which take a consumer name, which must be registered.
+int private_consumer_handle(struct Buffer* buf, const char* name);
+
+// Looks up the handle for the functions which take a producer name, which must be registered.
+int private_producer_handle(struct Buffer* buf, const char* name);
+
+// Marks the consumer `consumer_id` as done for the given ID
+void private_mark_consumer_done(struct Buffer* buf, const int consumer_id, const int ID);
 
-// Marks the producer named by `name` as done for the given ID
-void private_mark_producer_done(struct Buffer* buf, const char* name, const int ID);
+// Marks the producer `producer_id` as done for the given ID
+void private_mark_producer_done(struct Buffer* buf, const int producer_id, const int ID);
 
 // Returns 1 if all consumers are done for the given ID.
 int private_consumers_done(struct Buffer* buf, const int ID);
@@ -60,18 +138,80 @@ void private_reset_producers(struct Buffer* buf, const int ID);
 // Resets the list of consumers for the given ID
 void private_reset_consumers(struct Buffer* buf, const int ID);
 
+// Returns 1 if the frame is full, in locking mode buf->lock must be held.
+int private_is_frame_full(struct Buffer* buf, const int ID);
+
+// Marks the producer done for the frame and marks the frame full if it was the last producer.
+// Returns 1 if the frame became full and the consumers need to be signalled.
+// buf->lock must be held.
+int private_mark_frame_full(struct Buffer* buf, const int producer_id, const int ID);
+
+// Returns 1 if the frame is available to the given producer (locking mode, buf->lock held)
+int private_frame_empty_for(struct Buffer* buf, const int producer_id, const int ID);
+
+// Returns 1 if the frame is available to the given consumer (locking mode, buf->lock held)
+int private_frame_full_for(struct Buffer* buf, const int consumer_id, const int ID);
+
+// The time in ns for the event log
+uint64_t private_event_time(void);
+
+// The time a stage starts waiting for a frame, or 0 if neither the event log nor the trace is
+// turned on.  Only read once a wait_for_* call has to block, so frames which are already
+// available don't pay for it.
+uint64_t private_event_wait_start(struct Buffer* buf);
+
+// Adds an event to the event log and the trace (if they are turned on).  `wait_start` is the
+// time the stage started waiting for the frame for acquire events, or 0.
+void private_log_event(struct Buffer* buf, const enum BufferEventType type, const int stage_id,
+                       const int ID, const uint64_t wait_start);
+
+// Records the trace events for a buffer event at `time`, see private_log_event.
+void private_trace_event(struct Buffer* buf, const enum BufferEventType type, const int stage_id,
+                         const int ID, const uint64_t wait_start, const uint64_t time);
+
 /**
- * @brief Marks a frame as empty and if the buffer requires zeroing then it starts
- *        the zeroing thread and delays marking it as empty until the zeroing is done.
+ * @brief Marks a frame as empty and if the buffer requires zeroing then it queues it
+ *        for the zeroing workers and delays marking it as empty until the zeroing is done.
  * @param buf The buffer the frame to empty is in.
  * @param id The id of the frame to mark as empty.
  * @return 1 if the frame was marked as empty, 0 if it is being zeroed.
  */
 int private_mark_frame_empty(struct Buffer* buf, const int id);
 
+// *** Lock free mode ***
+// In lock free mode each public function below dispatches to the private_lf_* version,
+// which works on the frame_state words with atomic operations instead of taking buf->lock.
+
+// Sleeps until the state word of frame `ID` no longer equals `expected`, a wake up is sent
+// or the absolute (CLOCK_REALTIME) `timeout` passes.  Returns ETIMEDOUT on timeout, else 0.
+int private_lf_wait(struct Buffer* buf, const int ID, const uint32_t expected,
+                    const struct timespec* timeout);
+
+// Wakes all threads sleeping on the state word of frame `ID`, if there are any.
+void private_lf_wake(struct Buffer* buf, const int ID);
+
+// Called by the one thread which completed the consumers of frame `ID`, releases the
+// metadata and either clears the frame or queues it for the zeroing workers.
+void private_lf_release_frame(struct Buffer* buf, const int ID);
+
+// Clears the full flag and the consumer flags of frame `ID`, handing it back to the producers.
+void private_lf_clear_frame(struct Buffer* buf, const int ID);
+
+// Sets the consumer done flags `bits` on frame `ID`, and releases the frame if this completed
+// its consumers.  Returns the previous state word.
+uint32_t private_lf_set_consumers_done(struct Buffer* buf, const int ID, const uint32_t bits);
+
+void private_lf_mark_frame_full(struct Buffer* buf, const int producer_id, const int ID);
+void private_lf_mark_frame_empty(struct Buffer* buf, const int consumer_id, const int ID);
+uint8_t* private_lf_wait_for_empty_frame(struct Buffer* buf, const int producer_id, const int ID);
+int private_lf_wait_for_full_frame(struct Buffer* buf, const int consumer_id, const int ID,
+                                   const struct timespec* timeout);
+void private_lf_unregister_consumer(struct Buffer* buf, const int consumer_id);
+
 struct Buffer* create_buffer(int num_frames, size_t len, struct metadataPool* pool,
                              const char* buffer_name, const char* buffer_type, int numa_node,
-                             bool use_hugepages, bool mlock_frames, bool zero_new_frames) {
+                             bool use_hugepages, bool mlock_frames, bool zero_new_frames,
+                             bool lock_free, int event_log_size) {
 
     assert(num_frames > 0);
 
@@ -101,8 +241,20 @@ struct Buffer* create_buffer(int num_frames, size_t len, struct metadataPool* po
     buf->use_hugepages = use_hugepages;
     buf->mlock_frames = mlock_frames;
 
+#ifdef MAC_OSX
+    if (lock_free) {
+        WARN_F("Lock free mode isn't supported on MacOS, buffer %s will use locks", buffer_name);
+        lock_free = false;
+    }
+#endif
+    buf->lock_free = lock_free;
+    buf->consumer_mask = 0;
+    buf->producer_mask = 0;
+    buf->retired_consumer_mask = 0;
+
     // Copy the buffer name and type.
     buf->buffer_name = strdup(buffer_name);
+    buf->trace_name = kotekan_trace_intern(buffer_name);
     buf->buffer_type = strdup(buffer_type);
 
     buf->num_frames = num_frames;
@@ -163,8 +315,35 @@ struct Buffer* create_buffer(int num_frames, size_t len, struct metadataPool* po
         private_reset_consumers(buf, i);
     }
 
+    // The lock free state words, keep each one on its own cache line to avoid false sharing
+    // between threads working on neighbouring frames.
+    buf->frame_state = NULL;
+    buf->frame_waiters = NULL;
+    if (lock_free) {
+        CHECK_ERROR_F(posix_memalign((void**)&buf->frame_state, LF_STATE_STRIDE * sizeof(uint32_t),
+                                     num_frames * LF_STATE_STRIDE * sizeof(uint32_t)));
+        CHECK_ERROR_F(posix_memalign((void**)&buf->frame_waiters,
+                                     LF_STATE_STRIDE * sizeof(uint32_t),
+                                     num_frames * LF_STATE_STRIDE * sizeof(uint32_t)));
+        memset(buf->frame_state, 0, num_frames * LF_STATE_STRIDE * sizeof(uint32_t));
+        memset(buf->frame_waiters, 0, num_frames * LF_STATE_STRIDE * sizeof(uint32_t));
+    }
+
+    // The event log, rounded up to a power of two so the slot is just a mask of the count
+    buf->event_log = NULL;
+    buf->event_log_size = 0;
+    buf->event_count = 0;
+    if (event_log_size > 0) {
+        buf->event_log_size = 1;
+        while (buf->event_log_size < (uint32_t)event_log_size)
+            buf->event_log_size *= 2;
+        buf->event_log = calloc(buf->event_log_size, sizeof(struct bufferEventSlot));
+        CHECK_MEM_F(buf->event_log);
+    }
+
     // By default don't zero buffers at the end of their use.
     buf->zero_frames = 0;
+    private_create_zero_pool(buf);
 
     buf->last_arrival_time = 0;
 
@@ -188,6 +367,9 @@ struct Buffer* create_buffer(int num_frames, size_t len, struct metadataPool* po
 }
 
 void delete_buffer(struct Buffer* buf) {
+    // The workers might still be zeroing a frame
+    private_delete_zero_pool(buf);
+
     for (int i = 0; i < buf->num_frames; ++i) {
         buffer_free(buf->frames[i], buf->aligned_frame_size, buf->use_hugepages);
         free(buf->producers_done[i]);
@@ -199,6 +381,9 @@ void delete_buffer(struct Buffer* buf) {
     free(buf->metadata);
     free(buf->producers_done);
     free(buf->consumers_done);
+    free(buf->frame_state);
+    free(buf->frame_waiters);
+    free(buf->event_log);
     free(buf->buffer_name);
     free(buf->buffer_type);
 
@@ -209,21 +394,73 @@ void delete_buffer(struct Buffer* buf) {
 }
 
 void mark_frame_full(struct Buffer* buf, const char* name, const int ID) {
+    producer_mark_frame_full(buf, private_producer_handle(buf, name), ID);
+}
+
+void producer_mark_frame_full(struct Buffer* buf, const int producer_id, const int ID) {
     assert(ID >= 0);
     assert(ID < buf->num_frames);
 
-    // DEBUG_F("Frame %s[%d] being marked full by producer %s\n", buf->buffer_name, ID, name);
+    // DEBUG_F("Frame %s[%d] being marked full by producer %d\n", buf->buffer_name, ID,
+    // producer_id);
+
+    if (buf->lock_free) {
+        private_lf_mark_frame_full(buf, producer_id, ID);
+        return;
+    }
+
+    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+
+    int set_full = private_mark_frame_full(buf, producer_id, ID);
+
+    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+
+    // Signal consumer
+    if (set_full == 1) {
+        CHECK_ERROR_F(pthread_cond_broadcast(&buf->full_cond));
+    }
+}
+
+void mark_frames_full(struct Buffer* buf, const char* name, const int start_id, const int n) {
+    producer_mark_frames_full(buf, private_producer_handle(buf, name), start_id, n);
+}
+
+void producer_mark_frames_full(struct Buffer* buf, const int producer_id, const int start_id,
+                               const int n) {
+    assert(start_id >= 0);
+    assert(start_id < buf->num_frames);
+    assert(n >= 0 && n <= buf->num_frames);
+
+    if (buf->lock_free) {
+        for (int i = 0; i < n; ++i)
+            private_lf_mark_frame_full(buf, producer_id, (start_id + i) % buf->num_frames);
+        return;
+    }
+
+    int set_full = 0;
 
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
+    for (int i = 0; i < n; ++i)
+        set_full |= private_mark_frame_full(buf, producer_id, (start_id + i) % buf->num_frames);
+
+    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+
+    // Signal consumers once for the whole run
+    if (set_full == 1) {
+        CHECK_ERROR_F(pthread_cond_broadcast(&buf->full_cond));
+    }
+}
+
+int private_mark_frame_full(struct Buffer* buf, const int producer_id, const int ID) {
     int set_full = 0;
-    int set_empty = 0;
 
-    private_mark_producer_done(buf, name, ID);
+    private_mark_producer_done(buf, producer_id, ID);
     if (private_producers_done(buf, ID) == 1) {
         private_reset_producers(buf, ID);
         buf->is_full[ID] = 1;
         buf->last_arrival_time = e_time();
+        private_log_event(buf, BUFFER_EVENT_FRAME_FULL, -1, ID, 0);
         set_full = 1;
 
         // If there are no consumers registered then we can just mark the buffer empty
@@ -235,74 +472,359 @@ void mark_frame_full(struct Buffer* buf, const char* name, const int ID) {
                 decrement_metadata_ref_count(buf->metadata[ID]);
                 buf->metadata[ID] = NULL;
             }
-            set_empty = 1;
             private_reset_consumers(buf, ID);
         }
     }
 
-    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+    return set_full;
+}
 
-    // Signal consumer
-    if (set_full == 1) {
-        CHECK_ERROR_F(pthread_cond_broadcast(&buf->full_cond));
+void private_create_zero_pool(struct Buffer* buf) {
+    struct bufferZeroPool* pool = malloc(sizeof(struct bufferZeroPool));
+    CHECK_MEM_F(pool);
+
+    CHECK_ERROR_F(pthread_mutex_init(&pool->lock, NULL));
+    CHECK_ERROR_F(pthread_cond_init(&pool->cond, NULL));
+
+    pool->policy = ZERO_FULL_FRAME;
+    pool->region_size = 0;
+    pool->region_stride = 0;
+    pool->num_threads = 1;
+    pool->cpu_affinity = NULL;
+    pool->num_cpus = 0;
+    pool->threads = NULL;
+    pool->stop = 0;
+
+    pool->queue = malloc(buf->num_frames * sizeof(int));
+    CHECK_MEM_F(pool->queue);
+    pool->queue_head = 0;
+    pool->queue_len = 0;
+    pool->active = 0;
+
+    pool->num_frames_zeroed = 0;
+    pool->num_bytes = 0;
+    pool->busy_time = 0;
+
+    pool->dirty_start = malloc(buf->num_frames * sizeof(size_t));
+    pool->dirty_end = malloc(buf->num_frames * sizeof(size_t));
+    CHECK_MEM_F(pool->dirty_start);
+    CHECK_MEM_F(pool->dirty_end);
+    for (int i = 0; i < buf->num_frames; ++i) {
+        pool->dirty_start[i] = SIZE_MAX;
+        pool->dirty_end[i] = 0;
     }
 
-    // Signal producer
-    if (set_empty == 1) {
-        // CHECK_ERROR_F( pthread_cond_broadcast(&buf->empty_cond) );
+    buf->zero_pool = pool;
+}
+
+void private_delete_zero_pool(struct Buffer* buf) {
+    struct bufferZeroPool* pool = buf->zero_pool;
+
+    if (pool->threads != NULL) {
+        CHECK_ERROR_F(pthread_mutex_lock(&pool->lock));
+        pool->stop = 1;
+        CHECK_ERROR_F(pthread_mutex_unlock(&pool->lock));
+        CHECK_ERROR_F(pthread_cond_broadcast(&pool->cond));
+
+        for (int i = 0; i < pool->num_threads; ++i)
+            CHECK_ERROR_F(pthread_join(pool->threads[i], NULL));
+        free(pool->threads);
+    }
+
+    CHECK_ERROR_F(pthread_mutex_destroy(&pool->lock));
+    CHECK_ERROR_F(pthread_cond_destroy(&pool->cond));
+    free(pool->cpu_affinity);
+    free(pool->queue);
+    free(pool->dirty_start);
+    free(pool->dirty_end);
+    free(pool);
+    buf->zero_pool = NULL;
+}
+
+void* private_zero_worker(void* args) {
+    struct Buffer* buf = (struct Buffer*)args;
+    struct bufferZeroPool* pool = buf->zero_pool;
+
+    char name[MAX_STAGE_NAME_LEN];
+    snprintf(name, sizeof(name), "%s/zero", buf->buffer_name);
+    kotekan_trace_set_thread_name(name);
+#ifndef MAC_OSX
+    // Thread names are limited to 15 characters
+    char short_name[16];
+    snprintf(short_name, sizeof(short_name), "zero_%s", buf->buffer_name);
+    pthread_setname_np(pthread_self(), short_name);
+#endif
+
+#ifdef WITH_NUMA
+    // Without any cores given, stay on the cores next to the frame memory
+    if (pool->num_cpus == 0 && numa_run_on_node(buf->numa_node) != 0)
+        WARN_F("Failed to run the zeroing thread of %s on NUMA node %d", buf->buffer_name,
+               buf->numa_node);
+#endif
+
+    CHECK_ERROR_F(pthread_mutex_lock(&pool->lock));
+    while (1) {
+        while (pool->queue_len == 0 && !pool->stop)
+            CHECK_ERROR_F(pthread_cond_wait(&pool->cond, &pool->lock));
+        if (pool->stop)
+            break;
+
+        const int ID = pool->queue[pool->queue_head];
+        pool->queue_head = (pool->queue_head + 1) % buf->num_frames;
+        pool->queue_len--;
+        pool->active++;
+        CHECK_ERROR_F(pthread_mutex_unlock(&pool->lock));
+
+        const uint64_t start = private_event_time();
+        const size_t bytes = private_zero_frame(buf, ID);
+        const uint64_t end = private_event_time();
+        if (kotekan_trace_enabled())
+            kotekan_trace_record(TRACE_PHASE_COMPLETE, "zero_frame", "buffer", "buffer",
+                                 buf->trace_name, 0, ID, start, end - start);
+
+        // Count the frame before handing it back, so the stats include every frame a
+        // producer has got back.
+        CHECK_ERROR_F(pthread_mutex_lock(&pool->lock));
+        pool->active--;
+        pool->num_frames_zeroed++;
+        pool->num_bytes += bytes;
+        pool->busy_time += end - start;
+        CHECK_ERROR_F(pthread_mutex_unlock(&pool->lock));
+
+        private_finish_zero_frame(buf, ID);
+
+        CHECK_ERROR_F(pthread_mutex_lock(&pool->lock));
     }
+    CHECK_ERROR_F(pthread_mutex_unlock(&pool->lock));
+
+    return NULL;
 }
 
-void* private_zero_frames(void* args) {
+void private_zero_region(uint8_t* dest, size_t len) {
+    // nt_memset needs a 32 byte aligned start and a multiple of 256 bytes
+    size_t head = (32 - ((uintptr_t)dest & 31)) & 31;
+    if (head > len)
+        head = len;
+    memset(dest, 0x00, head);
+    dest += head;
+    len -= head;
+
+    size_t div_256 = len & ~(size_t)255;
+    if (div_256 > 0)
+        nt_memset((void*)dest, 0x00, div_256);
+    memset((void*)&dest[div_256], 0x00, len - div_256);
+}
 
-    int ID = ((struct zero_frames_thread_args*)(args))->ID;
-    struct Buffer* buf = ((struct zero_frames_thread_args*)(args))->buf;
+size_t private_zero_frame(struct Buffer* buf, const int ID) {
+    struct bufferZeroPool* pool = buf->zero_pool;
+    uint8_t* frame = buf->frames[ID];
+    const size_t frame_size = buf->frame_size;
+    size_t bytes = 0;
 
     assert(ID >= 0);
-    assert(ID <= buf->num_frames);
+    assert(ID < buf->num_frames);
+
+    switch (pool->policy) {
+        case ZERO_STRIDED:
+            for (size_t offset = 0; offset < frame_size; offset += pool->region_stride) {
+                size_t len = frame_size - offset;
+                if (len > pool->region_size)
+                    len = pool->region_size;
+                private_zero_region(&frame[offset], len);
+                bytes += len;
+            }
+            break;
+        case ZERO_DIRTY: {
+            // Take the range and reset it for the next fill of the frame
+            size_t start = __atomic_exchange_n(&pool->dirty_start[ID], SIZE_MAX, __ATOMIC_ACQ_REL);
+            size_t end = __atomic_exchange_n(&pool->dirty_end[ID], 0, __ATOMIC_ACQ_REL);
+            if (end > frame_size)
+                end = frame_size;
+            if (start < end) {
+                private_zero_region(&frame[start], end - start);
+                bytes = end - start;
+            }
+            break;
+        }
+        case ZERO_FULL_FRAME:
+        default:
+            private_zero_region(frame, frame_size);
+            bytes = frame_size;
+            break;
+    }
 
-    // This zeros everything, but for VDIF we just need to header zeroed.
-    int div_256 = 256 * (buf->frame_size / 256);
-    nt_memset((void*)buf->frames[ID], 0x00, div_256);
-    memset((void*)&buf->frames[ID][div_256], 0x00, buf->frame_size - div_256);
+    // Make sure the non-temporal stores are visible before the frame is handed back
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-    // HACK: Just zero the first two words of the VDIF header
-    // for (int i = 0; i < buf->frame_size/1056; ++i) {
-    //    *((uint64_t*)&buf->frames[ID][i*1056]) = 0;
-    //}
+    return bytes;
+}
 
-    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+void private_finish_zero_frame(struct Buffer* buf, const int ID) {
+    if (buf->lock_free) {
+        private_lf_clear_frame(buf, ID);
+    } else {
+        CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
-    buf->is_full[ID] = 0;
-    private_reset_consumers(buf, ID);
+        buf->is_full[ID] = 0;
+        private_reset_consumers(buf, ID);
 
-    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+        CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
 
-    CHECK_ERROR_F(pthread_cond_broadcast(&buf->empty_cond));
+        CHECK_ERROR_F(pthread_cond_broadcast(&buf->empty_cond));
+    }
+}
 
-    free(args);
+void private_queue_zero_frame(struct Buffer* buf, const int ID) {
+    struct bufferZeroPool* pool = buf->zero_pool;
 
-    int ret = 0;
-    pthread_exit(&ret);
+    CHECK_ERROR_F(pthread_mutex_lock(&pool->lock));
+    assert(pool->queue_len < buf->num_frames);
+    pool->queue[(pool->queue_head + pool->queue_len) % buf->num_frames] = ID;
+    pool->queue_len++;
+    CHECK_ERROR_F(pthread_mutex_unlock(&pool->lock));
+
+    CHECK_ERROR_F(pthread_cond_signal(&pool->cond));
 }
 
 void zero_frames(struct Buffer* buf) {
+    struct bufferZeroPool* pool = buf->zero_pool;
+
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+    if (buf->zero_frames == 1) {
+        CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+        return;
+    }
+
+    // Start the workers before any frame can be queued for them
+    CHECK_ERROR_F(pthread_mutex_lock(&pool->lock));
+    pool->threads = malloc(pool->num_threads * sizeof(pthread_t));
+    CHECK_MEM_F(pool->threads);
+    for (int i = 0; i < pool->num_threads; ++i) {
+        CHECK_ERROR_F(pthread_create(&pool->threads[i], NULL, &private_zero_worker, (void*)buf));
+
+        if (pool->num_cpus > 0) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            for (int j = 0; j < pool->num_cpus; ++j)
+                CPU_SET(pool->cpu_affinity[j], &cpuset);
+            CHECK_ERROR_F(pthread_setaffinity_np(pool->threads[i], sizeof(cpu_set_t), &cpuset));
+        }
+    }
+    CHECK_ERROR_F(pthread_mutex_unlock(&pool->lock));
+
     buf->zero_frames = 1;
     CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
 }
 
+int set_zero_policy(struct Buffer* buf, enum ZeroPolicy policy, size_t region_size,
+                    size_t region_stride) {
+    struct bufferZeroPool* pool = buf->zero_pool;
+
+    if (policy == ZERO_STRIDED
+        && (region_size == 0 || region_stride == 0 || region_size > region_stride)) {
+        ERROR_F("Invalid strided zeroing for buffer %s: region size %zu, stride %zu",
+                buf->buffer_name, region_size, region_stride);
+        return -1;
+    }
+
+    CHECK_ERROR_F(pthread_mutex_lock(&pool->lock));
+    if (pool->threads != NULL) {
+        CHECK_ERROR_F(pthread_mutex_unlock(&pool->lock));
+        ERROR_F("The zeroing policy of buffer %s can't be changed once zeroing has started",
+                buf->buffer_name);
+        return -1;
+    }
+    pool->policy = policy;
+    pool->region_size = region_size;
+    pool->region_stride = region_stride;
+    CHECK_ERROR_F(pthread_mutex_unlock(&pool->lock));
+
+    return 0;
+}
+
+int set_zero_threads(struct Buffer* buf, int num_threads, const int* cpu_affinity,
+                     int num_cpus) {
+    struct bufferZeroPool* pool = buf->zero_pool;
+
+    if (num_threads < 1 || num_cpus < 0 || (num_cpus > 0 && cpu_affinity == NULL)) {
+        ERROR_F("Invalid zeroing threads for buffer %s: %d threads, %d cores", buf->buffer_name,
+                num_threads, num_cpus);
+        return -1;
+    }
+
+    CHECK_ERROR_F(pthread_mutex_lock(&pool->lock));
+    if (pool->threads != NULL) {
+        CHECK_ERROR_F(pthread_mutex_unlock(&pool->lock));
+        ERROR_F("The zeroing threads of buffer %s can't be changed once zeroing has started",
+                buf->buffer_name);
+        return -1;
+    }
+    pool->num_threads = num_threads;
+    free(pool->cpu_affinity);
+    pool->cpu_affinity = NULL;
+    pool->num_cpus = num_cpus;
+    if (num_cpus > 0) {
+        pool->cpu_affinity = malloc(num_cpus * sizeof(int));
+        CHECK_MEM_F(pool->cpu_affinity);
+        memcpy(pool->cpu_affinity, cpu_affinity, num_cpus * sizeof(int));
+    }
+    CHECK_ERROR_F(pthread_mutex_unlock(&pool->lock));
+
+    return 0;
+}
+
+void mark_frame_dirty(struct Buffer* buf, const int ID, size_t offset, size_t len) {
+    assert(ID >= 0);
+    assert(ID < buf->num_frames);
+
+    struct bufferZeroPool* pool = buf->zero_pool;
+    if (pool->policy != ZERO_DIRTY || len == 0)
+        return;
+
+    const size_t end = offset + len;
+    size_t cur = __atomic_load_n(&pool->dirty_start[ID], __ATOMIC_RELAXED);
+    while (offset < cur
+           && !__atomic_compare_exchange_n(&pool->dirty_start[ID], &cur, offset, false,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    cur = __atomic_load_n(&pool->dirty_end[ID], __ATOMIC_RELAXED);
+    while (end > cur
+           && !__atomic_compare_exchange_n(&pool->dirty_end[ID], &cur, end, false,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void get_zero_stats(struct Buffer* buf, struct ZeroStats* stats) {
+    struct bufferZeroPool* pool = buf->zero_pool;
+
+    CHECK_ERROR_F(pthread_mutex_lock(&pool->lock));
+    stats->num_frames = pool->num_frames_zeroed;
+    stats->num_bytes = pool->num_bytes;
+    stats->busy_time = pool->busy_time;
+    stats->backlog = pool->queue_len + pool->active;
+    CHECK_ERROR_F(pthread_mutex_unlock(&pool->lock));
+}
+
 void mark_frame_empty(struct Buffer* buf, const char* consumer_name, const int ID) {
+    consumer_mark_frame_empty(buf, private_consumer_handle(buf, consumer_name), ID);
+}
+
+void consumer_mark_frame_empty(struct Buffer* buf, const int consumer_id, const int ID) {
     assert(ID >= 0);
     assert(ID < buf->num_frames);
     int broadcast = 0;
 
+    if (buf->lock_free) {
+        private_lf_mark_frame_empty(buf, consumer_id, ID);
+        return;
+    }
+
     // If we've been asked to zero the buffer do it here.
     // This needs to happen out side of the critical section
     // so that we don't block for a long time here.
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
-    private_mark_consumer_done(buf, consumer_name, ID);
+    private_mark_consumer_done(buf, consumer_id, ID);
 
     if (private_consumers_done(buf, ID) == 1) {
         broadcast = private_mark_frame_empty(buf, ID);
@@ -316,22 +838,47 @@ void mark_frame_empty(struct Buffer* buf, const char* consumer_name, const int I
     }
 }
 
+void mark_frames_empty(struct Buffer* buf, const char* consumer_name, const int start_id,
+                       const int n) {
+    consumer_mark_frames_empty(buf, private_consumer_handle(buf, consumer_name), start_id, n);
+}
+
+void consumer_mark_frames_empty(struct Buffer* buf, const int consumer_id, const int start_id,
+                                const int n) {
+    assert(start_id >= 0);
+    assert(start_id < buf->num_frames);
+    assert(n >= 0 && n <= buf->num_frames);
+    int broadcast = 0;
+
+    if (buf->lock_free) {
+        for (int i = 0; i < n; ++i)
+            private_lf_mark_frame_empty(buf, consumer_id, (start_id + i) % buf->num_frames);
+        return;
+    }
+
+    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+
+    for (int i = 0; i < n; ++i) {
+        int id = (start_id + i) % buf->num_frames;
+        private_mark_consumer_done(buf, consumer_id, id);
+
+        if (private_consumers_done(buf, id) == 1) {
+            broadcast |= private_mark_frame_empty(buf, id);
+        }
+    }
+
+    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+
+    // Signal producers once for the whole run
+    if (broadcast == 1) {
+        CHECK_ERROR_F(pthread_cond_broadcast(&buf->empty_cond));
+    }
+}
+
 int private_mark_frame_empty(struct Buffer* buf, const int id) {
     int broadcast = 0;
     if (buf->zero_frames == 1) {
-        pthread_t zero_t;
-        struct zero_frames_thread_args* zero_args = malloc(sizeof(struct zero_frames_thread_args));
-        zero_args->ID = id;
-        zero_args->buf = buf;
-
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        // TODO: Move this to the config file (when buffers.c updated to C++11)
-        CPU_SET(5, &cpuset);
-
-        CHECK_ERROR_F(pthread_create(&zero_t, NULL, &private_zero_frames, (void*)zero_args));
-        CHECK_ERROR_F(pthread_setaffinity_np(zero_t, sizeof(cpu_set_t), &cpuset));
-        CHECK_ERROR_F(pthread_detach(zero_t));
+        private_queue_zero_frame(buf, id);
     } else {
         buf->is_full[id] = 0;
         private_reset_consumers(buf, id);
@@ -345,23 +892,31 @@ int private_mark_frame_empty(struct Buffer* buf, const int id) {
 }
 
 uint8_t* wait_for_empty_frame(struct Buffer* buf, const char* producer_name, const int ID) {
+    return producer_wait_for_empty_frame(buf, private_producer_handle(buf, producer_name), ID);
+}
+
+uint8_t* producer_wait_for_empty_frame(struct Buffer* buf, const int producer_id, const int ID) {
     assert(ID >= 0);
     assert(ID < buf->num_frames);
+    assert(producer_id >= 0 && producer_id < MAX_PRODUCERS);
 
     int print_stat = 0;
 
-    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+    if (buf->lock_free)
+        return private_lf_wait_for_empty_frame(buf, producer_id, ID);
 
-    int producer_id = private_get_producer_id(buf, producer_name);
-    assert(producer_id != -1);
+    uint64_t wait_start = 0;
+
+    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
     // If the buffer isn't full, i.e. is_full[ID] == 0, then we never sleep on the cond var.
     // The second condition stops us from using a buffer we've already filled,
     // and forces a wait until that buffer has been marked as empty.
-    while ((buf->is_full[ID] == 1 || buf->producers_done[ID][producer_id] == 1)
-           && buf->shutdown_signal == 0) {
+    while (!private_frame_empty_for(buf, producer_id, ID) && buf->shutdown_signal == 0) {
+        if (wait_start == 0)
+            wait_start = private_event_wait_start(buf);
         DEBUG_F("wait_for_empty_frame: %s waiting for empty frame ID = %d in buffer %s",
-                producer_name, ID, buf->buffer_name);
+                buf->producers[producer_id].name, ID, buf->buffer_name);
         print_stat = 1;
         pthread_cond_wait(&buf->empty_cond, &buf->lock);
     }
@@ -377,10 +932,11 @@ uint8_t* wait_for_empty_frame(struct Buffer* buf, const char* producer_name, con
         return NULL;
 
     buf->producers[producer_id].last_frame_acquired = ID;
+    private_log_event(buf, BUFFER_EVENT_PRODUCER_ACQUIRE, producer_id, ID, wait_start);
     return buf->frames[ID];
 }
 
-void register_consumer(struct Buffer* buf, const char* name) {
+int register_consumer(struct Buffer* buf, const char* name) {
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
     DEBUG_F("Registering consumer %s for buffer %s", name, buf->buffer_name);
@@ -389,18 +945,22 @@ void register_consumer(struct Buffer* buf, const char* name) {
         ERROR_F("You cannot register two consumers with the same name!");
         assert(0); // Optional
         CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
-        return;
+        return -1;
     }
 
     for (int i = 0; i < MAX_CONSUMERS; ++i) {
-        if (buf->consumers[i].in_use == 0) {
+        // Unregistered slots cannot be reused in lock free mode, since their done flags
+        // stay set in every frame.
+        if (buf->consumers[i].in_use == 0 && (buf->retired_consumer_mask & (1u << i)) == 0) {
             buf->consumers[i].in_use = 1;
+            __atomic_fetch_or(&buf->consumer_mask, 1u << i, __ATOMIC_SEQ_CST);
             // -1 here means no frame has been acquired/released
             buf->consumers[i].last_frame_acquired = -1;
             buf->consumers[i].last_frame_released = -1;
             strncpy(buf->consumers[i].name, name, MAX_STAGE_NAME_LEN);
+            buf->consumers[i].trace_name = kotekan_trace_intern(name);
             CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
-            return;
+            return i;
         }
     }
 
@@ -408,6 +968,8 @@ void register_consumer(struct Buffer* buf, const char* name) {
     assert(0); // Optional
 
     CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+
+    return -1;
 }
 
 void unregister_consumer(struct Buffer* buf, const char* name) {
@@ -426,6 +988,12 @@ void unregister_consumer(struct Buffer* buf, const char* name) {
     buf->consumers[consumer_id].in_use = 0;
     snprintf(buf->consumers[consumer_id].name, MAX_STAGE_NAME_LEN, "unregistered");
 
+    if (buf->lock_free) {
+        private_lf_unregister_consumer(buf, consumer_id);
+        CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+        return;
+    }
+
     // Check if removing this consumer would cause any of the frames
     // which are currently full to become empty.
     for (int id = 0; id < buf->num_frames; ++id) {
@@ -444,25 +1012,28 @@ void unregister_consumer(struct Buffer* buf, const char* name) {
 }
 
 
-void register_producer(struct Buffer* buf, const char* name) {
+int register_producer(struct Buffer* buf, const char* name) {
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
     DEBUG_F("Buffer: %s Registering producer: %s", buf->buffer_name, name);
     if (private_get_producer_id(buf, name) != -1) {
         ERROR_F("You cannot register two consumers with the same name!");
         assert(0); // Optional
         CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
-        return;
+        return -1;
     }
 
     for (int i = 0; i < MAX_PRODUCERS; ++i) {
         if (buf->producers[i].in_use == 0) {
             buf->producers[i].in_use = 1;
+            __atomic_fetch_or(&buf->producer_mask, 1u << (LF_PRODUCER_SHIFT + i),
+                              __ATOMIC_SEQ_CST);
             // -1 here means no frame has been acquired/released
             buf->producers[i].last_frame_acquired = -1;
             buf->producers[i].last_frame_released = -1;
             strncpy(buf->producers[i].name, name, MAX_STAGE_NAME_LEN);
+            buf->producers[i].trace_name = kotekan_trace_intern(name);
             CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
-            return;
+            return i;
         }
     }
 
@@ -470,6 +1041,8 @@ void register_producer(struct Buffer* buf, const char* name) {
     assert(0); // Optional
 
     CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+
+    return -1;
 }
 
 int private_get_consumer_id(struct Buffer* buf, const char* name) {
@@ -494,46 +1067,72 @@ int private_get_producer_id(struct Buffer* buf, const char* name) {
     return -1;
 }
 
-void private_reset_producers(struct Buffer* buf, const int ID) {
-    memset(buf->producers_done[ID], 0, MAX_PRODUCERS * sizeof(int));
+int get_consumer_id(struct Buffer* buf, const char* name) {
+    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+    int consumer_id = private_get_consumer_id(buf, name);
+    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+    return consumer_id;
 }
 
-void private_reset_consumers(struct Buffer* buf, const int ID) {
-    memset(buf->consumers_done[ID], 0, MAX_CONSUMERS * sizeof(int));
+int get_producer_id(struct Buffer* buf, const char* name) {
+    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+    int producer_id = private_get_producer_id(buf, name);
+    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+    return producer_id;
 }
 
-void private_mark_consumer_done(struct Buffer* buf, const char* name, const int ID) {
+int private_consumer_handle(struct Buffer* buf, const char* name) {
+    // This doesn't take the lock, the stages register before any frames are passed and a
+    // consumer which unregisters must not use the buffer any more.
     int consumer_id = private_get_consumer_id(buf, name);
     if (consumer_id == -1) {
         ERROR_F("The consumer %s hasn't been registered!", name);
     }
+    assert(consumer_id != -1);
+    return consumer_id;
+}
+
+int private_producer_handle(struct Buffer* buf, const char* name) {
+    int producer_id = private_get_producer_id(buf, name);
+    if (producer_id == -1) {
+        ERROR_F("The producer %s hasn't been registered!", name);
+    }
+    assert(producer_id != -1);
+    return producer_id;
+}
+
+void private_reset_producers(struct Buffer* buf, const int ID) {
+    memset(buf->producers_done[ID], 0, MAX_PRODUCERS * sizeof(int));
+}
+
+void private_reset_consumers(struct Buffer* buf, const int ID) {
+    memset(buf->consumers_done[ID], 0, MAX_CONSUMERS * sizeof(int));
+}
 
+void private_mark_consumer_done(struct Buffer* buf, const int consumer_id, const int ID) {
     // DEBUG_F("%s->consumers_done[%d][%d] == %d", buf->buffer_name, ID, consumer_id,
     // buf->consumers_done[ID][consumer_id] );
 
-    assert(consumer_id != -1);
+    assert(consumer_id >= 0 && consumer_id < MAX_CONSUMERS);
     // The consumer we are marking as done, shouldn't already be done!
     assert(buf->consumers_done[ID][consumer_id] == 0);
 
     buf->consumers[consumer_id].last_frame_released = ID;
     buf->consumers_done[ID][consumer_id] = 1;
+    private_log_event(buf, BUFFER_EVENT_CONSUMER_RELEASE, consumer_id, ID, 0);
 }
 
-void private_mark_producer_done(struct Buffer* buf, const char* name, const int ID) {
-    int producer_id = private_get_producer_id(buf, name);
-    if (producer_id == -1) {
-        ERROR_F("The producer %s hasn't been registered!", name);
-    }
-
+void private_mark_producer_done(struct Buffer* buf, const int producer_id, const int ID) {
     // DEBUG_F("%s->producers_done[%d][%d] == %d", buf->buffer_name, ID, producer_id,
     // buf->producers_done[ID][producer_id] );
 
-    assert(producer_id != -1);
+    assert(producer_id >= 0 && producer_id < MAX_PRODUCERS);
     // The producer we are marking as done, shouldn't already be done!
     assert(buf->producers_done[ID][producer_id] == 0);
 
     buf->producers[producer_id].last_frame_released = ID;
     buf->producers_done[ID][producer_id] = 1;
+    private_log_event(buf, BUFFER_EVENT_PRODUCER_RELEASE, producer_id, ID, 0);
 }
 
 int private_consumers_done(struct Buffer* buf, const int ID) {
@@ -561,6 +1160,9 @@ int is_frame_empty(struct Buffer* buf, const int ID) {
 
     int empty = 1;
 
+    if (buf->lock_free)
+        return (__atomic_load_n(LF_STATE(buf, ID), __ATOMIC_SEQ_CST) & LF_FULL_BIT) == 0;
+
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
     if (buf->is_full[ID] == 1) {
@@ -572,16 +1174,66 @@ int is_frame_empty(struct Buffer* buf, const int ID) {
     return empty;
 }
 
+int private_frame_empty_for(struct Buffer* buf, const int producer_id, const int ID) {
+    return buf->is_full[ID] == 0 && buf->producers_done[ID][producer_id] == 0;
+}
+
+int private_frame_full_for(struct Buffer* buf, const int consumer_id, const int ID) {
+    return buf->is_full[ID] == 1 && buf->consumers_done[ID][consumer_id] == 0;
+}
+
+int private_is_frame_full(struct Buffer* buf, const int ID) {
+    if (buf->lock_free)
+        return (__atomic_load_n(LF_STATE(buf, ID), __ATOMIC_SEQ_CST) & LF_FULL_BIT) != 0;
+
+    return buf->is_full[ID];
+}
+
+int is_frame_consumer_done(struct Buffer* buf, const int consumer_id, const int frame_id) {
+    assert(consumer_id >= 0 && consumer_id < MAX_CONSUMERS);
+    assert(frame_id >= 0 && frame_id < buf->num_frames);
+
+    if (buf->lock_free)
+        return (__atomic_load_n(LF_STATE(buf, frame_id), __ATOMIC_SEQ_CST) & (1u << consumer_id))
+               != 0;
+
+    return buf->consumers_done[frame_id][consumer_id];
+}
+
+int is_frame_producer_done(struct Buffer* buf, const int producer_id, const int frame_id) {
+    assert(producer_id >= 0 && producer_id < MAX_PRODUCERS);
+    assert(frame_id >= 0 && frame_id < buf->num_frames);
+
+    if (buf->lock_free)
+        return (__atomic_load_n(LF_STATE(buf, frame_id), __ATOMIC_SEQ_CST)
+                & (1u << (LF_PRODUCER_SHIFT + producer_id)))
+               != 0;
+
+    return buf->producers_done[frame_id][producer_id];
+}
+
 uint8_t* wait_for_full_frame(struct Buffer* buf, const char* name, const int ID) {
-    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+    return consumer_wait_for_full_frame(buf, private_consumer_handle(buf, name), ID);
+}
 
-    int consumer_id = private_get_consumer_id(buf, name);
-    assert(consumer_id != -1);
+uint8_t* consumer_wait_for_full_frame(struct Buffer* buf, const int consumer_id, const int ID) {
+    assert(consumer_id >= 0 && consumer_id < MAX_CONSUMERS);
+
+    if (buf->lock_free) {
+        if (private_lf_wait_for_full_frame(buf, consumer_id, ID, NULL) != 0)
+            return NULL;
+        return buf->frames[ID];
+    }
+
+    uint64_t wait_start = 0;
+
+    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
     // This loop exists when is_full == 1 (i.e. a full buffer) AND
     // when this producer hasn't already marked this buffer as
-    while ((buf->is_full[ID] == 0 || buf->consumers_done[ID][consumer_id] == 1)
-           && buf->shutdown_signal == 0) {
+    while (!private_frame_full_for(buf, consumer_id, ID) && buf->shutdown_signal == 0) {
+        if (wait_start == 0)
+            wait_start = private_event_wait_start(buf);
         pthread_cond_wait(&buf->full_cond, &buf->lock);
     }
 
@@ -591,21 +1243,35 @@ uint8_t* wait_for_full_frame(struct Buffer* buf, const char* name, const int ID)
         return NULL;
 
     buf->consumers[consumer_id].last_frame_acquired = ID;
+    private_log_event(buf, BUFFER_EVENT_CONSUMER_ACQUIRE, consumer_id, ID, wait_start);
     return buf->frames[ID];
 }
 
 int wait_for_full_frame_timeout(struct Buffer* buf, const char* name, const int ID,
                                 const struct timespec timeout) {
+    return consumer_wait_for_full_frame_timeout(buf, private_consumer_handle(buf, name), ID,
+                                                timeout);
+}
+
+int consumer_wait_for_full_frame_timeout(struct Buffer* buf, const int consumer_id, const int ID,
+                                         const struct timespec timeout) {
+    assert(consumer_id >= 0 && consumer_id < MAX_CONSUMERS);
+
+    if (buf->lock_free)
+        return private_lf_wait_for_full_frame(buf, consumer_id, ID, &timeout);
+
+    uint64_t wait_start = 0;
+
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
-    int consumer_id = private_get_consumer_id(buf, name);
-    assert(consumer_id != -1);
     int err = 0;
 
     // This loop exists when is_full == 1 (i.e. a full buffer) AND
     // when this producer hasn't already marked this buffer as
-    while ((buf->is_full[ID] == 0 || buf->consumers_done[ID][consumer_id] == 1)
-           && buf->shutdown_signal == 0 && err == 0) {
+    while (!private_frame_full_for(buf, consumer_id, ID) && buf->shutdown_signal == 0
+           && err == 0) {
+        if (wait_start == 0)
+            wait_start = private_event_wait_start(buf);
         err = pthread_cond_timedwait(&buf->full_cond, &buf->lock, &timeout);
     }
 
@@ -618,12 +1284,154 @@ int wait_for_full_frame_timeout(struct Buffer* buf, const char* name, const int
         return 1;
 
     buf->consumers[consumer_id].last_frame_acquired = ID;
+    private_log_event(buf, BUFFER_EVENT_CONSUMER_ACQUIRE, consumer_id, ID, wait_start);
     return 0;
 }
 
+int wait_for_empty_frames(struct Buffer* buf, const char* producer_name, const int start_id,
+                          const int max_n) {
+    return producer_wait_for_empty_frames(buf, private_producer_handle(buf, producer_name),
+                                          start_id, max_n);
+}
+
+int producer_wait_for_empty_frames(struct Buffer* buf, const int producer_id, const int start_id,
+                                   const int max_n) {
+    assert(start_id >= 0);
+    assert(start_id < buf->num_frames);
+    assert(max_n > 0);
+    assert(producer_id >= 0 && producer_id < MAX_PRODUCERS);
+
+    const int max_frames = max_n < buf->num_frames ? max_n : buf->num_frames;
+    int n = 0;
+
+    if (buf->lock_free) {
+        if (private_lf_wait_for_empty_frame(buf, producer_id, start_id) == NULL)
+            return -1;
+        const uint32_t bit = 1u << (LF_PRODUCER_SHIFT + producer_id);
+        n = 1;
+        while (n < max_frames
+               && (__atomic_load_n(LF_STATE(buf, (start_id + n) % buf->num_frames),
+                                   __ATOMIC_SEQ_CST)
+                   & (LF_FULL_BIT | LF_SHUTDOWN_BIT | bit))
+                      == 0) {
+            private_log_event(buf, BUFFER_EVENT_PRODUCER_ACQUIRE, producer_id,
+                              (start_id + n) % buf->num_frames, 0);
+            n++;
+        }
+        return n;
+    }
+
+    uint64_t wait_start = 0;
+
+    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+
+    while (!private_frame_empty_for(buf, producer_id, start_id) && buf->shutdown_signal == 0) {
+        if (wait_start == 0)
+            wait_start = private_event_wait_start(buf);
+        pthread_cond_wait(&buf->empty_cond, &buf->lock);
+    }
+
+    // Pick up any following frames which are already available
+    if (buf->shutdown_signal == 0) {
+        n = 1;
+        while (n < max_frames
+               && private_frame_empty_for(buf, producer_id, (start_id + n) % buf->num_frames)) {
+            n++;
+        }
+        buf->producers[producer_id].last_frame_acquired = (start_id + n - 1) % buf->num_frames;
+        for (int i = 0; i < n; ++i)
+            private_log_event(buf, BUFFER_EVENT_PRODUCER_ACQUIRE, producer_id,
+                              (start_id + i) % buf->num_frames, i == 0 ? wait_start : 0);
+    }
+
+    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+
+    return n > 0 ? n : -1;
+}
+
+int wait_for_full_frames(struct Buffer* buf, const char* consumer_name, const int start_id,
+                         const int max_n, const struct timespec* timeout) {
+    return consumer_wait_for_full_frames(buf, private_consumer_handle(buf, consumer_name),
+                                         start_id, max_n, timeout);
+}
+
+int consumer_wait_for_full_frames(struct Buffer* buf, const int consumer_id, const int start_id,
+                                  const int max_n, const struct timespec* timeout) {
+    assert(start_id >= 0);
+    assert(start_id < buf->num_frames);
+    assert(max_n > 0);
+    assert(consumer_id >= 0 && consumer_id < MAX_CONSUMERS);
+
+    const int max_frames = max_n < buf->num_frames ? max_n : buf->num_frames;
+    int n = 0;
+
+    if (buf->lock_free) {
+        int status = private_lf_wait_for_full_frame(buf, consumer_id, start_id, timeout);
+        if (status != 0)
+            return status == 1 ? 0 : -1;
+        const uint32_t bit = 1u << consumer_id;
+        n = 1;
+        while (n < max_frames) {
+            uint32_t state =
+                __atomic_load_n(LF_STATE(buf, (start_id + n) % buf->num_frames), __ATOMIC_SEQ_CST);
+            if ((state & LF_FULL_BIT) == 0 || (state & (LF_SHUTDOWN_BIT | bit)) != 0)
+                break;
+            private_log_event(buf, BUFFER_EVENT_CONSUMER_ACQUIRE, consumer_id,
+                              (start_id + n) % buf->num_frames, 0);
+            n++;
+        }
+        return n;
+    }
+
+    uint64_t wait_start = 0;
+
+    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+
+    int err = 0;
+
+    while (!private_frame_full_for(buf, consumer_id, start_id) && buf->shutdown_signal == 0
+           && err == 0) {
+        if (wait_start == 0)
+            wait_start = private_event_wait_start(buf);
+        if (timeout == NULL) {
+            pthread_cond_wait(&buf->full_cond, &buf->lock);
+        } else {
+            err = pthread_cond_timedwait(&buf->full_cond, &buf->lock, timeout);
+        }
+    }
+
+    // Pick up any following frames which are already full
+    if (buf->shutdown_signal == 0 && private_frame_full_for(buf, consumer_id, start_id)) {
+        n = 1;
+        while (n < max_frames
+               && private_frame_full_for(buf, consumer_id, (start_id + n) % buf->num_frames)) {
+            n++;
+        }
+        buf->consumers[consumer_id].last_frame_acquired = (start_id + n - 1) % buf->num_frames;
+        for (int i = 0; i < n; ++i)
+            private_log_event(buf, BUFFER_EVENT_CONSUMER_ACQUIRE, consumer_id,
+                              (start_id + i) % buf->num_frames, i == 0 ? wait_start : 0);
+    }
+
+    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+
+    if (buf->shutdown_signal == 1)
+        return -1;
+
+    return n;
+}
+
 int get_num_full_frames(struct Buffer* buf) {
     int numFull = 0;
 
+    if (buf->lock_free) {
+        for (int i = 0; i < buf->num_frames; ++i) {
+            if (__atomic_load_n(LF_STATE(buf, i), __ATOMIC_SEQ_CST) & LF_FULL_BIT)
+                numFull++;
+        }
+        return numFull;
+    }
+
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
     for (int i = 0; i < buf->num_frames; ++i) {
@@ -637,6 +1445,115 @@ int get_num_full_frames(struct Buffer* buf) {
     return numFull;
 }
 
+uint64_t private_event_time(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+uint64_t private_event_wait_start(struct Buffer* buf) {
+    return (buf->event_log != NULL || kotekan_trace_enabled()) ? private_event_time() : 0;
+}
+
+void private_log_event(struct Buffer* buf, const enum BufferEventType type, const int stage_id,
+                       const int ID, const uint64_t wait_start) {
+    const int tracing = kotekan_trace_enabled();
+    if (buf->event_log == NULL && !tracing)
+        return;
+
+    const uint64_t time = private_event_time();
+    if (tracing)
+        private_trace_event(buf, type, stage_id, ID, wait_start, time);
+    if (buf->event_log == NULL)
+        return;
+
+    const uint64_t n = __atomic_fetch_add(&buf->event_count, 1, __ATOMIC_RELAXED);
+    struct bufferEventSlot* slot = &buf->event_log[n & (buf->event_log_size - 1)];
+
+    // Each slot is a seqlock, the same as in visSharedMemRing, so the readers can tell if
+    // it was rewritten while they copied it.  A writer preempted for a whole lap of the log
+    // could leave an entry mixed with a newer one, which can only skew the statistics.
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&slot->event.time, time, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->event.wait, wait_start != 0 ? time - wait_start : 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->event.frame_id, ID, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->event.stage_id, (int16_t)stage_id, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->event.type, (uint16_t)type, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slot->seq, n + 1, __ATOMIC_RELEASE);
+}
+
+void private_trace_event(struct Buffer* buf, const enum BufferEventType type, const int stage_id,
+                         const int ID, const uint64_t wait_start, const uint64_t time) {
+    if (type == BUFFER_EVENT_FRAME_FULL) {
+        kotekan_trace_record(TRACE_PHASE_INSTANT, "frame_full", "buffer", "buffer",
+                             buf->trace_name, 0, ID, time, 0);
+        return;
+    }
+
+    const int producer =
+        (type == BUFFER_EVENT_PRODUCER_ACQUIRE || type == BUFFER_EVENT_PRODUCER_RELEASE);
+    if (stage_id < 0 || stage_id >= (producer ? MAX_PRODUCERS : MAX_CONSUMERS))
+        return;
+    const char* stage_name =
+        producer ? buf->producers[stage_id].trace_name : buf->consumers[stage_id].trace_name;
+
+    // The time each stage holds each frame is an async span, since a stage can hold several
+    // frames at once and release them on another thread.  The buffer struct is bigger than the
+    // number of frames, so its address plus the frame ID is unique to the frame.
+    const uint64_t id = (uint64_t)(uintptr_t)buf + (uint64_t)ID;
+
+    if (type == BUFFER_EVENT_PRODUCER_ACQUIRE || type == BUFFER_EVENT_CONSUMER_ACQUIRE) {
+        // Only record the wait when the stage was blocked
+        if (wait_start != 0 && wait_start < time)
+            kotekan_trace_record(TRACE_PHASE_COMPLETE,
+                                 producer ? "wait_for_empty_frame" : "wait_for_full_frame",
+                                 "buffer", "buffer", buf->trace_name, 0, ID, wait_start,
+                                 time - wait_start);
+        kotekan_trace_record(TRACE_PHASE_ASYNC_BEGIN, stage_name, "frame", "buffer",
+                             buf->trace_name, id, ID, time, 0);
+    } else {
+        kotekan_trace_record(TRACE_PHASE_ASYNC_END, stage_name, "frame", "buffer",
+                             buf->trace_name, id, ID, time, 0);
+    }
+}
+
+int get_buffer_events(struct Buffer* buf, struct BufferEvent* events, int max_events) {
+    if (buf->event_log == NULL || max_events <= 0)
+        return 0;
+
+    const uint64_t count = __atomic_load_n(&buf->event_count, __ATOMIC_ACQUIRE);
+    uint64_t num = count < buf->event_log_size ? count : buf->event_log_size;
+    if (num > (uint64_t)max_events)
+        num = max_events;
+
+    int copied = 0;
+    for (uint64_t n = count - num; n < count; ++n) {
+        struct bufferEventSlot* slot = &buf->event_log[n & (buf->event_log_size - 1)];
+
+        // Skip events which are still being written, or have already been overwritten
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != n + 1)
+            continue;
+
+        struct BufferEvent event;
+        event.time = __atomic_load_n(&slot->event.time, __ATOMIC_RELAXED);
+        event.wait = __atomic_load_n(&slot->event.wait, __ATOMIC_RELAXED);
+        event.frame_id = __atomic_load_n(&slot->event.frame_id, __ATOMIC_RELAXED);
+        event.stage_id = __atomic_load_n(&slot->event.stage_id, __ATOMIC_RELAXED);
+        event.type = __atomic_load_n(&slot->event.type, __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != n + 1)
+            continue;
+
+        events[copied++] = event;
+    }
+
+    return copied;
+}
+
 int get_num_consumers(struct Buffer* buf) {
     int num_consumers = 0;
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
@@ -666,7 +1583,8 @@ void print_buffer_status(struct Buffer* buf) {
 
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
-    memcpy(is_full, buf->is_full, buf->num_frames * sizeof(int));
+    for (int i = 0; i < buf->num_frames; ++i)
+        is_full[i] = private_is_frame_full(buf, i);
 
     CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
 
@@ -694,7 +1612,7 @@ void print_full_status(struct Buffer* buf) {
     INFO_F("--------------------- %s ---------------------", buf->buffer_name);
 
     for (int i = 0; i < buf->num_frames; ++i) {
-        if (buf->is_full[i] == 1) {
+        if (private_is_frame_full(buf, i)) {
             status_string[i] = 'X';
         } else {
             status_string[i] = '_';
@@ -708,7 +1626,7 @@ void print_full_status(struct Buffer* buf) {
     for (int producer_id = 0; producer_id < MAX_PRODUCERS; ++producer_id) {
         if (buf->producers[producer_id].in_use == 1) {
             for (int i = 0; i < buf->num_frames; ++i) {
-                if (buf->producers_done[i][producer_id] == 1) {
+                if (is_frame_producer_done(buf, producer_id, i)) {
                     status_string[i] = '+';
                 } else {
                     status_string[i] = '_';
@@ -725,7 +1643,7 @@ void print_full_status(struct Buffer* buf) {
     for (int consumer_id = 0; consumer_id < MAX_CONSUMERS; ++consumer_id) {
         if (buf->consumers[consumer_id].in_use == 1) {
             for (int i = 0; i < buf->num_frames; ++i) {
-                if (buf->consumers_done[i][consumer_id] == 1) {
+                if (is_frame_consumer_done(buf, consumer_id, i)) {
                     status_string[i] = '=';
                 } else {
                     status_string[i] = '_';
@@ -1021,6 +1939,217 @@ void send_shutdown_signal(struct Buffer* buf) {
     buf->shutdown_signal = 1;
     CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
 
+    if (buf->lock_free) {
+        // Changing the state words guarantees that threads about to sleep on them don't miss
+        // the shutdown.
+        for (int i = 0; i < buf->num_frames; ++i) {
+            __atomic_fetch_or(LF_STATE(buf, i), LF_SHUTDOWN_BIT, __ATOMIC_SEQ_CST);
+            private_lf_wake(buf, i);
+        }
+        return;
+    }
+
     CHECK_ERROR_F(pthread_cond_broadcast(&buf->empty_cond));
     CHECK_ERROR_F(pthread_cond_broadcast(&buf->full_cond));
 }
+
+// *** Lock free mode ***
+
+int private_lf_wait(struct Buffer* buf, const int ID, const uint32_t expected,
+                    const struct timespec* timeout) {
+#ifndef MAC_OSX
+    // The waiter count is raised before sleeping, so a thread changing the state word after
+    // this point is guaranteed to see it and call the futex wake.  If the state changed before
+    // that, the futex call returns immediately with EAGAIN since the word != expected.
+    __atomic_fetch_add(LF_WAITERS(buf, ID), 1, __ATOMIC_SEQ_CST);
+    int op = FUTEX_WAIT_BITSET_PRIVATE;
+    if (timeout != NULL)
+        op |= FUTEX_CLOCK_REALTIME;
+    int err = 0;
+    if (syscall(SYS_futex, LF_STATE(buf, ID), op, expected, timeout, NULL, FUTEX_BITSET_MATCH_ANY)
+        == -1)
+        err = errno;
+    __atomic_fetch_sub(LF_WAITERS(buf, ID), 1, __ATOMIC_SEQ_CST);
+
+    // EAGAIN and EINTR just mean the caller should check the state again.
+    return err == ETIMEDOUT ? ETIMEDOUT : 0;
+#else
+    (void)buf;
+    (void)ID;
+    (void)expected;
+    (void)timeout;
+    assert(0); // Lock free mode is disabled in create_buffer on MacOS
+    return 0;
+#endif
+}
+
+void private_lf_wake(struct Buffer* buf, const int ID) {
+#ifndef MAC_OSX
+    if (__atomic_load_n(LF_WAITERS(buf, ID), __ATOMIC_SEQ_CST) > 0) {
+        syscall(SYS_futex, LF_STATE(buf, ID), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+#else
+    (void)buf;
+    (void)ID;
+#endif
+}
+
+void private_lf_clear_frame(struct Buffer* buf, const int ID) {
+    // Unregistered consumers always count as done, so their flags are left set.
+    uint32_t retired = __atomic_load_n(&buf->retired_consumer_mask, __ATOMIC_SEQ_CST);
+    uint32_t state = __atomic_load_n(LF_STATE(buf, ID), __ATOMIC_SEQ_CST);
+    uint32_t new_state;
+    do {
+        new_state = (state & ~(LF_FULL_BIT | LF_CONSUMER_BITS)) | retired;
+    } while (!__atomic_compare_exchange_n(LF_STATE(buf, ID), &state, new_state, false,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    private_lf_wake(buf, ID);
+
+    // A consumer unregistered after `retired` was read above would have had its flag
+    // cleared, put it back.
+    uint32_t missed = __atomic_load_n(&buf->retired_consumer_mask, __ATOMIC_SEQ_CST) & ~retired;
+    if (missed != 0)
+        private_lf_set_consumers_done(buf, ID, missed);
+}
+
+uint32_t private_lf_set_consumers_done(struct Buffer* buf, const int ID, const uint32_t bits) {
+    // The flags are only ever set with this fetch_or, so exactly one call sees the
+    // transition from incomplete to complete for each fill of the frame.
+    const uint32_t old_state = __atomic_fetch_or(LF_STATE(buf, ID), bits, __ATOMIC_SEQ_CST);
+    const uint32_t consumer_mask = __atomic_load_n(&buf->consumer_mask, __ATOMIC_SEQ_CST);
+    if ((old_state & LF_FULL_BIT) != 0 && (old_state & consumer_mask) != consumer_mask
+        && ((old_state | bits) & consumer_mask) == consumer_mask) {
+        private_lf_release_frame(buf, ID);
+    }
+    return old_state;
+}
+
+void private_lf_release_frame(struct Buffer* buf, const int ID) {
+    // Only one thread can get here for a given fill of the frame, so the metadata
+    // can be released without the buffer lock.
+    if (buf->metadata[ID] != NULL) {
+        decrement_metadata_ref_count(buf->metadata[ID]);
+        buf->metadata[ID] = NULL;
+    }
+
+    // The frame stays full (with all consumers done) while it is being zeroed.
+    if (buf->zero_frames == 1) {
+        private_queue_zero_frame(buf, ID);
+    } else {
+        private_lf_clear_frame(buf, ID);
+    }
+}
+
+void private_lf_mark_frame_full(struct Buffer* buf, const int producer_id, const int ID) {
+    assert(producer_id >= 0 && producer_id < MAX_PRODUCERS);
+
+    buf->producers[producer_id].last_frame_released = ID;
+    private_log_event(buf, BUFFER_EVENT_PRODUCER_RELEASE, producer_id, ID, 0);
+
+    const uint32_t bit = 1u << (LF_PRODUCER_SHIFT + producer_id);
+    uint32_t state = __atomic_or_fetch(LF_STATE(buf, ID), bit, __ATOMIC_SEQ_CST);
+    // The producer we are marking as done, shouldn't already be done!
+    assert((state & LF_FULL_BIT) == 0);
+
+    // Only the last producer to finish goes on to mark the frame as full.
+    const uint32_t producer_mask = __atomic_load_n(&buf->producer_mask, __ATOMIC_SEQ_CST);
+    if ((state & producer_mask) != producer_mask)
+        return;
+
+    // Swap the producer flags for the full flag in one step, so no producer can see
+    // the frame as empty in between.
+    uint32_t new_state;
+    do {
+        new_state = (state & ~LF_PRODUCER_BITS) | LF_FULL_BIT;
+    } while (!__atomic_compare_exchange_n(LF_STATE(buf, ID), &state, new_state, false,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    buf->last_arrival_time = e_time();
+    private_log_event(buf, BUFFER_EVENT_FRAME_FULL, -1, ID, 0);
+
+    // If there are no consumers registered then we can just mark the buffer empty
+    const uint32_t consumer_mask = __atomic_load_n(&buf->consumer_mask, __ATOMIC_SEQ_CST);
+    if ((new_state & consumer_mask) == consumer_mask) {
+        DEBUG_F("No consumers are registered on %s dropping data in frame %d...", buf->buffer_name,
+                ID);
+        private_lf_release_frame(buf, ID);
+        return;
+    }
+
+    private_lf_wake(buf, ID);
+}
+
+void private_lf_mark_frame_empty(struct Buffer* buf, const int consumer_id, const int ID) {
+    assert(consumer_id >= 0 && consumer_id < MAX_CONSUMERS);
+
+    buf->consumers[consumer_id].last_frame_released = ID;
+    private_log_event(buf, BUFFER_EVENT_CONSUMER_RELEASE, consumer_id, ID, 0);
+
+    const uint32_t bit = 1u << consumer_id;
+    const uint32_t old_state = private_lf_set_consumers_done(buf, ID, bit);
+    // The consumer we are marking as done, shouldn't already be done!
+    assert((old_state & bit) == 0);
+    assert((old_state & LF_FULL_BIT) != 0);
+    (void)old_state;
+}
+
+uint8_t* private_lf_wait_for_empty_frame(struct Buffer* buf, const int producer_id, const int ID) {
+    uint64_t wait_start = 0;
+
+    const uint32_t bit = 1u << (LF_PRODUCER_SHIFT + producer_id);
+    uint32_t state = __atomic_load_n(LF_STATE(buf, ID), __ATOMIC_SEQ_CST);
+    // Wait for the frame to be empty, and for this producer not to have filled it already.
+    while ((state & (LF_FULL_BIT | bit)) != 0 && (state & LF_SHUTDOWN_BIT) == 0) {
+        if (wait_start == 0)
+            wait_start = private_event_wait_start(buf);
+        DEBUG_F("wait_for_empty_frame: %s waiting for empty frame ID = %d in buffer %s",
+                buf->producers[producer_id].name, ID, buf->buffer_name);
+        private_lf_wait(buf, ID, state, NULL);
+        state = __atomic_load_n(LF_STATE(buf, ID), __ATOMIC_SEQ_CST);
+    }
+
+    if (state & LF_SHUTDOWN_BIT)
+        return NULL;
+
+    buf->producers[producer_id].last_frame_acquired = ID;
+    private_log_event(buf, BUFFER_EVENT_PRODUCER_ACQUIRE, producer_id, ID, wait_start);
+    return buf->frames[ID];
+}
+
+int private_lf_wait_for_full_frame(struct Buffer* buf, const int consumer_id, const int ID,
+                                   const struct timespec* timeout) {
+    uint64_t wait_start = 0;
+
+    const uint32_t bit = 1u << consumer_id;
+    int err = 0;
+    uint32_t state = __atomic_load_n(LF_STATE(buf, ID), __ATOMIC_SEQ_CST);
+    // Wait for the frame to be full, and for this consumer not to have released it already.
+    while (((state & LF_FULL_BIT) == 0 || (state & bit) != 0) && (state & LF_SHUTDOWN_BIT) == 0
+           && err == 0) {
+        if (wait_start == 0)
+            wait_start = private_event_wait_start(buf);
+        err = private_lf_wait(buf, ID, state, timeout);
+        state = __atomic_load_n(LF_STATE(buf, ID), __ATOMIC_SEQ_CST);
+    }
+
+    if (state & LF_SHUTDOWN_BIT)
+        return -1;
+
+    if (err == ETIMEDOUT && ((state & LF_FULL_BIT) == 0 || (state & bit) != 0))
+        return 1;
+
+    buf->consumers[consumer_id].last_frame_acquired = ID;
+    private_log_event(buf, BUFFER_EVENT_CONSUMER_ACQUIRE, consumer_id, ID, wait_start);
+    return 0;
+}
+
+void private_lf_unregister_consumer(struct Buffer* buf, const int consumer_id) {
+    // The consumer stays in the consumer mask, but is marked as done in every frame (now and
+    // after every future release).  This way each fill of a frame still has exactly one
+    // thread which sees its consumers complete.
+    const uint32_t bit = 1u << consumer_id;
+    __atomic_fetch_or(&buf->retired_consumer_mask, bit, __ATOMIC_SEQ_CST);
+
+    for (int id = 0; id < buf->num_frames; ++id) {
+        private_lf_set_consumers_done(buf, id, bit);
+    }
+}
@@ -6,14 +6,31 @@
  *  - create_buffer
  *  - delete_buffer
  *  - zero_frames
+ *  - set_zero_policy
+ *  - set_zero_threads
+ *  - mark_frame_dirty
+ *  - get_zero_stats
  *  - register_consumer
  *  - register_producer
+ *  - get_consumer_id
+ *  - get_producer_id
  *  - mark_frame_full
  *  - mark_frame_empty
  *  - wait_for_empty_frame
  *  - wait_for_full_frame
+ *  - wait_for_empty_frames
+ *  - wait_for_full_frames
+ *  - mark_frames_full
+ *  - mark_frames_empty
+ *  - producer_wait_for_empty_frame
+ *  - producer_mark_frame_full
+ *  - consumer_wait_for_full_frame
+ *  - consumer_mark_frame_empty
  *  - is_frame_empty
+ *  - is_frame_consumer_done
+ *  - is_frame_producer_done
  *  - get_num_full_frames
+ *  - get_buffer_events
  *  - print_buffer_status
  *  - allocate_new_metadata_object
  *  - get_metadata
@@ -33,7 +50,7 @@ extern "C" {
 
 #include <pthread.h> // for pthread_cond_t, pthread_mutex_t
 #include <stdbool.h> // for bool
-#include <stdint.h>  // for uint8_t
+#include <stdint.h>  // for uint8_t, uint64_t, int32_t, int16_t, uint16_t, uint32_t
 #include <time.h>    // for size_t, timespec
 
 #ifdef MAC_OSX
@@ -52,6 +69,8 @@ extern "C" {
 #define MAX_CONSUMERS 20
 /// The maximum number of producers that can register on a buffer
 #define MAX_PRODUCERS 10
+// Note: in lock free mode the consumer and producer done flags of a frame are packed into
+// a single 32-bit word together with two status bits, so MAX_CONSUMERS + MAX_PRODUCERS <= 30.
 
 /**
  * @struct StageInfo
@@ -69,8 +88,83 @@ struct StageInfo {
 
     /// Last frame to be released with a call to mark_frame_*
     int last_frame_released;
+
+    /// A copy of the name which is never freed, for the trace (see kotekanTrace.h)
+    const char* trace_name;
+};
+
+/// The default number of entries in the event log of each buffer
+#define DEFAULT_EVENT_LOG_SIZE 4096
+
+/// The types of the events recorded in the buffer event log, see @c get_buffer_events
+enum BufferEventType {
+    /// A producer was given an empty frame by a @c wait_for_empty_* call
+    BUFFER_EVENT_PRODUCER_ACQUIRE = 0,
+    /// A producer marked a frame as full
+    BUFFER_EVENT_PRODUCER_RELEASE = 1,
+    /// A consumer was given a full frame by a @c wait_for_full_* call
+    BUFFER_EVENT_CONSUMER_ACQUIRE = 2,
+    /// A consumer marked a frame as empty
+    BUFFER_EVENT_CONSUMER_RELEASE = 3,
+    /// The last producer marked a frame as full, so it is ready for the consumers
+    BUFFER_EVENT_FRAME_FULL = 4
+};
+
+/**
+ * @struct BufferEvent
+ * @brief An entry of the buffer event log.
+ */
+struct BufferEvent {
+    /// The time of the event in ns, from @c CLOCK_MONOTONIC_RAW
+    uint64_t time;
+
+    /// Acquire events only: the time in ns spent blocked waiting for the frame
+    uint64_t wait;
+
+    /// The frame the event is for
+    int32_t frame_id;
+
+    /// The index of the stage in @c consumers or @c producers, -1 for @c BUFFER_EVENT_FRAME_FULL
+    int16_t stage_id;
+
+    /// The @c BufferEventType
+    uint16_t type;
+};
+
+// A slot of the event log, defined in buffer.c
+struct bufferEventSlot;
+
+/// What part of a frame is zeroed once all the consumers have released it
+enum ZeroPolicy {
+    /// The whole frame
+    ZERO_FULL_FRAME = 0,
+    /// A region at the start of every fixed size block, e.g. just the VDIF headers
+    ZERO_STRIDED = 1,
+    /// Only the part of the frame declared dirty with @c mark_frame_dirty
+    ZERO_DIRTY = 2
 };
 
+/**
+ * @struct ZeroStats
+ * @brief The totals of the zeroing workers of a buffer.
+ */
+struct ZeroStats {
+    /// The number of frames zeroed
+    uint64_t num_frames;
+
+    /// The number of bytes zeroed
+    uint64_t num_bytes;
+
+    /// The time the workers have spent zeroing in ns
+    uint64_t busy_time;
+
+    /// The number of frames waiting to be zeroed, or being zeroed
+    int backlog;
+};
+
+// The zeroing workers and their queue, defined in buffer.c
+struct bufferZeroPool;
+
 /**
  * @struct Buffer
  * @brief Kotekan's core multi-producer, multi-consumer ring buffer with metadata
@@ -104,7 +198,11 @@ struct StageInfo {
  * Unless the function @c zero_frames() is called on the buffer object, the
  * default behaviour is not to zero the memory of the frames between uses.
  * Therefore it is normally up to the producer(s) to ensure all memory
- * values are either given new data, or zeroed.
+ * values are either given new data, or zeroed.  When zeroing is turned on, a frame
+ * released by all its consumers is queued for a pool of worker threads which belong to the
+ * buffer, and only handed back to the producers once it has been zeroed.  The workers run
+ * on the buffer's NUMA node unless they are given CPU cores, and can zero just part of
+ * each frame (see @c set_zero_policy).
  *
  * In the config file a buffer is created with a <tt>kotekan_buffer: standard</tt>
  * named block.   The buffer name becomes the path name of that config block.
@@ -119,6 +217,31 @@ struct StageInfo {
  * @conf numa_node The NUMA domain to mbind the memory into.  Default: 1
  * @conf use_hugepages Allocate 2MB huge pages for the frames. Default: false
  * @conf mlock_frames Lock the frame pages with mlock Default: true
+ * @conf lock_free Use the lock free frame state mode, see below. Default: false
+ * @conf event_log_size The number of frame events to keep for latency tracing, rounded up to
+ *                      a power of two, or 0 to turn it off.  Default: 4096
+ * @conf zero_frames Zero the frames after the consumers release them. Default: false
+ * @conf zero_policy What to zero: @c full, @c strided or @c dirty. Default: full
+ * @conf zero_region_size For @c strided, the bytes zeroed at the start of every block
+ * @conf zero_region_stride For @c strided, the size of the blocks
+ * @conf zero_threads The number of zeroing worker threads. Default: 1
+ * @conf zero_cpu_affinity The cores to run the zeroing workers on.  Default: [], which
+ *                         runs them on the cores of @c numa_node
+ *
+ * By default the frame state is guarded by the single buffer mutex, and every state
+ * change is broadcast to all waiting producers and consumers.  With <tt>lock_free: true</tt>
+ * the state of each frame is kept in one atomic word (see @c frame_state), the
+ * @c wait_for_* and @c mark_frame_* calls never take the buffer mutex, and only the
+ * threads waiting on the frame which changed are woken (using a futex on that word).
+ * The C API is identical in both modes.  In lock free mode all producers and consumers must
+ * register before the pipeline starts, and unregistered consumer slots are not reused.
+ * Lock free mode is only supported on Linux.
+ *
+ * Every time a producer or consumer acquires or releases a frame the buffer records the
+ * time in a ring log, which costs a clock read and a few atomic stores per call.  From this
+ * the time each stage holds a frame, how long it is blocked waiting for frames, and how long
+ * full frames wait for each consumer can be worked out without touching the stage code.
+ * See @c get_buffer_events and bufferLatency.hpp.
  *
  * See metadata.h for more information on metadata pools
  *
@@ -180,6 +303,9 @@ struct Buffer {
     /// Flag set to indicate if the frames should be zeroed between uses
     int zero_frames;
 
+    /// The zeroing policy, workers and queue, the workers are started by @c zero_frames
+    struct bufferZeroPool* zero_pool;
+
     /// The array of frames (the actual data we are carrying)
     uint8_t** frames;
 
@@ -201,6 +327,9 @@ struct Buffer {
     /// The name of the buffer for use in debug messages.
     char* buffer_name;
 
+    /// A copy of the buffer name which is never freed, for the trace (see kotekanTrace.h)
+    const char* trace_name;
+
     /// The type of the buffer for use in writing data.
     char* buffer_type;
 
@@ -212,6 +341,40 @@ struct Buffer {
 
     /// The NUMA node the frames are allocated in
     int numa_node;
+
+    /// Set if the buffer uses the lock free frame state (@c frame_state) instead of @c lock
+    bool lock_free;
+
+    /**
+     * @brief Lock free mode only: the state word of each frame.
+     * Bits [0, MAX_CONSUMERS) are the consumers done flags, the next MAX_PRODUCERS bits
+     * are the producers done flags, bit 30 is set when the frame is full and bit 31 once
+     * the buffer has been shutdown.  Replaces @c is_full, @c producers_done and
+     * @c consumers_done, which are not used in this mode.
+     */
+    uint32_t* frame_state;
+
+    /// Lock free mode only: the number of threads sleeping on each @c frame_state word.
+    uint32_t* frame_waiters;
+
+    /// Lock free mode only: bit mask of the registered consumers (including unregistered ones).
+    uint32_t consumer_mask;
+
+    /// Lock free mode only: bit mask of the registered producers (shifted into @c frame_state)
+    uint32_t producer_mask;
+
+    /// Lock free mode only: consumers which have been unregistered, always considered done.
+    uint32_t retired_consumer_mask;
+
+    /// The ring log of frame events, NULL if the log is turned off.
+    struct bufferEventSlot* event_log;
+
+    /// The number of slots in @c event_log, a power of two.
+    uint32_t event_log_size;
+
+    /// The number of events logged so far, the next one goes in slot
+    /// <tt>event_count % event_log_size</tt>.
+    uint64_t event_count;
 };
 
 /**
@@ -232,11 +395,15 @@ struct Buffer {
  * @param[in] zero_new_frames In theory some memory allocators don't zero new allocations
  *                            so by default we zero new frames on startup, but this is expensive
  *                            and can be disabled by setting this to false.
+ * @param[in] lock_free Use the lock free frame state mode (ignored on MacOS).
+ * @param[in] event_log_size The number of events to keep in the event log (rounded up to a
+ *                           power of two), or 0 to turn the log off.
  * @returns A buffer object.
  */
 struct Buffer* create_buffer(int num_frames, size_t frame_size, struct metadataPool* pool,
                              const char* buffer_name, const char* buffer_type, int numa_node,
-                             bool use_huge_pages, bool mlock_frames, bool zero_new_frames);
+                             bool use_huge_pages, bool mlock_frames, bool zero_new_frames,
+                             bool lock_free, int event_log_size);
 
 /**
  * @brief Deletes a buffer object and frees all frame memory
@@ -248,20 +415,74 @@ void delete_buffer(struct Buffer* buf);
 /**
  * @brief Zero all frames after all consumers have marked them as empty
  *
+ * This starts the zeroing worker threads, with the policy and threads set by
+ * @c set_zero_policy and @c set_zero_threads (by default one thread zeroing whole frames).
+ *
  * @param[in] buf The buffer object which will be set to automatically zero all frames
  */
 void zero_frames(struct Buffer* buf);
 
+/**
+ * @brief Set what part of each frame is zeroed, this must be done before @c zero_frames
+ *
+ * @param[in] buf The buffer object
+ * @param[in] policy What to zero
+ * @param[in] region_size For @c ZERO_STRIDED, the bytes to zero at the start of every block
+ * @param[in] region_stride For @c ZERO_STRIDED, the size of the blocks
+ * @returns 0 on success, or -1 if the arguments are invalid or zeroing has already started
+ */
+int set_zero_policy(struct Buffer* buf, enum ZeroPolicy policy, size_t region_size,
+                    size_t region_stride);
+
+/**
+ * @brief Set the zeroing worker threads, this must be done before @c zero_frames
+ *
+ * @param[in] buf The buffer object
+ * @param[in] num_threads The number of worker threads
+ * @param[in] cpu_affinity The cores to run the workers on, or NULL to run them on the cores
+ *                         of the buffer's NUMA node (when built with NUMA support)
+ * @param[in] num_cpus The length of @c cpu_affinity
+ * @returns 0 on success, or -1 if the arguments are invalid or zeroing has already started
+ */
+int set_zero_threads(struct Buffer* buf, int num_threads, const int* cpu_affinity,
+                     int num_cpus);
+
+/**
+ * @brief Declare part of a frame as written, so it is zeroed under @c ZERO_DIRTY
+ *
+ * Any stage holding the frame can call this, the regions declared are merged into one
+ * range which is zeroed and reset once the frame is released.  Under @c ZERO_DIRTY a frame
+ * with nothing declared isn't zeroed at all.  Does nothing under the other policies.
+ *
+ * @param[in] buf The buffer object
+ * @param[in] ID The frame
+ * @param[in] offset The start of the written region in bytes
+ * @param[in] len The length of the written region in bytes
+ */
+void mark_frame_dirty(struct Buffer* buf, const int ID, size_t offset, size_t len);
+
+/**
+ * @brief Get the totals of the zeroing workers, for the metrics.
+ *
+ * @param[in] buf The buffer object
+ * @param[out] stats The totals
+ */
+void get_zero_stats(struct Buffer* buf, struct ZeroStats* stats);
+
 /**
  * @brief Register a consumer with a given name.
  *
  * In order to use a buffer a consumer must first register its name so that
  * the buffer object can track which consumers have signed off on each frame.
  *
+ * The handle returned can be given to the @c consumer_* functions instead of the name,
+ * which saves looking up the name on every call.
+ *
  * @param[in] buf The buffer to register on
  * @param[in] name The name of the consumer.
+ * @returns The handle of the consumer, or -1 if it couldn't be registered.
  */
-void register_consumer(struct Buffer* buf, const char* name);
+int register_consumer(struct Buffer* buf, const char* name);
 
 /**
  * @brief Removes the consumer with the given name
@@ -282,10 +503,32 @@ void unregister_consumer(struct Buffer* buf, const char* name);
  * In order to use a buffer a producer must first register its name so that
  * the buffer object can track which producers have signed off on each frame.
  *
+ * The handle returned can be given to the @c producer_* functions instead of the name,
+ * which saves looking up the name on every call.
+ *
  * @param[in] buf The buffer to register on
  * @param[in] name The name of the producer.
+ * @returns The handle of the producer, or -1 if it couldn't be registered.
+ */
+int register_producer(struct Buffer* buf, const char* name);
+
+/**
+ * @brief Get the handle of a registered consumer.
+ *
+ * @param[in] buf The buffer object
+ * @param[in] name The name the consumer was registered with.
+ * @returns The handle returned by @c register_consumer(), or -1 if there is no such consumer.
+ */
+int get_consumer_id(struct Buffer* buf, const char* name);
+
+/**
+ * @brief Get the handle of a registered producer.
+ *
+ * @param[in] buf The buffer object
+ * @param[in] name The name the producer was registered with.
+ * @returns The handle returned by @c register_producer(), or -1 if there is no such producer.
  */
-void register_producer(struct Buffer* buf, const char* name);
+int get_producer_id(struct Buffer* buf, const char* name);
 
 /**
  * @brief Marks a buffer frame as full.
@@ -310,6 +553,34 @@ void mark_frame_full(struct Buffer* buf, const char* producer_name, const int fr
  */
 void mark_frame_empty(struct Buffer* buf, const char* consumer_name, const int frame_id);
 
+/**
+ * @brief Marks a run of buffer frames as full.
+ *
+ * Same as calling @c mark_frame_full() on the frames <tt>(start_id + i) % num_frames</tt>
+ * for <tt>i < n</tt>, but with a single lock acquisition and wake up of the consumers.
+ *
+ * @param[in] buf The buffer containing the frames to mark as full
+ * @param[in] producer_name The name of the producer registered with @c register_producer()
+ * @param[in] start_id The first frame ID to be marked as full
+ * @param[in] n The number of frames to mark as full
+ */
+void mark_frames_full(struct Buffer* buf, const char* producer_name, const int start_id,
+                      const int n);
+
+/**
+ * @brief Marks a run of buffer frames as empty.
+ *
+ * Same as calling @c mark_frame_empty() on the frames <tt>(start_id + i) % num_frames</tt>
+ * for <tt>i < n</tt>, but with a single lock acquisition and wake up of the producers.
+ *
+ * @param[in] buf The buffer containing the frames to mark as empty
+ * @param[in] consumer_name The name of the consumer registered with @c register_consumer()
+ * @param[in] start_id The first frame ID to be marked as empty
+ * @param[in] n The number of frames to mark as empty
+ */
+void mark_frames_empty(struct Buffer* buf, const char* consumer_name, const int start_id,
+                       const int n);
+
 /**
  * @brief Blocks until the frame requested by frame_id is empty.
  *
@@ -365,6 +636,86 @@ uint8_t* wait_for_full_frame(struct Buffer* buf, const char* consumer_name, cons
 int wait_for_full_frame_timeout(struct Buffer* buf, const char* name, const int ID,
                                 const struct timespec timeout);
 
+/**
+ * @brief Blocks until at least one empty frame is available, and returns the run of
+ *        consecutive empty frames starting at @c start_id.
+ *
+ * This is the batched version of @c wait_for_empty_frame(), it waits for the frame
+ * @c start_id and then (under the same lock acquisition) counts how many of the following
+ * frames in the ring are also available to this producer.  The frames are
+ * <tt>(start_id + i) % num_frames</tt> for <tt>i < n</tt>, and must all be released with
+ * @c mark_frame_full() or @c mark_frames_full().
+ *
+ * @param[in] buf The buffer object
+ * @param[in] producer_name The name of the registered producer requesting the frames
+ * @param[in] start_id The id of the first frame to wait for.
+ * @param[in] max_n The maximum number of frames to return, capped at @c num_frames.
+ * @returns The number of frames acquired (at least 1), or -1 if the buffer is shutting down.
+ */
+int wait_for_empty_frames(struct Buffer* buf, const char* producer_name, const int start_id,
+                          const int max_n);
+
+/**
+ * @brief Blocks until at least one full frame is available, and returns the run of
+ *        consecutive full frames starting at @c start_id.
+ *
+ * This is the batched version of @c wait_for_full_frame(), it waits for the frame
+ * @c start_id and then (under the same lock acquisition) counts how many of the following
+ * frames in the ring are also full and not yet released by this consumer.  This lets a
+ * consumer which has fallen behind pick up all the waiting frames with one call.
+ * The frames are <tt>(start_id + i) % num_frames</tt> for <tt>i < n</tt>, and must all be
+ * released with @c mark_frame_empty() or @c mark_frames_empty().
+ *
+ * @param[in] buf The buffer object
+ * @param[in] consumer_name The name of the registered consumer requesting the frames
+ * @param[in] start_id The id of the first frame to wait for.
+ * @param[in] max_n The maximum number of frames to return, capped at @c num_frames.
+ * @param[in] timeout If not NULL, give up after this *absolute* time.
+ * @returns The number of frames acquired (at least 1), 0 if we timed out waiting,
+ *          or -1 if the buffer is shutting down.
+ */
+int wait_for_full_frames(struct Buffer* buf, const char* consumer_name, const int start_id,
+                         const int max_n, const struct timespec* timeout);
+
+// *** Handle versions ***
+// The following are the same as the functions above, but take the handle returned by
+// register_producer() or register_consumer() instead of the stage name.  The functions
+// taking a name look up the handle and call these.
+
+/// Same as @c wait_for_empty_frame(), with the handle from @c register_producer()
+uint8_t* producer_wait_for_empty_frame(struct Buffer* buf, const int producer_id,
+                                       const int frame_id);
+
+/// Same as @c wait_for_empty_frames(), with the handle from @c register_producer()
+int producer_wait_for_empty_frames(struct Buffer* buf, const int producer_id, const int start_id,
+                                   const int max_n);
+
+/// Same as @c mark_frame_full(), with the handle from @c register_producer()
+void producer_mark_frame_full(struct Buffer* buf, const int producer_id, const int frame_id);
+
+/// Same as @c mark_frames_full(), with the handle from @c register_producer()
+void producer_mark_frames_full(struct Buffer* buf, const int producer_id, const int start_id,
+                               const int n);
+
+/// Same as @c wait_for_full_frame(), with the handle from @c register_consumer()
+uint8_t* consumer_wait_for_full_frame(struct Buffer* buf, const int consumer_id,
+                                      const int frame_id);
+
+/// Same as @c wait_for_full_frame_timeout(), with the handle from @c register_consumer()
+int consumer_wait_for_full_frame_timeout(struct Buffer* buf, const int consumer_id,
+                                         const int frame_id, const struct timespec timeout);
+
+/// Same as @c wait_for_full_frames(), with the handle from @c register_consumer()
+int consumer_wait_for_full_frames(struct Buffer* buf, const int consumer_id, const int start_id,
+                                  const int max_n, const struct timespec* timeout);
+
+/// Same as @c mark_frame_empty(), with the handle from @c register_consumer()
+void consumer_mark_frame_empty(struct Buffer* buf, const int consumer_id, const int frame_id);
+
+/// Same as @c mark_frames_empty(), with the handle from @c register_consumer()
+void consumer_mark_frames_empty(struct Buffer* buf, const int consumer_id, const int start_id,
+                                const int n);
+
 /**
  * @brief Checks if the requested buffer is empty.
  *
@@ -376,6 +727,30 @@ int wait_for_full_frame_timeout(struct Buffer* buf, const char* name, const int
  */
 int is_frame_empty(struct Buffer* buf, const int frame_id);
 
+/**
+ * @brief Checks if the given consumer has marked the frame as empty.
+ *
+ * Only intended for status reporting, the value may be stale by the time it is used.
+ *
+ * @param[in] buf The buffer object
+ * @param[in] consumer_id The index of the consumer in @c buf->consumers
+ * @param[in] frame_id The id of the frame to check.
+ * @returns 1 if the consumer is done with the frame, 0 otherwise.
+ */
+int is_frame_consumer_done(struct Buffer* buf, const int consumer_id, const int frame_id);
+
+/**
+ * @brief Checks if the given producer has marked the frame as full.
+ *
+ * Only intended for status reporting, the value may be stale by the time it is used.
+ *
+ * @param[in] buf The buffer object
+ * @param[in] producer_id The index of the producer in @c buf->producers
+ * @param[in] frame_id The id of the frame to check.
+ * @returns 1 if the producer is done with the frame, 0 otherwise.
+ */
+int is_frame_producer_done(struct Buffer* buf, const int producer_id, const int frame_id);
+
 /**
  * @brief Returns the number of currently full frames.
  *
@@ -384,6 +759,19 @@ int is_frame_empty(struct Buffer* buf, const int frame_id);
  */
 int get_num_full_frames(struct Buffer* buf);
 
+/**
+ * @brief Copies the most recent entries of the buffer event log, oldest first.
+ *
+ * The log is written without locks, so this never holds up the producers and consumers.
+ * Entries which are being overwritten while they are copied are skipped.
+ *
+ * @param[in] buf The buffer object
+ * @param[out] events Array to copy the events into
+ * @param[in] max_events The size of @c events
+ * @returns The number of events copied
+ */
+int get_buffer_events(struct Buffer* buf, struct BufferEvent* events, int max_events);
+
 /**
  * @brief Get the number of consumers on this buffer
  *
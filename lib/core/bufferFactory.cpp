@@ -2,7 +2,7 @@
 
 #include "Config.hpp"         // for Config
 #include "HFBFrameView.hpp"   // for HFBFrameView
-#include "buffer.h"           // for create_buffer
+#include "buffer.h"           // for create_buffer, set_zero_policy, set_zero_threads, zero_...
 #include "kotekanLogging.hpp" // for INFO_NON_OO
 #include "metadata.h"         // for metadataPool // IWYU pragma: keep
 #include "visBuffer.hpp"      // for VisFrameView
@@ -11,6 +11,7 @@
 
 #include <cstdint>   // for int32_t, uint32_t
 #include <exception> // for exception
+#include <map>       // for map
 #include <regex>     // for match_results<>::_Base_type
 #include <stddef.h>  // for size_t
 #include <stdexcept> // for runtime_error
@@ -74,6 +75,9 @@ struct Buffer* bufferFactory::new_buffer(const string& type_name, const string&
     bool use_hugepages = config.get_default<bool>(location, "use_hugepages", false);
     bool mlock_frames = config.get_default<bool>(location, "mlock_frames", true);
     bool zero_new_frames = config.get_default<bool>(location, "zero_new_frames", true);
+    bool lock_free = config.get_default<bool>(location, "lock_free", false);
+    int32_t event_log_size =
+        config.get_default<int32_t>(location, "event_log_size", DEFAULT_EVENT_LOG_SIZE);
 
     struct metadataPool* pool = nullptr;
     if (metadataPool_name != "none") {
@@ -102,10 +106,36 @@ struct Buffer* bufferFactory::new_buffer(const string& type_name, const string&
                 type_name, name, num_frames, frame_size, metadataPool_name, numa_node);
     struct Buffer* buf =
         create_buffer(num_frames, frame_size, pool, name.c_str(), type_name.c_str(), numa_node,
-                      use_hugepages, mlock_frames, zero_new_frames);
+                      use_hugepages, mlock_frames, zero_new_frames, lock_free, event_log_size);
     if (buf == nullptr) {
         throw std::runtime_error(fmt::format(fmt("Could not create the buffer: {:s}"), name));
     }
+
+    // The zeroing workers, stages can also turn zeroing on with zero_frames()
+    string zero_policy = config.get_default<std::string>(location, "zero_policy", "full");
+    size_t zero_region_size = config.get_default<size_t>(location, "zero_region_size", 0);
+    size_t zero_region_stride = config.get_default<size_t>(location, "zero_region_stride", 0);
+    int zero_threads = config.get_default<int>(location, "zero_threads", 1);
+    std::vector<int> zero_cpu_affinity =
+        config.get_default<std::vector<int>>(location, "zero_cpu_affinity", {});
+
+    std::map<string, ZeroPolicy> zero_policies = {
+        {"full", ZERO_FULL_FRAME}, {"strided", ZERO_STRIDED}, {"dirty", ZERO_DIRTY}};
+    if (zero_policies.count(zero_policy) == 0) {
+        throw std::runtime_error(fmt::format(
+            fmt("Unknown zero_policy {:s} for the buffer {:s}, expected full, strided or dirty"),
+            zero_policy, name));
+    }
+    int err =
+        set_zero_policy(buf, zero_policies[zero_policy], zero_region_size, zero_region_stride);
+    err |= set_zero_threads(buf, zero_threads, zero_cpu_affinity.data(), zero_cpu_affinity.size());
+    if (err != 0) {
+        throw std::runtime_error(
+            fmt::format(fmt("Invalid zeroing config for the buffer: {:s}"), name));
+    }
+    if (config.get_default<bool>(location, "zero_frames", false))
+        zero_frames(buf);
+
     return buf;
 }
 
@@ -0,0 +1,252 @@
+#include "bufferLatency.hpp"
+
+#include "kotekanLogging.hpp" // for WARN_NON_OO
+
+#include <chrono>    // for duration
+#include <exception> // for exception
+#include <time.h>    // for clock_gettime, timespec, CLOCK_MONOTONIC_RAW
+#include <utility>   // for pair
+
+namespace kotekan {
+
+// The stage name of the zeroing metrics, which belong to the buffers rather than a stage
+static const std::string ZERO_METRICS_STAGE = "buffer_zeroing";
+
+// Running totals for one stage
+struct StageTotals {
+    uint64_t num_acquired = 0;
+    uint64_t num_released = 0;
+    uint64_t num_held = 0;
+    uint64_t num_queued = 0;
+    double hold_time = 0;
+    double wait_time = 0;
+    double queue_time = 0;
+    // Time each frame was acquired, or 0 if it isn't held
+    std::vector<uint64_t> acquire_time;
+};
+
+BufferLatency get_buffer_latency(struct Buffer* buf) {
+    BufferLatency latency;
+    if (buf->event_log == nullptr)
+        return latency;
+
+    std::vector<BufferEvent> events(buf->event_log_size);
+    events.resize(get_buffer_events(buf, events.data(), events.size()));
+
+    struct timespec now_ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now_ts);
+    uint64_t now = (uint64_t)now_ts.tv_sec * 1000000000ull + now_ts.tv_nsec;
+
+    // The consumers come first, in the same order as their flags in the lock free state words
+    const int num_stages = MAX_CONSUMERS + MAX_PRODUCERS;
+    std::vector<StageTotals> totals(num_stages);
+    for (auto& t : totals)
+        t.acquire_time.resize(buf->num_frames, 0);
+    std::vector<uint64_t> full_time(buf->num_frames, 0);
+
+    for (const auto& e : events) {
+        if (e.frame_id < 0 || e.frame_id >= buf->num_frames)
+            continue;
+
+        if (e.type == BUFFER_EVENT_FRAME_FULL) {
+            full_time[e.frame_id] = e.time;
+            continue;
+        }
+
+        bool producer =
+            (e.type == BUFFER_EVENT_PRODUCER_ACQUIRE || e.type == BUFFER_EVENT_PRODUCER_RELEASE);
+        int max_id = producer ? MAX_PRODUCERS : MAX_CONSUMERS;
+        if (e.stage_id < 0 || e.stage_id >= max_id)
+            continue;
+        auto& t = totals[producer ? MAX_CONSUMERS + e.stage_id : e.stage_id];
+
+        if (e.type == BUFFER_EVENT_PRODUCER_ACQUIRE || e.type == BUFFER_EVENT_CONSUMER_ACQUIRE) {
+            t.num_acquired++;
+            t.wait_time += e.wait * 1e-9;
+            t.acquire_time[e.frame_id] = e.time;
+
+            // Only count the frames we saw being filled
+            if (!producer && full_time[e.frame_id] != 0 && full_time[e.frame_id] <= e.time) {
+                t.num_queued++;
+                t.queue_time += (e.time - full_time[e.frame_id]) * 1e-9;
+            }
+        } else {
+            t.num_released++;
+            if (t.acquire_time[e.frame_id] != 0 && t.acquire_time[e.frame_id] <= e.time) {
+                t.num_held++;
+                t.hold_time += (e.time - t.acquire_time[e.frame_id]) * 1e-9;
+            }
+            t.acquire_time[e.frame_id] = 0;
+        }
+    }
+
+    // Measure the rates up to now, so a stalled stage drops to zero
+    if (!events.empty() && now > events.front().time)
+        latency.window = (now - events.front().time) * 1e-9;
+
+    for (int i = 0; i < num_stages; ++i) {
+        bool producer = (i >= MAX_CONSUMERS);
+        const StageInfo& info = producer ? buf->producers[i - MAX_CONSUMERS] : buf->consumers[i];
+        if (!info.in_use)
+            continue;
+
+        const auto& t = totals[i];
+        StageLatency stage;
+        stage.name = info.name;
+        stage.producer = producer;
+        stage.num_frames = t.num_released;
+        if (latency.window > 0)
+            stage.frame_rate = t.num_released / latency.window;
+        if (t.num_held > 0)
+            stage.hold_time = t.hold_time / t.num_held;
+        if (t.num_acquired > 0)
+            stage.wait_time = t.wait_time / t.num_acquired;
+        if (t.num_queued > 0)
+            stage.queue_time = t.queue_time / t.num_queued;
+        latency.stages.push_back(stage);
+    }
+
+    return latency;
+}
+
+nlohmann::json to_json(const BufferLatency& latency) {
+    nlohmann::json j;
+    j["window"] = latency.window;
+    j["producers"] = nlohmann::json::object();
+    j["consumers"] = nlohmann::json::object();
+    for (const auto& stage : latency.stages) {
+        nlohmann::json s;
+        s["num_frames"] = stage.num_frames;
+        s["frame_rate"] = stage.frame_rate;
+        s["hold_time"] = stage.hold_time;
+        s["wait_time"] = stage.wait_time;
+        if (stage.producer) {
+            j["producers"][stage.name] = s;
+        } else {
+            s["queue_time"] = stage.queue_time;
+            j["consumers"][stage.name] = s;
+        }
+    }
+    return j;
+}
+
+BufferLatencyMonitor::~BufferLatencyMonitor() {
+    stop();
+
+    // The stages' own metrics are normally gone by now, but a consumer name might not
+    // belong to a stage.
+    for (auto& stage : stage_metrics)
+        prometheus::Metrics::instance().remove_stage_metrics(stage.first);
+    if (zero_metrics.backlog != nullptr)
+        prometheus::Metrics::instance().remove_stage_metrics(ZERO_METRICS_STAGE);
+}
+
+void BufferLatencyMonitor::start(const std::map<std::string, struct Buffer*>& buffers,
+                                 double update_interval) {
+    this->buffers = buffers;
+    this->update_interval = update_interval;
+    stop_thread = false;
+    monitor_thread = std::thread(&BufferLatencyMonitor::run, this);
+}
+
+void BufferLatencyMonitor::stop() {
+    {
+        std::lock_guard<std::mutex> lock(stop_lock);
+        stop_thread = true;
+    }
+    stop_cond.notify_all();
+
+    if (monitor_thread.joinable()) {
+        try {
+            monitor_thread.join();
+        } catch (std::exception& e) {
+            WARN_NON_OO("BufferLatencyMonitor: Failure when joining thread: {:s}", e.what());
+        }
+    }
+}
+
+void BufferLatencyMonitor::run() {
+    std::unique_lock<std::mutex> lock(stop_lock);
+    while (!stop_thread) {
+        lock.unlock();
+        update();
+        lock.lock();
+        stop_cond.wait_for(lock, std::chrono::duration<double>(update_interval),
+                           [this] { return stop_thread; });
+    }
+}
+
+void BufferLatencyMonitor::update() {
+    auto& metrics = prometheus::Metrics::instance();
+
+    for (auto& [buf_name, buf] : buffers) {
+        for (const auto& stage : get_buffer_latency(buf).stages) {
+            auto it = stage_metrics.find(stage.name);
+            if (it == stage_metrics.end()) {
+                const std::vector<std::string> labels = {"buffer_name", "role"};
+                StageMetrics m;
+                m.frame_rate =
+                    &metrics.add_gauge("kotekan_buffer_frames_per_second", stage.name, labels);
+                m.hold_time =
+                    &metrics.add_gauge("kotekan_buffer_hold_time_seconds", stage.name, labels);
+                m.wait_time =
+                    &metrics.add_gauge("kotekan_buffer_wait_time_seconds", stage.name, labels);
+                m.queue_time =
+                    &metrics.add_gauge("kotekan_buffer_queue_time_seconds", stage.name, labels);
+                it = stage_metrics.emplace(stage.name, m).first;
+            }
+
+            const std::vector<std::string> label_values = {
+                buf_name, stage.producer ? "producer" : "consumer"};
+            auto& m = it->second;
+            m.frame_rate->labels(label_values).set(stage.frame_rate);
+            m.hold_time->labels(label_values).set(stage.hold_time);
+            m.wait_time->labels(label_values).set(stage.wait_time);
+            if (!stage.producer)
+                m.queue_time->labels(label_values).set(stage.queue_time);
+        }
+    }
+
+    update_zero_metrics();
+}
+
+void BufferLatencyMonitor::update_zero_metrics() {
+    struct timespec now_ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now_ts);
+    double now = now_ts.tv_sec + now_ts.tv_nsec * 1e-9;
+
+    for (auto& [buf_name, buf] : buffers) {
+        if (!buf->zero_frames)
+            continue;
+
+        if (zero_metrics.backlog == nullptr) {
+            auto& metrics = prometheus::Metrics::instance();
+            const std::vector<std::string> labels = {"buffer_name"};
+            zero_metrics.backlog = &metrics.add_gauge("kotekan_buffer_zero_backlog_frames",
+                                                      ZERO_METRICS_STAGE, labels);
+            zero_metrics.bandwidth = &metrics.add_gauge(
+                "kotekan_buffer_zero_bandwidth_bytes_per_second", ZERO_METRICS_STAGE, labels);
+            zero_metrics.busy_fraction = &metrics.add_gauge("kotekan_buffer_zero_busy_fraction",
+                                                            ZERO_METRICS_STAGE, labels);
+        }
+
+        ZeroStats stats;
+        get_zero_stats(buf, &stats);
+        zero_metrics.backlog->labels({buf_name}).set(stats.backlog);
+
+        // The rates since the last update
+        auto last = zero_metrics.last_stats.find(buf_name);
+        if (last != zero_metrics.last_stats.end() && now > zero_metrics.last_time) {
+            double busy = (stats.busy_time - last->second.busy_time) * 1e-9;
+            if (busy > 0)
+                zero_metrics.bandwidth->labels({buf_name}).set(
+                    (stats.num_bytes - last->second.num_bytes) / busy);
+            zero_metrics.busy_fraction->labels({buf_name}).set(
+                busy / (now - zero_metrics.last_time));
+        }
+        zero_metrics.last_stats[buf_name] = stats;
+    }
+    zero_metrics.last_time = now;
+}
+
+} // namespace kotekan
@@ -0,0 +1,160 @@
+/*****************************************
+@file
+@brief Per stage frame latency and throughput, worked out from the buffer event logs.
+- StageLatency
+- BufferLatency
+- get_buffer_latency
+- BufferLatencyMonitor
+*****************************************/
+#ifndef BUFFER_LATENCY_HPP
+#define BUFFER_LATENCY_HPP
+
+#include "buffer.h"              // for Buffer, ZeroStats
+#include "prometheusMetrics.hpp" // for Gauge, MetricFamily
+
+#include "json.hpp" // for json
+
+#include <condition_variable> // for condition_variable
+#include <map>                // for map
+#include <mutex>              // for mutex
+#include <stdint.h>           // for uint64_t
+#include <string>             // for string
+#include <thread>             // for thread
+#include <vector>             // for vector
+
+namespace kotekan {
+
+/**
+ * @brief How one producer or consumer of a buffer has been handling its frames.
+ *
+ * The times are means over the frames in the buffer's event log.
+ */
+struct StageLatency {
+    /// The name the stage registered on the buffer with
+    std::string name;
+
+    /// Set for a producer, unset for a consumer
+    bool producer;
+
+    /// The number of frames released
+    uint64_t num_frames = 0;
+
+    /// The frames released per second
+    double frame_rate = 0;
+
+    /// The time between acquiring and releasing a frame (s)
+    double hold_time = 0;
+
+    /// The time spent blocked in the @c wait_for_* calls before getting a frame (s)
+    double wait_time = 0;
+
+    /// Consumers only, the time a frame was full before this consumer acquired it (s)
+    double queue_time = 0;
+};
+
+/**
+ * @brief The latency of all the stages on a buffer.
+ */
+struct BufferLatency {
+    /// The time covered by the event log, up to now (s)
+    double window = 0;
+
+    /// The producers and consumers registered on the buffer
+    std::vector<StageLatency> stages;
+};
+
+/**
+ * @brief Work out the latency of each stage from the buffer's event log.
+ *
+ * A stage that holds its frames for most of the window without waiting for new ones is the
+ * one keeping the pipeline back.  Frames which are full for a long time before a consumer
+ * picks them up also point at that consumer.
+ *
+ * @param buf The buffer.
+ * @returns The latency of the stages, with no stages if the event log is turned off.
+ **/
+BufferLatency get_buffer_latency(struct Buffer* buf);
+
+/// The latency of a buffer in the format of the @c /buffers/latency endpoint
+nlohmann::json to_json(const BufferLatency& latency);
+
+/**
+ * @class BufferLatencyMonitor
+ * @brief Periodically publish the latency of every stage on every buffer as metrics.
+ *
+ * The metrics are labelled with the stage name of the producer or consumer,
+ * and the buffer name.  For the buffers which zero their frames, the zeroing backlog and
+ * bandwidth are published too, labelled with the buffer name.
+ *
+ * @conf enabled           Bool. Publish the metrics. Default: false
+ * @conf update_interval   Double. Seconds between updates. Default: 10
+ *
+ * @metric kotekan_buffer_frames_per_second
+ *         The rate each stage releases frames on each buffer.
+ * @metric kotekan_buffer_hold_time_seconds
+ *         The mean time each stage holds a frame of each buffer.
+ * @metric kotekan_buffer_wait_time_seconds
+ *         The mean time each stage is blocked waiting for a frame of each buffer.
+ * @metric kotekan_buffer_queue_time_seconds
+ *         The mean time a full frame waits for each consumer.
+ * @metric kotekan_buffer_zero_backlog_frames
+ *         The number of frames waiting to be zeroed, or being zeroed.
+ * @metric kotekan_buffer_zero_bandwidth_bytes_per_second
+ *         The rate the zeroing workers zero memory while they are busy.
+ * @metric kotekan_buffer_zero_busy_fraction
+ *         The fraction of the time the zeroing workers are busy, summed over the workers.
+ **/
+class BufferLatencyMonitor {
+public:
+    BufferLatencyMonitor() = default;
+    ~BufferLatencyMonitor();
+
+    /**
+     * @brief Start the thread publishing the metrics.
+     *
+     * @param buffers          The buffers to watch, which must outlive the thread.
+     * @param update_interval  Seconds between updates.
+     **/
+    void start(const std::map<std::string, struct Buffer*>& buffers, double update_interval);
+
+    /**
+     * @brief Stop and join the thread, this must be done before the buffers are deleted.
+     **/
+    void stop();
+
+private:
+    // The metrics of one stage
+    struct StageMetrics {
+        prometheus::MetricFamily<prometheus::Gauge>* frame_rate;
+        prometheus::MetricFamily<prometheus::Gauge>* hold_time;
+        prometheus::MetricFamily<prometheus::Gauge>* wait_time;
+        prometheus::MetricFamily<prometheus::Gauge>* queue_time;
+    };
+
+    // The zeroing metrics, and the totals at the last update
+    struct ZeroMetrics {
+        prometheus::MetricFamily<prometheus::Gauge>* backlog = nullptr;
+        prometheus::MetricFamily<prometheus::Gauge>* bandwidth = nullptr;
+        prometheus::MetricFamily<prometheus::Gauge>* busy_fraction = nullptr;
+        std::map<std::string, ZeroStats> last_stats;
+        double last_time = 0;
+    };
+
+    void update();
+    void update_zero_metrics();
+    void run();
+
+    std::map<std::string, struct Buffer*> buffers;
+    std::map<std::string, StageMetrics> stage_metrics;
+    ZeroMetrics zero_metrics;
+    double update_interval = 10;
+
+    std::thread monitor_thread;
+    std::mutex stop_lock;
+    std::condition_variable stop_cond;
+    bool stop_thread = false;
+};
+
+} // namespace kotekan
+
+#endif // BUFFER_LATENCY_HPP
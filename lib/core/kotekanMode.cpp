@@ -4,11 +4,13 @@
 #include "Stage.hpp"             // for Stage
 #include "StageFactory.hpp"      // for StageFactory
 #include "Telescope.hpp"         // for Telescope
-#include "buffer.h"              // for Buffer, StageInfo, get_num_full_frames, delete_buffer
+#include "buffer.h"              // for Buffer, StageInfo, get_num_full_frames, get_zero_stats
 #include "bufferFactory.hpp"     // for bufferFactory
+#include "bufferLatency.hpp"     // for get_buffer_latency, to_json, BufferLatencyMonitor
 #include "configUpdater.hpp"     // for configUpdater
 #include "datasetManager.hpp"    // for datasetManager
 #include "kotekanLogging.hpp"    // for INFO_NON_OO
+#include "kotekanTrace.hpp"      // for KotekanTrace
 #include "kotekanTrackers.hpp"   // for KotekanTrackers
 #include "metadata.h"            // for delete_metadata_pool
 #include "metadataFactory.hpp"   // for metadataFactory
@@ -49,9 +51,12 @@ kotekanMode::kotekanMode(Config& config_) : config(config_) {
 
 kotekanMode::~kotekanMode() {
 
+    buffer_latency_monitor.stop();
+
     configUpdater::instance().reset();
     restServer::instance().remove_get_callback("/config");
     restServer::instance().remove_get_callback("/buffers");
+    restServer::instance().remove_get_callback("/buffers/latency");
     restServer::instance().remove_get_callback("/pipeline_dot");
     restServer::instance().remove_all_aliases();
 
@@ -96,6 +101,9 @@ void kotekanMode::initalize_stages() {
     KotekanTrackers::instance(config).register_with_server(&restServer::instance());
     KotekanTrackers::instance().set_kotekan_mode_ptr(this);
 
+    // Apply the trace config, the recorder itself is global so it can be used by any thread
+    KotekanTrace::instance(config).register_with_server(&restServer::instance());
+
     // Create Metadata Pool
     metadataFactory metadata_factory(config);
     metadata_pools = metadata_factory.build_pools();
@@ -116,6 +124,9 @@ void kotekanMode::initalize_stages() {
     restServer::instance().register_get_callback(
         "/buffers", std::bind(&kotekanMode::buffer_data_callback, this, _1));
 
+    restServer::instance().register_get_callback(
+        "/buffers/latency", std::bind(&kotekanMode::buffer_latency_callback, this, _1));
+
     restServer::instance().register_get_callback(
         "/pipeline_dot", std::bind(&kotekanMode::pipeline_dot_graph_callback, this, _1));
 }
@@ -141,12 +152,19 @@ void kotekanMode::start_stages() {
         cpu_monitor.set_affinity(config);
     }
 #endif
+
+    if (config.get_default<bool>("/buffer_latency", "enabled", false)) {
+        buffer_latency_monitor.start(
+            buffers, config.get_default<double>("/buffer_latency", "update_interval", 10));
+    }
 }
 
 void kotekanMode::stop_stages() {
 #if !defined(MAC_OSX)
     cpu_monitor.stop();
 #endif
+    buffer_latency_monitor.stop();
+
     // First set the shutdown variable on all stages
     for (auto const& stage : stages)
         stage.second->stop();
@@ -175,7 +193,7 @@ nlohmann::json kotekanMode::get_buffer_json() {
                     buf.second->consumers[i].last_frame_released;
                 for (int f = 0; f < buf.second->num_frames; ++f) {
                     buf_info["consumers"][consumer_name]["marked_frame_empty"].push_back(
-                        buf.second->consumers_done[f][i]);
+                        is_frame_consumer_done(buf.second, i, f));
                 }
             }
         }
@@ -190,13 +208,13 @@ nlohmann::json kotekanMode::get_buffer_json() {
                     buf.second->producers[i].last_frame_released;
                 for (int f = 0; f < buf.second->num_frames; ++f) {
                     buf_info["producers"][producer_name]["marked_frame_empty"].push_back(
-                        buf.second->producers_done[f][i]);
+                        is_frame_producer_done(buf.second, i, f));
                 }
             }
         }
         buf_info["frames"];
         for (int i = 0; i < buf.second->num_frames; ++i) {
-            buf_info["frames"].push_back(buf.second->is_full[i]);
+            buf_info["frames"].push_back(static_cast<int>(!is_frame_empty(buf.second, i)));
         }
 
         buf_info["num_full_frame"] = get_num_full_frames(buf.second);
@@ -205,6 +223,15 @@ nlohmann::json kotekanMode::get_buffer_json() {
         buf_info["last_frame_arrival_time"] = buf.second->last_arrival_time;
         buf_info["type"] = buf.second->buffer_type;
 
+        if (buf.second->zero_frames) {
+            ZeroStats zero_stats;
+            get_zero_stats(buf.second, &zero_stats);
+            buf_info["zeroing"]["backlog"] = zero_stats.backlog;
+            buf_info["zeroing"]["num_frames"] = zero_stats.num_frames;
+            buf_info["zeroing"]["num_bytes"] = zero_stats.num_bytes;
+            buf_info["zeroing"]["busy_time"] = zero_stats.busy_time * 1e-9;
+        }
+
         buffer_json[buf.first] = buf_info;
     }
 
@@ -215,6 +242,13 @@ void kotekanMode::buffer_data_callback(connectionInstance& conn) {
     conn.send_json_reply(get_buffer_json());
 }
 
+void kotekanMode::buffer_latency_callback(connectionInstance& conn) {
+    nlohmann::json latency_json = {};
+    for (auto& buf : buffer_container.get_buffer_map())
+        latency_json[buf.first] = to_json(get_buffer_latency(buf.second));
+    conn.send_json_reply(latency_json);
+}
+
 void kotekanMode::pipeline_dot_graph_callback(connectionInstance& conn) {
     const std::string prefix = "    ";
     std::string dot =
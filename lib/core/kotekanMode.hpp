@@ -4,6 +4,7 @@
 #include "Config.hpp"          // for Config
 #include "Stage.hpp"           // for Stage
 #include "bufferContainer.hpp" // for bufferContainer
+#include "bufferLatency.hpp"   // for BufferLatencyMonitor
 #include "metadata.h"          // for metadataPool  // IWYU pragma: keep
 #include "restServer.hpp"      // for connectionInstance
 #if !defined(MAC_OSX)
@@ -54,6 +55,15 @@ public:
      */
     nlohmann::json get_buffer_json();
 
+    /**
+     * @brief HTTP callback that gives the latency and throughput of each stage on each buffer.
+     *
+     * For every buffer, the frame rate, and the mean time each producer and consumer holds
+     * a frame and waits for one, over the buffer's event log.  For consumers also the mean
+     * time a frame was full before they acquired it.  See bufferLatency.hpp.
+     */
+    void buffer_latency_callback(connectionInstance& conn);
+
     // HTTP callback that dumps the current pipeline graph in `dot` format.
     void pipeline_dot_graph_callback(connectionInstance& conn);
 
@@ -63,6 +73,7 @@ private:
 #if !defined(MAC_OSX)
     CpuMonitor cpu_monitor;
 #endif
+    BufferLatencyMonitor buffer_latency_monitor;
 
     std::map<std::string, Stage*> stages;
     std::map<std::string, struct metadataPool*> metadata_pools;
@@ -0,0 +1,362 @@
+#include "kotekanTrace.hpp"
+
+#include "Config.hpp"         // for Config
+#include "kotekanLogging.hpp" // for INFO_NON_OO
+#include "restServer.hpp"     // for restServer, connectionInstance, HTTP_RESPONSE
+
+#include "fmt.hpp"  // for format
+#include "json.hpp" // for json, basic_json<>::object_t, basic_json<>::value_type
+
+#include <algorithm>     // for max
+#include <atomic>        // for atomic, atomic_thread_fence, memory_order_relaxed
+#include <functional>    // for _Bind_helper<>::type, _Placeholder, bind, _1, _2
+#include <memory>        // for shared_ptr, make_shared
+#include <mutex>         // for mutex, lock_guard
+#include <pthread.h>     // for pthread_getname_np, pthread_self
+#include <string>        // for string
+#include <sys/syscall.h> // for SYS_gettid // IWYU pragma: keep
+// IWYU pragma: no_include <syscall.h>
+#include <time.h>        // for clock_gettime, timespec, CLOCK_MONOTONIC_RAW, CLOCK_REALTIME
+#include <unistd.h>      // for getpid, syscall
+#include <unordered_set> // for unordered_set
+#include <vector>        // for vector
+
+int _kotekan_trace_enabled = 0;
+
+namespace {
+
+// The rings of threads which have exited are kept so their last events can still be dumped,
+// up to this many of them.
+const size_t MAX_EXITED_RINGS = 64;
+
+// One event in a ring.  The slot is a seqlock, the same as in the buffer event logs: `seq` is
+// the index of the event plus one, or 0 while it is being written.
+struct TraceSlot {
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> time;
+    std::atomic<uint64_t> duration;
+    std::atomic<uint64_t> id;
+    std::atomic<const char*> name;
+    std::atomic<const char*> cat;
+    std::atomic<const char*> arg_name;
+    std::atomic<const char*> arg;
+    std::atomic<int32_t> frame_id;
+    std::atomic<char> phase;
+};
+
+// A copy of an event read out of a ring
+struct TraceEvent {
+    uint64_t time;
+    uint64_t duration;
+    uint64_t id;
+    const char* name;
+    const char* cat;
+    const char* arg_name;
+    const char* arg;
+    int32_t frame_id;
+    char phase;
+};
+
+// The events of one thread, only written by that thread
+struct TraceRing {
+    TraceRing(size_t size, uint64_t tid) : slots(size), mask(size - 1), tid(tid) {}
+
+    std::vector<TraceSlot> slots;
+    const uint64_t mask;
+
+    // The number of events written
+    std::atomic<uint64_t> count{0};
+    // The first event to dump, events before it were recorded before tracing was turned on
+    std::atomic<uint64_t> start{0};
+
+    const uint64_t tid;
+
+    // These are protected by the registry lock
+    std::string thread_name;
+    bool exited = false;
+};
+
+struct TraceRegistry {
+    std::mutex lock;
+    std::vector<std::shared_ptr<TraceRing>> rings;
+    size_t buffer_size = 16384;
+
+    std::mutex strings_lock;
+    std::unordered_set<std::string> strings;
+};
+
+// Never destroyed, since threads can still record events during the static destruction.
+TraceRegistry& registry() {
+    static TraceRegistry* _registry = new TraceRegistry();
+    return *_registry;
+}
+
+// The ring of the calling thread, which is marked as exited when the thread ends
+struct ThreadTrace {
+    ~ThreadTrace() {
+        if (ring) {
+            std::lock_guard<std::mutex> lock(registry().lock);
+            ring->exited = true;
+        }
+    }
+
+    std::shared_ptr<TraceRing> ring;
+    std::string name;
+};
+
+thread_local ThreadTrace thread_trace;
+
+TraceRing* create_ring() {
+    TraceRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.lock);
+
+#ifndef MAC_OSX
+    uint64_t tid = syscall(SYS_gettid);
+#else
+    static uint64_t next_tid = 1;
+    uint64_t tid = next_tid++;
+#endif
+
+    size_t size = 1;
+    while (size < std::max<size_t>(reg.buffer_size, 2))
+        size <<= 1;
+    auto ring = std::make_shared<TraceRing>(size, tid);
+
+    if (!thread_trace.name.empty()) {
+        ring->thread_name = thread_trace.name;
+    } else {
+        char name[16] = "";
+        pthread_getname_np(pthread_self(), name, sizeof(name));
+        ring->thread_name = name;
+    }
+
+    // Drop the oldest rings of threads which have exited
+    size_t num_exited = 0;
+    for (auto& r : reg.rings)
+        num_exited += r->exited;
+    for (auto it = reg.rings.begin(); it != reg.rings.end() && num_exited > MAX_EXITED_RINGS;) {
+        if ((*it)->exited) {
+            it = reg.rings.erase(it);
+            num_exited--;
+        } else {
+            ++it;
+        }
+    }
+
+    reg.rings.push_back(ring);
+    thread_trace.ring = ring;
+    return ring.get();
+}
+
+// Copies out the events of a ring which are still there, oldest first
+void copy_events(TraceRing& ring, std::vector<TraceEvent>& events) {
+    const uint64_t count = ring.count.load(std::memory_order_acquire);
+    const uint64_t size = ring.slots.size();
+    uint64_t first = ring.start.load(std::memory_order_relaxed);
+    if (count > size)
+        first = std::max(first, count - size);
+
+    for (uint64_t n = first; n < count; ++n) {
+        const TraceSlot& slot = ring.slots[n & ring.mask];
+
+        // Skip events which are still being written, or have already been overwritten
+        if (slot.seq.load(std::memory_order_acquire) != n + 1)
+            continue;
+
+        TraceEvent e;
+        e.time = slot.time.load(std::memory_order_relaxed);
+        e.duration = slot.duration.load(std::memory_order_relaxed);
+        e.id = slot.id.load(std::memory_order_relaxed);
+        e.name = slot.name.load(std::memory_order_relaxed);
+        e.cat = slot.cat.load(std::memory_order_relaxed);
+        e.arg_name = slot.arg_name.load(std::memory_order_relaxed);
+        e.arg = slot.arg.load(std::memory_order_relaxed);
+        e.frame_id = slot.frame_id.load(std::memory_order_relaxed);
+        e.phase = slot.phase.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != n + 1)
+            continue;
+
+        events.push_back(e);
+    }
+}
+
+uint64_t clock_ns(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+} // namespace
+
+uint64_t kotekan_trace_time(void) {
+    return clock_ns(CLOCK_MONOTONIC_RAW);
+}
+
+void kotekan_trace_record(const enum TracePhase phase, const char* name, const char* cat,
+                          const char* arg_name, const char* arg, const uint64_t id,
+                          const int32_t frame_id, const uint64_t time, const uint64_t duration) {
+    if (!kotekan_trace_enabled())
+        return;
+
+    TraceRing* ring = thread_trace.ring.get();
+    if (ring == nullptr)
+        ring = create_ring();
+
+    // Only this thread writes to the ring, so the count doesn't need to be incremented atomically
+    const uint64_t n = ring->count.load(std::memory_order_relaxed);
+    TraceSlot& slot = ring->slots[n & ring->mask];
+
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.time.store(time, std::memory_order_relaxed);
+    slot.duration.store(duration, std::memory_order_relaxed);
+    slot.id.store(id, std::memory_order_relaxed);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.cat.store(cat, std::memory_order_relaxed);
+    slot.arg_name.store(arg_name, std::memory_order_relaxed);
+    slot.arg.store(arg, std::memory_order_relaxed);
+    slot.frame_id.store(frame_id, std::memory_order_relaxed);
+    slot.phase.store((char)phase, std::memory_order_relaxed);
+
+    slot.seq.store(n + 1, std::memory_order_release);
+    ring->count.store(n + 1, std::memory_order_release);
+}
+
+const char* kotekan_trace_intern(const char* str) {
+    if (str == nullptr)
+        return nullptr;
+
+    TraceRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.strings_lock);
+    // The strings are never removed, and the nodes of an unordered_set don't move
+    return reg.strings.emplace(str).first->c_str();
+}
+
+void kotekan_trace_set_thread_name(const char* name) {
+    thread_trace.name = name;
+    if (thread_trace.ring) {
+        std::lock_guard<std::mutex> lock(registry().lock);
+        thread_trace.ring->thread_name = name;
+    }
+}
+
+namespace kotekan {
+
+KotekanTrace& KotekanTrace::instance() {
+    static KotekanTrace _instance;
+    return _instance;
+}
+
+KotekanTrace& KotekanTrace::instance(const kotekan::Config& config) {
+    KotekanTrace& trace = instance();
+
+    trace.set_buffer_size(config.get_default<size_t>("/trace", "buffer_size", 16384));
+    trace.set_enabled(config.get_default<bool>("/trace", "enabled", false));
+
+    return trace;
+}
+
+void KotekanTrace::register_with_server(restServer* rest_server) {
+    using namespace std::placeholders;
+    rest_server->register_get_callback("/trace",
+                                       std::bind(&KotekanTrace::trace_callback, this, _1));
+    rest_server->register_post_callback("/trace",
+                                        std::bind(&KotekanTrace::enable_callback, this, _1, _2));
+}
+
+void KotekanTrace::set_enabled(bool enabled) {
+    TraceRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.lock);
+
+    if (enabled && !kotekan_trace_enabled()) {
+        for (auto& ring : reg.rings)
+            ring->start.store(ring->count.load(std::memory_order_acquire),
+                              std::memory_order_relaxed);
+        INFO_NON_OO("Trace recording started");
+    } else if (!enabled && kotekan_trace_enabled()) {
+        INFO_NON_OO("Trace recording stopped");
+    }
+
+    __atomic_store_n(&_kotekan_trace_enabled, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+void KotekanTrace::set_buffer_size(size_t size) {
+    TraceRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.lock);
+    reg.buffer_size = size;
+}
+
+nlohmann::json KotekanTrace::get_json() {
+    TraceRegistry& reg = registry();
+
+    const int pid = getpid();
+    nlohmann::json trace_events = nlohmann::json::array();
+    trace_events.push_back(
+        {{"ph", "M"}, {"name", "process_name"}, {"pid", pid}, {"args", {{"name", "kotekan"}}}});
+
+    std::vector<TraceEvent> events;
+    std::lock_guard<std::mutex> lock(reg.lock);
+    for (auto& ring : reg.rings) {
+        events.clear();
+        copy_events(*ring, events);
+        if (events.empty())
+            continue;
+
+        trace_events.push_back({{"ph", "M"},
+                                {"name", "thread_name"},
+                                {"pid", pid},
+                                {"tid", ring->tid},
+                                {"args", {{"name", ring->thread_name}}}});
+
+        for (const auto& e : events) {
+            nlohmann::json event = {{"ph", std::string(1, e.phase)},
+                                    {"name", e.name ? e.name : ""},
+                                    {"cat", e.cat ? e.cat : ""},
+                                    {"ts", e.time * 1e-3},
+                                    {"pid", pid},
+                                    {"tid", ring->tid}};
+            if (e.phase == TRACE_PHASE_COMPLETE)
+                event["dur"] = e.duration * 1e-3;
+            // A string, since the ids don't fit in a javascript number
+            if (e.phase == TRACE_PHASE_ASYNC_BEGIN || e.phase == TRACE_PHASE_ASYNC_END)
+                event["id"] = fmt::format("{:#x}", e.id);
+            if (e.phase == TRACE_PHASE_INSTANT)
+                event["s"] = "t";
+
+            nlohmann::json args = nlohmann::json::object();
+            if (e.arg_name != nullptr)
+                args[e.arg_name] = e.arg ? e.arg : "";
+            if (e.frame_id >= 0)
+                args["frame_id"] = e.frame_id;
+            event["args"] = args;
+
+            trace_events.push_back(event);
+        }
+    }
+
+    nlohmann::json trace;
+    trace["traceEvents"] = trace_events;
+    trace["displayTimeUnit"] = "ms";
+    // The offset of the trace clock from the wall clock, to line the trace up with the logs
+    int64_t offset = (int64_t)clock_ns(CLOCK_REALTIME) - (int64_t)kotekan_trace_time();
+    trace["otherData"] = {{"clock", "CLOCK_MONOTONIC_RAW"}, {"realtime_offset_us", offset / 1000}};
+    return trace;
+}
+
+void KotekanTrace::trace_callback(connectionInstance& conn) {
+    conn.send_json_reply(get_json());
+}
+
+void KotekanTrace::enable_callback(connectionInstance& conn, nlohmann::json& json_request) {
+    if (!json_request.contains("enabled") || !json_request["enabled"].is_boolean()) {
+        conn.send_error("Expected {\"enabled\": true|false}", HTTP_RESPONSE::BAD_REQUEST);
+        return;
+    }
+    set_enabled(json_request["enabled"].get<bool>());
+    conn.send_empty_reply(HTTP_RESPONSE::OK);
+}
+
+} // namespace kotekan
@@ -0,0 +1,102 @@
+/**
+ * @file
+ * @brief A low overhead recorder of a timeline of what each thread is doing, which can be
+ *        dumped in the Chrome trace format and viewed with Perfetto (ui.perfetto.dev).
+ *  - kotekan_trace_enabled
+ *  - kotekan_trace_begin
+ *  - kotekan_trace_end
+ *  - kotekan_trace_record
+ *  - kotekan_trace_intern
+ *  - kotekan_trace_set_thread_name
+ *
+ * Each thread writes its events into its own ring, so recording an event takes no locks and
+ * is only a few stores plus a clock read.  When tracing is turned off every call returns after
+ * checking a flag.  The rings are read out and turned into JSON by @c KotekanTrace in
+ * kotekanTrace.hpp, which also has the C++ helpers.
+ *
+ * All the strings given to the recorder are kept by pointer, so they must never be freed.
+ * Use @c kotekan_trace_intern to get a permanent copy of a string which isn't a literal.
+ */
+#ifndef KOTEKAN_TRACE_H
+#define KOTEKAN_TRACE_H
+
+#include <stdint.h> // for uint64_t, int32_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Set to 1 while tracing is turned on, use @c kotekan_trace_enabled to read it.
+extern int _kotekan_trace_enabled;
+
+/// The Chrome trace event phases recorded.
+enum TracePhase {
+    /// A span on one thread, with a start time and duration
+    TRACE_PHASE_COMPLETE = 'X',
+    /// The start of a span which can end on another thread, matched up by its id
+    TRACE_PHASE_ASYNC_BEGIN = 'b',
+    /// The end of an async span
+    TRACE_PHASE_ASYNC_END = 'e',
+    /// A single point in time on one thread
+    TRACE_PHASE_INSTANT = 'i'
+};
+
+/// Returns 1 if tracing is turned on.
+static inline int kotekan_trace_enabled(void) {
+    return __atomic_load_n(&_kotekan_trace_enabled, __ATOMIC_RELAXED);
+}
+
+/// The time in ns used for the trace (CLOCK_MONOTONIC_RAW, the same as the buffer event logs).
+uint64_t kotekan_trace_time(void);
+
+/**
+ * @brief Records an event in the calling thread's ring.
+ *
+ * @param phase     One of @c TracePhase.
+ * @param name      The name of the event.
+ * @param cat       The category of the event.
+ * @param arg_name  The name of an extra string argument, or NULL for none.
+ * @param arg       The value of the extra argument.
+ * @param id        The id matching up async begin and end events, unused otherwise.
+ * @param frame_id  A frame id to add as an argument, or -1 for none.
+ * @param time      The time the event (or span) started in ns, see @c kotekan_trace_time.
+ * @param duration  The length of a complete span in ns, unused otherwise.
+ */
+void kotekan_trace_record(const enum TracePhase phase, const char* name, const char* cat,
+                          const char* arg_name, const char* arg, const uint64_t id,
+                          const int32_t frame_id, const uint64_t time, const uint64_t duration);
+
+/// Returns the start time for @c kotekan_trace_end, or 0 if tracing is turned off.
+static inline uint64_t kotekan_trace_begin(void) {
+    return kotekan_trace_enabled() ? kotekan_trace_time() : 0;
+}
+
+/**
+ * @brief Records a complete span from @c start up to now.
+ *
+ * Does nothing if @c start is 0, i.e. tracing was off when @c kotekan_trace_begin was called.
+ */
+static inline void kotekan_trace_end(const char* name, const char* cat, const char* arg_name,
+                                     const char* arg, const int32_t frame_id,
+                                     const uint64_t start) {
+    if (start != 0)
+        kotekan_trace_record(TRACE_PHASE_COMPLETE, name, cat, arg_name, arg, 0, frame_id, start,
+                             kotekan_trace_time() - start);
+}
+
+/**
+ * @brief Returns a copy of @c str which is never freed.
+ *
+ * Interning the same string again returns the same pointer.  This takes a lock, so intern
+ * names once when they are created rather than for every event.
+ */
+const char* kotekan_trace_intern(const char* str);
+
+/// Sets the name the calling thread is shown with in the trace.
+void kotekan_trace_set_thread_name(const char* name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KOTEKAN_TRACE_H
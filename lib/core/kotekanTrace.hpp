@@ -0,0 +1,142 @@
+#ifndef KOTEKAN_TRACE_HPP
+#define KOTEKAN_TRACE_HPP
+
+#include "Config.hpp"     // for Config
+#include "kotekanTrace.h" // for kotekan_trace_begin, kotekan_trace_end
+#include "restServer.hpp" // for connectionInstance, restServer
+
+#include "json.hpp" // for json
+
+#include <stddef.h> // for size_t
+#include <stdint.h> // for int32_t, uint64_t
+
+namespace kotekan {
+
+/**
+ * @class KotekanTrace
+ * @brief Turns the trace recorder on and off, and dumps the trace for Perfetto.
+ *
+ * The trace is a timeline of what every thread is doing: which frames each stage holds,
+ * when they are blocked waiting for frames, and what the GPU and network stages are doing.
+ * It is recorded into a ring of events for each thread (see kotekanTrace.h), so it covers
+ * the last few seconds before it is dumped.
+ *
+ * This class must be registered with a kotekan REST server instance by
+ * using the @c register_with_server() function.  The @c /trace endpoint then returns the
+ * trace in the Chrome trace JSON format, which can be opened in ui.perfetto.dev or
+ * chrome://tracing, and posting @c {"enabled": true} or @c false to it turns tracing on and
+ * off.  Turning it on clears the events recorded before.
+ *
+ * This class is a singleton, and can be accessed with @c instance()
+ *
+ * @conf enabled      Bool. Record from when the config is loaded. Default: false
+ * @conf buffer_size  Int. The number of events kept for each thread, rounded up to a power of
+ *                    two. Each event takes 72 bytes. Default: 16384
+ */
+class KotekanTrace {
+public:
+    /**
+     * @brief Set and apply the static config to KotekanTrace
+     * @param config         The config.
+     *
+     * @returns A reference to the global KotekanTrace instance.
+     */
+    static KotekanTrace& instance(const kotekan::Config& config);
+
+    /**
+     * @brief Get the global KotekanTrace.
+     *
+     * @returns A reference to the global KotekanTrace instance.
+     **/
+    static KotekanTrace& instance();
+
+    /**
+     * @brief Registers this class with the REST server, creating the
+     *        /trace end point
+     * @param rest_server The server to register with.
+     */
+    void register_with_server(restServer* rest_server);
+
+    /**
+     * @brief Turn the recording on or off.
+     *
+     * Turning it on drops all the events recorded so far.
+     *
+     * @param enabled  Whether to record events.
+     */
+    void set_enabled(bool enabled);
+
+    /**
+     * @brief Set the number of events kept for each thread.
+     *
+     * This only applies to threads which haven't recorded any events yet.
+     *
+     * @param size  The number of events, rounded up to a power of two.
+     */
+    void set_buffer_size(size_t size);
+
+    /**
+     * @brief Get the recorded events in the Chrome trace format.
+     *
+     * @returns The JSON object with the @c traceEvents, including the thread names.
+     */
+    nlohmann::json get_json();
+
+    /**
+     * @brief The call back function for the REST server to use.
+     * This returns the recorded trace.
+     *
+     * This function is never called directly.
+     *
+     * @param conn The connection instance to send results to.
+     */
+    void trace_callback(connectionInstance& conn);
+
+    /**
+     * @brief The call back function for the REST server to use.
+     * This turns the recording on or off with @c {"enabled": bool}.
+     *
+     * This function is never called directly.
+     *
+     * @param conn The connection instance to send results to.
+     * @param json_request The request, with the @c enabled flag.
+     */
+    void enable_callback(connectionInstance& conn, nlohmann::json& json_request);
+
+private:
+    KotekanTrace() = default;
+    ~KotekanTrace() = default;
+};
+
+/**
+ * @class TraceSpan
+ * @brief Records a complete span over the lifetime of the object, when tracing is on.
+ *
+ * The strings must never be freed, see @c kotekan_trace_intern.
+ */
+class TraceSpan {
+public:
+    TraceSpan(const char* name, const char* cat, const char* arg_name = nullptr,
+              const char* arg = nullptr, int32_t frame_id = -1) :
+        name(name),
+        cat(cat), arg_name(arg_name), arg(arg), frame_id(frame_id), start(kotekan_trace_begin()) {}
+
+    ~TraceSpan() {
+        kotekan_trace_end(name, cat, arg_name, arg, frame_id, start);
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    const char* cat;
+    const char* arg_name;
+    const char* arg;
+    int32_t frame_id;
+    uint64_t start;
+};
+
+} // namespace kotekan
+
+#endif // KOTEKAN_TRACE_HPP
@@ -1,14 +1,22 @@
 #include "metadata.h"
 
-#include "errors.h" // for CHECK_ERROR_F, CHECK_MEM_F
+#include "errors.h" // for CHECK_ERROR_F, CHECK_MEM_F, ERROR_F
 
-#include <assert.h> // for assert
-#include <stdlib.h> // for malloc, free
-#include <string.h> // for memset
+#include <assert.h>  // for assert
+#include <stdbool.h> // for true
+#include <stdlib.h>  // for malloc, free, exit
+#include <string.h>  // for memset, strdup
+
+// Pops the index of a free container off the stack, returns METADATA_POOL_EMPTY if there is none
+uint32_t private_pop_free_object(struct metadataPool* pool);
+
+// Pushes the index of a free container onto the stack
+void private_push_free_object(struct metadataPool* pool, uint32_t index);
 
 // *** Metadata object section ***
 
-struct metadataContainer* create_metadata(size_t object_size, struct metadataPool* parent_pool) {
+struct metadataContainer* create_metadata(size_t object_size, struct metadataPool* parent_pool,
+                                          uint32_t pool_index) {
 
     struct metadataContainer* metadata_container;
     metadata_container = malloc(sizeof(struct metadataContainer));
@@ -20,6 +28,7 @@ struct metadataContainer* create_metadata(size_t object_size, struct metadataPoo
 
     metadata_container->ref_count = 0;
     metadata_container->parent_pool = parent_pool;
+    metadata_container->pool_index = pool_index;
 
     reset_metadata_object(metadata_container);
 
@@ -39,7 +48,7 @@ void delete_metadata(struct metadataContainer* container) {
 }
 
 void reset_metadata_object(struct metadataContainer* container) {
-    assert(container->ref_count == 0);
+    assert(__atomic_load_n(&container->ref_count, __ATOMIC_RELAXED) == 0);
     memset(container->metadata, 0, container->metadata_size);
 }
 
@@ -52,22 +61,18 @@ void unlock_metadata(struct metadataContainer* container) {
 }
 
 void increment_metadata_ref_count(struct metadataContainer* container) {
-    lock_metadata(container);
-    container->ref_count += 1;
-    unlock_metadata(container);
+    // The caller already holds a reference, so this can't race with the return to the pool.
+    uint32_t old_ref_count = __atomic_fetch_add(&container->ref_count, 1, __ATOMIC_RELAXED);
+    assert(old_ref_count > 0);
+    (void)old_ref_count;
 }
 
 void decrement_metadata_ref_count(struct metadataContainer* container) {
-    uint32_t local_ref_count;
-
-    lock_metadata(container);
-
-    assert(container->ref_count > 0);
+    // Release so every use of the metadata happens before the last decrement, and acquire so
+    // the thread doing the last decrement sees those uses before it resets the container.
+    uint32_t local_ref_count = __atomic_sub_fetch(&container->ref_count, 1, __ATOMIC_ACQ_REL);
 
-    container->ref_count -= 1;
-    local_ref_count = container->ref_count;
-
-    unlock_metadata(container);
+    assert(local_ref_count != UINT32_MAX); // Decremented below zero (!)
 
     if (local_ref_count == 0) {
         return_metadata_to_pool(container->parent_pool, container);
@@ -82,9 +87,9 @@ struct metadataPool* create_metadata_pool(int num_metadata_objects, size_t objec
     pool = malloc(sizeof(struct metadataPool));
     CHECK_MEM_F(pool);
 
+    assert(num_metadata_objects > 0);
     pool->pool_size = num_metadata_objects;
     pool->metadata_object_size = object_size;
-    CHECK_ERROR_F(pthread_mutex_init(&pool->pool_lock, NULL));
 
     pool->unique_name = strdup(unique_name);
     CHECK_MEM_F(pool->unique_name);
@@ -96,11 +101,16 @@ struct metadataPool* create_metadata_pool(int num_metadata_objects, size_t objec
     CHECK_MEM_F(pool->in_use);
     pool->metadata_objects = malloc(pool->pool_size * sizeof(struct metadataContainer*));
     CHECK_MEM_F(pool->metadata_objects);
+    pool->free_next = malloc(pool->pool_size * sizeof(uint32_t));
+    CHECK_MEM_F(pool->free_next);
 
+    // Stack all the containers, with the first one on top
     for (unsigned int i = 0; i < pool->pool_size; ++i) {
-        pool->metadata_objects[i] = create_metadata(object_size, pool);
+        pool->metadata_objects[i] = create_metadata(object_size, pool, i);
         pool->in_use[i] = 0;
+        pool->free_next[i] = (i + 1 < pool->pool_size) ? i + 1 : METADATA_POOL_EMPTY;
     }
+    pool->free_head = 0;
 
     return pool;
 }
@@ -110,32 +120,45 @@ void delete_metadata_pool(struct metadataPool* pool) {
         delete_metadata(pool->metadata_objects[i]);
     }
 
-    CHECK_ERROR_F(pthread_mutex_destroy(&pool->pool_lock));
     free(pool->unique_name);
     free(pool->type_name);
     free(pool->in_use);
     free(pool->metadata_objects);
+    free(pool->free_next);
 }
 
-struct metadataContainer* request_metadata_object(struct metadataPool* pool) {
-    struct metadataContainer* container = NULL;
+uint32_t private_pop_free_object(struct metadataPool* pool) {
+    uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_ACQUIRE);
+    uint64_t new_head;
+    uint32_t index;
+    do {
+        index = (uint32_t)head;
+        if (index == METADATA_POOL_EMPTY)
+            return METADATA_POOL_EMPTY;
+        // This might already be out of date if another thread popped the container,
+        // but then the tag has changed and the swap fails.
+        uint32_t next = __atomic_load_n(&pool->free_next[index], __ATOMIC_RELAXED);
+        new_head = (((head >> 32) + 1) << 32) | next;
+    } while (!__atomic_compare_exchange_n(&pool->free_head, &head, new_head, true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return index;
+}
 
-    CHECK_ERROR_F(pthread_mutex_lock(&pool->pool_lock));
+void private_push_free_object(struct metadataPool* pool, uint32_t index) {
+    uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_RELAXED);
+    uint64_t new_head;
+    do {
+        __atomic_store_n(&pool->free_next[index], (uint32_t)head, __ATOMIC_RELAXED);
+        new_head = (((head >> 32) + 1) << 32) | index;
+        // Release, so the reset of the container happens before it can be popped again
+    } while (!__atomic_compare_exchange_n(&pool->free_head, &head, new_head, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
 
-    // TODO there are better data structures for this.
-    for (unsigned int i = 0; i < pool->pool_size; ++i) {
-        if (pool->in_use[i] == 0) {
-            // DEBUG_F("pool->metadata_objects[%d] == %p", i, pool->metadata_objects[i]);
-            container = pool->metadata_objects[i];
-            assert(container->ref_count == 0); // Shouldn't give an inuse object (!)
-            container->ref_count = 1;
-            pool->in_use[i] = 1;
-            break;
-        }
-    }
-    CHECK_ERROR_F(pthread_mutex_unlock(&pool->pool_lock));
+struct metadataContainer* request_metadata_object(struct metadataPool* pool) {
+    uint32_t index = private_pop_free_object(pool);
 
-    if (container == NULL) {
+    if (index == METADATA_POOL_EMPTY) {
         ERROR_F("The metadata pool `%s` is out of metadata objects, try increasing "
                 "`num_metadata_objects:` in the config.",
                 pool->unique_name);
@@ -143,24 +166,24 @@ struct metadataContainer* request_metadata_object(struct metadataPool* pool) {
         exit(-1);
     }
 
+    struct metadataContainer* container = pool->metadata_objects[index];
+    // Shouldn't give an inuse object (!)
+    assert(__atomic_load_n(&pool->in_use[index], __ATOMIC_RELAXED) == 0);
+    assert(__atomic_load_n(&container->ref_count, __ATOMIC_RELAXED) == 0);
+    __atomic_store_n(&pool->in_use[index], 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&container->ref_count, 1, __ATOMIC_RELAXED);
+
     return container;
 }
 
 void return_metadata_to_pool(struct metadataPool* pool, struct metadataContainer* info) {
-
-    CHECK_ERROR_F(pthread_mutex_lock(&pool->pool_lock));
-
-    // DEBUG_F("Called return_metadata_to_pool");
-    for (unsigned int i = 0; i < pool->pool_size; ++i) {
-        // Pointer check
-        if (pool->metadata_objects[i] == info) {
-            assert(pool->in_use[i] == 1); // Should be in-use if we are returning it!
-
-            reset_metadata_object(pool->metadata_objects[i]);
-            pool->in_use[i] = 0;
-            CHECK_ERROR_F(pthread_mutex_unlock(&pool->pool_lock));
-            return;
-        }
-    }
-    assert(0 == 1); // We should have found the info object in the pool (!)
+    // We should have found the info object in the pool (!)
+    assert(info->parent_pool == pool && info->pool_index < pool->pool_size);
+    assert(pool->metadata_objects[info->pool_index] == info);
+    // Should be in-use if we are returning it!
+    assert(__atomic_load_n(&pool->in_use[info->pool_index], __ATOMIC_RELAXED) == 1);
+
+    reset_metadata_object(info);
+    __atomic_store_n(&pool->in_use[info->pool_index], 0, __ATOMIC_RELAXED);
+    private_push_free_object(pool, info->pool_index);
 }
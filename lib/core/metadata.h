@@ -22,11 +22,14 @@
 #define METADATA_H
 
 #include <pthread.h> // for pthread_mutex_t
-#include <stdint.h>  // for uint32_t
+#include <stdint.h>  // for uint32_t, uint64_t, UINT32_MAX
 #include <stdio.h>   // for size_t
 
 struct metadataPool;
 
+/// The index marking the end of the stack of free containers in a @c metadataPool
+#define METADATA_POOL_EMPTY UINT32_MAX
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -56,18 +59,21 @@ struct metadataContainer {
      * @brief Pointer reference count.
      * Tracks references to this object,
      * and returns the object to the associated @c metadataPool, once
-     * the counter reaches zero.
+     * the counter reaches zero.  Only changed with atomic operations.
      */
     uint32_t ref_count;
 
     /**
-     * @brief Lock for variables in this object.
-     * Can also be used to lock access to metadata values.
+     * @brief Lock for the metadata values.
+     * The reference count doesn't use this lock.
      */
     pthread_mutex_t metadata_lock;
 
     /// Reference to metadataPool that this object belongs too.
     struct metadataPool* parent_pool;
+
+    /// The index of this object in the @c metadata_objects array of its pool.
+    uint32_t pool_index;
 };
 
 /**
@@ -81,9 +87,11 @@ struct metadataContainer {
  *
  * @param[in] object_size The size of the metadata struct to be stored in this container
  * @param[in] parent_pool The pool this container will belong too.
+ * @param[in] pool_index The index of the container in the pool.
  * @return A @c metadataContainer object with the @c metadata memory allocated
  */
-struct metadataContainer* create_metadata(size_t object_size, struct metadataPool* parent_pool);
+struct metadataContainer* create_metadata(size_t object_size, struct metadataPool* parent_pool,
+                                          uint32_t pool_index);
 
 /**
  * @brief Frees the memory associated with a metadataContainer
@@ -115,7 +123,7 @@ void decrement_metadata_ref_count(struct metadataContainer* container);
 /**
  * @brief Request the lock on the metadata container
  *
- * Used for example when changing the reference counter
+ * Used for example when changing the metadata values in place
  *
  * @param[in] container The container to request the lock for
  */
@@ -142,6 +150,13 @@ void unlock_metadata(struct metadataContainer* container);
  * When the a metadata container's reference counter reaches zero, it returns
  * itself back to its associated pool
  *
+ * The free containers are kept in a lock free stack (a Treiber stack) of indexes into
+ * @c metadata_objects, so requesting and returning a container takes a compare and swap
+ * rather than a lock and a scan of the pool.  The top of the stack is tagged with a
+ * counter which changes on every update, so a thread which was delayed between reading
+ * the top and swapping it can't be fooled by the same index having been popped and
+ * pushed back in the meantime.  The most recently returned container is handed out first.
+ *
  * @author Andre Renard
  */
 struct metadataPool {
@@ -160,8 +175,15 @@ struct metadataPool {
     /// The size of the object stored by the metadata containers
     size_t metadata_object_size;
 
-    /// Locks requests for metadata to avoid race conditions.
-    pthread_mutex_t pool_lock;
+    /**
+     * @brief The top of the stack of free containers.
+     * The low 32 bits are the index of the top container, or @c METADATA_POOL_EMPTY,
+     * and the high 32 bits are the tag counting the updates.
+     */
+    uint64_t free_head;
+
+    /// The index of the next free container below each free container in the stack.
+    uint32_t* free_next;
 
     /// Name of the metadata pool
     char* unique_name;
@@ -5,11 +5,12 @@
 
 #include "fmt.hpp" // for print, format, fmt
 
-#include <cmath>      // for isinf, isnan
+#include <algorithm>  // for lower_bound
+#include <cmath>      // for isnan, isinf, pow
 #include <functional> // for _Bind_helper<>::type, _Placeholder, bind, _1, placeholders
 #include <iterator>   // for begin, end
 #include <ostream>    // for operator<<, basic_ostream
-#include <sys/time.h> // for gettimeofday, timeval
+#include <time.h>     // for clock_gettime, timespec, CLOCK_REALTIME_COARSE
 #include <utility>    // for pair
 
 using std::string;
@@ -19,29 +20,46 @@ namespace prometheus {
 
 Metric::Metric(const std::vector<string>& label_values) : label_values(label_values) {}
 
+void Metric::serialize(std::ostringstream& out, const string& name, const string& labels) {
+    out << name << "{" << labels << "} ";
+    to_string(out);
+    out << "\n";
+}
+
 
 Counter::Counter(const std::vector<string>& label_values) : Metric(label_values) {}
 
-void Counter::inc() {
-    std::lock_guard<std::mutex> lock(metric_lock);
+/* static */
+size_t Counter::shard_index() {
+    // Threads are handed out shards in turn as they first use a counter
+    static std::atomic<size_t> next_shard(0);
+    static thread_local const size_t shard =
+        next_shard.fetch_add(1, std::memory_order_relaxed) % num_shards;
+    return shard;
+}
 
-    ++value;
+void Counter::inc() {
+    shards[shard_index()].value.fetch_add(1, std::memory_order_relaxed);
 }
 
 void Counter::inc(const uint64_t increment) {
-    std::lock_guard<std::mutex> lock(metric_lock);
+    shards[shard_index()].value.fetch_add(increment, std::memory_order_relaxed);
+}
 
-    value += increment;
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (auto& s : shards) {
+        total += s.value.load(std::memory_order_relaxed);
+    }
+    return total;
 }
 
 string Counter::to_string() {
-    return std::to_string(value);
+    return std::to_string(value());
 }
 
 std::ostringstream& Counter::to_string(std::ostringstream& out) {
-    std::lock_guard<std::mutex> lock(metric_lock);
-
-    out << value;
+    out << value();
     return out;
 }
 
@@ -49,10 +67,12 @@ std::ostringstream& Counter::to_string(std::ostringstream& out) {
 Gauge::Gauge(const std::vector<string>& label_values) : Metric(label_values) {}
 
 void Gauge::set(const double value) {
-    std::lock_guard<std::mutex> lock(metric_lock);
+    _value.store(value, std::memory_order_relaxed);
+    last_update_time_stamp.store(get_time_in_milliseconds(), std::memory_order_relaxed);
+}
 
-    this->value = value;
-    this->last_update_time_stamp = get_time_in_milliseconds();
+double Gauge::value() const {
+    return _value.load(std::memory_order_relaxed);
 }
 
 string Gauge::to_string() {
@@ -62,7 +82,10 @@ string Gauge::to_string() {
 }
 
 std::ostringstream& Gauge::to_string(std::ostringstream& out) {
-    std::lock_guard<std::mutex> lock(metric_lock);
+    // The value and time stamp are read separately, so a concurrent update may
+    // pair one with the other. That's fine for a scrape.
+    double value = _value.load(std::memory_order_relaxed);
+    uint64_t last_update_time_stamp = this->last_update_time_stamp.load(std::memory_order_relaxed);
 
     if (std::isnan(value)) {
         fmt::print(out, fmt("NaN {:d}"), last_update_time_stamp);
@@ -77,19 +100,155 @@ std::ostringstream& Gauge::to_string(std::ostringstream& out) {
 
 /* static */
 uint64_t Gauge::get_time_in_milliseconds() {
-    struct timeval tv;
-    gettimeofday(&tv, nullptr);
+    // The coarse clock is a few ms behind at most, which is plenty for a time
+    // stamp in ms, and much cheaper to read on every update
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+
+    return (uint64_t)(ts.tv_sec) * 1000 + (uint64_t)(ts.tv_nsec) / 1000000;
+}
+
+
+Histogram::Histogram(const std::vector<string>& label_values, const std::vector<double>& buckets) :
+    Metric(label_values),
+    upper_bounds(buckets),
+    counts(new std::atomic<uint64_t>[buckets.size() + 1]) {
+
+    for (size_t i = 0; i < buckets.size(); i++) {
+        if (std::isnan(buckets[i]) || (i > 0 && buckets[i] <= buckets[i - 1])) {
+            throw std::invalid_argument("Histogram bucket bounds must be increasing.");
+        }
+    }
+    for (size_t i = 0; i <= buckets.size(); i++) {
+        counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::observe(const double value) {
+    // The first bucket whose upper bound is not below the value, NaN goes in +Inf
+    size_t i = std::isnan(value)
+                   ? upper_bounds.size()
+                   : std::lower_bound(upper_bounds.begin(), upper_bounds.end(), value)
+                         - upper_bounds.begin();
+    counts[i].fetch_add(1, std::memory_order_relaxed);
+
+    double sum = _sum.load(std::memory_order_relaxed);
+    while (!_sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t Histogram::count() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i <= upper_bounds.size(); i++) {
+        total += counts[i].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+double Histogram::sum() const {
+    return _sum.load(std::memory_order_relaxed);
+}
+
+std::vector<uint64_t> Histogram::bucket_counts() const {
+    std::vector<uint64_t> cumulative(upper_bounds.size() + 1);
+    uint64_t total = 0;
+    for (size_t i = 0; i <= upper_bounds.size(); i++) {
+        total += counts[i].load(std::memory_order_relaxed);
+        cumulative[i] = total;
+    }
+    return cumulative;
+}
+
+string Histogram::to_string() {
+    return std::to_string(count());
+}
+
+std::ostringstream& Histogram::to_string(std::ostringstream& out) {
+    out << count();
+    return out;
+}
+
+void Histogram::serialize(std::ostringstream& out, const string& name, const string& labels) {
+    // Take the counts once, so that the buckets and the count agree
+    auto cumulative = bucket_counts();
+    const string sep = labels.empty() ? "" : ",";
+
+    // Written with the stream defaults, so the bounds come out as e.g. 0.005 and 50
+    for (size_t i = 0; i < upper_bounds.size(); i++) {
+        out << name << "_bucket{" << labels << sep << "le=\"" << upper_bounds[i] << "\"} "
+            << cumulative[i] << "\n";
+    }
+    out << name << "_bucket{" << labels << sep << "le=\"+Inf\"} " << cumulative.back() << "\n";
+
+    double s = sum();
+    out << name << "_sum{" << labels << "} ";
+    if (std::isnan(s)) {
+        out << "NaN";
+    } else if (std::isinf(s)) {
+        out << (s < 0 ? "-Inf" : "+Inf");
+    } else {
+        out << s;
+    }
+    out << "\n" << name << "_count{" << labels << "} " << cumulative.back() << "\n";
+}
+
+/* static */
+std::vector<double> Histogram::linear_buckets(double start, double width, size_t count) {
+    std::vector<double> buckets;
+    for (size_t i = 0; i < count; i++) {
+        buckets.push_back(start + i * width);
+    }
+    return buckets;
+}
+
+/* static */
+std::vector<double> Histogram::exponential_buckets(double start, double factor, size_t count) {
+    std::vector<double> buckets;
+    double bound = start;
+    for (size_t i = 0; i < count; i++) {
+        buckets.push_back(bound);
+        bound *= factor;
+    }
+    return buckets;
+}
+
+/* static */
+std::vector<double> Histogram::log_linear_buckets(double start, size_t num_decades,
+                                                  size_t steps_per_decade) {
+    std::vector<double> buckets;
+    double decade = start;
+    for (size_t d = 0; d < num_decades; d++) {
+        for (size_t i = 0; i < steps_per_decade; i++) {
+            buckets.push_back(decade * (1.0 + 9.0 * i / steps_per_decade));
+        }
+        decade *= 10;
+    }
+    buckets.push_back(decade);
+    return buckets;
+}
 
-    return (uint64_t)(tv.tv_sec) * 1000 + (uint64_t)(tv.tv_usec) / 1000;
+/* static */
+std::vector<double> Histogram::time_buckets() {
+    // Steps of 1, 2, 5 in each decade. Divide for the negative powers so the
+    // bounds come out as the nearest doubles to 0.0001, 0.0002, ...
+    std::vector<double> buckets;
+    for (int e = -4; e < 2; e++) {
+        for (double step : {1.0, 2.0, 5.0}) {
+            buckets.push_back(e < 0 ? step / std::pow(10.0, -e) : step * std::pow(10.0, e));
+        }
+    }
+    buckets.push_back(100);
+    return buckets;
 }
 
 
 template<typename T>
 MetricFamily<T>::MetricFamily(const string& name, const string& stage_name,
                               const std::vector<string>& label_names,
-                              const MetricFamily<T>::MetricType metric_type) :
+                              const MetricFamily<T>::MetricType metric_type,
+                              const std::vector<double>& buckets) :
     name(name),
-    stage_name(stage_name), label_names(label_names), metric_type(metric_type) {}
+    stage_name(stage_name), label_names(label_names), metric_type(metric_type), buckets(buckets) {}
 
 template<typename T>
 string MetricFamily<T>::serialize() {
@@ -107,24 +266,21 @@ string MetricFamily<T>::serialize() {
         case MetricFamily<T>::MetricType::Gauge:
             out << "# TYPE " << name << " gauge\n";
             break;
+        case MetricFamily<T>::MetricType::Histogram:
+            out << "# TYPE " << name << " histogram\n";
+            break;
         default:
             out << "# TYPE " << name << " untyped\n";
     }
     for (auto& m : metrics) {
-        out << name;
-        out << "{"
-            << "stage_name=\"" << stage_name << "\"";
+        string labels = "stage_name=\"" + stage_name + "\"";
         if (!label_names.empty()) {
             auto value = m.label_values.begin();
             for (auto label : label_names) {
-                out << ",";
-                out << label << "=\"" << *value++ << "\"";
+                labels += "," + label + "=\"" + *value++ + "\"";
             }
         }
-        out << "}"
-            << " ";
-        m.to_string(out);
-        out << "\n";
+        m.serialize(out, name, labels);
     }
     return out.str();
 }
@@ -209,6 +365,25 @@ MetricFamily<Counter>& Metrics::add_counter(const std::string& name, const std::
     return *f;
 }
 
+Histogram& Metrics::add_histogram(const std::string& name, const std::string& stage_name,
+                                  const std::vector<double>& buckets) {
+    const std::vector<string> empty_labels;
+    auto f = std::make_shared<MetricFamily<Histogram>>(
+        name, stage_name, empty_labels, MetricFamily<Histogram>::MetricType::Histogram, buckets);
+    add(name, stage_name, f);
+    return f->labels({});
+}
+
+MetricFamily<Histogram>& Metrics::add_histogram(const std::string& name,
+                                                const std::string& stage_name,
+                                                const std::vector<std::string>& label_names,
+                                                const std::vector<double>& buckets) {
+    auto f = std::make_shared<MetricFamily<Histogram>>(
+        name, stage_name, label_names, MetricFamily<Histogram>::MetricType::Histogram, buckets);
+    add(name, stage_name, f);
+    return *f;
+}
+
 
 void Metrics::remove_stage_metrics(const string& stage_name) {
     std::lock_guard<std::mutex> lock(metrics_lock);
@@ -3,16 +3,22 @@
 
 #include "restServer.hpp"
 
-#include <deque>     // for deque
-#include <iosfwd>    // for ostringstream
-#include <map>       // for map
-#include <memory>    // for shared_ptr
-#include <mutex>     // for mutex, lock_guard
-#include <stdexcept> // for runtime_error
-#include <stdint.h>  // for uint64_t
-#include <string>    // for string
-#include <tuple>     // for tuple
-#include <vector>    // for vector
+#include <array>         // for array
+#include <atomic>        // for atomic, memory_order_relaxed
+#include <deque>         // for deque
+#include <functional>    // for hash
+#include <iosfwd>        // for ostringstream
+#include <map>           // for map
+#include <memory>        // for shared_ptr
+#include <mutex>         // for mutex, lock_guard
+#include <stddef.h>      // for size_t
+#include <stdexcept>     // for runtime_error
+#include <stdint.h>      // for uint64_t
+#include <string>        // for string
+#include <tuple>         // for tuple
+#include <type_traits>   // for is_same
+#include <unordered_map> // for unordered_map
+#include <vector>        // for vector
 
 
 namespace kotekan {
@@ -21,6 +27,9 @@ namespace prometheus {
 /**
  * @class Metric
  * @brief An internal base class for storing metric value for a given combination of label values
+ *
+ * Updating a metric never takes a lock, so it is cheap enough to do for every
+ * frame. The values are only gathered up when the metrics are serialized.
  */
 class Metric {
 public:
@@ -31,17 +40,30 @@ public:
     virtual std::string to_string() = 0;
     /// @brief Formats the stored value as a string into the given output stream.
     virtual std::ostringstream& to_string(std::ostringstream& out) = 0;
-    const std::vector<std::string> label_values;
 
-protected:
-    /// Metric updating lock
-    std::mutex metric_lock;
+    /**
+     * @brief Writes the sample lines for this metric in Prometheus text format.
+     *
+     * By default this is a single line with the value from `to_string`.
+     *
+     * @param out    Stream to write to.
+     * @param name   Name of the metric family.
+     * @param labels The formatted labels, without the braces.
+     */
+    virtual void serialize(std::ostringstream& out, const std::string& name,
+                           const std::string& labels);
+
+    const std::vector<std::string> label_values;
 };
 
 /**
  * @class Counter
  * @brief Represents a metric whose value can only go up
  *
+ * The count is split into shards on separate cache lines, and each thread
+ * adds to its own shard, so threads incrementing the same counter don't
+ * fight over it. The shards are summed when the value is read.
+ *
  * @remark See [Prometheus
  * documentation](https://prometheus.io/docs/instrumenting/exposition_formats/) for the precise
  * format specification.
@@ -51,12 +73,24 @@ public:
     Counter(const std::vector<std::string>&);
     void inc();
     void inc(const uint64_t increment);
+    /// @brief Returns the current count, summed over the shards.
+    uint64_t value() const;
     std::string to_string() override;
     std::ostringstream& to_string(std::ostringstream& out) override;
 
+    /// Number of shards the count is split into
+    static constexpr size_t num_shards = 8;
+
 private:
-    /// The actual value to be returned
-    uint64_t value = 0;
+    /// The shard the calling thread adds to
+    static size_t shard_index();
+
+    /// A part of the count, padded out to a cache line
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+
+    std::array<Shard, num_shards> shards;
 };
 
 /**
@@ -71,6 +105,8 @@ class Gauge : public Metric {
 public:
     Gauge(const std::vector<std::string>&);
     void set(const double);
+    /// @brief Returns the last value set.
+    double value() const;
     std::string to_string() override;
     std::ostringstream& to_string(std::ostringstream& out) override;
 
@@ -79,10 +115,81 @@ private:
     static uint64_t get_time_in_milliseconds();
 
     /// The actual value to be returned
-    double value = 0;
+    std::atomic<double> _value{0};
 
     /// Time stamp in milliseconds.
-    uint64_t last_update_time_stamp;
+    std::atomic<uint64_t> last_update_time_stamp{0};
+};
+
+/**
+ * @class Histogram
+ * @brief Counts observations, like per frame processing times, in a fixed set of buckets
+ *
+ * This exports the cumulative count in each bucket, and the count and sum of
+ * all observations, from which Prometheus can estimate quantiles (e.g. with
+ * `histogram_quantile(0.99, rate(<name>_bucket[5m]))`). Unlike a gauge of the
+ * last or average value, this shows up the occasional slow frame.
+ *
+ * Observing a value is a binary search over the bucket bounds and a couple of
+ * atomic updates, and never takes a lock.
+ *
+ * @remark See [Prometheus
+ * documentation](https://prometheus.io/docs/practices/histograms/) for how to choose the buckets.
+ */
+class Histogram : public Metric {
+public:
+    /**
+     * @brief Create a histogram.
+     *
+     * @param label_values The label values of this histogram.
+     * @param buckets      The upper bounds of the buckets, in increasing
+     *                     order. A `+Inf` bucket is always added.
+     * @throw std::invalid_argument if the bounds are not increasing.
+     */
+    Histogram(const std::vector<std::string>& label_values, const std::vector<double>& buckets);
+    void observe(const double value);
+    /// @brief Returns the number of observations.
+    uint64_t count() const;
+    /// @brief Returns the sum of all observations.
+    double sum() const;
+    /// @brief Returns the cumulative count for each bucket, ending with `+Inf`.
+    std::vector<uint64_t> bucket_counts() const;
+    /// @brief Returns the bucket upper bounds, without `+Inf`.
+    const std::vector<double>& buckets() const {
+        return upper_bounds;
+    }
+    /// @brief Returns the number of observations as a string.
+    std::string to_string() override;
+    std::ostringstream& to_string(std::ostringstream& out) override;
+    void serialize(std::ostringstream& out, const std::string& name,
+                   const std::string& labels) override;
+
+    /// @brief `count` buckets `width` apart, starting at `start`.
+    static std::vector<double> linear_buckets(double start, double width, size_t count);
+
+    /// @brief `count` buckets each `factor` times the last, starting at `start`.
+    static std::vector<double> exponential_buckets(double start, double factor, size_t count);
+
+    /**
+     * @brief Log-linear buckets, with a fixed relative resolution over a wide range.
+     *
+     * Each decade starting at `start` is split into `steps_per_decade`
+     * linear steps, e.g. 1, 2, ..., 9, 10, 20, ... for 9 steps, similar to an
+     * HDR histogram.
+     */
+    static std::vector<double> log_linear_buckets(double start, size_t num_decades,
+                                                  size_t steps_per_decade = 9);
+
+    /// @brief Default buckets for per frame processing times, 100 us to 100 s.
+    static std::vector<double> time_buckets();
+
+private:
+    const std::vector<double> upper_bounds;
+
+    /// Non cumulative counts for each bucket, the last one being `+Inf`
+    std::unique_ptr<std::atomic<uint64_t>[]> counts;
+
+    std::atomic<double> _sum{0};
 };
 
 /**
@@ -113,12 +220,14 @@ public:
     enum class MetricType {
         Counter,
         Gauge,
+        Histogram,
         Untyped,
     };
 
     MetricFamily(const std::string& name, const std::string& stage,
                  const std::vector<std::string>& label_names,
-                 const MetricType metric_type = MetricType::Untyped);
+                 const MetricType metric_type = MetricType::Untyped,
+                 const std::vector<double>& buckets = {});
 
     /**
      * @brief Returns the ``Metric`` instance for the given combination of label values
@@ -126,6 +235,11 @@ public:
      * If the combination of values is seen for the first time, a new Metric
      * instance will be created and added to the family.
      *
+     * The returned reference is a handle that stays valid for as long as the
+     * family does. Looking up the labels takes a lock and hashes the values,
+     * so stages updating a metric per frame should resolve the labels once
+     * and keep the handle, e.g. per frequency or per thread.
+     *
      * @param label_values
      * @return reference to the Metric
      * @ @throw std::runtime_error if the number of label values doesn't match the length of the
@@ -138,12 +252,16 @@ public:
 
         std::lock_guard<std::mutex> lock(metrics_lock);
 
-        for (auto& m : metrics) {
-            if (m.label_values == label_values) {
-                return m;
-            }
+        auto it = index.find(label_values);
+        if (it != index.end()) {
+            return *it->second;
         }
-        metrics.emplace_back(label_values);
+        if constexpr (std::is_same<T, Histogram>::value) {
+            metrics.emplace_back(label_values, buckets);
+        } else {
+            metrics.emplace_back(label_values);
+        }
+        index.emplace(label_values, &metrics.back());
         return metrics.back();
     }
 
@@ -160,12 +278,28 @@ public:
     const std::vector<std::string> label_names;
 
 private:
+    /// Hash of a combination of label values
+    struct LabelHash {
+        size_t operator()(const std::vector<std::string>& values) const {
+            size_t h = values.size();
+            for (auto& v : values)
+                h = h * 31 + std::hash<std::string>()(v);
+            return h;
+        }
+    };
+
     /// metric instances for label combinations observed so far
     std::deque<T> metrics;
 
+    /// lookup of the metric instances by their label values
+    std::unordered_map<std::vector<std::string>, T*, LabelHash> index;
+
     /// metric type
     const MetricType metric_type;
 
+    /// bucket upper bounds for histograms
+    const std::vector<double> buckets;
+
     /// Metric list updating lock
     std::mutex metrics_lock;
 };
@@ -277,6 +411,33 @@ public:
     MetricFamily<Counter>& add_counter(const std::string& name, const std::string& stage_name,
                                        const std::vector<std::string>& label_names);
 
+    /**
+     * @brief Adds a new metric of type histogram and no labels
+     *
+     * @param name The name of the metric.
+     * @param stage_name The unique stage name, normally @c unique_name.
+     * @param buckets The upper bounds of the buckets, see @c Histogram.
+     * @return a reference to the newly created @c Histogram instance
+     * @throw std::runtime_error if the metric with that name is already registered.
+     */
+    Histogram& add_histogram(const std::string& name, const std::string& stage_name,
+                             const std::vector<double>& buckets = Histogram::time_buckets());
+
+    /**
+     * @brief Adds a new metric family of type histogram
+     *
+     * @param name The name of the metric.
+     * @param stage_name The unique stage name, normally @c unique_name.
+     * @param label_names The names of the labels used
+     * @param buckets The upper bounds of the buckets, see @c Histogram.
+     * @return a reference to the newly created @c MetricFamily<Histogram> instance
+     * @throw std::runtime_error if the metric with that name is already registered.
+     */
+    MetricFamily<Histogram>& add_histogram(const std::string& name, const std::string& stage_name,
+                                           const std::vector<std::string>& label_names,
+                                           const std::vector<double>& buckets =
+                                               Histogram::time_buckets());
+
     /**
      * @brief Remove all registered stage metrics
      *
@@ -5,6 +5,7 @@
 #include "gpuDeviceInterface.hpp" // for gpuDeviceInterface, Config
 #include "gpuEventContainer.hpp"  // for gpuEventContainer
 #include "kotekanLogging.hpp"     // for INFO, DEBUG2, DEBUG
+#include "kotekanTrace.hpp"       // for TraceSpan, kotekan_trace_intern, kotekan_trace_record
 #include "restServer.hpp"         // for restServer, connectionInstance
 #include "util.h"                 // for e_time
 
@@ -20,11 +21,13 @@
 #include <regex>       // for match_results<>::_Base_type
 #include <sched.h>     // for cpu_set_t, CPU_SET, CPU_ZERO
 #include <stdexcept>   // for runtime_error
+#include <stdint.h>    // for uint64_t, uintptr_t
 #include <sys/types.h> // for uint
 
 using kotekan::bufferContainer;
 using kotekan::Config;
 using kotekan::Stage;
+using kotekan::TraceSpan;
 
 using kotekan::connectionInstance;
 using kotekan::restServer;
@@ -33,6 +36,12 @@ using namespace std;
 
 using nlohmann::json;
 
+// The id of the async span of a GPU frame in the trace.  The stage object is bigger than the
+// buffer depth, so its address plus the frame id is unique to the frame.
+static uint64_t trace_frame_id(const gpuProcess* process, int gpu_frame_id) {
+    return (uint64_t)(uintptr_t)process + (uint64_t)gpu_frame_id;
+}
+
 // TODO Remove the GPU_ID from this constructor
 gpuProcess::gpuProcess(Config& config_, const std::string& unique_name,
                        bufferContainer& buffer_container) :
@@ -44,6 +53,8 @@ gpuProcess::gpuProcess(Config& config_, const std::string& unique_name,
 
     frame_arrival_period = config.get_default<double>(unique_name, "frame_arrival_period", 0.0);
 
+    trace_name = kotekan_trace_intern(unique_name.c_str());
+
     json in_bufs = config.get_value(unique_name, "in_buffers");
     for (json::iterator it = in_bufs.begin(); it != in_bufs.end(); ++it) {
         std::string internal_name = it.key();
@@ -89,6 +100,7 @@ void gpuProcess::init() {
         std::string unique_path = fmt::format(fmt("{:s}/commands/{:d}"), unique_name, i++);
         std::string command_name = cmd["name"];
         commands.push_back(create_command(command_name, unique_path));
+        command_trace_names.push_back(kotekan_trace_intern(command_name.c_str()));
     }
 
     for (auto& buf : local_buffer_container.get_buffer_map()) {
@@ -155,18 +167,32 @@ void gpuProcess::main_thread() {
         // This is things like waiting for the input buffer to have data
         // and for there to be free space in the output buffers.
         // INFO("Waiting on preconditions for GPU[{:d}][{:d}]", gpu_id, gpu_frame_id);
-        for (auto& command : commands) {
-            if (command->wait_on_precondition(gpu_frame_id) != 0) {
+        for (size_t i = 0; i < commands.size(); ++i) {
+            TraceSpan span("wait_on_precondition", "gpu", "command", command_trace_names[i],
+                           gpu_frame_id);
+            if (commands[i]->wait_on_precondition(gpu_frame_id) != 0) {
                 INFO("Received exit signal from GPU command precondition (Command '{:s}')",
-                     command->get_name());
+                     commands[i]->get_name());
                 goto exit_loop;
             }
         }
 
         DEBUG("Waiting for free slot for GPU[{:d}][{:d}]", gpu_id, gpu_frame_id);
         // We make sure we aren't using a gpu frame that's currently in-flight.
-        final_signals[gpu_frame_id]->wait_for_free_slot();
-        queue_commands(gpu_frame_id);
+        {
+            TraceSpan span("wait_for_free_slot", "gpu", nullptr, nullptr, gpu_frame_id);
+            final_signals[gpu_frame_id]->wait_for_free_slot();
+        }
+
+        // The GPU frame is traced from queuing its commands until it is finalized
+        if (kotekan_trace_enabled())
+            kotekan_trace_record(TRACE_PHASE_ASYNC_BEGIN, "gpu_frame", "gpu", "stage", trace_name,
+                                 trace_frame_id(this, gpu_frame_id), gpu_frame_id,
+                                 kotekan_trace_time(), 0);
+        {
+            TraceSpan span("queue_commands", "gpu", nullptr, nullptr, gpu_frame_id);
+            queue_commands(gpu_frame_id);
+        }
         if (first_run) {
             results_thread_handle = std::thread(&gpuProcess::results_thread, std::ref(*this));
 
@@ -195,6 +221,7 @@ exit_loop:
 
 void gpuProcess::results_thread() {
     dev->set_thread_device();
+    kotekan_trace_set_thread_name(fmt::format(fmt("{:s}/results"), unique_name).c_str());
 
     // Start with the first GPU frame;
     int gpu_frame_id = 0;
@@ -203,15 +230,18 @@ void gpuProcess::results_thread() {
         // Wait for a signal to be completed
         DEBUG2("Waiting for signal for gpu[{:d}], frame {:d}, time: {:f}", gpu_id, gpu_frame_id,
                e_time());
-        if (final_signals[gpu_frame_id]->wait_for_signal() == -1) {
-            // If wait_for_signal returns -1, then we don't have a signal to wait on,
-            // but we have been given a shutdown request, so break this loop.
-            break;
+        {
+            TraceSpan span("wait_for_signal", "gpu", nullptr, nullptr, gpu_frame_id);
+            if (final_signals[gpu_frame_id]->wait_for_signal() == -1) {
+                // If wait_for_signal returns -1, then we don't have a signal to wait on,
+                // but we have been given a shutdown request, so break this loop.
+                break;
+            }
         }
         DEBUG2("Got final signal for gpu[{:d}], frame {:d}, time: {:f}", gpu_id, gpu_frame_id,
                e_time());
 
-        for (auto& command : commands) {
+        for (size_t i = 0; i < commands.size(); ++i) {
             // Note the fact that we don't run `finalize_frame()` when the shutdown
             // signal is set, means that we cannot use it to free memory.
             // In theory this shouldn't be a problem, but it might be an issue for
@@ -219,9 +249,16 @@ void gpuProcess::results_thread() {
             // Two ways around this would be to have a different call for memory freeing
             // which is always called, or make sure that all finalize_frame calls can
             // run even when there is a shutdown in progress.
-            if (!stop_thread)
-                command->finalize_frame(gpu_frame_id);
+            if (!stop_thread) {
+                TraceSpan span("finalize_frame", "gpu", "command", command_trace_names[i],
+                               gpu_frame_id);
+                commands[i]->finalize_frame(gpu_frame_id);
+            }
         }
+        if (kotekan_trace_enabled())
+            kotekan_trace_record(TRACE_PHASE_ASYNC_END, "gpu_frame", "gpu", "stage", trace_name,
+                                 trace_frame_id(this, gpu_frame_id), gpu_frame_id,
+                                 kotekan_trace_time(), 0);
         DEBUG2("Finished finalizing frames for gpu[{:d}][{:d}]", gpu_id, gpu_frame_id);
 
         if (log_profiling) {
@@ -59,6 +59,10 @@ protected:
     // Config variables
     uint32_t _gpu_buffer_depth;
     uint32_t gpu_id;
+
+    // The names used in the trace, see kotekanTrace.h
+    const char* trace_name;
+    std::vector<const char*> command_trace_names;
 };
 
 #endif // GPU_PROCESS_H
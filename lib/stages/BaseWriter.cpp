@@ -1,15 +1,16 @@
 #include "BaseWriter.hpp"
 
+#include "AsyncFileWriter.hpp"   // for AsyncFileWriter
 #include "Config.hpp"            // for Config
 #include "FrameView.hpp"         // for FrameView
 #include "Hash.hpp"              // for operator<
-#include "buffer.h"              // for mark_frame_empty, register_consumer, wait_for_full_frame
+#include "buffer.h"              // for mark_frames_empty, register_consumer, wait_for_full_frames
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "datasetManager.hpp"    // for dset_id_t, fingerprint_t, datasetManager
 #include "datasetState.hpp"      // for metadataState, _factory_aliasdatasetState
 #include "factory.hpp"           // for FACTORY
 #include "kotekanLogging.hpp"    // for INFO, WARN, FATAL_ERROR, DEBUG, logLevel
-#include "prometheusMetrics.hpp" // for Counter, Metrics, MetricFamily, Gauge
+#include "prometheusMetrics.hpp" // for Counter, Metrics, MetricFamily, Gauge, Histogram
 #include "restServer.hpp"        // for HTTP_RESPONSE, connectionInstance, restServer
 #include "version.h"             // for get_git_commit_hash
 #include "visFile.hpp"           // for visFileBundle, _factory_aliasvisFile
@@ -46,7 +47,13 @@ BaseWriter::BaseWriter(Config& config, const std::string& unique_name,
     bad_dataset_frame_counter(Metrics::instance().add_counter(
         "kotekan_writer_bad_dataset_frame_total", unique_name, {"dataset_id"})),
     write_time_metric(
-        Metrics::instance().add_gauge("kotekan_writer_write_time_seconds", unique_name)) {
+        Metrics::instance().add_gauge("kotekan_writer_write_time_seconds", unique_name)),
+    write_duration_metric(Metrics::instance().add_histogram(
+        "kotekan_writer_write_duration_seconds", unique_name)),
+    inflight_bytes_metric(
+        Metrics::instance().add_gauge("kotekan_writer_inflight_bytes", unique_name)),
+    completion_time_metric(
+        Metrics::instance().add_gauge("kotekan_writer_completion_time_seconds", unique_name)) {
 
     // Fetch any simple configuration
     root_path = config.get_default<std::string>(unique_name, "root_path", ".");
@@ -57,6 +64,14 @@ BaseWriter::BaseWriter(Config& config, const std::string& unique_name,
     in_buf = get_buffer("in_buf");
     register_consumer(in_buf, unique_name.c_str());
 
+    // By default leave at least half of the ring to the producer while we write a batch
+    max_batch_frames = config.get_default<int>(unique_name, "max_batch_frames",
+                                               std::max(in_buf->num_frames / 2, 1));
+    if (max_batch_frames < 1) {
+        throw std::runtime_error(
+            fmt::format("max_batch_frames must be positive (got {:d})", max_batch_frames));
+    }
+
     // Get the type of the file we are writing
     // TODO: we may want to validate here rather than at creation time
     file_type = config.get_default<std::string>(unique_name, "file_type", "hdf5fast");
@@ -64,6 +79,18 @@ BaseWriter::BaseWriter(Config& config, const std::string& unique_name,
         throw std::runtime_error(fmt::format("Unknown file type '{}'", file_type));
     }
 
+    // Set up writing in the background if requested
+    auto write_backend = config.get_default<std::string>(unique_name, "write_backend", "sync");
+    if (write_backend != "sync") {
+        auto write_threads = config.get_default<size_t>(unique_name, "write_threads", 2);
+        auto max_inflight_mb =
+            config.get_default<size_t>(unique_name, "write_max_inflight_mb", 512);
+        async_writer = AsyncFileWriter::create(write_backend, write_threads,
+                                               max_inflight_mb * 1024 * 1024,
+                                               kotekan::logLevel(_member_log_level));
+        INFO("Writing files in the background with the {:s} backend.", async_writer->backend());
+    }
+
     file_length = config.get_default<size_t>(unique_name, "file_length", 1024);
     window = config.get_default<size_t>(unique_name, "window", 20);
 
@@ -100,15 +127,19 @@ void BaseWriter::main_thread() {
 
     while (!stop_thread) {
 
-        // Wait for the buffer to be filled with data
-        auto status = wait_for_full_frame_timeout(in_buf, unique_name.c_str(), frame_id, timeout);
-        if (status == 0) {
-            // Write frame
-            write_data(in_buf, frame_id);
-
-            // Mark the buffer and move on
-            mark_frame_empty(in_buf, unique_name.c_str(), frame_id++);
-        } else if (status == -1) {
+        // Wait for the buffer to be filled with data, and pick up any backlog of full frames
+        int num_frames =
+            wait_for_full_frames(in_buf, unique_name.c_str(), frame_id, max_batch_frames, &timeout);
+        if (num_frames > 0) {
+            // Write frames
+            for (int i = 0; i < num_frames; i++) {
+                write_data(in_buf, frame_id + i);
+            }
+
+            // Mark the buffers and move on
+            mark_frames_empty(in_buf, unique_name.c_str(), frame_id, num_frames);
+            frame_id += num_frames;
+        } else if (num_frames == -1) {
             break;
         }
 
@@ -154,6 +185,7 @@ void BaseWriter::init_acq(dset_id_t ds_id) {
         acq.file_bundle = std::make_unique<visFileBundle>(
             file_type, root_path, acq_fmt, file_fmt, metadata, file_length, window,
             kotekan::logLevel(_member_log_level), ds_id, file_length);
+        acq.file_bundle->set_async_writer(async_writer);
     } catch (std::exception& e) {
         FATAL_ERROR("Failed creating file bundle for new acquisition: {:s}", e.what());
     }
@@ -216,6 +248,12 @@ void BaseWriter::write_frame(const FrameView& frame, dset_id_t dataset_id, uint3
         // Update average write time in prometheus
         write_time.add_sample(elapsed);
         write_time_metric.set(write_time.average());
+        write_duration_metric.observe(elapsed);
+
+        if (async_writer) {
+            inflight_bytes_metric.set(async_writer->inflight_bytes());
+            completion_time_metric.set(async_writer->completion_time());
+        }
     }
 }
 
@@ -6,13 +6,14 @@
 #ifndef BASE_WRITER_HPP
 #define BASE_WRITER_HPP
 
+#include "AsyncFileWriter.hpp"   // for AsyncFileWriter
 #include "Config.hpp"            // for Config
 #include "FrameView.hpp"         // for FrameView
 #include "Stage.hpp"             // for Stage
 #include "buffer.h"              // for Buffer
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "datasetManager.hpp"    // for dset_id_t, fingerprint_t
-#include "prometheusMetrics.hpp" // for Counter, MetricFamily, Gauge
+#include "prometheusMetrics.hpp" // for Counter, MetricFamily, Gauge, Histogram
 #include "visFile.hpp"           // for visFileBundle
 #include "visUtil.hpp"           // for movingAverage, time_ctype
 
@@ -83,11 +84,32 @@
  * @conf   critical_states  List of strings. A list of state types to consider
  *                          critical. That is, if they change in the incoming
  *                          data stream then a new acquisition will be started.
+ * @conf   max_batch_frames Int (default: half the input buffer). Maximum number
+ *                          of full frames to acquire, write and release at once.
+ * @conf   write_backend    String (default: sync). How to write `raw` and
+ *                          `hfbraw` files. With 'sync' the frames are written
+ *                          by this stage. With 'io_uring' or 'threads' they are
+ *                          copied and written in the background (see
+ *                          `AsyncFileWriter`), which stops a slow disk from
+ *                          stalling the pipeline. 'io_uring' falls back to
+ *                          'threads' if it is not available.
+ * @conf   write_threads    Int (default 2). Threads used by the 'threads'
+ *                          backend.
+ * @conf   write_max_inflight_mb  Int (default 512). Maximum amount of data, in
+ *                          MB, waiting to be written in the background before
+ *                          writes block.
  *
  * @par Metrics
  * @metric kotekan_writer_write_time_seconds
  *         The write time of the raw writer. An exponential moving average over ~10
  *         samples.
+ * @metric kotekan_writer_write_duration_seconds
+ *         Histogram of the write time of each frame.
+ * @metric kotekan_writer_inflight_bytes
+ *         The number of bytes queued or being written in the background.
+ * @metric kotekan_writer_completion_time_seconds
+ *         Time from a frame being queued to reaching the page cache, for the
+ *         background backends. An exponential moving average over ~10 samples.
  * @metric kotekan_writer_late_frame_total
  *         The number of frames dropped while attempting to write as they are too late.
  * @metric kotekan_writer_bad_dataset_frame_total
@@ -192,6 +214,10 @@ private:
     size_t window;
     bool ignore_version;
     double acq_timeout;
+    int max_batch_frames;
+
+    /// Background writer, null if writing synchronously
+    std::shared_ptr<AsyncFileWriter> async_writer;
 
     /// Input buffer to read from
     Buffer* in_buf;
@@ -205,6 +231,9 @@ private:
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Counter>& late_frame_counter;
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Counter>& bad_dataset_frame_counter;
     kotekan::prometheus::Gauge& write_time_metric;
+    kotekan::prometheus::Histogram& write_duration_metric;
+    kotekan::prometheus::Gauge& inflight_bytes_metric;
+    kotekan::prometheus::Gauge& completion_time_metric;
 };
 
 #endif
@@ -7,7 +7,7 @@
 #include "buffer.h"              // for allocate_new_metadata_object, mark_frame_empty, mark_fr...
 #include "datasetState.hpp"      // for datasetState, eigenvalueState, state_uptr
 #include "kotekanLogging.hpp"    // for DEBUG
-#include "prometheusMetrics.hpp" // for Gauge, Metrics, MetricFamily
+#include "prometheusMetrics.hpp" // for Gauge, Metrics, MetricFamily, Histogram
 #include "visBuffer.hpp"         // for VisFrameView, VisField, VisField::erms, VisField::eval
 #include "visUtil.hpp"           // for cfloat, frameID, current_time, modulo, movingAverage
 
@@ -41,6 +41,8 @@ EigenVisIter::EigenVisIter(Config& config, const std::string& unique_name,
     Stage(config, unique_name, buffer_container, std::bind(&EigenVisIter::main_thread, this)),
     comp_time_seconds_metric(
         Metrics::instance().add_gauge("kotekan_eigenvisiter_comp_time_seconds", unique_name)),
+    comp_duration_seconds_metric(Metrics::instance().add_histogram(
+        "kotekan_eigenvisiter_comp_duration_seconds", unique_name)),
     eigenvalue_metric(Metrics::instance().add_gauge("kotekan_eigenvisiter_eigenvalue", unique_name,
                                                     {"eigenvalue", "freq_id"})),
     iterations_metric(
@@ -201,6 +203,7 @@ void EigenVisIter::update_metrics(uint32_t freq_id, dset_id_t dset_id, double el
     auto& calc_time = calc_time_map[key];
     calc_time.add_sample(elapsed_time);
     comp_time_seconds_metric.set(calc_time.average());
+    comp_duration_seconds_metric.observe(elapsed_time);
 
     // Output eigenvalues to prometheus
     for (uint32_t i = 0; i < _num_eigenvectors; i++) {
@@ -20,7 +20,7 @@
 #include "buffer.h"              // for Buffer
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "datasetManager.hpp"    // for dset_id_t, state_id_t
-#include "prometheusMetrics.hpp" // for Gauge, MetricFamily
+#include "prometheusMetrics.hpp" // for Gauge, MetricFamily, Histogram
 #include "visUtil.hpp"           // for movingAverage, cfloat
 
 
@@ -68,6 +68,8 @@
  * @metric kotekan_eigenvisiter_comp_time_seconds
  *         Time required to find eigenvectors. An exponential moving average over
  *         ~10 samples.
+ * @metric kotekan_eigenvisiter_comp_duration_seconds
+ *         Histogram of the time required to find the eigenvectors of each frame.
  * @metric kotekan_eigenvisiter_eigenvalue
  *         The value of each eigenvalue calculated, or the RMS.
  * @metric kotekan_eigenvisiter_iterations
@@ -123,6 +125,7 @@ private:
     dset_id_t input_dset_id = dset_id_t::null;
 
     kotekan::prometheus::Gauge& comp_time_seconds_metric;
+    kotekan::prometheus::Histogram& comp_duration_seconds_metric;
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Gauge>& eigenvalue_metric;
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Gauge>& iterations_metric;
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Gauge>& eigenvalue_convergence_metric;
@@ -27,6 +27,7 @@
 #include <stdexcept>    // for out_of_range, invalid_argument
 #include <stdint.h>     // for uint32_t, uint64_t
 #include <system_error> // for system_error
+#include <utility>      // for swap
 
 
 using kotekan::bufferContainer;
@@ -167,6 +168,11 @@ bool HFBTranspose::get_dataset_state(dset_id_t ds_id) {
     frac_lost.resize(chunk_t * chunk_f, 1.);
     dset_id.resize(chunk_t * chunk_f);
 
+    // ... and the same again for the chunk being written out
+    hfb_out = hfb;
+    hfb_weight_out = hfb_weight;
+    frac_lost_out = frac_lost;
+
     // Initialise dataset ID array with null IDs
     std::string null_ds_id = fmt::format("{}", dset_id_t::null);
     for (auto& ds : dset_id) {
@@ -183,15 +189,21 @@ std::tuple<size_t, uint64_t, dset_id_t> HFBTranspose::get_frame_data() {
                            frame.dataset_id);
 }
 
-void HFBTranspose::write_chunk(size_t t_ind, size_t f_ind) {
+void HFBTranspose::swap_chunk() {
+    std::swap(hfb, hfb_out);
+    std::swap(hfb_weight, hfb_weight_out);
+    std::swap(frac_lost, frac_lost_out);
+}
+
+void HFBTranspose::write_chunk(size_t t_ind, size_t f_ind, size_t n_f, size_t n_t) {
     DEBUG("Writing at freq {:d} and time {:d}", f_ind, t_ind);
-    DEBUG("Writing block of {:d} freqs and {:d} times. data: {}...{}...{}", write_f, write_t,
-          hfb[0], hfb[write_t], hfb[write_t * 2]);
+    DEBUG("Writing block of {:d} freqs and {:d} times. data: {}...{}...{}", n_f, n_t, hfb_out[0],
+          hfb_out[n_t], hfb_out[n_t * 2]);
 
-    file->write_block("hfb", f_ind, t_ind, write_f, write_t, hfb.data());
-    file->write_block("hfb_weight", f_ind, t_ind, write_f, write_t, hfb_weight.data());
-    file->write_block("flags/frac_lost", f_ind, t_ind, write_f, write_t, frac_lost.data());
-    file->write_block("flags/dataset_id", f_ind, t_ind, write_f, write_t, dset_id.data());
+    file->write_block("hfb", f_ind, t_ind, n_f, n_t, hfb_out.data());
+    file->write_block("hfb_weight", f_ind, t_ind, n_f, n_t, hfb_weight_out.data());
+    file->write_block("flags/frac_lost", f_ind, t_ind, n_f, n_t, frac_lost_out.data());
+    file->write_block("flags/dataset_id", f_ind, t_ind, n_f, n_t, dset_id_out.data());
 }
 
 // increment between chunks
@@ -52,8 +52,11 @@ protected:
     // Copy flags into local vectors using HFBFrameView
     void copy_flags(uint32_t time_index) override;
 
+    // Move the filled chunk into the output buffers
+    void swap_chunk() override;
+
     // Write datasets to file
-    void write_chunk(size_t t_ind, size_t f_ind) override;
+    void write_chunk(size_t t_ind, size_t f_ind, size_t n_f, size_t n_t) override;
 
     // Increment between chunks
     void increment_chunk(size_t& t_ind, size_t& f_ind, bool& t_edge, bool& f_edge) override;
@@ -65,6 +68,11 @@ private:
     std::vector<float> hfb_weight;
     std::vector<float> frac_lost;
 
+    // The chunk being written out
+    std::vector<float> hfb_out;
+    std::vector<float> hfb_weight_out;
+    std::vector<float> frac_lost_out;
+
     /// The list of frequencies and inputs that get written into the index maps
     /// of the HDF5 files
     std::vector<time_ctype> times;
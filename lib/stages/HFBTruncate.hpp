@@ -15,9 +15,8 @@
  * Absorber values are truncated to a precision based on their
  * weight.
  *
- * @warning Don't run this anywhere but on the transpose (gossec) node.
- * The OpenMP calls could cause issues on systems using kotekan pin
- * priority threads (likely the GPU nodes).
+ * The truncation is vectorised (see truncateKernel.hpp), using the best
+ * instruction set the CPU supports, and gives the same results on every one.
  *
  * @par Buffers
  * @buffer in_buf The input stream.
@@ -23,24 +23,29 @@
 #include "fmt.hpp"  // for format, fmt
 #include "json.hpp" // for json
 
-#include <cstring>    // for strerror, memcpy
-#include <errno.h>    // for errno
-#include <exception>  // for exception
-#include <fcntl.h>    // for open, posix_fadvise, O_RDONLY, POSIX_FADV_DONTNEED
-#include <fstream>    // for ifstream, ios_base::failure, ios_base, basic_ios, basic_i...
-#include <functional> // for _Bind_helper<>::type, bind, function
-#include <map>        // for map
-#include <regex>      // for match_results<>::_Base_type
-#include <stddef.h>   // for size_t
-#include <stdexcept>  // for runtime_error, invalid_argument, out_of_range
-#include <stdint.h>   // for uint32_t, uint8_t
-#include <string>     // for string
-#include <sys/mman.h> // for madvise, mmap, munmap, MADV_DONTNEED, MADV_WILLNEED, MAP_...
-#include <sys/stat.h> // for stat
-#include <time.h>     // for nanosleep, timespec
-#include <unistd.h>   // for close, off_t
-#include <utility>    // for pair
-#include <vector>     // for vector
+#include <atomic>             // for atomic
+#include <condition_variable> // for condition_variable
+#include <cstring>            // for strerror, memcpy
+#include <errno.h>            // for errno, EINVAL
+#include <exception>          // for exception
+#include <fcntl.h>            // for open, posix_fadvise, O_RDONLY, POSIX_FADV_DONTNEED
+#include <fstream>            // for ifstream, ios_base::failure, ios_base, basic_ios, basic_i...
+#include <functional>         // for _Bind_helper<>::type, bind, function
+#include <map>                // for map
+#include <mutex>              // for mutex, unique_lock, lock_guard
+#include <regex>              // for match_results<>::_Base_type
+#include <stddef.h>           // for size_t
+#include <stdexcept>          // for runtime_error, invalid_argument, out_of_range
+#include <stdint.h>           // for uint32_t, uint8_t
+#include <string>             // for string
+#include <sys/mman.h>         // for madvise, mmap, munmap, MADV_DONTNEED, MADV_WILLNEED, MAP_...
+#include <sys/stat.h>         // for stat
+#include <sys/types.h>        // for ssize_t
+#include <thread>             // for thread
+#include <time.h>             // for nanosleep, timespec
+#include <unistd.h>           // for close, off_t, sysconf, _SC_PAGESIZE
+#include <utility>            // for pair
+#include <vector>             // for vector
 
 using kotekan::bufferContainer;
 using kotekan::Config;
@@ -75,6 +80,16 @@ using nlohmann::json;
  *
  * @conf    readahead_blocks       Int. Number of blocks to advise OS to read ahead
  *                                 of current read.
+ * @conf    readahead_chunks       Int. If greater than zero, run a thread that faults
+ *                                 in the frames of this many chunks (or time samples
+ *                                 if not chunked) ahead of the current read, so the
+ *                                 main loop never waits on the disk. Default is 0.
+ * @conf    zero_copy              Bool. Instead of copying each frame into the output
+ *                                 buffer, swap in a pointer to the frame's data in
+ *                                 the memory mapped file. The mapping is copy on
+ *                                 write, so consumers may still modify the frame.
+ *                                 Note the data is only byte aligned within the file.
+ *                                 Default is false.
  * @conf    chunk_size             Array of [int, int, int]. Read chunk size (freq,
  *                                 prod, time). If not specified will read file
  *                                 contiguously.
@@ -194,6 +209,36 @@ private:
      **/
     int position_map(int ind);
 
+    /**
+     * @brief Fault in the pages of the frames ahead of the main loop.
+     *
+     * Runs in its own thread when `readahead_chunks` is set, keeping
+     * `readahead_chunks` chunks ahead of `read_pos`.
+     **/
+    void prefault_thread();
+
+    /**
+     * @brief Fault in a region of the mapped file.
+     *
+     * @param offset Offset into the file.
+     * @param len    Length of the region.
+     **/
+    void prefault(size_t offset, size_t len);
+
+    /**
+     * @brief Drop a frame's pages from the mapping and the page cache.
+     *
+     * @param file_ind Index of the frame in the file.
+     **/
+    void release_frame(size_t file_ind);
+
+    /**
+     * @brief Put the buffer's own memory back in place of a mapped frame.
+     *
+     * @param frame_id The buffer frame.
+     **/
+    void restore_frame(int frame_id);
+
     // The metadata
     nlohmann::json _metadata;
     std::vector<time_ctype> _times;
@@ -218,12 +263,33 @@ private:
     // the input file
     int fd;
     uint8_t* mapped_file;
+    // Length of the mapping. Padded in zero copy mode so that consumers can
+    // access a whole buffer frame past the start of the last frame's data
+    size_t mapped_len;
+
+    // Whether to hand out frames pointing into the mapped file
+    bool zero_copy;
+
+    // The buffer's own frame memory while a mapped frame is swapped in, and
+    // which frame of the file the swapped in frame is (-1 if none)
+    std::vector<uint8_t*> own_frames;
+    std::vector<ssize_t> mapped_frames;
 
     size_t file_frame_size, data_size, nfreq, ntime;
 
     // Number of blocks to read ahead while reading from disk
     size_t readahead_blocks;
 
+    // Number of chunks for the prefault thread to keep ahead, and the number of
+    // frames in each of them
+    size_t readahead_chunks;
+    size_t frames_per_chunk;
+
+    // Position of the main loop, shared with the prefault thread
+    std::atomic<size_t> read_pos;
+    std::mutex read_pos_mutex;
+    std::condition_variable read_pos_cv;
+
     // the dataset state for the time axis
     state_id_t tstate_id;
 
@@ -244,6 +310,8 @@ RawReader<T>::RawReader(Config& config, const std::string& unique_name,
 
     filename = config.get<std::string>(unique_name, "infile");
     readahead_blocks = config.get<size_t>(unique_name, "readahead_blocks");
+    readahead_chunks = config.get_default<size_t>(unique_name, "readahead_chunks", 0);
+    zero_copy = config.get_default<bool>(unique_name, "zero_copy", false);
     max_read_rate = config.get_default<double>(unique_name, "max_read_rate", 0.0);
     sleep_time = config.get_default<float>(unique_name, "sleep_time", -1);
     update_dataset_id = config.get_default<bool>(unique_name, "update_dataset_id", true);
@@ -353,6 +421,7 @@ RawReader<T>::RawReader(Config& config, const std::string& unique_name,
         // Number of elements in a chunked row
         row_size = chunk_t * nfreq;
     }
+    frames_per_chunk = chunked ? chunk_t * chunk_f : nfreq;
 
     // Check that buffer is large enough
     if (out_buf->frame_size < data_size) {
@@ -387,8 +456,31 @@ RawReader<T>::RawReader(Config& config, const std::string& unique_name,
         throw std::runtime_error(
             fmt::format(fmt("Failed to open file {:s}.data: {:s}."), filename, strerror(errno)));
     }
-    mapped_file =
-        (uint8_t*)mmap(nullptr, ntime * nfreq * file_frame_size, PROT_READ, MAP_SHARED, fd, 0);
+    size_t file_len = ntime * nfreq * file_frame_size;
+    if (!zero_copy) {
+        mapped_len = file_len;
+        mapped_file = (uint8_t*)mmap(nullptr, mapped_len, PROT_READ, MAP_SHARED, fd, 0);
+    } else {
+        // Reserve zeroed memory past the end of the file first, as touching
+        // pages of a file mapping beyond its end raises SIGBUS
+        size_t page = sysconf(_SC_PAGESIZE);
+        mapped_len = (file_len + out_buf->frame_size + page - 1) / page * page;
+        mapped_file = (uint8_t*)mmap(nullptr, mapped_len, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        // Copy on write, so that consumers can modify the frames in place
+        // without touching the file
+        if (mapped_file != MAP_FAILED && file_len > 0
+            && mmap(mapped_file, file_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0)
+                   == MAP_FAILED) {
+            int err = errno;
+            munmap(mapped_file, mapped_len);
+            errno = err;
+            mapped_file = (uint8_t*)MAP_FAILED;
+        }
+
+        own_frames.resize(out_buf->num_frames, nullptr);
+        mapped_frames.resize(out_buf->num_frames, -1);
+    }
     if (mapped_file == MAP_FAILED)
         throw std::runtime_error(fmt::format(fmt("Failed to map file {:s}.data to memory: {:s}."),
                                              filename, strerror(errno)));
@@ -396,7 +488,12 @@ RawReader<T>::RawReader(Config& config, const std::string& unique_name,
 
 template<typename T>
 RawReader<T>::~RawReader() {
-    if (munmap(mapped_file, ntime * nfreq * file_frame_size) == -1) {
+    // All stages have stopped by now, so hand the buffer its own memory back
+    // before the frames pointing into the file go away
+    for (int i = 0; i < (int)own_frames.size(); i++)
+        restore_frame(i);
+
+    if (munmap(mapped_file, mapped_len) == -1) {
         // Make sure kotekan is exiting...
         FATAL_ERROR("Failed to unmap file {:s}.data: {:s}.", filename, strerror(errno));
     }
@@ -427,6 +524,11 @@ void RawReader<T>::main_thread() {
         read_ahead(read_ind);
     }
 
+    read_pos = 0;
+    std::thread prefault_t;
+    if (readahead_chunks > 0)
+        prefault_t = std::thread(&RawReader<T>::prefault_thread, this);
+
     while (!stop_thread && ind < nframe) {
 
         // Get the start time of the loop for rate limiting
@@ -445,6 +547,10 @@ void RawReader<T>::main_thread() {
         // Get the index into the file
         file_ind = position_map(ind);
 
+        // Consumers are done with whatever frame of the file this held before
+        if (zero_copy && mapped_frames[frame_id] >= 0)
+            release_frame(mapped_frames[frame_id]);
+
         // Allocate the metadata space
         allocate_new_metadata_object(out_buf, frame_id);
 
@@ -454,11 +560,22 @@ void RawReader<T>::main_thread() {
             std::memcpy(out_buf->metadata[frame_id]->metadata,
                         mapped_file + file_ind * file_frame_size + 1, metadata_size);
 
-            // Copy the data from the file
-            std::memcpy(frame, mapped_file + file_ind * file_frame_size + metadata_size + 1,
-                        data_size);
+            uint8_t* data = mapped_file + file_ind * file_frame_size + metadata_size + 1;
+            if (zero_copy) {
+                // Point the frame straight at the data in the file
+                uint8_t* prev = swap_external_frame(out_buf, frame_id, data);
+                if (mapped_frames[frame_id] < 0)
+                    own_frames[frame_id] = prev;
+                mapped_frames[frame_id] = file_ind;
+            } else {
+                // Copy the data from the file
+                std::memcpy(frame, data, data_size);
+            }
         } else {
-            // Create empty frame and set structural metadata
+            // Create empty frame and set structural metadata, which needs the
+            // buffer's own memory
+            if (zero_copy)
+                restore_frame(frame_id);
             create_empty_frame(frame_id);
         }
 
@@ -467,23 +584,23 @@ void RawReader<T>::main_thread() {
         dset_id_t& ds_id = frame.dataset_id;
         ds_id = get_dataset_state(ds_id);
 
-        // Try and clear out the cached data from the memory map as we don't need it again
-        if (madvise(mapped_file + file_ind * file_frame_size, file_frame_size, MADV_DONTNEED) == -1)
-            WARN("madvise failed: {:s}", strerror(errno));
-#ifdef __linux__
-        // Try and clear out the cached data from the page cache as we don't need it again
-        // NOTE: unless we do this in addition to the above madvise the kernel will try and keep as
-        // much of the file in the page cache as possible and it will fill all the available memory
-        if (posix_fadvise(fd, file_ind * file_frame_size, file_frame_size, POSIX_FADV_DONTNEED)
-            == -1)
-            WARN("fadvise failed: {:s}", strerror(errno));
-#endif
+        // In zero copy mode the data is still in use until the frame comes
+        // back empty
+        if (!zero_copy || mapped_frames[frame_id] < 0)
+            release_frame(file_ind);
 
         // Release the frame and advance all the counters
         mark_frame_full(out_buf, unique_name.c_str(), frame_id++);
         read_ind++;
         ind++;
 
+        // Let the prefault thread know when we move onto a new chunk
+        read_pos = ind;
+        if (readahead_chunks > 0 && ind % frames_per_chunk == 0) {
+            std::lock_guard<std::mutex> lock(read_pos_mutex);
+            read_pos_cv.notify_one();
+        }
+
         // Get the end time for the loop and sleep for long enough to satisfy
         // the max rate
         end_time = current_time();
@@ -495,6 +612,15 @@ void RawReader<T>::main_thread() {
         }
     }
 
+    if (prefault_t.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(read_pos_mutex);
+            read_pos = nframe;
+        }
+        read_pos_cv.notify_one();
+        prefault_t.join();
+    }
+
     if (sleep_time > 0) {
         INFO("Read all data. Sleeping and then exiting kotekan...");
         timespec ts = double_to_ts(sleep_time);
@@ -544,6 +670,75 @@ void RawReader<T>::read_ahead(int ind) {
         DEBUG("madvise failed: {:s}", strerror(errno));
 }
 
+template<typename T>
+void RawReader<T>::prefault_thread() {
+
+    size_t nframe = nfreq * ntime;
+    size_t ind = 0;
+
+    while (!stop_thread) {
+        size_t pos = read_pos;
+        if (pos >= nframe)
+            break;
+
+        // Fault in everything up to the end of the chunk `readahead_chunks`
+        // past the current one
+        size_t target =
+            std::min(nframe, (pos / frames_per_chunk + readahead_chunks + 1) * frames_per_chunk);
+        for (ind = std::max(ind, pos); ind < target && !stop_thread; ind++)
+            prefault(position_map(ind) * file_frame_size, file_frame_size);
+
+        // Wait for the main loop to move onto the next chunk
+        std::unique_lock<std::mutex> lock(read_pos_mutex);
+        read_pos_cv.wait(lock, [&]() {
+            return stop_thread || read_pos / frames_per_chunk != pos / frames_per_chunk;
+        });
+    }
+}
+
+template<typename T>
+void RawReader<T>::prefault(size_t offset, size_t len) {
+
+#ifdef MADV_POPULATE_READ
+    // Faults in the whole range in one go (Linux >= 5.14)
+    if (madvise(mapped_file + offset, len, MADV_POPULATE_READ) == 0)
+        return;
+    if (errno != EINVAL)
+        DEBUG("madvise failed: {:s}", strerror(errno));
+#endif
+
+    // Otherwise touch every page
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    volatile uint8_t sink = 0;
+    for (size_t i = 0; i < len; i += page)
+        sink = sink + mapped_file[offset + i];
+}
+
+template<typename T>
+void RawReader<T>::release_frame(size_t file_ind) {
+
+    // Try and clear out the cached data from the memory map as we don't need it again
+    if (madvise(mapped_file + file_ind * file_frame_size, file_frame_size, MADV_DONTNEED) == -1)
+        WARN("madvise failed: {:s}", strerror(errno));
+#ifdef __linux__
+    // Try and clear out the cached data from the page cache as we don't need it again
+    // NOTE: unless we do this in addition to the above madvise the kernel will try and keep as
+    // much of the file in the page cache as possible and it will fill all the available memory
+    if (posix_fadvise(fd, file_ind * file_frame_size, file_frame_size, POSIX_FADV_DONTNEED) == -1)
+        WARN("fadvise failed: {:s}", strerror(errno));
+#endif
+}
+
+template<typename T>
+void RawReader<T>::restore_frame(int frame_id) {
+    if (mapped_frames[frame_id] < 0)
+        return;
+
+    swap_external_frame(out_buf, frame_id, own_frames[frame_id]);
+    own_frames[frame_id] = nullptr;
+    mapped_frames[frame_id] = -1;
+}
+
 template<typename T>
 int RawReader<T>::position_map(int ind) {
     if (chunked) {
@@ -161,6 +161,10 @@ void RfiFrameDrop::main_thread() {
         // Release the update lock
         lock.unlock();
 
+        // Resolve the metrics for this frequency once for all the sub frames
+        auto& frames_total = frame_counter.labels({std::to_string(freq_id)});
+        auto& dropped_frames_total = dropped_frame_counter.labels({std::to_string(freq_id)});
+
 
         for (size_t ii = 0; ii < num_sub_frames; ii++) {
 
@@ -217,11 +221,11 @@ void RfiFrameDrop::main_thread() {
                 set_dataset_id(_buf_out, frame_id_out, dset_id_out);
                 mark_frame_full(_buf_out, unique_name.c_str(), frame_id_out++);
             } else {
-                dropped_frame_counter.labels({std::to_string(freq_id)}).inc();
+                dropped_frames_total.inc();
             }
 
             mark_frame_empty(_buf_in_vis, unique_name.c_str(), frame_id_in_vis++);
-            frame_counter.labels({std::to_string(freq_id)}).inc();
+            frames_total.inc();
         }
         mark_frame_empty(_buf_in_sk, unique_name.c_str(), frame_id_in_sk++);
     }
@@ -10,8 +10,9 @@
 #include "datasetState.hpp"      // for metadataState, stackState, acqDatasetIdState, eigenvalu...
 #include "errors.h"              // for exit_kotekan, CLEAN_EXIT, ReturnCode
 #include "kotekanLogging.hpp"    // for DEBUG, FATAL_ERROR, logLevel, INFO
-#include "prometheusMetrics.hpp" // for Metrics, Gauge
+#include "prometheusMetrics.hpp" // for Metrics, Gauge, Counter
 #include "version.h"             // for get_git_commit_hash
+#include "visUtil.hpp"           // for current_time, frameID, modulo
 
 #include "fmt.hpp" // for format
 
@@ -20,7 +21,7 @@
 #include <cxxabi.h>     // for __forced_unwind
 #include <exception>    // for exception
 #include <functional>   // for _Bind_helper<>::type, bind, function
-#include <future>       // for async, future
+#include <future>       // for async, future, launch
 #include <map>          // for map
 #include <memory>       // for allocator_traits<>::value_type
 #include <regex>        // for match_results<>::_Base_type
@@ -48,6 +49,8 @@ Transpose::Transpose(Config& config, const std::string& unique_name,
     timeout =
         std::chrono::duration<float>(config.get_default<float>(unique_name, "comet_timeout", 60.));
 
+    async_write = config.get_default<bool>(unique_name, "async_write", true);
+
     // Collect some metadata. The rest is requested from the datasetManager,
     // once we received the first frame.
     metadata["notes"] = "";
@@ -121,6 +124,8 @@ void Transpose::main_thread() {
 
     auto& transposed_bytes_metric =
         Metrics::instance().add_counter("kotekan_transpose_data_transposed_bytes", unique_name);
+    auto& write_wait_metric =
+        Metrics::instance().add_gauge("kotekan_transpose_write_wait_seconds", unique_name);
 
     while (!stop_thread) {
         if (num_empty_skip > 0) {
@@ -181,8 +186,21 @@ void Transpose::main_thread() {
         if (fi == 0)
             ti++;
         if (ti == write_t) {
-            // chunk is complete
-            write_chunk(t_ind, f_ind);
+            // chunk is complete. Wait until the previous one is out of the
+            // way, then write this one.
+            double start = current_time();
+            wait_for_write();
+            write_wait_metric.set(current_time() - start);
+
+            swap_chunk();
+            dset_id_out = dset_id;
+            if (async_write) {
+                pending_write = std::async(std::launch::async, &Transpose::write_chunk, this,
+                                           t_ind, f_ind, write_f, write_t);
+            } else {
+                write_chunk(t_ind, f_ind, write_f, write_t);
+            }
+
             // increment between chunks
             increment_chunk(t_ind, f_ind, t_edge, f_edge);
             fi = 0;
@@ -195,11 +213,21 @@ void Transpose::main_thread() {
         frames_so_far++;
         // Exit when all frames have been written
         if (frames_so_far == num_time * num_freq) {
+            wait_for_write();
             INFO("Done. Exiting.");
             exit_kotekan(ReturnCode::CLEAN_EXIT);
             return;
         }
     }
+
+    // Don't leave the last chunk half written
+    wait_for_write();
+}
+
+void Transpose::wait_for_write() {
+    // This rethrows anything raised while writing
+    if (pending_write.valid())
+        pending_write.get();
 }
 
 dset_id_t Transpose::base_dset(dset_id_t ds_id) {
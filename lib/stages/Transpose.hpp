@@ -17,7 +17,8 @@
 
 #include "json.hpp" // for json
 
-#include <chrono>
+#include <chrono>   // for duration
+#include <future>   // for future
 #include <stddef.h> // for size_t
 #include <stdint.h> // for uint32_t
 #include <string>   // for string
@@ -37,7 +38,8 @@
  *  create_hdf5_file();
  *  copy_frame_data(uint32_t freq_index, uint32_t time_index);
  *  copy_flags(uint32_t time_index);
- *  write_chunk(size_t t_ind, size_t f_ind);
+ *  swap_chunk();
+ *  write_chunk(size_t t_ind, size_t f_ind, size_t n_f, size_t n_t);
  *  increment_chunk(size_t &t_ind, size_t &f_ind, bool &t_edge, bool &f_edge);
  *
  * The data is received as one-dimensional arrays
@@ -48,6 +50,13 @@
  * This stage expects the data to be ordered like RawReader does.
  * Other stages might not guarentee this same order.
  *
+ * Writing a chunk into the file is where HDF5 runs the bitshuffle
+ * compression, which takes about as long as filling the chunk. To overlap the
+ * two the chunk buffers are doubled: once a chunk is filled `swap_chunk`
+ * exchanges it with the second set of buffers, which are then written by a
+ * background thread while the next chunk is filled. HDF5 is not thread safe,
+ * so there is only ever one chunk being written.
+ *
  * @warning Don't run this anywhere but on the transpose (gossec) node.
  * The OpenMP calls could cause issues on systems using kotekan pin
  * priority threads (likely the GPU nodes).
@@ -63,10 +72,17 @@
  *                              write to (e.g. "/path/to/0000_000", without .h5).
  * @conf   comet_timeout        Float, default 60. Timeout for communications with
  *                              dataset broker.
+ * @conf   async_write          Bool, default true. Write and compress chunks in the
+ *                              background. This doubles the memory used for the
+ *                              chunk buffers.
  *
  * @par Metrics
  * @metric kotekan_transpose_data_transposed_bytes
  *         The total amount of data processed in bytes.
+ * @metric kotekan_transpose_write_wait_seconds
+ *         The time spent waiting for the previous chunk to be written before
+ *         the next could be handed over. If this is regularly non-zero, the
+ *         writes can't keep up.
  *
  * @author Tristan Pinsonneault-Marotte, Rick Nitsche
  */
@@ -119,6 +135,9 @@ protected:
     // Datasets to be stored until ready to write
     std::vector<dset_id_str> dset_id;
 
+    // Dataset IDs of the chunk being written
+    std::vector<dset_id_str> dset_id_out;
+
 private:
     /// Request dataset states from the datasetManager and prepare all metadata
     /// that is not already set in the constructor.
@@ -136,14 +155,26 @@ private:
     // Copy flags into local vectors
     virtual void copy_flags(uint32_t time_index) = 0;
 
-    // Write datasets to file
-    virtual void write_chunk(size_t t_ind, size_t f_ind) = 0;
+    // Move the filled chunk into the buffers that `write_chunk` writes from
+    virtual void swap_chunk() = 0;
+
+    // Write datasets to file. This may be called from a different thread, and
+    // must only use the buffers filled by `swap_chunk`.
+    virtual void write_chunk(size_t t_ind, size_t f_ind, size_t n_f, size_t n_t) = 0;
 
     // Increment between chunks
     virtual void increment_chunk(size_t& t_ind, size_t& f_ind, bool& t_edge, bool& f_edge) = 0;
 
     /// Extract the base dataset ID
     dset_id_t base_dset(dset_id_t ds_id);
+
+    /// Wait for the chunk being written in the background, if any
+    void wait_for_write();
+
+    bool async_write;
+
+    /// The chunk being written in the background
+    std::future<void> pending_write;
 };
 
 template<typename T>
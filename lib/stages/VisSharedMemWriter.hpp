@@ -11,12 +11,14 @@
 #include "buffer.h"              // for Buffer
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "datasetManager.hpp"    // for dset_id_t, fingerprint_t
-#include "prometheusMetrics.hpp" // for MetricFamily, Counter, Gauge
+#include "prometheusMetrics.hpp" // for MetricFamily, Counter
 #include "visBuffer.hpp"         // for VisFrameView
-#include "visUtil.hpp"           // for time_ctype, modulo, movingAverage
+#include "visSharedMem.hpp"      // for visSharedMemRing
+#include "visUtil.hpp"           // for time_ctype, modulo
 
-#include <cstdint>     // for uint64_t, uint32_t, uint8_t, int64_t
+#include <cstdint>     // for uint32_t, uint8_t
 #include <map>         // for map
+#include <memory>      // for unique_ptr
 #include <semaphore.h> // for sem_t
 #include <set>         // for set
 #include <stddef.h>    // for size_t
@@ -46,17 +48,21 @@
  * the validity of the data. The access record has a 1:1 correlation to
  * the Data region. Every time the Data is modified, the access record
  * will have the timestamp of modification. While data is written,
- * its access record will be set to -1. Acquiring a semaphore, with the
- * same name as the shared memory region is required before reading
- * from or writing to the access record. The Data region is lock free.
+ * its access record will be set to -1.
+ *
+ * No locks are taken, by the writer or the readers. After the Data region
+ * there is a sequence number for each frame, which the writer makes odd
+ * while it is changing the frame and even again once it is done. Readers
+ * keep a copy of a frame only if its sequence number was even and didn't
+ * change while they copied it (see visSharedMemRing, and visSharedMemReader
+ * for a reader). So any number of readers can run without ever holding up
+ * the writer. A semaphore with the same name as the shared memory region
+ * is still created for older readers, but the writer never waits on it.
  *
  * This stage writes out the data it receives with minimal processing.
  * Removing certain fields from the output must be done in a prior
  * transformation.
  *
- * A Valve stage should be added before this buffer process
- * to prevent data backing up during semaphore deadlocks.
- *
  * To obtain the metadata about the stream received usage of the datasetManager
  * is required.
  *
@@ -76,9 +82,6 @@
  *                          shared memory and semaphore.
  * @conf    name           Name of shared memory region and semaphore.
  * @conf    num_samples        Number of time samples stored in ring buffer.
- * @conf    wait_time   Maximum time that the writer will wait to
- *                          unlock a semaphore. If it hits the limit
- *                          Kotekan will shut down the stage.
  * @conf    critical_states List of strings. A list of state types to consider
  *                          critical. That is, if they change in the incoming
  *                          data stream then Kotekan will shut down.
@@ -86,9 +89,6 @@
  * @par Metrics
  * @metric dropped_frame_counter
  *          The number of times a frame was dropped because it arrived too late.
- * @metric  access_record_wait_time_seconds
- *          The amount of time the writer spent, in seconds waiting to
- *          access the access record.
  *
  * @author Anja Boskovic
  */
@@ -107,53 +107,14 @@ protected:
     // Input buffer to read from
     Buffer* in_buf;
 
-    // Semaphore for updating access record
+    // Semaphore kept for older readers
     sem_t* sem;
 
-    // Pointers to shared memory addresses for structured data, access record and ringBuffer
-    uint64_t* structured_data_addr;
-    int64_t* access_record_addr;
-    uint8_t* buf_addr;
-
     // Parameters that define structure of ring buffer
-    //
-    struct RingBufferStructure {
-        // The number of time samples contained in ring buffer
-        uint64_t _ntime;
-        // The number of frequencies contained in each time sample
-        uint64_t nfreq;
-        // The size of each frame (valid byte + metadata + data + page alignment padding)
-        uint64_t frame_size;
-        // The size of each metadata section
-        uint64_t metadata_size;
-        // The size of each data section
-        uint64_t data_size;
-    };
-
-    RingBufferStructure rbs;
-
-    // Counter for the number of writes to the ring buffer
-    // Set to 0, upon stage shut-down
-    uint64_t num_writes = 0;
-    // The semaphore wait time before a timeout, in seconds
-    size_t _wait_time;
-
-    // Messages
-    // Indicates that the written frame is valid
-    const uint8_t valid = 1;
-    // Space that the "valid byte" takes up
-    size_t valid_size = 4;
-    // Indicates that the ring buffer frames at those time_ind and freq_ind are
-    // invalid
-    const int64_t invalid = -1;
-
-    // The number of elements in the structured data
-    const size_t structured_data_num = 6;
-    // the size of each element
-    const size_t structured_data_size = sizeof(uint64_t);
-
-    // The size of each record address
-    const size_t access_record_size = 8;
+    visSharedMemRing::Structure rbs;
+
+    // The ring buffer in the shared memory region
+    std::unique_ptr<visSharedMemRing> ring;
 
     // The current position in the ring buffer of the most recent time sample
     modulo<int> cur_pos;
@@ -200,16 +161,6 @@ protected:
      **/
     void reset_memory(uint32_t time_ind);
 
-    /**
-     * Waits to acquire access record semaphore.
-     **/
-    void wait_for_semaphore();
-
-    /**
-     * Releases access record semaphore
-     **/
-    void release_semaphore();
-
     std::string _root_path, _name;
 
     // List of critical states, if changed they will trigger an error
@@ -224,12 +175,6 @@ protected:
 private:
     // Number of dropped frames
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Counter>& dropped_frame_counter;
-
-    // Time spent waiting for semaphore
-    kotekan::prometheus::MetricFamily<kotekan::prometheus::Gauge>& access_record_wait_time_seconds;
-
-    // Keep track of the average semaphore wait time
-    movingAverage wait_time_average;
 };
 
 #endif // VISSHAREDMEMWRITER_HPP
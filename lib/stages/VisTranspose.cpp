@@ -28,6 +28,7 @@
 #include <stdint.h>     // for uint32_t, uint64_t
 #include <sys/types.h>  // for uint
 #include <system_error> // for system_error
+#include <utility>      // for swap
 
 
 using kotekan::bufferContainer;
@@ -176,6 +177,21 @@ bool VisTranspose::get_dataset_state(dset_id_t ds_id) {
     input_flags.resize(chunk_t * num_input, 0.);
     dset_id.resize(chunk_t * chunk_f);
 
+    // ... and the same again for the chunk being written out
+    vis_out = vis;
+    vis_weight_out = vis_weight;
+    eval_out = eval;
+    evec_out = evec;
+    erms_out = erms;
+    gain_out = gain;
+    frac_lost_out = frac_lost;
+    frac_rfi_out = frac_rfi;
+
+    vis_tiles = tiledTranspose<cfloat>(eff_data_dim, chunk_f);
+    weight_tiles = tiledTranspose<float>(eff_data_dim, chunk_f);
+    evec_tiles = tiledTranspose<cfloat>(num_ev * num_input, chunk_f);
+    gain_tiles = tiledTranspose<cfloat>(num_input, chunk_f);
+
     // Initialise dataset ID array with null IDs
     std::string null_ds_id = fmt::format("{}", dset_id_t::null);
     for (auto& ds : dset_id) {
@@ -192,29 +208,46 @@ std::tuple<size_t, uint64_t, dset_id_t> VisTranspose::get_frame_data() {
                            frame.fpga_seq_total, frame.dataset_id);
 }
 
-void VisTranspose::write_chunk(size_t t_ind, size_t f_ind) {
+void VisTranspose::swap_chunk() {
+    // Every element of these is overwritten while filling the next chunk, so
+    // they can just be exchanged
+    std::swap(vis, vis_out);
+    std::swap(vis_weight, vis_weight_out);
+    std::swap(eval, eval_out);
+    std::swap(evec, evec_out);
+    std::swap(erms, erms_out);
+    std::swap(gain, gain_out);
+    std::swap(frac_lost, frac_lost_out);
+    std::swap(frac_rfi, frac_rfi_out);
+
+    // The input flags are carried over between the frequency chunks of the
+    // same time chunk, so must be copied
+    input_flags_out = input_flags;
+}
+
+void VisTranspose::write_chunk(size_t t_ind, size_t f_ind, size_t n_f, size_t n_t) {
     DEBUG("Writing at freq {:d} and time {:d}", f_ind, t_ind);
-    DEBUG("Writing block of {:d} freqs and {:d} times", write_f, write_t);
+    DEBUG("Writing block of {:d} freqs and {:d} times", n_f, n_t);
 
-    file->write_block("vis", f_ind, t_ind, write_f, write_t, vis.data());
+    file->write_block("vis", f_ind, t_ind, n_f, n_t, vis_out.data());
 
-    file->write_block("vis_weight", f_ind, t_ind, write_f, write_t, vis_weight.data());
+    file->write_block("vis_weight", f_ind, t_ind, n_f, n_t, vis_weight_out.data());
 
     if (num_ev > 0) {
-        file->write_block("eval", f_ind, t_ind, write_f, write_t, eval.data());
-        file->write_block("evec", f_ind, t_ind, write_f, write_t, evec.data());
-        file->write_block("erms", f_ind, t_ind, write_f, write_t, erms.data());
+        file->write_block("eval", f_ind, t_ind, n_f, n_t, eval_out.data());
+        file->write_block("evec", f_ind, t_ind, n_f, n_t, evec_out.data());
+        file->write_block("erms", f_ind, t_ind, n_f, n_t, erms_out.data());
     }
 
-    file->write_block("gain", f_ind, t_ind, write_f, write_t, gain.data());
+    file->write_block("gain", f_ind, t_ind, n_f, n_t, gain_out.data());
 
-    file->write_block("flags/frac_lost", f_ind, t_ind, write_f, write_t, frac_lost.data());
+    file->write_block("flags/frac_lost", f_ind, t_ind, n_f, n_t, frac_lost_out.data());
 
-    file->write_block("flags/frac_rfi", f_ind, t_ind, write_f, write_t, frac_rfi.data());
+    file->write_block("flags/frac_rfi", f_ind, t_ind, n_f, n_t, frac_rfi_out.data());
 
-    file->write_block("flags/inputs", f_ind, t_ind, write_f, write_t, input_flags.data());
+    file->write_block("flags/inputs", f_ind, t_ind, n_f, n_t, input_flags_out.data());
 
-    file->write_block("flags/dataset_id", f_ind, t_ind, write_f, write_t, dset_id.data());
+    file->write_block("flags/dataset_id", f_ind, t_ind, n_f, n_t, dset_id_out.data());
 }
 
 // increment between chunks
@@ -265,26 +298,23 @@ void VisTranspose::copy_frame_data(uint32_t freq_index, uint32_t time_index) {
     // Collect frames until a chunk is filled
     // Time-transpose as frames come in
     // Fastest varying is time (needs to be consistent with reader!)
-    uint32_t offset = freq_index * write_t;
-    strided_copy(frame.vis.data(), vis.data(), offset * eff_data_dim + time_index, write_t,
-                 eff_data_dim);
-    strided_copy(frame.weight.data(), vis_weight.data(), offset * eff_data_dim + time_index,
-                 write_t, eff_data_dim);
+    // The bulk of the data goes through tiles, which write it out once
+    // enough times have been collected (and always at the end of the chunk)
+    vis_tiles.add(frame.vis.data(), vis.data(), freq_index, time_index, write_t);
+    weight_tiles.add(frame.weight.data(), vis_weight.data(), freq_index, time_index, write_t);
 
     strided_copy(frame.eval.data(), eval.data(), freq_index * num_ev * write_t + time_index,
                  write_t, num_ev);
 
-    strided_copy(frame.evec.data(), evec.data(),
-                 freq_index * num_ev * num_input * write_t + time_index, write_t,
-                 num_ev * num_input);
+    evec_tiles.add(frame.evec.data(), evec.data(), freq_index, time_index, write_t);
 
+    uint32_t offset = freq_index * write_t;
     erms[offset + time_index] = frame.erms;
     frac_lost[offset + time_index] =
         frame.fpga_seq_length == 0 ? 1. : 1. - float(frame.fpga_seq_total) / frame.fpga_seq_length;
     frac_rfi[offset + time_index] =
         frame.fpga_seq_length == 0 ? 0. : float(frame.rfi_total) / frame.fpga_seq_length;
-    strided_copy(frame.gain.data(), gain.data(), offset * num_input + time_index, write_t,
-                 num_input);
+    gain_tiles.add(frame.gain.data(), gain.data(), freq_index, time_index, write_t);
 }
 
 void VisTranspose::copy_flags(uint32_t time_index) {
@@ -10,6 +10,7 @@
 #include "Transpose.hpp"
 #include "bufferContainer.hpp" // for bufferContainer
 #include "datasetManager.hpp"  // for dset_id_t
+#include "tiledTranspose.hpp"  // for tiledTranspose
 #include "visFileArchive.hpp"  // for visFileArchive
 #include "visUtil.hpp"         // for cfloat, time_ctype, freq_ctype, input_ctype, prod_ctype
 
@@ -52,8 +53,11 @@ protected:
     // Copy flags into local vectors using VisFrameView
     void copy_flags(uint32_t time_index) override;
 
+    // Move the filled chunk into the output buffers
+    void swap_chunk() override;
+
     // Write datasets to file
-    void write_chunk(size_t t_ind, size_t f_ind) override;
+    void write_chunk(size_t t_ind, size_t f_ind, size_t n_f, size_t n_t) override;
 
     // Increment between chunks
     void increment_chunk(size_t& t_ind, size_t& f_ind, bool& t_edge, bool& f_edge) override;
@@ -71,6 +75,23 @@ private:
     std::vector<float> input_flags;
     std::vector<rstack_ctype> reverse_stack;
 
+    // The chunk being written out
+    std::vector<cfloat> vis_out;
+    std::vector<float> vis_weight_out;
+    std::vector<float> eval_out;
+    std::vector<cfloat> evec_out;
+    std::vector<float> erms_out;
+    std::vector<cfloat> gain_out;
+    std::vector<float> frac_lost_out;
+    std::vector<float> frac_rfi_out;
+    std::vector<float> input_flags_out;
+
+    // Tiles for transposing the larger datasets into the chunk
+    tiledTranspose<cfloat> vis_tiles;
+    tiledTranspose<float> weight_tiles;
+    tiledTranspose<cfloat> evec_tiles;
+    tiledTranspose<cfloat> gain_tiles;
+
     /// The list of frequencies and inputs that get written into the index maps
     /// of the HDF5 files
     std::vector<time_ctype> times;
@@ -16,9 +16,8 @@
  * the config. visibility values are truncated to a precision based on their
  * weight.
  *
- * @warning Don't run this anywhere but on the transpose (gossec) node.
- * The OpenMP calls could cause issues on systems using kotekan pin
- * priority threads (likely the GPU nodes).
+ * The truncation is vectorised (see truncateKernel.hpp), using the best
+ * instruction set the CPU supports, and gives the same results on every one.
  *
  * @par Buffers
  * @buffer in_buf The input stream.
@@ -46,9 +45,11 @@ public:
     void main_thread() override;
 
 private:
-    // Buffers
+    // Buffers, and our handles on them
     Buffer* in_buf;
     Buffer* out_buf;
+    int in_buf_id;
+    int out_buf_id;
 
     // Truncation parameters
     float err_sq_lim;
@@ -4,7 +4,8 @@
 #include "H5Support.hpp"         // IWYU pragma: keep
 #include "Hash.hpp"              // for operator<
 #include "StageFactory.hpp"      // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
-#include "buffer.h"              // for mark_frame_empty, wait_for_full_frame, allocate_new...
+#include "applyGainsKernel.hpp"  // for apply_gains_vis
+#include "buffer.h"              // for mark_frame_empty, swap_frames, wait_for_full_frame...
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "configUpdater.hpp"     // for configUpdater
 #include "datasetManager.hpp"    // for dset_id_t, datasetManager, state_id_t
@@ -97,6 +98,8 @@ applyGains::applyGains(Config& config, const std::string& unique_name,
     if (num_threads == 0)
         throw std::invalid_argument("applyGains: num_threads has to be at least 1.");
 
+    in_place = config.get_default<bool>(unique_name, "in_place", true);
+
     // FIFO for gains and weights updates
     gains_fifo.resize(num_kept_updates);
 
@@ -199,6 +202,21 @@ void applyGains::main_thread() {
     // Fetch the first frame to initialise various parameters
     initialise();
 
+    // The frames can only be handed over if no one else reads or writes them.
+    // All stages have registered by the time they are started.
+    if (in_place && (get_num_consumers(in_buf) != 1 || get_num_producers(out_buf) != 1)) {
+        INFO("{:s} or {:s} is shared with other stages, copying frames instead of applying "
+             "gains in place.",
+             in_buf->buffer_name, out_buf->buffer_name);
+        in_place = false;
+    }
+    if (in_place && in_buf->aligned_frame_size != out_buf->aligned_frame_size) {
+        INFO("Frame sizes of {:s} and {:s} differ, copying frames instead of applying gains in "
+             "place.",
+             in_buf->buffer_name, out_buf->buffer_name);
+        in_place = false;
+    }
+
     // Sleep briefly here. This is to give the fetch_thread chance to spin up
     // and read the initial gains
     std::this_thread::sleep_for(0.5s);
@@ -277,55 +295,58 @@ void applyGains::apply_thread() {
         if (wait_for_empty_frame(out_buf, unique_name.c_str(), output_frame_id) == nullptr) {
             break;
         }
-        allocate_new_metadata_object(out_buf, output_frame_id);
-
-        // Create view to output frame
-        auto output_frame =
-            VisFrameView::create_frame_view(out_buf, output_frame_id, input_frame.num_elements,
-                                            input_frame.num_prod, input_frame.num_ev);
-
-
-        // Copy over the data we won't modify
-        output_frame.copy_metadata(input_frame);
-        output_frame.copy_data(input_frame, {VisField::vis, VisField::weight});
 
         // Check if we have already registered this gain update against this
         // input dataset, do so if we haven't, and then label the output data
         // with the new id. This must be done while locked as the underlying map
         // could change
+        dset_id_t output_dset_id;
         {
             std::scoped_lock<std::mutex> lock_frame_ids(m_frame_ids);
             std::pair<state_id_t, dset_id_t> key = {state_id, input_frame.dataset_id};
             if (output_dataset_ids.count(key) == 0) {
                 output_dataset_ids[key] = dm.add_dataset(state_id, input_frame.dataset_id);
             }
-            output_frame.dataset_id = output_dataset_ids[key];
+            output_dset_id = output_dataset_ids[key];
         }
 
-        // Get raw pointers to avoid the gsl::span bounds checking
-        cfloat* out_vis = output_frame.vis.data();
-        cfloat* in_vis = input_frame.vis.data();
-        float* out_weight = output_frame.weight.data();
-        float* in_weight = input_frame.weight.data();
-
         // For now this doesn't try to do any type of check on the
         // ordering of products in vis and elements in gains.
         // Also assumes the ordering of freqs in gains is standard
-        uint32_t idx = 0;
-        for (uint32_t ii = 0; ii < input_frame.num_elements; ii++) {
-            for (uint32_t jj = ii; jj < input_frame.num_elements; jj++) {
-                // Gains are to be multiplied to vis
-                out_vis[idx] = in_vis[idx] * gain[ii] * gain_conj[jj];
-
-                // Update the weights take care not to generate NaN's if both the gain
-                // was zero and the weight was infinite (which can happen if a channel
-                // was turned off)
-                float wp = weight_factor[ii] * weight_factor[jj];
-                out_weight[idx] = (wp == 0 ? 0.0 : in_weight[idx] * wp);
-                idx++;
-            }
-            // Update the gains.
-            output_frame.gain[ii] = input_frame.gain[ii] * gain[ii];
+        if (in_place) {
+            // Apply the gains to the input frame and hand it to the output
+            // buffer, so the data is only read and written once
+            apply_gains_vis(input_frame.vis.data(), input_frame.weight.data(),
+                            input_frame.vis.data(), input_frame.weight.data(), gain.data(),
+                            gain_conj.data(), weight_factor.data(), num_elements.value());
+            for (uint32_t ii = 0; ii < input_frame.num_elements; ii++)
+                input_frame.gain[ii] *= gain[ii];
+
+            swap_frames(in_buf, input_frame_id, out_buf, output_frame_id);
+
+            // The metadata may still be shared with upstream buffers, so it
+            // must be copied rather than passed as we change the dataset ID
+            allocate_new_metadata_object(out_buf, output_frame_id);
+            copy_metadata(in_buf, input_frame_id, out_buf, output_frame_id);
+            VisFrameView(out_buf, output_frame_id).dataset_id = output_dset_id;
+        } else {
+            allocate_new_metadata_object(out_buf, output_frame_id);
+
+            // Create view to output frame
+            auto output_frame =
+                VisFrameView::create_frame_view(out_buf, output_frame_id, input_frame.num_elements,
+                                                input_frame.num_prod, input_frame.num_ev);
+
+            // Copy over the data we won't modify
+            output_frame.copy_metadata(input_frame);
+            output_frame.copy_data(input_frame, {VisField::vis, VisField::weight});
+            output_frame.dataset_id = output_dset_id;
+
+            apply_gains_vis(output_frame.vis.data(), output_frame.weight.data(),
+                            input_frame.vis.data(), input_frame.weight.data(), gain.data(),
+                            gain_conj.data(), weight_factor.data(), num_elements.value());
+            for (uint32_t ii = 0; ii < input_frame.num_elements; ii++)
+                output_frame.gain[ii] = input_frame.gain[ii] * gain[ii];
         }
 
         // Report how old the gains being applied to the current data are.
@@ -64,6 +64,13 @@
  *                                  prevent discontinuities. Default is 5 minutes.
  * @conf   num_kept_updates Int.    The number of gain updates stored in a FIFO.
  * @conf   num_threads      Int.    Number of threads to run. Default is 1.
+ * @conf   in_place         Bool, default true. Apply the gains directly to the
+ *                                  input frame and swap it into the output
+ *                                  buffer instead of copying it. This is only
+ *                                  done if this stage is the sole consumer of
+ *                                  @c in_buf and producer of @c out_buf, and
+ *                                  the frame sizes match, otherwise the frames
+ *                                  are copied.
  *
  * @par Metrics
  * @metric kotekan_applygains_late_update_count The number of updates received
@@ -120,6 +127,9 @@ private:
     /// Whether to read gains from file or over network
     bool read_from_file;
 
+    /// Whether to apply the gains in place and swap the frames to the output
+    bool in_place;
+
     /// The gains and when to start applying them in a FIFO (len set by config)
     updateQueue<GainUpdate> gains_fifo;
 
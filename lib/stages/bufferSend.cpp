@@ -5,6 +5,7 @@
 #include "buffer.h"              // for Buffer, get_num_full_frames, mark_frame_empty, register...
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "kotekanLogging.hpp"    // for DEBUG2, ERROR, DEBUG, WARN, INFO
+#include "kotekanTrace.hpp"      // for TraceSpan, kotekan_trace_intern
 #include "metadata.h"            // for metadataContainer
 #include "prometheusMetrics.hpp" // for Metrics, Counter
 
@@ -33,6 +34,7 @@
 using kotekan::bufferContainer;
 using kotekan::Config;
 using kotekan::Stage;
+using kotekan::TraceSpan;
 using kotekan::prometheus::Metrics;
 
 REGISTER_KOTEKAN_STAGE(bufferSend);
@@ -49,6 +51,8 @@ bufferSend::bufferSend(Config& config, const std::string& unique_name,
     connected = false;
     server_ip = config.get<std::string>(unique_name, "server_ip");
     server_port = config.get_default<uint32_t>(unique_name, "server_port", 11024);
+    trace_server =
+        kotekan_trace_intern(fmt::format(fmt("{:s}:{:d}"), server_ip, server_port).c_str());
 
     send_timeout = config.get_default<uint32_t>(unique_name, "send_timeout", 20);
     reconnect_time = config.get_default<uint32_t>(unique_name, "reconnect_time", 5);
@@ -93,6 +97,8 @@ void bufferSend::main_thread() {
                  buf->buffer_name, frame_id, server_ip, server_port);
             dropped_frame_counter.inc();
         } else if (connected) {
+            TraceSpan span("send_frame", "network", "server", trace_server, frame_id);
+
             // Send header
             struct bufferFrameHeader header;
             const size_t header_len = sizeof(struct bufferFrameHeader);
@@ -186,6 +192,7 @@ void bufferSend::close_connection() {
 }
 
 void bufferSend::connect_to_server() {
+    kotekan_trace_set_thread_name(fmt::format(fmt("{:s}/connect"), unique_name).c_str());
 
     while (!stop_thread) {
 
@@ -199,7 +206,12 @@ void bufferSend::connect_to_server() {
             throw std::runtime_error(msg);
         }
 
-        if (connect(socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+        int err;
+        {
+            TraceSpan span("connect", "network", "server", trace_server);
+            err = connect(socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+        }
+        if (err == -1) {
             WARN("Could not connect to server {:s}:{:d}, error: {:s}({:d}), waiting {:d} seconds "
                  "to retry...",
                  server_ip, server_port, strerror(errno), errno, reconnect_time);
@@ -92,6 +92,9 @@ private:
     /// The server IP address to connect to.
     std::string server_ip;
 
+    /// The server address shown in the trace, see kotekanTrace.h
+    const char* trace_server;
+
     /// The number of seconds before send() times outs and returns and error.
     uint32_t send_timeout;
 
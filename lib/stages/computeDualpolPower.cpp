@@ -1,6 +1,7 @@
 #include "computeDualpolPower.hpp"
 
 #include "Config.hpp"          // for Config
+#include "ConfigValue.hpp"     // for ConfigValue
 #include "StageFactory.hpp"    // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
 #include "buffer.h"            // for mark_frame_empty, mark_frame_full, register_consumer, reg...
 #include "bufferContainer.hpp" // for bufferContainer
@@ -38,6 +39,7 @@
 
 using kotekan::bufferContainer;
 using kotekan::Config;
+using kotekan::ConfigValue;
 using kotekan::Stage;
 
 REGISTER_KOTEKAN_STAGE(computeDualpolPower);
@@ -77,6 +79,7 @@ void computeDualpolPower::main_thread() {
     const int nthreads = 1;
     int nloop = timesteps_out / nthreads;
     std::thread this_thread[nthreads];
+    ConfigValue<std::vector<int>> cpu_affinity(config, unique_name, "cpu_affinity");
 
     while (!stop_thread) {
         in_local = (unsigned char*)wait_for_full_frame(buf_in, unique_name.c_str(), buf_in_id);
@@ -92,7 +95,7 @@ void computeDualpolPower::main_thread() {
             this_thread[j] = std::thread(&computeDualpolPower::parallelSqSumVdif, this, j, nloop);
             cpu_set_t cpuset;
             CPU_ZERO(&cpuset);
-            for (auto& i : config.get<std::vector<int>>(unique_name, "cpu_affinity"))
+            for (auto& i : cpu_affinity.get())
                 CPU_SET(i, &cpuset);
             pthread_setaffinity_np(this_thread[j].native_handle(), sizeof(cpu_set_t), &cpuset);
         }
@@ -6,7 +6,7 @@
 #include "buffer.h"              // for mark_frame_empty, allocate_new_metadata_object, mark_fr...
 #include "datasetState.hpp"      // for datasetState, eigenvalueState, state_uptr
 #include "kotekanLogging.hpp"    // for DEBUG, ERROR, INFO
-#include "prometheusMetrics.hpp" // for Metrics, Gauge, MetricFamily
+#include "prometheusMetrics.hpp" // for Metrics, Gauge, MetricFamily, Histogram
 #include "visBuffer.hpp"         // for VisFrameView, VisField, VisField::erms, VisField::eval
 #include "visUtil.hpp"           // for cfloat, frameID, modulo, current_time, cmap, movingAverage
 
@@ -97,6 +97,8 @@ void eigenVis::main_thread() {
 
     auto& comp_time_seconds_metric =
         Metrics::instance().add_gauge("kotekan_eigenvis_comp_time_seconds", unique_name);
+    auto& comp_duration_seconds_metric =
+        Metrics::instance().add_histogram("kotekan_eigenvis_comp_duration_seconds", unique_name);
 
     // TODO: this should logically be a Counter
     auto& lapack_failure_counter = Metrics::instance().add_gauge(
@@ -239,6 +241,7 @@ void eigenVis::main_thread() {
         // Update average write time in prometheus
         calc_time.add_sample(elapsed_time);
         comp_time_seconds_metric.set(calc_time.average());
+        comp_duration_seconds_metric.observe(elapsed_time);
 
         // Output eigenvalues to prometheus
         for (uint32_t i = 0; i < num_eigenvectors; i++) {
@@ -51,6 +51,8 @@
  * @metric kotekan_eigenvis_comp_time_seconds
  *         Time required to find eigenvectors. An exponential moving average over
  *         ~10 samples.
+ * @metric kotekan_eigenvis_comp_duration_seconds
+ *         Histogram of the time required to find the eigenvectors of each frame.
  * @metric kotekan_eigenvis_eigenvalue
  *         The value of each eigenvalue calculated, or the RMS.
  * @metric kotekan_eigenvis_lapack_failure_total
@@ -1,6 +1,7 @@
 #include "rfiAVXVDIF.hpp"
 
 #include "Config.hpp"          // for Config
+#include "ConfigValue.hpp"     // for ConfigValue
 #include "StageFactory.hpp"    // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
 #include "buffer.h"            // for mark_frame_empty, mark_frame_full, register_consumer, reg...
 #include "bufferContainer.hpp" // for bufferContainer
@@ -37,6 +38,7 @@
 
 using kotekan::bufferContainer;
 using kotekan::Config;
+using kotekan::ConfigValue;
 using kotekan::Stage;
 
 REGISTER_KOTEKAN_STAGE(rfiAVXVDIF);
@@ -73,6 +75,7 @@ void rfiAVXVDIF::main_thread() {
     uint32_t nthreads = 1;
     uint32_t nloop = (_samples_per_data_set / _sk_step) / nthreads;
     std::thread this_thread[nthreads];
+    ConfigValue<std::vector<int>> cpu_affinity(config, unique_name, "cpu_affinity");
     // Endless Loop
     while (!stop_thread) {
         // Get input frame
@@ -92,7 +95,7 @@ void rfiAVXVDIF::main_thread() {
             this_thread[j] = std::thread(&rfiAVXVDIF::parallelSpectralKurtosis, this, j, nloop);
             cpu_set_t cpuset;
             CPU_ZERO(&cpuset);
-            for (auto& i : config.get<std::vector<int>>(unique_name, "cpu_affinity"))
+            for (auto& i : cpu_affinity.get())
                 CPU_SET(i, &cpuset);
             pthread_setaffinity_np(this_thread[j].native_handle(), sizeof(cpu_set_t), &cpuset);
         }
@@ -1,22 +1,24 @@
 #include "visAccumulate.hpp"
 
-#include "Config.hpp"            // for Config
-#include "Hash.hpp"              // for operator!=
-#include "StageFactory.hpp"      // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
-#include "Telescope.hpp"         // for Telescope
-#include "buffer.h"              // for register_producer, Buffer, allocate_new_metadata_object
-#include "bufferContainer.hpp"   // for bufferContainer
-#include "chimeMetadata.hpp"     // for chimeMetadata, get_dataset_id, get_fpga_seq_num, get_lo...
-#include "configUpdater.hpp"     // for configUpdater
-#include "datasetManager.hpp"    // for state_id_t, dset_id_t, datasetManager
-#include "datasetState.hpp"      // for eigenvalueState, freqState, gatingState, inputState
-#include "factory.hpp"           // for FACTORY
-#include "kotekanLogging.hpp"    // for FATAL_ERROR, INFO, logLevel, DEBUG
-#include "metadata.h"            // for metadataContainer
-#include "prometheusMetrics.hpp" // for Counter, MetricFamily, Metrics
-#include "version.h"             // for get_git_commit_hash
-#include "visBuffer.hpp"         // for VisFrameView
-#include "visUtil.hpp"           // for prod_ctype, frameID, modulo, input_ctype, operator+
+#include "Config.hpp"              // for Config
+#include "Hash.hpp"                // for operator!=
+#include "StageFactory.hpp"        // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
+#include "Telescope.hpp"           // for Telescope
+#include "WorkerPool.hpp"          // for WorkerPool
+#include "buffer.h"                // for register_producer, Buffer, allocate_new_metadata_object
+#include "bufferContainer.hpp"     // for bufferContainer
+#include "chimeMetadata.hpp"       // for chimeMetadata, get_dataset_id, get_fpga_seq_num, get_lo...
+#include "configUpdater.hpp"       // for configUpdater
+#include "datasetManager.hpp"      // for state_id_t, dset_id_t, datasetManager
+#include "datasetState.hpp"        // for eigenvalueState, freqState, gatingState, inputState
+#include "factory.hpp"             // for FACTORY
+#include "kotekanLogging.hpp"      // for FATAL_ERROR, INFO, logLevel, DEBUG
+#include "metadata.h"              // for metadataContainer
+#include "prometheusMetrics.hpp"   // for Counter, MetricFamily, Metrics
+#include "version.h"               // for get_git_commit_hash
+#include "visAccumulateKernel.hpp" // for accumulate_vis, accumulate_vis_even, accumulate_vis_odd
+#include "visBuffer.hpp"           // for VisFrameView
+#include "visUtil.hpp"             // for prod_ctype, frameID, modulo, input_ctype, operator+
 
 #include "fmt.hpp"      // for format, fmt
 #include "gsl-lite.hpp" // for span<>::iterator, span
@@ -27,9 +29,9 @@
 #include <atomic>     // for atomic_bool
 #include <cmath>      // for pow
 #include <complex>    // for operator*, complex
-#include <cstring>    // for memcpy
 #include <exception>  // for exception
 #include <iterator>   // for back_insert_iterator, begin, end, back_inserter
+#include <memory>     // for make_unique, unique_ptr
 #include <mutex>      // for lock_guard, mutex
 #include <numeric>    // for iota
 #include <optional>   // for optional
@@ -70,6 +72,7 @@ visAccumulate::visAccumulate(Config& config, const std::string& unique_name,
     // Get the indices for reordering
     auto input_reorder = parse_reorder_default(config, unique_name);
     input_remap = std::get<0>(input_reorder);
+    gather_plan = vis_triangle_gather_plan(input_remap, block_size, num_elements);
 
     float int_time = config.get_default<float>(unique_name, "integration_time", -1.0);
 
@@ -95,6 +98,24 @@ visAccumulate::visAccumulate(Config& config, const std::string& unique_name,
     size_t nb = num_elements / block_size;
     num_prod_gpu = num_freq_in_frame * nb * (nb + 1) * block_size * block_size / 2;
 
+    // The main thread takes part in all parallel sections, so start one fewer helper
+    num_threads = config.get_default<uint32_t>(unique_name, "num_threads", 1);
+    if (num_threads == 0)
+        throw std::invalid_argument("visAccumulate: num_threads has to be at least 1.");
+    pool = std::make_unique<WorkerPool>(num_threads - 1,
+                                        config.get<std::vector<int>>(unique_name, "cpu_affinity"),
+                                        unique_name);
+
+    // Split the products into one contiguous range per thread. Round the ranges
+    // to a multiple of 16 products so that each starts on a cache line in every
+    // accumulation array and the vectorised kernels have no tails to deal with
+    // except at the very end.
+    size_t chunk = (num_prod_gpu + num_threads - 1) / num_threads;
+    chunk = std::max<size_t>(16 * ((chunk + 15) / 16), 16);
+    for (size_t p = 0; p < num_prod_gpu; p += chunk) {
+        prod_chunks.emplace_back(p, std::min(chunk, num_prod_gpu - p));
+    }
+
     // Get everything we need for registering dataset states
 
     // --> get metadata
@@ -139,6 +160,15 @@ visAccumulate::visAccumulate(Config& config, const std::string& unique_name,
     in_buf = get_buffer("in_buf");
     register_consumer(in_buf, unique_name.c_str());
 
+    // By default leave at least half of the ring to the GPU while we process a batch
+    max_batch_frames = config.get_default<int>(unique_name, "max_batch_frames",
+                                               std::max(in_buf->num_frames / 2, 1));
+    if (max_batch_frames < 1) {
+        throw std::invalid_argument(
+            fmt::format("visAccumulate: max_batch_frames must be positive (got {:d})",
+                        max_batch_frames));
+    }
+
     out_buf = get_buffer("out_buf");
     register_producer(out_buf, unique_name.c_str());
 
@@ -283,179 +313,207 @@ void visAccumulate::main_thread() {
 
     while (!stop_thread) {
 
-        // Fetch a new frame and get its sequence id
-        uint8_t* in_frame = wait_for_full_frame(in_buf, unique_name.c_str(), in_frame_id);
-        if (in_frame == nullptr)
+        // Fetch all the frames which are ready, they are processed in order and released together
+        int num_in_frames = wait_for_full_frames(in_buf, unique_name.c_str(), in_frame_id,
+                                                 max_batch_frames, nullptr);
+        if (num_in_frames < 0)
             break;
+        frameID batch_start_id = in_frame_id;
 
-        // Check if dataset ID changed
-        dset_id_t ds_id_in_new = get_dataset_id(in_buf, in_frame_id);
-        if (!ds_id_in || ds_id_in_new != *ds_id_in) {
-            ds_id_in = ds_id_in_new;
-
-            // Register base dataset. If no dataset ID was was set in the incoming frame,
-            // ds_id_in will be dset_id_t::null and thus cause a root dataset to
-            // be registered.
-            base_dataset_id = dm.add_dataset(base_dataset_states, *ds_id_in);
-            DEBUG("Registered base dataset: {}", base_dataset_id)
-
-            // Set the output dataset ID for all datasets
-            for (auto& state : gated_datasets) {
-                state.output_dataset_id = register_gate_dataset(*state.spec.get());
-            }
-        }
-
-        int32_t* input = (int32_t*)in_frame;
-        uint64_t frame_count = (get_fpga_seq_num(in_buf, in_frame_id) / samples_per_data_set);
-
-        // Start and end times of this frame
-        timespec t_s;
-        if (gps_time_enabled) {
-            t_s = ((chimeMetadata*)in_buf->metadata[in_frame_id]->metadata)->gps_time;
-        } else {
-            // If GPS time is not set, fall back to system time.
-            TIMEVAL_TO_TIMESPEC(
-                &((chimeMetadata*)in_buf->metadata[in_frame_id]->metadata)->first_packet_recv_time,
-                &t_s);
-        }
-        timespec t_e = add_nsec(t_s, samples_per_data_set * tel.seq_length_nsec());
+        for (int batch_ind = 0; batch_ind < num_in_frames; batch_ind++, in_frame_id++) {
 
-        // If we have wrapped around we need to write out any frames that have
-        // been filled in previous iterations. In here we need to reorder the
-        // accumulates and do any final manipulations.
-        bool wrapped = (last_frame_count / num_gpu_frames) < (frame_count / num_gpu_frames);
+            // Get the frame and its sequence id
+            uint8_t* in_frame = in_buf->frames[in_frame_id];
 
-        if (init && wrapped) {
+            // Check if dataset ID changed
+            dset_id_t ds_id_in_new = get_dataset_id(in_buf, in_frame_id);
+            if (!ds_id_in || ds_id_in_new != *ds_id_in) {
+                ds_id_in = ds_id_in_new;
 
-            internalState& d0 = enabled_gated_datasets.at(0);
+                // Register base dataset. If no dataset ID was was set in the incoming frame,
+                // ds_id_in will be dset_id_t::null and thus cause a root dataset to
+                // be registered.
+                base_dataset_id = dm.add_dataset(base_dataset_states, *ds_id_in);
+                DEBUG("Registered base dataset: {}", base_dataset_id)
 
-            // Debias the weights estimate, by subtracting out the bias estimation
-            float w = d0.weight_diff_sum / pow(d0.sample_weight_total, 2);
-            for (size_t i = 0; i < num_prod_gpu; i++) {
-                float di = d0.vis1[2 * i];
-                float dr = d0.vis1[2 * i + 1];
-                d0.vis2[i] -= w * (dr * dr + di * di);
+                // Set the output dataset ID for all datasets
+                for (auto& state : gated_datasets) {
+                    state.output_dataset_id = register_gate_dataset(*state.spec.get());
+                }
             }
 
-            // Iterate over *only* the gated datasets (remember that element
-            // zero is the vis), and remove the bias and copy in the variance
-            for (size_t i = 1; i < enabled_gated_datasets.size(); i++) {
-                combine_gated(enabled_gated_datasets.at(i), d0);
+            int32_t* input = (int32_t*)in_frame;
+            uint64_t frame_count = (get_fpga_seq_num(in_buf, in_frame_id) / samples_per_data_set);
+
+            // Start and end times of this frame
+            timespec t_s;
+            auto in_metadata = (chimeMetadata*)in_buf->metadata[in_frame_id]->metadata;
+            if (gps_time_enabled) {
+                t_s = in_metadata->gps_time;
+            } else {
+                // If GPS time is not set, fall back to system time.
+                TIMEVAL_TO_TIMESPEC(&in_metadata->first_packet_recv_time, &t_s);
             }
-
-            // Finalise the output and release the frames
-            for (internalState& dset : enabled_gated_datasets) {
-                finalise_output(dset, t_s);
+            timespec t_e = add_nsec(t_s, samples_per_data_set * tel.seq_length_nsec());
+
+            // If we have wrapped around we need to write out any frames that have
+            // been filled in previous iterations. In here we need to reorder the
+            // accumulates and do any final manipulations.
+            bool wrapped = (last_frame_count / num_gpu_frames) < (frame_count / num_gpu_frames);
+
+            if (init && wrapped) {
+
+                internalState& d0 = enabled_gated_datasets.at(0);
+
+                // Debias the weights estimate, by subtracting out the bias estimation
+                float w = d0.weight_diff_sum / pow(d0.sample_weight_total, 2);
+                pool->parallel_for(prod_chunks.size(), [&](size_t c) {
+                    auto [start, count] = prod_chunks[c];
+                    for (size_t i = start; i < start + count; i++) {
+                        float di = d0.vis1[2 * i];
+                        float dr = d0.vis1[2 * i + 1];
+                        d0.vis2[i] -= w * (dr * dr + di * di);
+                    }
+                });
+
+                // Iterate over *only* the gated datasets (remember that element
+                // zero is the vis), and remove the bias and copy in the variance
+                pool->parallel_for(enabled_gated_datasets.size() - 1, [&](size_t i) {
+                    combine_gated(enabled_gated_datasets.at(i + 1), d0);
+                });
+
+                // Finalise the output and release the frames
+                finalise_output(enabled_gated_datasets, t_s);
+
+                init = false;
+                frames_in_this_cycle = 0;
             }
 
-            init = false;
-            frames_in_this_cycle = 0;
-        }
-
-        // We've started accumulating a new frame. Initialise the output and
-        // copy over any metadata.
-        if (frame_count % num_gpu_frames == 0) {
+            // We've started accumulating a new frame. Initialise the output and
+            // copy over any metadata.
+            if (frame_count % num_gpu_frames == 0) {
 
-            // Reset gated streams and find which ones are enabled for this period
-            enabled_gated_datasets.clear();
-            for (auto& state : gated_datasets) {
-                if (reset_state(state, t_s)) {
-                    enabled_gated_datasets.push_back(state);
+                // Reset gated streams and find which ones are enabled for this period
+                enabled_gated_datasets.clear();
+                for (auto& state : gated_datasets) {
+                    if (reset_state(state, t_s)) {
+                        enabled_gated_datasets.push_back(state);
+                    }
                 }
-            }
 
-            // For each dataset and frequency, claim an empty frame and initialise it...
-            for (internalState& dset : enabled_gated_datasets) {
-                // Initialise the output, if true is returned we need to exit
-                // the process as kotekan is shutting down
-                if (initialise_output(dset, in_frame_id)) {
-                    return;
+                // For each dataset and frequency, claim an empty frame and initialise it...
+                for (internalState& dset : enabled_gated_datasets) {
+                    // Initialise the output, if true is returned we need to exit
+                    // the process as kotekan is shutting down
+                    if (initialise_output(dset, in_frame_id)) {
+                        return;
+                    }
                 }
+
+                init = true;
             }
 
-            init = true;
-        }
+            // If we've got to here and we've not initialised we need to skip this frame.
+            if (init) {
+
+                // Get the amount of data in the frame
+                // TODO: for the multifrequency support this probably needs to become frequency
+                // dependent
+                int32_t lost_in_frame = get_lost_timesamples(in_buf, in_frame_id);
+                int32_t rfi_in_frame = get_rfi_flagged_samples(in_buf, in_frame_id);
 
-        // If we've got to here and we've not initialised we need to skip this frame.
-        if (init) {
+                // Assert that we haven't got an issue calculating the lost data
+                // This did happen when the RFI system was messing up.
+                assert(lost_in_frame >= 0);
+                assert(rfi_in_frame >= 0);
+                assert(samples_per_data_set >= (size_t)lost_in_frame);
+                assert(samples_per_data_set >= (size_t)rfi_in_frame);
 
-            // Get the amount of data in the frame
-            // TODO: for the multifrequency support this probably needs to become frequency
-            // dependent
-            int32_t lost_in_frame = get_lost_timesamples(in_buf, in_frame_id);
-            int32_t rfi_in_frame = get_rfi_flagged_samples(in_buf, in_frame_id);
+                int32_t samples_in_frame = samples_per_data_set - lost_in_frame;
 
-            // Assert that we haven't got an issue calculating the lost data
-            // This did happen when the RFI system was messing up.
-            assert(lost_in_frame >= 0);
-            assert(rfi_in_frame >= 0);
-            assert(samples_per_data_set >= (size_t)lost_in_frame);
-            assert(samples_per_data_set >= (size_t)rfi_in_frame);
+                // Find the datasets to accumulate into and update their sample counts. At
+                // the moment this doesn't really work if there are multiple frequencies in
+                // the same buffer..
+                size_t num_accumulate = 0;
+                for (internalState& dset : enabled_gated_datasets) {
 
-            int32_t samples_in_frame = samples_per_data_set - lost_in_frame;
+                    float freq_in_MHz = tel.to_freq(dset.frames[0].freq_id);
+                    float w = dset.calculate_weight(t_s, t_e, freq_in_MHz);
 
-            // Accumulate the weighted data into each dataset. At the moment this
-            // doesn't really work if there are multiple frequencies in the same buffer..
-            for (internalState& dset : enabled_gated_datasets) {
+                    // Don't bother to accumulate if weight is zero
+                    if (w == 0)
+                        break;
+                    num_accumulate++;
 
-                float freq_in_MHz = tel.to_freq(dset.frames[0].freq_id);
-                float w = dset.calculate_weight(t_s, t_e, freq_in_MHz);
+                    dset.sample_weight_total += samples_in_frame;
 
-                // Don't bother to accumulate if weight is zero
-                if (w == 0)
-                    break;
+                    for (auto& frame : dset.frames) {
+                        // Accumulate the samples/RFI
+                        frame.fpga_seq_total += (uint32_t)samples_in_frame;
+                        frame.rfi_total += (uint32_t)rfi_in_frame;
 
+                        DEBUG("Lost samples {:d}, RFI flagged samples {:d}, total_samples: {:d}",
+                              lost_in_frame, rfi_in_frame, frame.fpga_seq_total);
+                    }
+                }
+
+                // Accumulate the data, split over product ranges and datasets.
                 // TODO: implement generalised non uniform weighting, I'm primarily
                 // not doing this because I don't want to burn cycles doing the
                 // multiplications
-                // Perform primary accumulation (assume that the weight is one)
-                for (size_t i = 0; i < 2 * num_prod_gpu; i++) {
-                    dset.vis1[i] += input[i];
+                // Perform primary accumulation (assume that the weight is one).
+                // Even frames are saved for the variance estimate, and odd ones
+                // difference against them. The main dataset does this in the same
+                // pass over the input as its accumulation, and always needs
+                // processing even if its weight was zero.
+                bool even = (frame_count % 2 == 0);
+                internalState& d0 = enabled_gated_datasets.at(0);
+                size_t num_tasks = std::max<size_t>(num_accumulate, 1) * prod_chunks.size();
+
+                pool->parallel_for(num_tasks, [&](size_t task) {
+                    size_t dset_ind = task / prod_chunks.size();
+                    auto [start, count] = prod_chunks[task % prod_chunks.size()];
+                    const int32_t* in = input + 2 * start;
+
+                    if (dset_ind == 0) {
+                        int32_t* acc = (num_accumulate > 0) ? d0.vis1.data() + 2 * start : nullptr;
+                        if (even) {
+                            accumulate_vis_even(acc, vis_even.data() + 2 * start, in, count);
+                        } else {
+                            accumulate_vis_odd(acc, d0.vis2.data() + start,
+                                               vis_even.data() + 2 * start, in, count);
+                        }
+                    } else {
+                        internalState& dset = enabled_gated_datasets.at(dset_ind);
+                        accumulate_vis(dset.vis1.data() + 2 * start, in, 2 * count);
+                    }
+                });
+
+                // We are calculating the weights by differencing even and odd samples.
+                // Every even sample we save the set of visibilities...
+                if (even) {
+                    samples_even = samples_in_frame;
                 }
-
-                dset.sample_weight_total += samples_in_frame;
-
-                for (auto& frame : dset.frames) {
-                    // Accumulate the samples/RFI
-                    frame.fpga_seq_total += (uint32_t)samples_in_frame;
-                    frame.rfi_total += (uint32_t)rfi_in_frame;
-
-                    DEBUG("Lost samples {:d}, RFI flagged samples {:d}, total_samples: {:d}",
-                          lost_in_frame, rfi_in_frame, frame.fpga_seq_total);
+                // ... every odd sample we accumulate the squared differences into the weight
+                // dataset
+                // NOTE: this incrementally calculates the variance, but eventually
+                // output_frame.weight will hold the *inverse* variance
+                // TODO: we might need to account for packet loss in here too, but it
+                // would require some awkward rescalings
+                else {
+                    // Accumulate the squared samples difference which we need for
+                    // debiasing the variance estimate
+                    float samples_diff = samples_in_frame - samples_even;
+                    d0.weight_diff_sum += samples_diff * samples_diff;
                 }
             }
 
-            // We are calculating the weights by differencing even and odd samples.
-            // Every even sample we save the set of visibilities...
-            if (frame_count % 2 == 0) {
-                std::memcpy(vis_even.data(), input, 8 * num_prod_gpu);
-                samples_even = samples_in_frame;
-            }
-            // ... every odd sample we accumulate the squared differences into the weight dataset
-            // NOTE: this incrementally calculates the variance, but eventually
-            // output_frame.weight will hold the *inverse* variance
-            // TODO: we might need to account for packet loss in here too, but it
-            // would require some awkward rescalings
-            else {
-                internalState& d0 = enabled_gated_datasets.at(0); // Save into the main vis dataset
-                for (size_t i = 0; i < num_prod_gpu; i++) {
-                    // NOTE: avoid using the slow std::complex routines in here
-                    float di = input[2 * i] - vis_even[2 * i];
-                    float dr = input[2 * i + 1] - vis_even[2 * i + 1];
-                    d0.vis2[i] += (dr * dr + di * di);
-                }
-
-                // Accumulate the squared samples difference which we need for
-                // debiasing the variance estimate
-                float samples_diff = samples_in_frame - samples_even;
-                d0.weight_diff_sum += samples_diff * samples_diff;
-            }
+            last_frame_count = frame_count;
+            frames_in_this_cycle++;
         }
 
-        // Move the input buffer on one step
-        mark_frame_empty(in_buf, unique_name.c_str(), in_frame_id++);
-        last_frame_count = frame_count;
-        frames_in_this_cycle++;
+        // Move the input buffer on past the batch
+        mark_frames_empty(in_buf, unique_name.c_str(), batch_start_id, num_in_frames);
     }
 }
 
@@ -533,59 +591,80 @@ void visAccumulate::combine_gated(visAccumulate::internalState& gate,
 }
 
 
-void visAccumulate::finalise_output(visAccumulate::internalState& state,
+void visAccumulate::finalise_output(std::vector<std::reference_wrapper<internalState>>& states,
                                     timespec newest_frame_time) {
 
-    // Determine the weighting factors (if weight is zero we should just
-    // multiply the visibilities by zero so as not to generate Infs)
-    float w = state.sample_weight_total;
-    float iw = (w != 0.0) ? (1.0 / w) : 0.0;
+    // Frames to unpack, given as (dataset index, freq_ind)
+    std::vector<std::pair<size_t, size_t>> to_write;
 
-    bool blocked = false;
+    for (size_t state_ind = 0; state_ind < states.size(); state_ind++) {
+        internalState& state = states[state_ind];
 
-    // Loop over the frequencies in the frame and unpack the accumulates
-    // into the output frame...
-    for (size_t freq_ind = 0; freq_ind < num_freq_in_frame; freq_ind++) {
-        auto output_frame = state.frames[freq_ind];
-
-        // Check if we need to skip the frame.
-        //
-        // TODO: if we have multifrequencies, if any need to be skipped all of
-        // the following ones must be too. I think this requires the buffer
-        // mechanism being rewritten to fix this one.
-        if (ts_to_double(newest_frame_time - std::get<1>(output_frame.time)) > max_age) {
-            skipped_frame_counter.labels({std::to_string(output_frame.freq_id), "age"}).inc();
-            blocked = true;
-            continue;
-        }
-        if (output_frame.fpga_seq_total < minimum_samples) {
-            skipped_frame_counter.labels({std::to_string(output_frame.freq_id), "flagged"}).inc();
-            blocked = true;
-            continue;
-        } else if (blocked) {
-            // If we are here, an earlier frame was skipped and thus we have to
-            // throw this one away too. Mark it as skipped because it was
-            // blocked.
-            skipped_frame_counter.labels({std::to_string(output_frame.freq_id), "blocked"}).inc();
-            continue;
-        }
+        bool blocked = false;
 
-        // Copy the visibilities into place
-        map_vis_triangle(input_remap, block_size, num_elements, freq_ind,
-                         [&](int32_t pi, int32_t bi, bool conj) {
-                             cfloat t = {(float)state.vis1[2 * bi + 1], (float)state.vis1[2 * bi]};
-                             t = !conj ? t : std::conj(t);
-                             output_frame.vis[pi] = iw * t;
-                         });
-
-        // Unpack and invert the weights
-        map_vis_triangle(input_remap, block_size, num_elements, freq_ind,
-                         [&](int32_t pi, int32_t bi, bool conj) {
-                             (void)conj;
-                             float t = state.vis2[bi];
-                             output_frame.weight[pi] = w * w / t;
-                         });
+        // Loop over the frequencies in the frame and work out which ones can be
+        // written out
+        for (size_t freq_ind = 0; freq_ind < num_freq_in_frame; freq_ind++) {
+            auto& output_frame = state.frames[freq_ind];
+
+            // Check if we need to skip the frame.
+            //
+            // TODO: if we have multifrequencies, if any need to be skipped all of
+            // the following ones must be too. I think this requires the buffer
+            // mechanism being rewritten to fix this one.
+            if (ts_to_double(newest_frame_time - std::get<1>(output_frame.time)) > max_age) {
+                skipped_frame_counter.labels({std::to_string(output_frame.freq_id), "age"}).inc();
+                blocked = true;
+                continue;
+            }
+            if (output_frame.fpga_seq_total < minimum_samples) {
+                skipped_frame_counter.labels({std::to_string(output_frame.freq_id), "flagged"})
+                    .inc();
+                blocked = true;
+                continue;
+            } else if (blocked) {
+                // If we are here, an earlier frame was skipped and thus we have to
+                // throw this one away too. Mark it as skipped because it was
+                // blocked.
+                skipped_frame_counter.labels({std::to_string(output_frame.freq_id), "blocked"})
+                    .inc();
+                continue;
+            }
+
+            to_write.emplace_back(state_ind, freq_ind);
+        }
+    }
 
+    // ... unpack the accumulates into the output frames in parallel. Each frame
+    // is split into product ranges so that single frames also use the pool ...
+    const size_t num_prod = gather_plan.size();
+    const size_t chunk = std::max<size_t>(16 * ((num_prod / (pool->size() + 1) + 15) / 16), 16);
+    const size_t num_chunks = (num_prod + chunk - 1) / chunk;
+
+    pool->parallel_for(to_write.size() * num_chunks, [&](size_t task) {
+        internalState& state = states[to_write[task / num_chunks].first];
+        size_t freq_ind = to_write[task / num_chunks].second;
+        auto& output_frame = state.frames[freq_ind];
+
+        size_t start = (task % num_chunks) * chunk;
+        size_t count = std::min(chunk, num_prod - start);
+
+        // Determine the weighting factors (if weight is zero we should just
+        // multiply the visibilities by zero so as not to generate Infs)
+        float w = state.sample_weight_total;
+        float iw = (w != 0.0) ? (1.0 / w) : 0.0;
+
+        // Copy the visibilities into place, and unpack and invert the weights
+        size_t offset = freq_ind * gpu_N2_size(num_elements, block_size);
+        unpack_vis(output_frame.vis.data() + start, output_frame.weight.data() + start,
+                   gather_plan.data() + start, count, state.vis1.data() + 2 * offset,
+                   state.vis2.data() + offset, iw, w * w);
+    });
+
+    // ... and release them in order
+    for (auto& [state_ind, freq_ind] : to_write) {
+        (void)freq_ind;
+        internalState& state = states[state_ind];
         mark_frame_full(state.buf, unique_name.c_str(), state.frame_id++);
     }
 }
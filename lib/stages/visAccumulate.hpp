@@ -9,6 +9,7 @@
 
 #include "Config.hpp"            // for Config
 #include "Stage.hpp"             // for Stage
+#include "WorkerPool.hpp"        // for WorkerPool
 #include "buffer.h"              // for Buffer
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "datasetManager.hpp"    // for dset_id_t
@@ -19,7 +20,7 @@
 
 #include <cstdint>    // for uint32_t, int32_t
 #include <deque>      // for deque
-#include <functional> // for function
+#include <functional> // for function, reference_wrapper
 #include <map>        // for map
 #include <memory>     // for unique_ptr
 #include <mutex>      // for mutex
@@ -72,6 +73,15 @@
  *                              Default 0..1023.
  * @conf  max_age               Float. Drop frames later than this number of seconds.
  *                              Default is 60.0
+ * @conf  max_batch_frames      Int. Maximum number of input frames to acquire and
+ *                              release at once when the stage has a backlog.
+ *                              Default is half the input buffer.
+ * @conf  num_threads           Int. Number of threads to accumulate and unpack
+ *                              with, including the main stage thread. The
+ *                              frame is split into contiguous product ranges
+ *                              (so whole frequencies for multi-frequency
+ *                              frames) and gated datasets. Extra threads are
+ *                              pinned to `cpu_affinity`. Default is 1.
  *
  * @par Metrics
  * @metric  kotekan_visaccumulate_skipped_frame_total
@@ -160,6 +170,8 @@ private:
     size_t num_gpu_frames;
     size_t minimum_samples;
     float max_age;
+    int max_batch_frames;
+    uint32_t num_threads;
 
     // Derived from config
     size_t num_prod_gpu;
@@ -167,6 +179,15 @@ private:
     // The mapping from buffer element order to output file element ordering
     std::vector<uint32_t> input_remap;
 
+    /// Where to find each output product in the GPU data, see `vis_triangle_gather_plan`
+    std::vector<uint32_t> gather_plan;
+
+    /// Helper threads used alongside the main thread when `num_threads` > 1
+    std::unique_ptr<WorkerPool> pool;
+
+    /// Product ranges (start, count) that each parallel task handles
+    std::vector<std::pair<size_t, size_t>> prod_chunks;
+
     // Helper methods to make code clearer
 
     /**
@@ -192,13 +213,17 @@ private:
     bool initialise_output(internalState& state, int in_frame_id);
 
     /**
-     * @brief Fill in the data sections of VisBuffer and release the frame.
+     * @brief Fill in the data sections of VisBuffers and release the frames.
+     *
+     * The unpacking of every frequency in every dataset is spread across the
+     * worker pool, but the frames are released in order.
      *
-     * @param  state              Dataset to process.
+     * @param  states             Datasets to process.
      * @param  newest_frame_time  Used for deciding how late a frame is. A UNIX
      *                            time in seconds.
      **/
-    void finalise_output(internalState& state, timespec newest_frame_time);
+    void finalise_output(std::vector<std::reference_wrapper<internalState>>& states,
+                         timespec newest_frame_time);
 
     /**
      * @brief Reset the state when we restart an integration.
@@ -9,8 +9,9 @@
 #include "datasetManager.hpp"    // for dset_id_t, state_id_t, datasetManager
 #include "datasetState.hpp"      // for stackState, prodState, inputState
 #include "kotekanLogging.hpp"    // for INFO, DEBUG, ERROR, FATAL_ERROR
-#include "prometheusMetrics.hpp" // for Gauge, Counter, Metrics, MetricFamily
+#include "prometheusMetrics.hpp" // for Gauge, Counter, Metrics, MetricFamily, Histogram
 #include "visBuffer.hpp"         // for VisFrameView, VisField, VisField::vis, VisField::weight
+#include "visStackKernel.hpp"    // for stackPlan, make_stack_plan, stack_vis
 #include "visUtil.hpp"           // for current_time, modulo, rstack_ctype, cfloat, frameID
 
 #include "gsl-lite.hpp" // for span
@@ -53,6 +54,8 @@ baselineCompression::baselineCompression(Config& config, const std::string& uniq
                                "kotekan_baselinecompression_residuals", unique_name, {"freq_id"})),
     compression_time_seconds_metric(Metrics::instance().add_gauge(
         "kotekan_baselinecompression_time_seconds", unique_name, {"thread_id"})),
+    compression_duration_seconds_metric(Metrics::instance().add_histogram(
+        "kotekan_baselinecompression_duration_seconds", unique_name)),
     compression_frame_counter(Metrics::instance().add_counter(
         "kotekan_baselinecompression_frame_total", unique_name, {"thread_id"})) {
 
@@ -127,18 +130,22 @@ void baselineCompression::change_dataset_state(dset_id_t input_ds_id) {
 
         // Calculate stack description and register the state
         auto sspec = calculate_stack(istate_ptr->get_inputs(), pstate_ptr->get_prods());
+        auto plan = make_stack_plan(sspec.second, pstate_ptr->get_prods(), sspec.first);
         auto [state_id, sstate_ptr] =
             dm.create_state<stackState>(sspec.first, std::move(sspec.second));
 
+        DEBUG("Stacking {:d} products into {:d} stacks in {:d} runs.", plan.num_prod,
+              plan.num_stack, plan.runs.size());
+
         // Insert state into map
-        state_map[fprint] = {state_id, sstate_ptr, pstate_ptr};
+        state_map[fprint] = {state_id, sstate_ptr, std::move(plan)};
     }
 
 
-    auto [state_id, sstate, pstate] = state_map.at(fprint);
+    const auto& [state_id, sstate, plan] = state_map.at(fprint);
     auto new_ds_id = dm.add_dataset(state_id, input_ds_id);
 
-    dset_id_map[input_ds_id] = {new_ds_id, sstate, pstate};
+    dset_id_map[input_ds_id] = {new_ds_id, &plan};
 
     INFO("Created new stack update and registering. Took {:.2f}s", current_time() - start_time);
 }
@@ -162,6 +169,11 @@ void baselineCompression::compress_thread(uint32_t thread_id) {
     }
     auto input_frame = VisFrameView(in_buf, input_frame_id);
 
+    // The per thread metrics, resolved once rather than for every frame
+    const std::vector<std::string> thread_label = {std::to_string(thread_id)};
+    auto& compression_time_seconds = compression_time_seconds_metric.labels(thread_label);
+    auto& compression_frames = compression_frame_counter.labels(thread_label);
+
     while (!stop_thread) {
 
         // Wait for the input buffer to be filled with data
@@ -175,8 +187,7 @@ void baselineCompression::compress_thread(uint32_t thread_id) {
         auto input_frame = VisFrameView(in_buf, input_frame_id);
 
         dset_id_t new_dset_id;
-        const stackState* sstate_ptr = nullptr;
-        const prodState* pstate_ptr = nullptr;
+        const stackPlan* plan = nullptr;
 
         // If the input dataset has changed construct a new stack spec for the
         // datasetManager
@@ -185,15 +196,14 @@ void baselineCompression::compress_thread(uint32_t thread_id) {
             if (dset_id_map.count(input_frame.dataset_id) == 0) {
                 change_dataset_state(input_frame.dataset_id);
             }
-            std::tie(new_dset_id, sstate_ptr, pstate_ptr) = dset_id_map.at(input_frame.dataset_id);
+            std::tie(new_dset_id, plan) = dset_id_map.at(input_frame.dataset_id);
         }
 
-        const auto& stack_map = sstate_ptr->get_rstack_map();
-        const auto& prods = pstate_ptr->get_prods();
-        auto num_stack = sstate_ptr->get_num_stack();
-
-        std::vector<float> stack_norm(sstate_ptr->get_num_stack(), 0.0);
-        std::vector<float> stack_v2(sstate_ptr->get_num_stack(), 0.0);
+        if (input_frame.num_prod != plan->num_prod) {
+            FATAL_ERROR("Number of products in frame ({:d}) doesn't match the prodState ({:d}).",
+                        input_frame.num_prod, plan->num_prod);
+            break;
+        }
 
         // Wait for the output buffer frame to be free
         if (wait_for_empty_frame(out_buf, unique_name.c_str(), output_frame_id) == nullptr) {
@@ -201,95 +211,37 @@ void baselineCompression::compress_thread(uint32_t thread_id) {
         }
 
         // Create view to output frame
-        auto output_frame = VisFrameView::create_frame_view(
-            out_buf, output_frame_id, input_frame.num_elements, num_stack, input_frame.num_ev);
+        auto output_frame =
+            VisFrameView::create_frame_view(out_buf, output_frame_id, input_frame.num_elements,
+                                            plan->num_stack, input_frame.num_ev);
 
         // Copy over the data we won't modify
         output_frame.copy_metadata(input_frame);
         output_frame.copy_data(input_frame, {VisField::vis, VisField::weight});
         output_frame.dataset_id = new_dset_id;
 
-        // Zero the output frame
-        std::fill(std::begin(output_frame.vis), std::end(output_frame.vis), 0.0);
-        std::fill(std::begin(output_frame.weight), std::end(output_frame.weight), 0.0);
-
         // Flag out the excluded inputs
         for (auto& input : exclude_inputs) {
             output_frame.flags[input] = 0.0;
         }
 
-        auto in_vis = input_frame.vis.data();
-        auto out_vis = output_frame.vis.data();
-        auto in_weight = input_frame.weight.data();
-        auto out_weight = output_frame.weight.data();
-        auto flags = output_frame.flags.data();
-
-        // Iterate over all the products and average together
-        for (uint32_t prod_ind = 0; prod_ind < prods.size(); prod_ind++) {
-            // TODO: if the weights are ever different from 0 or 1, we will
-            // definitely need to rewrite this.
-
-            // Alias the parts of the data we are going to stack
-            cfloat vis = in_vis[prod_ind];
-            float weight = in_weight[prod_ind];
-
-            auto& p = prods[prod_ind];
-            auto& s = stack_map[prod_ind];
-
-            // If the weight is zero, completely skip this iteration
-            if (weight == 0 || flags[p.input_a] == 0 || flags[p.input_b] == 0)
-                continue;
-
-            vis = s.conjugate ? conj(vis) : vis;
-
-            // First summation of the visibilities (dividing by the total weight will be done later)
-            out_vis[s.stack] += vis;
-
-            // Accumulate the square for variance calculation
-            stack_v2[s.stack] += fast_norm(vis);
-
-            // Accumulate the weighted *variances*. Normalising and inversion
-            // will be done later
-            out_weight[s.stack] += (1.0 / weight);
-
-            // Accumulate the weights so we can normalize correctly
-            stack_norm[s.stack] += 1.0;
-        }
-
-        // Loop over the stacks and normalise (and invert the variances)
-        float vart = 0.0;
-        float normt = 0.0;
-        for (uint32_t stack_ind = 0; stack_ind < num_stack; stack_ind++) {
-
-            // Calculate the mean and accumulate weight and place in the frame
-            float norm = stack_norm[stack_ind];
-
-            // Invert norm if set, otherwise use zero to set data to zero.
-            float inorm = (norm != 0.0) ? (1.0 / norm) : 0.0;
-            float iwgt = (output_frame.weight[stack_ind] != 0.0)
-                             ? (1.0 / output_frame.weight[stack_ind])
-                             : 0.0;
-
-            output_frame.vis[stack_ind] *= inorm;
-            output_frame.weight[stack_ind] = norm * norm * iwgt;
-
-            // Accumulate to calculate the variance of the residuals
-            vart += stack_v2[stack_ind] - std::norm(output_frame.vis[stack_ind]) * norm;
-            normt += norm;
-        }
+        // Average together the products in each stack. This runs along the
+        // precomputed runs of products rather than scattering each product
+        // into its stack in turn.
+        float residual =
+            stack_vis(output_frame.vis.data(), output_frame.weight.data(), *plan,
+                      input_frame.vis.data(), input_frame.weight.data(), output_frame.flags.data());
 
         // Mark the buffers and move on
         mark_frame_full(out_buf, unique_name.c_str(), output_frame_id);
         mark_frame_empty(in_buf, unique_name.c_str(), input_frame_id);
 
-        // Calculate residuals (return zero if no data for this freq)
-        float residual = (normt != 0.0) ? (vart / normt) : 0.0;
-
         // Update prometheus metrics
         double elapsed = current_time() - start_time;
         compression_residuals_metric.labels({std::to_string(output_frame.freq_id)}).set(residual);
-        compression_time_seconds_metric.labels({std::to_string(thread_id)}).set(elapsed);
-        compression_frame_counter.labels({std::to_string(thread_id)}).inc();
+        compression_time_seconds.set(elapsed);
+        compression_duration_seconds_metric.observe(elapsed);
+        compression_frames.inc();
 
         // Get the current values of the shared frame IDs and increment them.
         {
@@ -11,8 +11,9 @@
 #include "buffer.h"              // for Buffer
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "datasetManager.hpp"    // for dset_id_t, state_id_t, fingerprint_t
-#include "datasetState.hpp"      // for prodState, stackState
-#include "prometheusMetrics.hpp" // for MetricFamily, Gauge, Counter
+#include "datasetState.hpp"      // for stackState
+#include "prometheusMetrics.hpp" // for MetricFamily, Gauge, Counter, Histogram
+#include "visStackKernel.hpp"    // for stackPlan
 #include "visUtil.hpp"           // for frameID, rstack_ctype, input_ctype, prod_ctype
 
 #include <cstdint>    // for uint32_t
@@ -53,6 +54,8 @@
  *      The variance of the residuals.
  * @metric kotekan_baselinecompression_time_seconds
  *      The time elapsed to process one frame.
+ * @metric kotekan_baselinecompression_duration_seconds
+ *      Histogram of the time elapsed to process each frame, over all threads.
  * @metric kotekan_baselinecompression_frame_total
  *      Number of frames seen by each thread.
  *
@@ -109,14 +112,16 @@ private:
     std::mutex m_frame_ids;
     std::mutex m_dset_map;
 
-    // Map the incoming ID to an outgoing one
-    std::map<dset_id_t, std::tuple<dset_id_t, const stackState*, const prodState*>> dset_id_map;
+    // Map the incoming ID to an outgoing one and the plan for stacking it
+    std::map<dset_id_t, std::pair<dset_id_t, const stackPlan*>> dset_id_map;
 
-    // Map from the critical incoming states to the correct stackState
-    std::map<fingerprint_t, std::tuple<state_id_t, const stackState*, const prodState*>> state_map;
+    // Map from the critical incoming states to the correct stackState, and the
+    // plan for stacking. This is only built once per stack definition.
+    std::map<fingerprint_t, std::tuple<state_id_t, const stackState*, stackPlan>> state_map;
 
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Gauge>& compression_residuals_metric;
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Gauge>& compression_time_seconds_metric;
+    kotekan::prometheus::Histogram& compression_duration_seconds_metric;
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Counter>& compression_frame_counter;
 };
 
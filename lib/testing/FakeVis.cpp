@@ -2,7 +2,7 @@
 
 #include "Config.hpp"          // for Config
 #include "StageFactory.hpp"    // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
-#include "buffer.h"            // for allocate_new_metadata_object, mark_frame_full, register_p...
+#include "buffer.h"            // for allocate_new_metadata_object, producer_mark_frame_full, ...
 #include "bufferContainer.hpp" // for bufferContainer
 #include "datasetManager.hpp"  // for state_id_t, dset_id_t, datasetManager
 #include "datasetState.hpp"    // for eigenvalueState, freqState, inputState, metadataState
@@ -59,7 +59,7 @@ FakeVis::FakeVis(Config& config, const std::string& unique_name,
 
     // Fetch the buffer, register it
     out_buf = buffer_container.get_buffer(buffer_name);
-    register_producer(out_buf, unique_name.c_str());
+    out_buf_id = register_as_producer(out_buf);
 
     // Get frequency IDs from config
     freq = config.get<std::vector<uint32_t>>(unique_name, "freq_ids");
@@ -144,7 +144,7 @@ void FakeVis::main_thread() {
             DEBUG("Making fake VisBuffer for freq={:d}, fpga_seq={:d}", f, fpga_seq);
 
             // Wait for the buffer frame to be free
-            if (wait_for_empty_frame(out_buf, unique_name.c_str(), output_frame_id) == nullptr) {
+            if (producer_wait_for_empty_frame(out_buf, out_buf_id, output_frame_id) == nullptr) {
                 break;
             }
 
@@ -179,7 +179,7 @@ void FakeVis::main_thread() {
             }
 
             // Mark the buffers and move on
-            mark_frame_full(out_buf, unique_name.c_str(), output_frame_id);
+            producer_mark_frame_full(out_buf, out_buf_id, output_frame_id);
 
             // Advance the current frame ids
             output_frame_id = (output_frame_id + 1) % out_buf->num_frames;
@@ -247,11 +247,11 @@ ReplaceVis::ReplaceVis(Config& config, const std::string& unique_name,
 
     // Setup the input buffer
     in_buf = get_buffer("in_buf");
-    register_consumer(in_buf, unique_name.c_str());
+    in_buf_id = register_as_consumer(in_buf);
 
     // Setup the output buffer
     out_buf = get_buffer("out_buf");
-    register_producer(out_buf, unique_name.c_str());
+    out_buf_id = register_as_producer(out_buf);
 }
 
 void ReplaceVis::main_thread() {
@@ -262,12 +262,12 @@ void ReplaceVis::main_thread() {
     while (!stop_thread) {
 
         // Wait for the input buffer to be filled with data
-        if (wait_for_full_frame(in_buf, unique_name.c_str(), input_frame_id) == nullptr) {
+        if (consumer_wait_for_full_frame(in_buf, in_buf_id, input_frame_id) == nullptr) {
             break;
         }
 
         // Wait for the output buffer to be empty of data
-        if (wait_for_empty_frame(out_buf, unique_name.c_str(), output_frame_id) == nullptr) {
+        if (producer_wait_for_empty_frame(out_buf, out_buf_id, output_frame_id) == nullptr) {
             break;
         }
 
@@ -284,10 +284,10 @@ void ReplaceVis::main_thread() {
 
 
         // Mark the output buffer and move on
-        mark_frame_full(out_buf, unique_name.c_str(), output_frame_id);
+        producer_mark_frame_full(out_buf, out_buf_id, output_frame_id);
 
         // Mark the input buffer and move on
-        mark_frame_empty(in_buf, unique_name.c_str(), input_frame_id);
+        consumer_mark_frame_empty(in_buf, in_buf_id, input_frame_id);
 
         // Advance the current frame ids
         output_frame_id = (output_frame_id + 1) % out_buf->num_frames;
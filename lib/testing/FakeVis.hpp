@@ -91,8 +91,9 @@ private:
     /// Config parameters for freq or inputs test pattern
     std::vector<cfloat> test_pattern_value;
 
-    /// Output buffer
+    /// Output buffer, and our handle on it
     Buffer* out_buf;
+    int out_buf_id;
 
     /// List of frequencies for this buffer
     std::vector<uint32_t> freq;
@@ -155,9 +156,11 @@ public:
     void main_thread() override;
 
 private:
-    /// Buffers
+    /// Buffers, and our handles on them
     Buffer* in_buf;
     Buffer* out_buf;
+    int in_buf_id;
+    int out_buf_id;
 };
 
 #endif
@@ -0,0 +1,429 @@
+#include "AsyncFileWriter.hpp"
+
+#include "WorkerPool.hpp" // for WorkerPool
+#include "visUtil.hpp"    // for current_time, movingAverage
+
+#include "fmt.hpp" // for format
+
+#include <algorithm>    // for max
+#include <errno.h>      // for errno, EAGAIN, EINTR, EIO
+#include <fcntl.h>      // for sync_file_range, posix_fadvise, POSIX_FADV_DONTNEED, SYNC_FILE...
+#include <stdexcept>    // for runtime_error, invalid_argument
+#include <stdlib.h>     // for free, posix_memalign
+#include <string.h>     // for memcpy, memset, strerror
+#include <system_error> // for system_error
+#include <unistd.h>     // for pwrite, close, syscall
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h> // for __NR_io_uring_setup, __NR_io_uring_enter
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define ASYNC_WRITER_IO_URING
+#include <linux/io_uring.h> // for io_uring_params, io_uring_sqe, io_uring_cqe, IORING_OP_WRITEV
+#include <sys/mman.h>       // for mmap, munmap, MAP_FAILED, MAP_POPULATE, MAP_SHARED, PROT_READ
+#endif
+#endif
+
+
+AsyncFileWriter::AsyncFileWriter(size_t max_inflight_bytes, size_t max_requests,
+                                 const kotekan::logLevel log_level) :
+    max_inflight_bytes(max_inflight_bytes),
+    max_requests(max_requests), completion_average(10) {
+    set_log_level(log_level);
+    flusher = std::thread(&AsyncFileWriter::flush_thread, this);
+}
+
+AsyncFileWriter::~AsyncFileWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+    flusher.join();
+
+    for (auto buf : free_buffers)
+        free(buf);
+}
+
+void AsyncFileWriter::write(int fd, off_t offset, const std::vector<iovec>& pieces, size_t len) {
+
+    size_t total = 0;
+    for (auto& piece : pieces)
+        total += piece.iov_len;
+    if (total > len) {
+        throw std::invalid_argument(
+            fmt::format("Pieces are longer than the write ({:d} > {:d} bytes)", total, len));
+    }
+
+    auto req = new writeRequest{fd, offset, len, 0, nullptr, 0, current_time(), {nullptr, 0}};
+
+    {
+        // Always let a single write through, even if it's larger than the limit
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&]() {
+            return outstanding.empty()
+                   || (inflight + len <= max_inflight_bytes && outstanding.size() < max_requests);
+        });
+
+        inflight += len;
+        req->seq = next_seq++;
+        outstanding.insert(req->seq);
+
+        if (len != buffer_size) {
+            for (auto buf : free_buffers)
+                free(buf);
+            free_buffers.clear();
+            buffer_size = len;
+        }
+        if (!free_buffers.empty()) {
+            req->buf = free_buffers.back();
+            free_buffers.pop_back();
+        }
+    }
+
+    // Aligned so the buffers can be used with O_DIRECT files
+    if (req->buf == nullptr) {
+        void* buf;
+        int err = posix_memalign(&buf, 4096, std::max(len, (size_t)1));
+        if (err != 0) {
+            complete(req, -err);
+            throw std::system_error(err, std::generic_category(),
+                                    "Could not allocate write staging buffer");
+        }
+        req->buf = (uint8_t*)buf;
+    }
+
+    uint8_t* ptr = req->buf;
+    for (auto& piece : pieces) {
+        memcpy(ptr, piece.iov_base, piece.iov_len);
+        ptr += piece.iov_len;
+    }
+    memset(ptr, 0, len - total);
+
+    submit(req);
+}
+
+void AsyncFileWriter::complete(writeRequest* req, ssize_t result) {
+
+    if (result == -EINTR || result == -EAGAIN) {
+        submit(req);
+        return;
+    }
+
+    if (result > 0 && req->done + result < req->len) {
+        req->done += result;
+        submit(req);
+        return;
+    }
+
+    // A zero length write on a non-empty request means we can't make progress
+    if (result < 0 || (result == 0 && req->done < req->len)) {
+        int err = (result < 0) ? -result : EIO;
+        ERROR("Write error attempting to write {:d} bytes at offset {:d} into fd {:d}: {:s}",
+              req->len - req->done, req->offset + req->done, req->fd, strerror(err));
+    }
+
+    double elapsed = current_time() - req->start_time;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        inflight -= req->len;
+        outstanding.erase(req->seq);
+        completion_average.add_sample(elapsed);
+        if (req->buf != nullptr)
+            release_buffer(req->buf, req->len);
+    }
+    cv.notify_all();
+
+    delete req;
+}
+
+void AsyncFileWriter::release_buffer(uint8_t* buf, size_t len) {
+    if (len == buffer_size) {
+        free_buffers.push_back(buf);
+    } else {
+        free(buf);
+    }
+}
+
+void AsyncFileWriter::flush(int fd, off_t offset, size_t len, bool evict) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        flush_queue.push_back({fd, offset, len, evict, next_seq});
+    }
+    cv.notify_all();
+}
+
+void AsyncFileWriter::drain() {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this]() { return outstanding.empty() && flush_queue.empty() && !flushing; });
+}
+
+size_t AsyncFileWriter::inflight_bytes() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return inflight;
+}
+
+double AsyncFileWriter::completion_time() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return completion_average.average();
+}
+
+void AsyncFileWriter::flush_thread() {
+
+    std::unique_lock<std::mutex> lock(mtx);
+
+    while (true) {
+        // Flushes are ready once every write queued before them has completed
+        cv.wait(lock, [this]() {
+            return stopping
+                   || (!flush_queue.empty()
+                       && (outstanding.empty() || *outstanding.begin() >= flush_queue.front().seq));
+        });
+        if (flush_queue.empty())
+            return;
+
+        flushRequest req = flush_queue.front();
+        flush_queue.pop_front();
+        flushing = true;
+        lock.unlock();
+
+#ifdef __linux__
+        if (req.evict) {
+            sync_file_range(req.fd, req.offset, req.len,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+                                | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(req.fd, req.offset, req.len, POSIX_FADV_DONTNEED);
+        } else {
+            sync_file_range(req.fd, req.offset, req.len, SYNC_FILE_RANGE_WRITE);
+        }
+#else
+        (void)req; // Suppress warning
+#endif
+
+        lock.lock();
+        flushing = false;
+        cv.notify_all();
+    }
+}
+
+
+namespace {
+
+// Writes each request with a blocking pwrite from a pool of threads
+class threadFileWriter : public AsyncFileWriter {
+public:
+    threadFileWriter(size_t num_threads, size_t max_inflight_bytes,
+                     const kotekan::logLevel log_level) :
+        AsyncFileWriter(max_inflight_bytes, 1024, log_level),
+        pool(std::max(num_threads, (size_t)1), {}, "file_writer") {}
+
+    ~threadFileWriter() {
+        drain();
+    }
+
+    std::string backend() const override {
+        return "threads";
+    }
+
+protected:
+    void submit(writeRequest* req) override {
+        pool.submit([this, req]() {
+            ssize_t nbytes = pwrite(req->fd, req->buf + req->done, req->len - req->done,
+                                    req->offset + req->done);
+            complete(req, nbytes < 0 ? -errno : nbytes);
+        });
+    }
+
+private:
+    WorkerPool pool;
+};
+
+#ifdef ASYNC_WRITER_IO_URING
+
+// Writes each request through an io_uring. The submission side is shared by
+// the caller and the reaping thread (which resubmits short writes), while the
+// completion side is only touched by the reaping thread.
+class uringFileWriter : public AsyncFileWriter {
+public:
+    uringFileWriter(unsigned entries, size_t max_inflight_bytes,
+                    const kotekan::logLevel log_level) :
+        AsyncFileWriter(max_inflight_bytes, entries, log_level) {
+
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (ring_fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "io_uring_setup failed");
+        }
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+        sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd, IORING_OFF_SQ_RING);
+        cq_ring = single_mmap ? sq_ring
+                              : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+            int err = errno;
+            unmap();
+            close(ring_fd);
+            throw std::system_error(err, std::generic_category(), "Could not map io_uring");
+        }
+
+        auto sq = (uint8_t*)sq_ring;
+        sq_tail = (unsigned*)(sq + params.sq_off.tail);
+        sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq + params.sq_off.array);
+
+        auto cq = (uint8_t*)cq_ring;
+        cq_head = (unsigned*)(cq + params.cq_off.head);
+        cq_tail = (unsigned*)(cq + params.cq_off.tail);
+        cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+        reaper = std::thread(&uringFileWriter::reap, this);
+    }
+
+    ~uringFileWriter() {
+        drain();
+
+        // A no-op with no request attached tells the reaper to exit
+        push_sqe(IORING_OP_NOP, -1, nullptr);
+        reaper.join();
+
+        unmap();
+        close(ring_fd);
+    }
+
+    std::string backend() const override {
+        return "io_uring";
+    }
+
+protected:
+    void submit(writeRequest* req) override {
+        req->iov = {req->buf + req->done, req->len - req->done};
+        int err = push_sqe(IORING_OP_WRITEV, req->fd, req);
+        if (err != 0)
+            complete(req, -err);
+    }
+
+private:
+    // Queue one entry and tell the kernel about it. Returns zero or an error
+    // number. The base class never has more requests in flight than the ring
+    // has entries, so there is always a free slot.
+    int push_sqe(uint8_t opcode, int fd, writeRequest* req) {
+        std::lock_guard<std::mutex> lock(sq_mtx);
+
+        unsigned tail = *sq_tail;
+        unsigned index = tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        if (req != nullptr) {
+            sqe->addr = (uint64_t)&req->iov;
+            sqe->len = 1;
+            sqe->off = req->offset + req->done;
+        }
+        sqe->user_data = (uint64_t)req;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        int ret;
+        do {
+            ret = syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0);
+        } while (ret < 0 && errno == EINTR);
+        return (ret < 0) ? errno : 0;
+    }
+
+    void reap() {
+        while (true) {
+            int ret =
+                syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (ret < 0 && errno != EINTR) {
+                ERROR("Waiting for io_uring completions failed: {:s}", strerror(errno));
+            }
+
+            bool stop = false;
+            unsigned head = *cq_head;
+            unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++) {
+                io_uring_cqe* cqe = &cqes[head & cq_mask];
+                auto req = (writeRequest*)cqe->user_data;
+                int res = cqe->res;
+                // Free the slot before completing, as that may resubmit
+                __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+
+                if (req == nullptr) {
+                    stop = true;
+                } else {
+                    complete(req, res);
+                }
+            }
+            if (stop)
+                return;
+        }
+    }
+
+    void unmap() {
+        if (sqes != MAP_FAILED && sqes != nullptr)
+            munmap(sqes, sqes_size);
+        if (cq_ring != sq_ring && cq_ring != MAP_FAILED && cq_ring != nullptr)
+            munmap(cq_ring, cq_ring_size);
+        if (sq_ring != MAP_FAILED && sq_ring != nullptr)
+            munmap(sq_ring, sq_ring_size);
+    }
+
+    int ring_fd;
+
+    void* sq_ring = nullptr;
+    void* cq_ring = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe* cqes;
+
+    std::mutex sq_mtx;
+    std::thread reaper;
+};
+
+#endif // ASYNC_WRITER_IO_URING
+
+} // namespace
+
+
+std::shared_ptr<AsyncFileWriter> AsyncFileWriter::create(const std::string& backend,
+                                                         size_t num_threads,
+                                                         size_t max_inflight_bytes,
+                                                         const kotekan::logLevel log_level) {
+
+    if (backend == "io_uring") {
+#ifdef ASYNC_WRITER_IO_URING
+        try {
+            return std::make_shared<uringFileWriter>(64, max_inflight_bytes, log_level);
+        } catch (std::system_error& e) {
+            WARN_NON_OO("Could not start io_uring ({:s}). Using the thread backend instead.",
+                        e.what());
+        }
+#else
+        WARN_NON_OO("io_uring is not supported in this build. Using the thread backend instead.");
+#endif
+    } else if (backend != "threads") {
+        throw std::invalid_argument(fmt::format("Unknown write backend '{:s}'", backend));
+    }
+
+    return std::make_shared<threadFileWriter>(num_threads, max_inflight_bytes, log_level);
+}
@@ -0,0 +1,193 @@
+/**
+ * @file
+ * @brief Background engines for writing to files without blocking the caller
+ * - AsyncFileWriter
+ */
+#ifndef ASYNC_FILE_WRITER_HPP
+#define ASYNC_FILE_WRITER_HPP
+
+#include "kotekanLogging.hpp" // for kotekanLogging, logLevel
+#include "visUtil.hpp"        // for movingAverage
+
+#include <condition_variable> // for condition_variable
+#include <cstdint>            // for uint8_t, uint64_t
+#include <deque>              // for deque
+#include <memory>             // for shared_ptr, unique_ptr
+#include <mutex>              // for mutex
+#include <set>                // for set
+#include <stddef.h>           // for size_t
+#include <string>             // for string
+#include <sys/types.h>        // for off_t, ssize_t
+#include <sys/uio.h>          // for iovec
+#include <thread>             // for thread
+#include <vector>             // for vector
+
+
+/**
+ * @class AsyncFileWriter
+ * @brief Queue writes to files and complete them in the background.
+ *
+ * Each write is copied into a staging buffer owned by the writer, so the
+ * caller can reuse its memory as soon as `write` returns. The buffers are then
+ * written out by a backend:
+ *
+ *  - `io_uring`: submitted to a Linux io_uring, with completions reaped by a
+ *    background thread.
+ *  - `threads`: handed to a pool of threads that each call `pwrite`.
+ *
+ * If io_uring is not available (old kernel, or blocked by a container) the
+ * thread backend is used instead.
+ *
+ * Flushing and evicting ranges from the page cache is also done in the
+ * background, by a thread that waits for every write queued before the flush
+ * to complete.
+ *
+ * The number of bytes that can be waiting to be written is bounded. Once it is
+ * reached `write` blocks until enough has completed, so a disk that can't keep
+ * up still eventually pushes back on the caller.
+ *
+ * @note There is no ordering between writes, so the caller must not queue
+ *       overlapping writes without calling `drain` in between.
+ */
+class AsyncFileWriter : public kotekan::kotekanLogging {
+public:
+    /**
+     * @brief Create a writer.
+     *
+     * @param  backend             Either `io_uring` or `threads`.
+     * @param  num_threads         Number of threads for the thread backend.
+     * @param  max_inflight_bytes  Maximum number of bytes queued or being
+     *                             written before `write` blocks.
+     * @param  log_level           Log level for the writer.
+     *
+     * @returns The writer.
+     **/
+    static std::shared_ptr<AsyncFileWriter> create(const std::string& backend, size_t num_threads,
+                                                   size_t max_inflight_bytes,
+                                                   const kotekan::logLevel log_level);
+
+    /// Stops the flush thread. Derived classes must call `drain` before this.
+    virtual ~AsyncFileWriter();
+
+    AsyncFileWriter(const AsyncFileWriter&) = delete;
+    AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+
+    /**
+     * @brief Queue a write of several pieces into a contiguous range.
+     *
+     * The pieces are gathered into a single buffer and written with one
+     * request. If `len` is longer than the pieces the remainder is zero
+     * filled, which lets callers write whole aligned blocks.
+     *
+     * @param  fd      File to write to.
+     * @param  offset  Offset in the file of the first piece.
+     * @param  pieces  The data to write, in order.
+     * @param  len     Total length to write. Must be at least the length of
+     *                 the pieces.
+     **/
+    void write(int fd, off_t offset, const std::vector<iovec>& pieces, size_t len);
+
+    /**
+     * @brief Start writing back a range of a file once the writes into it are done.
+     *
+     * @param  fd      File to flush.
+     * @param  offset  Start of the range.
+     * @param  len     Length of the range.
+     * @param  evict   If false just start the writeback, if true wait for
+     *                 the data to reach the disk and then drop it from the
+     *                 page cache.
+     **/
+    void flush(int fd, off_t offset, size_t len, bool evict);
+
+    /// Wait for all queued writes and flushes to complete.
+    void drain();
+
+    /// Bytes queued or being written.
+    size_t inflight_bytes();
+
+    /// Average time from a write being queued to it completing, in seconds.
+    double completion_time();
+
+    /// Name of the backend in use.
+    virtual std::string backend() const = 0;
+
+protected:
+    /// An outstanding write.
+    struct writeRequest {
+        int fd;
+        off_t offset;
+        size_t len;
+        /// Number of bytes written so far.
+        size_t done;
+        /// Staging buffer holding the data.
+        uint8_t* buf;
+        /// Position in the order the writes were queued.
+        uint64_t seq;
+        /// When the write was queued.
+        double start_time;
+        /// Used by the io_uring backend to describe the remaining data.
+        iovec iov;
+    };
+
+    /**
+     * @param  max_inflight_bytes  See `create`.
+     * @param  max_requests        Maximum number of requests the backend can
+     *                             have outstanding at once.
+     * @param  log_level           Log level.
+     **/
+    AsyncFileWriter(size_t max_inflight_bytes, size_t max_requests,
+                    const kotekan::logLevel log_level);
+
+    /// Start writing `req->len - req->done` bytes from `req->buf + req->done`.
+    virtual void submit(writeRequest* req) = 0;
+
+    /**
+     * @brief Called by the backend once a submitted write returns.
+     *
+     * Short writes are resubmitted. Failed writes are logged and dropped.
+     *
+     * @param  req     The request.
+     * @param  result  Number of bytes written, or minus the error number.
+     **/
+    void complete(writeRequest* req, ssize_t result);
+
+private:
+    /// A range to flush once all writes with a lower `seq` are done.
+    struct flushRequest {
+        int fd;
+        off_t offset;
+        size_t len;
+        bool evict;
+        uint64_t seq;
+    };
+
+    /// Loop run by the flush thread
+    void flush_thread();
+
+    /// Return a staging buffer of the current size to the free list
+    void release_buffer(uint8_t* buf, size_t len);
+
+    std::mutex mtx;
+    std::condition_variable cv;
+
+    const size_t max_inflight_bytes;
+    const size_t max_requests;
+
+    size_t inflight = 0;
+    uint64_t next_seq = 0;
+    std::set<uint64_t> outstanding;
+    std::deque<flushRequest> flush_queue;
+    bool flushing = false;
+    bool stopping = false;
+
+    // Staging buffers are recycled while the write size stays the same, which
+    // it does for all frames of a file
+    size_t buffer_size = 0;
+    std::vector<uint8_t*> free_buffers;
+
+    movingAverage completion_average;
+
+    std::thread flusher;
+};
+
+#endif // ASYNC_FILE_WRITER_HPP
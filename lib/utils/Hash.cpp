@@ -2,10 +2,12 @@
 
 #include "fmt.hpp" // for format
 
+#include <algorithm>  // for min
 #include <inttypes.h> // IWYU pragma: keep
 #include <iostream>   // for istream, ostream, basic_istream::read
 #include <stdexcept>  // for invalid_argument
 #include <stdio.h>    // for sscanf
+#include <string.h>   // for memcpy, memset
 
 
 using nlohmann::json;
@@ -63,3 +65,115 @@ std::ostream& operator<<(std::ostream& os, const Hash& h) {
 std::string to_string(const Hash& h) {
     return fmt::format("{}", h);
 }
+
+
+// The incremental hash is a reimplementation of MurmurHash3_x64_128 that
+// keeps its state between calls. It must give the same result as the one shot
+// version used by `hash`.
+namespace {
+
+const uint64_t c1 = 0x87c37b91114253d5ULL;
+const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+inline uint64_t rotl64(uint64_t x, int8_t r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+inline uint64_t mix_k1(uint64_t k1) {
+    k1 *= c1;
+    k1 = rotl64(k1, 31);
+    k1 *= c2;
+    return k1;
+}
+
+inline uint64_t mix_k2(uint64_t k2) {
+    k2 *= c2;
+    k2 = rotl64(k2, 33);
+    k2 *= c1;
+    return k2;
+}
+
+} // namespace
+
+void HashBuilder::process_block(const uint8_t* block) {
+    uint64_t k1, k2;
+    memcpy(&k1, block, 8);
+    memcpy(&k2, block + 8, 8);
+
+    _h1 ^= mix_k1(k1);
+    _h1 = rotl64(_h1, 27);
+    _h1 += _h2;
+    _h1 = _h1 * 5 + 0x52dce729;
+
+    _h2 ^= mix_k2(k2);
+    _h2 = rotl64(_h2, 31);
+    _h2 += _h1;
+    _h2 = _h2 * 5 + 0x38495ab5;
+}
+
+void HashBuilder::update(const uint8_t* data, size_t len) {
+    _len += len;
+
+    // Complete any partially filled block first
+    if (_tail_len > 0) {
+        size_t n = std::min(len, sizeof(_tail) - _tail_len);
+        memcpy(_tail + _tail_len, data, n);
+        _tail_len += n;
+        data += n;
+        len -= n;
+
+        if (_tail_len < sizeof(_tail))
+            return;
+
+        process_block(_tail);
+        _tail_len = 0;
+    }
+
+    for (; len >= sizeof(_tail); data += sizeof(_tail), len -= sizeof(_tail))
+        process_block(data);
+
+    memcpy(_tail, data, len);
+    _tail_len = len;
+}
+
+Hash HashBuilder::finalize() const {
+    uint64_t h1 = _h1;
+    uint64_t h2 = _h2;
+
+    // The remaining bytes are processed as a zero padded block, but only the
+    // halves that contain any data are mixed in
+    uint8_t block[16];
+    memset(block, 0, sizeof(block));
+    memcpy(block, _tail, _tail_len);
+    uint64_t k1, k2;
+    memcpy(&k1, block, 8);
+    memcpy(&k2, block + 8, 8);
+
+    if (_tail_len > 8)
+        h2 ^= mix_k2(k2);
+    if (_tail_len > 0)
+        h1 ^= mix_k1(k1);
+
+    h1 ^= _len;
+    h2 ^= _len;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    return {h1, h2};
+}
@@ -8,10 +8,13 @@
 #include "json.hpp"     // for json
 
 // cinttypes needed by some CentOS systems.
-#include <cinttypes> // IWYU pragma: keep
-#include <iostream>  // for istream, ostream
-#include <stdint.h>  // for uint64_t
-#include <string>    // for string
+#include <cinttypes>   // IWYU pragma: keep
+#include <cstring>     // for memcpy, size_t
+#include <iostream>    // for istream, ostream
+#include <stdint.h>    // for uint64_t, uint8_t
+#include <string>      // for string
+#include <type_traits> // for enable_if_t, is_arithmetic_v
+#include <vector>      // for vector
 
 // Set a value for the hash seed
 #define _SEED 1420
@@ -69,7 +72,7 @@ struct Hash {
 template<typename T>
 Hash hash(gsl::span<const T> s) {
     Hash t;
-    MurmurHash3_x64_128((void*)s.as_bytes(), s.size_bytes(), _SEED, (void*)&t);
+    MurmurHash3_x64_128((const void*)s.data(), s.size_bytes(), _SEED, (void*)&t);
     return t;
 }
 
@@ -87,6 +90,91 @@ inline Hash hash(const std::string& s) {
     return t;
 }
 
+/**
+ * @brief Build a hash incrementally.
+ *
+ * The result is identical to calling `hash` on the concatenation of all the
+ * bytes added, but that concatenation never needs to exist in memory. This is
+ * meant for hashing structured data field by field.
+ *
+ * Numbers are added by their in-memory value, so hashes are only comparable
+ * between machines of the same endianness. Strings and vectors are prefixed
+ * with their length, such that e.g. adding "ab" then "c" differs from adding
+ * "a" then "bc".
+ **/
+class HashBuilder {
+public:
+    HashBuilder() = default;
+
+    /**
+     * @brief Add raw bytes to the hash.
+     *
+     * @param  data  Bytes to add.
+     * @param  len   Number of bytes.
+     **/
+    void add_bytes(const void* data, size_t len) {
+        // Small additions are very common, so just buffer them until there is
+        // a full block to process
+        if (_tail_len + len < sizeof(_tail)) {
+            std::memcpy(_tail + _tail_len, data, len);
+            _tail_len += len;
+            _len += len;
+            return;
+        }
+        update((const uint8_t*)data, len);
+    }
+
+    /// Add a number (or bool) by value.
+    template<typename T>
+    std::enable_if_t<std::is_arithmetic_v<T>> add(T x) {
+        add_bytes(&x, sizeof(T));
+    }
+
+    /// Add a string, prefixed by its length.
+    void add(const std::string& s) {
+        add<uint64_t>(s.size());
+        add_bytes(s.data(), s.size());
+    }
+
+    /// Add another hash.
+    void add(const Hash& h) {
+        add(h.l);
+        add(h.h);
+    }
+
+    /// Add a vector of numbers, prefixed by its length.
+    template<typename T>
+    std::enable_if_t<std::is_arithmetic_v<T>> add(const std::vector<T>& v) {
+        add<uint64_t>(v.size());
+        add_bytes(v.data(), v.size() * sizeof(T));
+    }
+
+    /**
+     * @brief Get the hash of everything added so far.
+     *
+     * @returns  The hash. More data can still be added afterwards.
+     **/
+    Hash finalize() const;
+
+private:
+    /// Add bytes that may complete one or more blocks
+    void update(const uint8_t* data, size_t len);
+
+    /// Mix a full 16 byte block into the state
+    void process_block(const uint8_t* block);
+
+    // MurmurHash3_x64_128 state
+    uint64_t _h1 = _SEED;
+    uint64_t _h2 = _SEED;
+
+    /// Bytes not yet processed as they don't fill a block
+    uint8_t _tail[16];
+    size_t _tail_len = 0;
+
+    /// Total number of bytes added
+    uint64_t _len = 0;
+};
+
 /**
  * @brief Comparison of two hash types.
  *
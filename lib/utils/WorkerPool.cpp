@@ -0,0 +1,129 @@
+#include "WorkerPool.hpp"
+
+#include "util.h" // for string_tail
+
+#include <algorithm> // for min
+#include <atomic>    // for atomic
+#include <exception> // for exception_ptr, current_exception, rethrow_exception
+#include <memory>    // for make_shared
+#include <pthread.h> // for pthread_setaffinity_np, pthread_setname_np
+#include <sched.h>   // for cpu_set_t, CPU_SET, CPU_ZERO
+#include <utility>   // for move
+
+
+WorkerPool::WorkerPool(size_t num_threads, const std::vector<int>& cpu_affinity,
+                       const std::string& name) {
+
+    for (size_t i = 0; i < num_threads; i++) {
+        auto& thread = threads.emplace_back(&WorkerPool::worker, this);
+
+#ifndef MAC_OSX
+        if (!cpu_affinity.empty()) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            for (auto& core : cpu_affinity)
+                CPU_SET(core, &cpuset);
+            pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+        }
+        if (!name.empty())
+            pthread_setname_np(thread.native_handle(), string_tail(name, 15).c_str());
+#else
+        (void)cpu_affinity;
+        (void)name;
+#endif
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+std::future<void> WorkerPool::submit(std::function<void()> task) {
+
+    auto ptask = std::make_shared<std::packaged_task<void()>>(std::move(task));
+    auto future = ptask->get_future();
+
+    if (threads.empty()) {
+        (*ptask)();
+        return future;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        queue.emplace_back([ptask]() { (*ptask)(); });
+    }
+    cv.notify_one();
+
+    return future;
+}
+
+void WorkerPool::parallel_for(size_t n, const std::function<void(size_t)>& f) {
+
+    if (n == 0)
+        return;
+
+    // Hand out indices from a shared counter until they run out
+    std::atomic<size_t> next(0);
+    auto run = [&]() {
+        size_t i;
+        while ((i = next++) < n)
+            f(i);
+    };
+
+    // No point waking up more threads than there are iterations left after
+    // the caller takes one
+    size_t num_helpers = std::min(threads.size(), n - 1);
+    std::vector<std::future<void>> helpers;
+    helpers.reserve(num_helpers);
+    for (size_t i = 0; i < num_helpers; i++)
+        helpers.push_back(submit(run));
+
+    std::exception_ptr error = nullptr;
+    try {
+        run();
+    } catch (...) {
+        // Stop handing out work, but we must wait for the helpers before
+        // unwinding as they reference our stack
+        next = n;
+        error = std::current_exception();
+    }
+
+    for (auto& helper : helpers) {
+        try {
+            helper.get();
+        } catch (...) {
+            next = n;
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void WorkerPool::worker() {
+
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+
+            // Only exit once the queue has been drained
+            if (queue.empty())
+                return;
+
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,93 @@
+/**
+ * @file
+ * @brief A fixed size pool of worker threads
+ * - WorkerPool
+ */
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <condition_variable> // for condition_variable
+#include <cstddef>            // for size_t
+#include <deque>              // for deque
+#include <functional>         // for function
+#include <future>             // for future
+#include <mutex>              // for mutex
+#include <string>             // for string
+#include <thread>             // for thread
+#include <vector>             // for vector
+
+
+/**
+ * @class WorkerPool
+ * @brief A set of threads that work through a shared queue of tasks.
+ *
+ * This is for stages that want to split their processing across several cores
+ * without starting threads per piece of work. The threads are started at
+ * construction and joined at destruction, which will first finish any queued
+ * tasks.
+ *
+ * Tasks can either be queued individually with `submit`, or a loop can be
+ * split with `parallel_for`, in which the calling thread also takes part.
+ */
+class WorkerPool {
+public:
+    /**
+     * @brief Start the worker threads.
+     *
+     * @param  num_threads   Number of threads to start. May be zero, in which
+     *                       case `parallel_for` runs entirely on the caller.
+     * @param  cpu_affinity  Cores to pin the threads to. If empty the affinity
+     *                       is not changed.
+     * @param  name          Name to give the threads (truncated to 15 chars).
+     **/
+    explicit WorkerPool(size_t num_threads, const std::vector<int>& cpu_affinity = {},
+                        const std::string& name = "");
+
+    /// Finish all queued tasks and join the threads.
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /**
+     * @brief Queue a task to be run by any worker.
+     *
+     * @param  task  The task to run.
+     * @returns      A future that is ready when the task has completed, and
+     *               which rethrows any exception it raised.
+     *
+     * @note With no worker threads the task is run before this returns.
+     **/
+    std::future<void> submit(std::function<void()> task);
+
+    /**
+     * @brief Call `f(i)` for every `i` in [0, n) across the pool.
+     *
+     * Indices are handed out dynamically, so the iterations need not take
+     * equal time. The calling thread processes indices too, and the call
+     * returns once all are done. If any iteration throws, the first exception
+     * is rethrown once all threads have stopped using `f`.
+     *
+     * @param  n  Number of iterations.
+     * @param  f  Function to call for each index.
+     **/
+    void parallel_for(size_t n, const std::function<void(size_t)>& f);
+
+    /// The number of worker threads (not counting callers of `parallel_for`).
+    size_t size() const {
+        return threads.size();
+    }
+
+private:
+    /// Loop run by each thread
+    void worker();
+
+    std::vector<std::thread> threads;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> queue;
+    bool stopping = false;
+};
+
+#endif // WORKER_POOL_HPP
@@ -0,0 +1,143 @@
+#include "applyGainsKernel.hpp"
+
+#include "simdDispatch.hpp" // for simdLevel
+
+#include <complex> // for complex, operator*
+#include <cstring> // for memcpy
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define GAINS_KERNEL_X86
+// GCC 12 gives false positives inside the AVX-512 headers (GCC bug 105593)
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h> // for __m256, __m512, _mm256_fmaddsub_ps, _mm512_fmaddsub_ps, ...
+#endif
+
+
+using cf = std::complex<float>;
+
+namespace {
+
+// Each of these processes one row `ii` of the triangle, i.e. the products
+// (ii, jj) for jj in [start, n). The pointers are offset such that they can be
+// indexed directly with jj.
+
+// Scalar version. This defines the reference result, and also handles the tails.
+void row_scalar(cf* out_vis, float* out_weight, const cf* in_vis, const float* in_weight, cf gi,
+                float wi, const cf* gain_conj, const float* weight_factor, size_t start,
+                size_t n) {
+    for (size_t jj = start; jj < n; jj++) {
+        out_vis[jj] = in_vis[jj] * gi * gain_conj[jj];
+
+        // Take care not to generate NaN's if both the gain was zero and the
+        // weight was infinite (which can happen if a channel was turned off)
+        float wp = wi * weight_factor[jj];
+        out_weight[jj] = (wp == 0 ? 0.0f : in_weight[jj] * wp);
+    }
+}
+
+#ifdef GAINS_KERNEL_X86
+
+// Multiply interleaved (real, imag) pairs. Each product is
+// (xr*yr - xi*yi, xr*yi + xi*yr), which is `x * yr -+ swap(x) * yi`.
+__attribute__((target("avx2,fma"))) inline __m256 cmul_avx2(__m256 x, __m256 y) {
+    __m256 yr = _mm256_moveldup_ps(y);
+    __m256 yi = _mm256_movehdup_ps(y);
+    __m256 xs = _mm256_permute_ps(x, 0xB1);
+    return _mm256_fmaddsub_ps(x, yr, _mm256_mul_ps(xs, yi));
+}
+
+// 8 products per iteration
+__attribute__((target("avx2,fma"))) void row_avx2(cf* out_vis, float* out_weight,
+                                                  const cf* in_vis, const float* in_weight,
+                                                  cf gi, float wi, const cf* gain_conj,
+                                                  const float* weight_factor, size_t start,
+                                                  size_t n) {
+    double gi_bits;
+    std::memcpy(&gi_bits, &gi, sizeof(gi_bits));
+    const __m256 gi_v = _mm256_castpd_ps(_mm256_set1_pd(gi_bits));
+    const __m256 wi_v = _mm256_set1_ps(wi);
+    const __m256 zero = _mm256_setzero_ps();
+
+    size_t jj = start;
+    for (; jj + 8 <= n; jj += 8) {
+        __m256 v0 = _mm256_loadu_ps((const float*)(in_vis + jj));
+        __m256 v1 = _mm256_loadu_ps((const float*)(in_vis + jj + 4));
+        __m256 g0 = _mm256_loadu_ps((const float*)(gain_conj + jj));
+        __m256 g1 = _mm256_loadu_ps((const float*)(gain_conj + jj + 4));
+        _mm256_storeu_ps((float*)(out_vis + jj), cmul_avx2(cmul_avx2(v0, gi_v), g0));
+        _mm256_storeu_ps((float*)(out_vis + jj + 4), cmul_avx2(cmul_avx2(v1, gi_v), g1));
+
+        __m256 wp = _mm256_mul_ps(wi_v, _mm256_loadu_ps(weight_factor + jj));
+        __m256 w = _mm256_mul_ps(_mm256_loadu_ps(in_weight + jj), wp);
+        __m256 zero_wp = _mm256_cmp_ps(wp, zero, _CMP_EQ_OQ);
+        _mm256_storeu_ps(out_weight + jj, _mm256_andnot_ps(zero_wp, w));
+    }
+    row_scalar(out_vis, out_weight, in_vis, in_weight, gi, wi, gain_conj, weight_factor, jj, n);
+}
+
+__attribute__((target("avx512f"))) inline __m512 cmul_avx512(__m512 x, __m512 y) {
+    __m512 yr = _mm512_moveldup_ps(y);
+    __m512 yi = _mm512_movehdup_ps(y);
+    __m512 xs = _mm512_permute_ps(x, 0xB1);
+    return _mm512_fmaddsub_ps(x, yr, _mm512_mul_ps(xs, yi));
+}
+
+// 16 products per iteration
+__attribute__((target("avx512f"))) void row_avx512(cf* out_vis, float* out_weight,
+                                                   const cf* in_vis, const float* in_weight,
+                                                   cf gi, float wi, const cf* gain_conj,
+                                                   const float* weight_factor, size_t start,
+                                                   size_t n) {
+    double gi_bits;
+    std::memcpy(&gi_bits, &gi, sizeof(gi_bits));
+    const __m512 gi_v = _mm512_castpd_ps(_mm512_set1_pd(gi_bits));
+    const __m512 wi_v = _mm512_set1_ps(wi);
+    const __m512 zero = _mm512_setzero_ps();
+
+    size_t jj = start;
+    for (; jj + 16 <= n; jj += 16) {
+        __m512 v0 = _mm512_loadu_ps((const float*)(in_vis + jj));
+        __m512 v1 = _mm512_loadu_ps((const float*)(in_vis + jj + 8));
+        __m512 g0 = _mm512_loadu_ps((const float*)(gain_conj + jj));
+        __m512 g1 = _mm512_loadu_ps((const float*)(gain_conj + jj + 8));
+        _mm512_storeu_ps((float*)(out_vis + jj), cmul_avx512(cmul_avx512(v0, gi_v), g0));
+        _mm512_storeu_ps((float*)(out_vis + jj + 8), cmul_avx512(cmul_avx512(v1, gi_v), g1));
+
+        // Unordered so that a NaN factor propagates as in the scalar code
+        __m512 wp = _mm512_mul_ps(wi_v, _mm512_loadu_ps(weight_factor + jj));
+        __mmask16 nonzero = _mm512_cmp_ps_mask(wp, zero, _CMP_NEQ_UQ);
+        __m512 w = _mm512_maskz_mul_ps(nonzero, _mm512_loadu_ps(in_weight + jj), wp);
+        _mm512_storeu_ps(out_weight + jj, w);
+    }
+    row_scalar(out_vis, out_weight, in_vis, in_weight, gi, wi, gain_conj, weight_factor, jj, n);
+}
+
+#endif // GAINS_KERNEL_X86
+
+} // namespace
+
+
+void apply_gains_vis(cf* out_vis, float* out_weight, const cf* in_vis, const float* in_weight,
+                     const cf* gain, const cf* gain_conj, const float* weight_factor,
+                     size_t num_elements, simdLevel level) {
+
+    auto row = row_scalar;
+#ifdef GAINS_KERNEL_X86
+    if (level == simdLevel::avx512)
+        row = row_avx512;
+    else if (level == simdLevel::avx2)
+        row = row_avx2;
+#endif
+    (void)level;
+
+    // Row ii starts at product `idx`, so index from `idx - ii` to line the
+    // products up with jj. This never goes below zero as every earlier row
+    // holds at least one product.
+    size_t idx = 0;
+    for (size_t ii = 0; ii < num_elements; ii++) {
+        size_t off = idx - ii;
+        row(out_vis + off, out_weight + off, in_vis + off, in_weight + off, gain[ii],
+            weight_factor[ii], gain_conj, weight_factor, ii, num_elements);
+        idx += num_elements - ii;
+    }
+}
@@ -0,0 +1,44 @@
+/*****************************************
+@file
+@brief Vectorised kernel for applying gains to a visibility triangle.
+- apply_gains_vis
+*****************************************/
+#ifndef APPLY_GAINS_KERNEL_HPP
+#define APPLY_GAINS_KERNEL_HPP
+
+#include "simdDispatch.hpp" // for simdLevel, simd_level
+
+#include <complex> // for complex
+#include <cstddef> // for size_t
+
+/**
+ * @brief Apply per-input gains to the upper triangle of products.
+ *
+ * For every product `(i, j)` with `i <= j` this computes
+ * `vis = vis * gain[i] * gain_conj[j]` and `weight = weight * wp` with
+ * `wp = weight_factor[i] * weight_factor[j]`. Where `wp` is zero the weight is
+ * set to zero, so that infinite weights on inputs that were turned off don't
+ * become NaN.
+ *
+ * The output may be the same as the input to apply the gains in place.
+ *
+ * The complex products may differ from a scalar loop in the last bit
+ * depending on whether the compiler fuses the multiply-adds.
+ *
+ * @param  out_vis        Output visibilities, `N(N+1)/2` of them.
+ * @param  out_weight     Output weights.
+ * @param  in_vis         Input visibilities.
+ * @param  in_weight      Input weights.
+ * @param  gain           Gain for each input.
+ * @param  gain_conj      Conjugate of the gain for each input.
+ * @param  weight_factor  Factor to scale the weights by for each input.
+ * @param  num_elements   Number of inputs `N`.
+ * @param  level          SIMD implementation to use.
+ **/
+void apply_gains_vis(std::complex<float>* out_vis, float* out_weight,
+                     const std::complex<float>* in_vis, const float* in_weight,
+                     const std::complex<float>* gain, const std::complex<float>* gain_conj,
+                     const float* weight_factor, size_t num_elements,
+                     simdLevel level = simd_level());
+
+#endif // APPLY_GAINS_KERNEL_HPP
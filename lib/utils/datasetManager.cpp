@@ -5,13 +5,21 @@
 #include "restClient.hpp" // for restClient::restReply, restClient
 #include "restServer.hpp" // for restServer, connectionInstance, HTTP_RESPONSE, HTTP_RESPONSE::...
 
-#include <algorithm>  // for max
-#include <cstdint>    // for int32_t
-#include <functional> // for function, _Bind_helper<>::type, _Placeholder, bind, _1
-#include <iosfwd>     // for streamsize
-#include <mutex>      // for mutex, lock_guard, lock, adopt_lock, unique_lock
-#include <regex>      // for match_results<>::_Base_type
-#include <stdlib.h>   // for exit
+#include <algorithm>          // for max
+#include <chrono>             // for steady_clock, duration, milliseconds, seconds
+#include <condition_variable> // for condition_variable
+#include <cstdint>            // for int32_t
+#include <functional>         // for function, _Bind_helper<>::type, _Placeholder, bind, _1
+#include <future>             // for promise, shared_future
+#include <iosfwd>             // for streamsize
+#include <memory>             // for shared_ptr, make_shared, atomic_load, atomic_store
+#include <mutex>              // for mutex, lock_guard, lock, adopt_lock, unique_lock
+#include <regex>              // for match_results<>::_Base_type
+#include <stdexcept>          // for invalid_argument, runtime_error
+#include <stdlib.h>           // for exit
+#include <thread>             // for thread
+#include <utility>            // for move, swap, make_pair
+#include <vector>             // for vector
 
 using nlohmann::json;
 
@@ -20,7 +28,15 @@ datasetManager::datasetManager() :
     _conn_error_count(0), _stop_request_threads(false), _n_request_threads(0),
     _config_applied(false), _rest_client(restClient::instance()),
     error_counter(kotekan::prometheus::Metrics::instance().add_gauge(
-        "kotekan_datasetbroker_error_count", DS_UNIQUE_NAME)) {
+        "kotekan_datasetbroker_error_count", DS_UNIQUE_NAME)),
+    state_cache_hit_counter(kotekan::prometheus::Metrics::instance().add_counter(
+        "kotekan_datasetmanager_state_cache_hit_total", DS_UNIQUE_NAME)),
+    state_cache_miss_counter(kotekan::prometheus::Metrics::instance().add_counter(
+        "kotekan_datasetmanager_state_cache_miss_total", DS_UNIQUE_NAME)),
+    broker_request_time(kotekan::prometheus::Metrics::instance().add_gauge(
+        "kotekan_datasetbroker_request_seconds", DS_UNIQUE_NAME, {"endpoint"})) {
+
+    _state_cache = std::make_shared<const state_cache_t>();
 
     kotekan::restServer::instance().register_get_callback(
         DS_FORCE_UPDATE_ENDPOINT_NAME,
@@ -63,7 +79,17 @@ datasetManager& datasetManager::instance(kotekan::Config& config) {
 
         DEBUG_NON_OO("datasetManager: expecting broker at {:s}:{:d}.", dm._ds_broker_host,
                      dm._ds_broker_port);
+
+        if (!dm._fetch_thread.joinable())
+            dm._fetch_thread = std::thread(&datasetManager::fetch_thread, &dm);
     }
+
+    std::string hash_mode = config.get_default<std::string>(DS_UNIQUE_NAME, "hash_mode", "binary");
+    if (hash_mode != "binary" && hash_mode != "json")
+        throw std::invalid_argument(fmt::format(
+            fmt("datasetManager: Unknown hash_mode \"{:s}\" (expected binary or json)."),
+            hash_mode));
+    dm._json_hash = (hash_mode == "json");
     dm._config_applied = true;
 
     return dm;
@@ -72,6 +98,13 @@ datasetManager& datasetManager::instance(kotekan::Config& config) {
 datasetManager::~datasetManager() {
     _stop_request_threads = true;
 
+    {
+        std::lock_guard<std::mutex> lock(_lock_fetch);
+        _cv_fetch.notify_all();
+    }
+    if (_fetch_thread.joinable())
+        _fetch_thread.join();
+
     kotekan::restServer::instance().remove_get_callback(DS_FORCE_UPDATE_ENDPOINT_NAME);
 
     // wait for the detached threads
@@ -83,6 +116,11 @@ datasetManager::~datasetManager() {
 void datasetManager::stop() {
     INFO_NON_OO("Stopping request threads...");
     _stop_request_threads = true;
+
+    // Take the lock so the fetch thread can't miss this between checking the
+    // flag and going to sleep
+    std::lock_guard<std::mutex> lock(_lock_fetch);
+    _cv_fetch.notify_all();
 }
 
 // TODO: 0 is not a good sentinel value. Move to std::optional typing when we use C++17
@@ -159,17 +197,30 @@ dset_id_t datasetManager::add_dataset(dataset ds) {
     return new_dset_id;
 }
 
-// TODO: decide if this is the best way of hashing the state and dataset.
-// It has the advantage of being simple, there's a slight issue in that json
-// technically doesn't guarantee order of items in an object, but in
-// practice nlohmann::json ensures they are alphabetical by default. It
-// might also be a little slow as it requires full serialisation.
+// The JSON hashes rely on nlohmann::json ordering the items of an object
+// alphabetically, which json itself doesn't guarantee. They are only kept for
+// compatibility with IDs issued before the binary hashes existed.
 state_id_t datasetManager::hash_state(datasetState& state) const {
-    return hash(state.to_json().dump());
+    if (_json_hash)
+        return hash(state.to_json().dump());
+
+    HashBuilder h;
+    h.add(state.type());
+    state.hash_data(h);
+    return h.finalize();
 }
 
 state_id_t datasetManager::hash_dataset(dataset& ds) const {
-    return hash(ds.to_json().dump());
+    if (_json_hash)
+        return hash(ds.to_json().dump());
+
+    HashBuilder h;
+    h.add(ds.type());
+    h.add(ds.state());
+    h.add(ds.is_root());
+    if (!ds.is_root())
+        h.add(ds.base_dset());
+    return h.finalize();
 }
 
 void datasetManager::register_state(state_id_t state) {
@@ -195,9 +246,7 @@ void datasetManager::request_thread(const json&& request, const std::string&& en
     restClient::restReply reply;
 
     while (true) {
-        reply =
-            _rest_client.make_request_blocking(endpoint, request, _ds_broker_host, _ds_broker_port,
-                                               _retries_rest_client, _timeout_rest_client_s);
+        reply = broker_request(endpoint, request, _retries_rest_client, _timeout_rest_client_s);
 
         // If parser succeeds, the request is done and this thread can exit.
         if (reply.first) {
@@ -442,15 +491,13 @@ void datasetManager::update_datasets(dset_id_t ds_id) {
     json js_rqst;
     js_rqst["ds_id"] = ds_id;
 
-    restClient::restReply reply = _rest_client.make_request_blocking(
-        PATH_UPDATE_DATASETS, js_rqst, _ds_broker_host, _ds_broker_port, _retries_rest_client,
-        _timeout_rest_client_s);
+    restClient::restReply reply = broker_request(PATH_UPDATE_DATASETS, js_rqst,
+                                                 _retries_rest_client, _timeout_rest_client_s);
 
     while (!_stop_request_threads && !parse_reply_dataset_update(reply)) {
         std::this_thread::sleep_for(std::chrono::milliseconds(_retry_wait_time_ms));
-        reply = _rest_client.make_request_blocking(PATH_UPDATE_DATASETS, js_rqst, _ds_broker_host,
-                                                   _ds_broker_port, _retries_rest_client,
-                                                   _timeout_rest_client_s);
+        reply = broker_request(PATH_UPDATE_DATASETS, js_rqst, _retries_rest_client,
+                               _timeout_rest_client_s);
     }
 }
 
@@ -501,6 +548,243 @@ bool datasetManager::parse_reply_dataset_update(restClient::restReply reply) {
     return true;
 }
 
+std::shared_future<const datasetState*> datasetManager::fetch_state(state_id_t state) {
+    return fetch_states({state})[0];
+}
+
+std::vector<std::shared_future<const datasetState*>>
+datasetManager::fetch_states(const std::vector<state_id_t>& states) {
+
+    std::vector<std::shared_future<const datasetState*>> futures;
+    futures.reserve(states.size());
+    bool queued = false;
+
+    {
+        // A received state is added to _states before its request is removed,
+        // so holding both locks means we can't miss it in between
+        std::lock_guard<std::mutex> lock(_lock_fetch);
+        std::lock_guard<std::mutex> slock(_lock_states);
+
+        for (const auto& state_id : states) {
+            // Join an ongoing request if there is one
+            auto pending = _fetch_states.find(state_id);
+            if (pending != _fetch_states.end()) {
+                futures.push_back(pending->second.second);
+                continue;
+            }
+
+            // Anything we know already (or can't ask the broker for, because
+            // there is none or the fetch thread has finished) is returned
+            // straight away
+            std::promise<const datasetState*> p;
+            futures.push_back(p.get_future().share());
+
+            auto it = _states.find(state_id);
+            if (it != _states.end() || !_use_broker || _stop_request_threads) {
+                p.set_value(it != _states.end() ? it->second.get() : nullptr);
+                continue;
+            }
+
+            _fetch_states.emplace(state_id, std::make_pair(std::move(p), futures.back()));
+            _fetch_queue.push_back(state_id);
+            queued = true;
+        }
+    }
+    if (queued)
+        _cv_fetch.notify_one();
+
+    return futures;
+}
+
+void datasetManager::prefetch(dset_id_t dset) {
+    if (!_use_broker)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_lock_fetch);
+        _prefetch_queue.push_back(dset);
+    }
+    _cv_fetch.notify_one();
+}
+
+void datasetManager::fetch_ancestor_states(dset_id_t dset) {
+
+    std::vector<state_id_t> states;
+    {
+        std::lock_guard<std::mutex> dslock(_lock_dsets);
+
+        auto it = _datasets.find(dset);
+        while (it != _datasets.end()) {
+            states.push_back(it->second.state());
+            if (it->second.is_root())
+                break;
+            it = _datasets.find(it->second.base_dset());
+        }
+    }
+
+    // Any states that are already known are skipped here
+    fetch_states(states);
+}
+
+void datasetManager::fetch_thread() {
+
+    std::unique_lock<std::mutex> lock(_lock_fetch);
+
+    while (true) {
+        _cv_fetch.wait(lock, [this]() {
+            return _stop_request_threads || !_fetch_queue.empty() || !_prefetch_queue.empty();
+        });
+        if (_stop_request_threads)
+            break;
+
+        // Update the dataset topology first, as that adds states to fetch
+        std::vector<dset_id_t> prefetch;
+        std::swap(prefetch, _prefetch_queue);
+        if (!prefetch.empty()) {
+            lock.unlock();
+            for (const auto& dset : prefetch) {
+                update_datasets(dset);
+                fetch_ancestor_states(dset);
+            }
+            lock.lock();
+        }
+
+        // Send everything that was queued up while the last requests were out
+        std::vector<state_id_t> batch;
+        std::swap(batch, _fetch_queue);
+        if (batch.empty())
+            continue;
+
+        lock.unlock();
+        std::vector<state_id_t> failed = request_states(batch);
+        lock.lock();
+
+        if (!failed.empty()) {
+            WARN_NON_OO("datasetManager: Failure requesting {:d} states from broker.\nRetrying...",
+                        failed.size());
+            _fetch_queue.insert(_fetch_queue.end(), failed.begin(), failed.end());
+            _cv_fetch.wait_for(lock, std::chrono::milliseconds(_retry_wait_time_ms),
+                               [this]() { return (bool)_stop_request_threads; });
+        }
+    }
+
+    // Nothing else will arrive, so release anyone still waiting
+    for (auto& s : _fetch_states)
+        s.second.first.set_value(nullptr);
+    _fetch_states.clear();
+    _fetch_queue.clear();
+    _prefetch_queue.clear();
+}
+
+std::vector<state_id_t> datasetManager::request_states(const std::vector<state_id_t>& states) {
+
+    std::vector<restClient::restReply> replies(states.size());
+    size_t num_replies = 0;
+    std::mutex mtx_reply;
+    std::condition_variable cv_reply;
+
+    // The restClient keeps a reference to the callbacks, so they must not
+    // move until all replies are in
+    std::vector<std::function<void(restClient::restReply)>> callbacks;
+    callbacks.reserve(states.size());
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < states.size(); i++) {
+        callbacks.emplace_back([&, i](restClient::restReply reply) {
+            std::lock_guard<std::mutex> lck_reply(mtx_reply);
+            replies[i] = std::move(reply);
+            num_replies++;
+            cv_reply.notify_one();
+        });
+
+        json js_request;
+        js_request["id"] = states[i];
+        _rest_client.make_request(PATH_REQUEST_STATE, callbacks.back(), js_request,
+                                  _ds_broker_host, _ds_broker_port, _retries_rest_client,
+                                  _timeout_rest_client_s);
+    }
+
+    {
+        // As in restClient::make_request_blocking, this timeout is only there
+        // in case libevent never calls back
+        int timeout = _timeout_rest_client_s == -1 ? 100 : _timeout_rest_client_s * 2;
+        std::unique_lock<std::mutex> lck_reply(mtx_reply);
+        while (!cv_reply.wait_for(lck_reply, std::chrono::seconds(timeout),
+                                  [&]() { return num_replies == states.size(); })) {
+            FATAL_ERROR_NON_OO("datasetManager: Timeout waiting for {:d} state requests to the "
+                               "broker.",
+                               states.size() - num_replies);
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    broker_request_time.labels({PATH_REQUEST_STATE}).set(elapsed.count());
+
+    std::vector<state_id_t> failed;
+    for (size_t i = 0; i < states.size(); i++) {
+        if (!parse_reply_state(states[i], replies[i]))
+            failed.push_back(states[i]);
+    }
+
+    return failed;
+}
+
+bool datasetManager::parse_reply_state(state_id_t state_id, const restClient::restReply& reply) {
+
+    if (!reply.first) {
+        WARN_NON_OO("datasetManager: Failure requesting state from broker: {:s}", reply.second);
+        error_counter.set(++_conn_error_count);
+        return false;
+    }
+
+    const datasetState* s;
+    try {
+        json js_reply = json::parse(reply.second);
+        if (js_reply.at("result") != "success")
+            throw std::runtime_error(fmt::format(fmt("Broker answered with result={:s}"),
+                                                 js_reply.at("result").dump(4)));
+
+        state_id_t s_id = js_reply.at("id");
+        if (s_id != state_id)
+            throw std::runtime_error(
+                fmt::format(fmt("Broker sent state {} instead of {}"), s_id, state_id));
+
+        state_uptr state = datasetState::from_json(js_reply.at("state"));
+        if (state == nullptr) {
+            throw(std::runtime_error(fmt::format(fmt("Failed to parse state received from "
+                                                     "broker: {:s}"),
+                                                 js_reply.at("state").dump(4))));
+        }
+
+        // register the received state
+        std::lock_guard<std::mutex> slck(_lock_states);
+        auto new_state = _states.emplace(s_id, std::move(state));
+
+        // hash collisions are checked for by the broker
+        if (!new_state.second)
+            INFO_NON_OO("datasetManager: received a state (with hash {}) that is already "
+                        "registered locally.",
+                        s_id);
+
+        s = new_state.first->second.get();
+    } catch (std::exception& e) {
+        WARN_NON_OO("datasetManager: failure parsing reply received from broker after requesting "
+                    "state (reply: {:s}): {:s}",
+                    reply.second, e.what());
+        error_counter.set(++_conn_error_count);
+        return false;
+    }
+
+    // signal everyone waiting for this state
+    std::lock_guard<std::mutex> lock(_lock_fetch);
+    auto it = _fetch_states.find(state_id);
+    if (it != _fetch_states.end()) {
+        it->second.first.set_value(s);
+        _fetch_states.erase(it);
+    }
+
+    return true;
+}
+
 void datasetManager::force_update_callback(kotekan::connectionInstance& conn) {
 
     INFO_NON_OO("Sending forced update to broker.");
@@ -585,6 +869,53 @@ datasetManager::closest_dataset_of_type(dset_id_t dset, const std::string& type)
 }
 
 
+const datasetState* datasetManager::cached_state(dset_id_t dset, const std::string& type) {
+
+    std::shared_ptr<const state_cache_t> cache = std::atomic_load(&_state_cache);
+
+    auto it = cache->find({dset, type});
+    if (it == cache->end()) {
+        state_cache_miss_counter.inc();
+        return nullptr;
+    }
+
+    state_cache_hit_counter.inc();
+    return it->second;
+}
+
+
+void datasetManager::cache_state(dset_id_t dset, const std::string& type,
+                                 const datasetState* state) {
+
+    std::lock_guard<std::mutex> lock(_lock_state_cache);
+
+    // Entries are only added once per dataset and state type, so the cost of
+    // copying is paid rarely
+    std::shared_ptr<const state_cache_t> cache = std::atomic_load(&_state_cache);
+    if (cache->count({dset, type}))
+        return;
+
+    auto new_cache = std::make_shared<state_cache_t>(*cache);
+    new_cache->emplace(state_cache_key_t(dset, type), state);
+    std::atomic_store(&_state_cache, std::shared_ptr<const state_cache_t>(std::move(new_cache)));
+}
+
+
+restClient::restReply datasetManager::broker_request(const std::string& endpoint,
+                                                     const json& data, const int retries,
+                                                     const int timeout) {
+
+    auto start = std::chrono::steady_clock::now();
+    restClient::restReply reply = _rest_client.make_request_blocking(
+        endpoint, data, _ds_broker_host, _ds_broker_port, retries, timeout);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    broker_request_time.labels({endpoint}).set(elapsed.count());
+
+    return reply;
+}
+
+
 fingerprint_t datasetManager::fingerprint(dset_id_t ds_id,
                                           const std::set<std::string>& state_types) {
 
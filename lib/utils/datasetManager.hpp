@@ -2,12 +2,12 @@
 #define DATASET_MANAGER_HPP
 
 #include "Config.hpp"            // for Config
-#include "Hash.hpp"              // for operator<, Hash
+#include "Hash.hpp"              // for operator<, Hash, HashBuilder
 #include "dataset.hpp"           // for dataset
 #include "datasetState.hpp"      // for datasetState, state_uptr, _factory_aliasdatasetState
 #include "factory.hpp"           // for FACTORY
 #include "kotekanLogging.hpp"    // for WARN_NON_OO, DEBUG_NON_OO, DEBUG2_NON_OO, FATAL_ERROR_N...
-#include "prometheusMetrics.hpp" // for Gauge
+#include "prometheusMetrics.hpp" // for Gauge, Counter, MetricFamily
 #include "restClient.hpp"        // for restClient::restReply, restClient
 #include "restServer.hpp"        // for connectionInstance
 
@@ -19,6 +19,7 @@
 #include <condition_variable> // for condition_variable
 #include <exception>          // for exception
 #include <functional>         // for function
+#include <future>             // for shared_future, promise
 #include <map>                // for map, _Rb_tree_iterator, operator!=, map<>::iterator
 #include <memory>             // for unique_ptr, allocator, operator==, make_unique
 #include <mutex>              // for mutex, unique_lock, lock_guard
@@ -27,9 +28,10 @@
 #include <stdexcept>          // for runtime_error, out_of_range
 #include <stdint.h>           // for uint32_t, int32_t, uint64_t
 #include <string>             // for string, basic_string
-#include <thread>             // for sleep_for
+#include <thread>             // for thread
 #include <type_traits>        // for is_base_of, enable_if, enable_if_t
-#include <typeinfo>           // for type_info
+#include <typeinfo>           // for type_info, typeid
+#include <unordered_map>      // for unordered_map
 #include <utility>            // for pair, move, forward
 #include <vector>             // for vector
 
@@ -94,10 +96,37 @@ const std::string PATH_REQUEST_STATE = "/request-state";
  *                              datasetManager. Default 0.
  * @conf timeout_rest_client_s  Int. Timeout value passed to libevent. -1 will
  *                              use libevent default value (50s). Default 100.
+ * @conf hash_mode              String. How state and dataset IDs are calculated.
+ *                              "binary" hashes the fields of each state
+ *                              directly, "json" hashes their JSON
+ *                              serialisation, which is much slower but gives
+ *                              the IDs used by older versions of kotekan (e.g.
+ *                              to match existing archives). All instances
+ *                              using the same broker must use the same mode.
+ *                              Default "binary".
+ *
+ * States not known locally are fetched from the broker by a background thread.
+ * Requests made while others are outstanding are sent together, and several
+ * requests for the same state share one reply. Callers of `dataset_state` only
+ * wait for the state they need and do not hold any of the manager's locks
+ * while doing so, and `fetch_state` returns a future instead of waiting. When
+ * a state is first requested for a dataset, the states of all of its
+ * ancestors are fetched too, as they are usually wanted next. Stages can also
+ * call `prefetch` when they first see a dataset ID.
+ *
+ * Results of `dataset_state` are cached per dataset ID and state type, as
+ * neither the ancestry of a dataset nor the states can change once known. A
+ * cache hit does not take any of the manager's locks or contact the broker.
  *
  * @par metrics
  * @metric kotekan_datasetbroker_error_count Number of errors encountered in
  *                                           communication with the broker.
+ * @metric kotekan_datasetmanager_state_cache_hit_total
+ *         Number of `dataset_state` calls answered from the cache.
+ * @metric kotekan_datasetmanager_state_cache_miss_total
+ *         Number of `dataset_state` calls that had to search the dataset tree.
+ * @metric kotekan_datasetbroker_request_seconds
+ *         Time taken by the most recent request to each broker endpoint.
  *
  * @par REST Endpoints
  * @endpoint    /force-update ``GET`` Forces the datasetManager to register
@@ -267,6 +296,31 @@ public:
     template<typename T>
     inline const T* dataset_state(dset_id_t dset);
 
+    /**
+     * @brief Get a state by its ID without waiting for the broker.
+     *
+     * If the state is not known locally and `use_dataset_broker` is set, it
+     * is queued to be requested from the broker.
+     *
+     * @param  state  The ID of the state.
+     *
+     * @returns       A future holding a read-only pointer to the state. This is
+     *                a `nullptr` if there is no broker to ask, or if the
+     *                manager was stopped before the state arrived.
+     **/
+    std::shared_future<const datasetState*> fetch_state(state_id_t state);
+
+    /**
+     * @brief Start fetching the ancestors of a dataset in the background.
+     *
+     * This requests the dataset topology from the broker and then any states
+     * of the ancestors not known locally, such that later calls to
+     * `dataset_state` don't have to wait. Does nothing without a broker.
+     *
+     * @param  dset  The ID of the dataset.
+     **/
+    void prefetch(dset_id_t dset);
+
 
     /**
      * @brief Fingerprint a dataset for specified states.
@@ -378,9 +432,54 @@ private:
     void request_thread(const nlohmann::json&& request, const std::string&& endpoint,
                         const std::function<bool(std::string&)>&& parse_reply);
 
-    /// Wait for any ongoing requests of the same state OR request state.
-    template<typename T>
-    inline const T* request_state(state_id_t state_id);
+    /// Queue the states that are not known locally to be fetched from the
+    /// broker, and return futures for all of them
+    std::vector<std::shared_future<const datasetState*>>
+    fetch_states(const std::vector<state_id_t>& states);
+
+    /// Queue all unknown states of the locally known ancestors of a dataset
+    void fetch_ancestor_states(dset_id_t dset);
+
+    /// Thread sending the queued prefetches and state requests to the broker
+    void fetch_thread();
+
+    /// Request states from the broker, without waiting for a reply before
+    /// sending the next request. Returns the states that failed.
+    std::vector<state_id_t> request_states(const std::vector<state_id_t>& states);
+
+    /// Parse the reply to a state request and hand the state to any waiters
+    bool parse_reply_state(state_id_t state_id, const restClient::restReply& reply);
+
+    /// Make a blocking request to the broker and record how long it took
+    restClient::restReply broker_request(const std::string& endpoint, const nlohmann::json& data,
+                                         const int retries = 0, const int timeout = -1);
+
+    /// Look up a state in the cache. Returns `nullptr` if it is not there.
+    const datasetState* cached_state(dset_id_t dset, const std::string& type);
+
+    /// Add a state found by `dataset_state` to the cache
+    void cache_state(dset_id_t dset, const std::string& type, const datasetState* state);
+
+    /// Key of the state cache: a dataset ID and the state type name
+    using state_cache_key_t = std::pair<dset_id_t, std::string>;
+
+    struct state_cache_hash {
+        size_t operator()(const state_cache_key_t& key) const {
+            // The dataset ID is already a good hash
+            return key.first.l ^ std::hash<std::string>()(key.second);
+        }
+    };
+
+    using state_cache_t =
+        std::unordered_map<state_cache_key_t, const datasetState*, state_cache_hash>;
+
+    /// Snapshot of the state cache. This is never modified once published;
+    /// instead it is copied, added to and swapped in atomically, so readers
+    /// never need to lock.
+    std::shared_ptr<const state_cache_t> _state_cache;
+
+    /// Lock to serialise updates of the state cache
+    std::mutex _lock_state_cache;
 
     /// Store the list of all the registered states.
     std::map<state_id_t, state_uptr> _states;
@@ -401,27 +500,41 @@ private:
     /// Lock for the register dataset cv.
     std::mutex _lock_reg;
 
-    /// Lock for the receive state cv.
-    std::mutex _lock_recv_state;
-
     /// Lock for the stop request threads cv
     std::mutex _lock_stop_request_threads;
 
     /// Lock to only allow one dataset update at a time.
     std::mutex _lock_ds_update;
 
-    /// conditional variable to signal a received state.
-    std::condition_variable _cv_received_state;
-
     /// Condition Variable to signal request threads to stop on exit.
     std::condition_variable _cv_stop_request_threads;
 
     /// counter for connection and parsing errors
     std::atomic<uint32_t> _conn_error_count;
 
-    /// set of the states currently requested from the broker.
-    /// Protected by _lock_recv_state.
-    std::set<state_id_t> _requested_states;
+    /// States requested from the broker that have not arrived yet, with the
+    /// promise to fulfil and the future handed out to all requesters.
+    /// Protected by _lock_fetch.
+    std::map<state_id_t, std::pair<std::promise<const datasetState*>,
+                                   std::shared_future<const datasetState*>>>
+        _fetch_states;
+
+    /// States waiting to be requested by the fetch thread.
+    /// Protected by _lock_fetch.
+    std::vector<state_id_t> _fetch_queue;
+
+    /// Datasets whose ancestors the fetch thread should fetch.
+    /// Protected by _lock_fetch.
+    std::vector<dset_id_t> _prefetch_queue;
+
+    /// Lock for the fetch queues
+    std::mutex _lock_fetch;
+
+    /// Condition variable to wake the fetch thread
+    std::condition_variable _cv_fetch;
+
+    /// Thread requesting states from the broker
+    std::thread _fetch_thread;
 
     /// Set to true by the destructor.
     std::atomic<bool> _stop_request_threads;
@@ -439,12 +552,17 @@ private:
     uint32_t _retry_wait_time_ms;
     uint32_t _retries_rest_client;
     int32_t _timeout_rest_client_s;
+    bool _json_hash = false;
 
     /// a reference to the restClient instance
     restClient& _rest_client;
 
     // TODO: this should be a counter, but we don't have it using atomic Ints
     kotekan::prometheus::Gauge& error_counter;
+
+    kotekan::prometheus::Counter& state_cache_hit_counter;
+    kotekan::prometheus::Counter& state_cache_miss_counter;
+    kotekan::prometheus::MetricFamily<kotekan::prometheus::Gauge>& broker_request_time;
 };
 
 
@@ -455,8 +573,14 @@ private:
 template<typename T>
 inline const T* datasetManager::dataset_state(dset_id_t dset) {
 
+    static const std::string type = FACTORY(datasetState)::label<T>();
+
+    // Any earlier result for this dataset is still valid
+    const datasetState* cached = cached_state(dset, type);
+    if (cached)
+        return (const T*)cached;
+
     // Try to find a matching dataset
-    std::string type = FACTORY(datasetState)::label<T>();
     auto ret = closest_dataset_of_type(dset, type);
 
     DEBUG2_NON_OO("Finding state type {} from dset={}", type, dset.to_string());
@@ -467,34 +591,26 @@ inline const T* datasetManager::dataset_state(dset_id_t dset) {
 
     state_id_t state_id = ret.value().second.state();
 
-    // NOTE: we may want to reconsider if we should have released the lock
-    // between here and the `closest_dataset_of_type` call above. There's a
-    // possibility we may end up doing multiple requests to comet
-    {
-        std::lock_guard<std::mutex> dslock(_lock_dsets);
-
-        // Check if we have that state already
-        const datasetState* state = nullptr;
-        try {
-            state = _states.at(state_id).get();
-            return (const T*)state;
-        } catch (std::out_of_range& e) {
-            DEBUG_NON_OO("datasetManager: requested state {} not known locally.", state_id);
-        }
+    // A dataset we haven't looked at before. Other states of it are likely to
+    // be asked for next, so get them from the broker at the same time.
+    if (_use_broker)
+        fetch_ancestor_states(dset);
 
-        if (_use_broker) {
-            // Request the state from the broker.
-            state = request_state<T>(state_id);
-            while (!state && !_stop_request_threads) {
-                WARN_NON_OO("datasetManager: Failure requesting state {} from broker.\nRetrying...",
-                            state_id);
-                std::this_thread::sleep_for(std::chrono::milliseconds(_retry_wait_time_ms));
-                state = request_state<T>(state_id);
-            }
-            return (const T*)state;
-        } else
-            return nullptr;
+    // Wait without holding any locks, other stages may want the manager
+    const datasetState* state = fetch_state(state_id).get();
+    if (!state)
+        return nullptr;
+
+    // Check the state matches the type
+    if (typeid(*state) != typeid(T)) {
+        WARN_NON_OO("datasetManager: state {} of dataset {} is of type {:s}, not {:s}.", state_id,
+                    dset, state->type(), type);
+        error_counter.set(++_conn_error_count);
+        return nullptr;
     }
+
+    cache_state(dset, type, state);
+    return (const T*)state;
 }
 
 
@@ -541,90 +657,4 @@ datasetManager::add_state(std::unique_ptr<T>&& state,
     return std::pair<state_id_t, const T*>(hash, (const T*)(_states.at(hash).get()));
 }
 
-
-template<typename T>
-inline const T* datasetManager::request_state(state_id_t state_id) {
-
-    // If this state is requested already, wait for it.
-    if (_requested_states.count(state_id)) {
-        std::unique_lock<std::mutex> lck_rcvd(_lock_recv_state);
-        _cv_received_state.wait(lck_rcvd,
-                                [this, state_id]() { return !_requested_states.count(state_id); });
-    }
-
-    // If an ongoing request returned just when this function was
-    // called, we are done.
-    {
-        std::lock_guard<std::mutex> lck_states(_lock_states);
-        if (_states.count(state_id))
-            return (const T*)_states.at(state_id).get();
-    }
-
-    // Request state from broker
-    _requested_states.insert(state_id);
-    nlohmann::json js_request;
-    js_request["id"] = state_id;
-    restClient::restReply reply = _rest_client.make_request_blocking(
-        PATH_REQUEST_STATE, js_request, _ds_broker_host, _ds_broker_port);
-    if (!reply.first) {
-        WARN_NON_OO("datasetManager: Failure requesting state from broker: {:s}", reply.second);
-        error_counter.set(++_conn_error_count);
-        return nullptr;
-    }
-
-    nlohmann::json js_reply;
-    try {
-        js_reply = nlohmann::json::parse(reply.second);
-        if (js_reply.at("result") != "success")
-            throw std::runtime_error(fmt::format(fmt("Broker answered with result={:s}"),
-                                                 js_reply.at("result").dump(4)));
-
-        state_id_t s_id = js_reply.at("id");
-
-        state_uptr state = datasetState::from_json(js_reply.at("state"));
-        if (state == nullptr) {
-            throw(std::runtime_error(fmt::format(fmt("Failed to parse state received from "
-                                                     "broker: {:s}"),
-                                                 js_reply.at("state").dump(4))));
-        }
-
-        // register the received state
-        std::unique_lock<std::mutex> slck(_lock_states);
-        auto new_state =
-            _states.insert(std::pair<state_id_t, std::unique_ptr<datasetState>>(s_id, move(state)));
-        slck.unlock();
-
-        // signal other waiting state requests, that we received this state
-        {
-            std::unique_lock<std::mutex> _lck_rcvd(_lock_recv_state);
-            _requested_states.erase(state_id);
-        }
-        _cv_received_state.notify_all();
-
-        // hash collisions are checked for by the broker
-        if (!new_state.second)
-            INFO_NON_OO("datasetManager::request_state: received a state (with hash {}) that "
-                        "is already registered locally.",
-                        s_id);
-
-        // get a pointer out of that iterator
-        const datasetState* s = (const datasetState*)new_state.first->second.get();
-
-        // Check the state matches the type
-        if (typeid(T).hash_code() == typeid(*s).hash_code())
-            return (const T*)s;
-        else {
-            throw std::runtime_error(
-                fmt::format(fmt("Broker sent state that didn't match requested type ({:s}): {:s}"),
-                            FACTORY(datasetState)::label<T>(), js_reply.at("state").dump(4)));
-        }
-    } catch (std::exception& e) {
-        WARN_NON_OO("datasetManager: failure parsing reply received from broker after requesting "
-                    "state (reply: {:s}): {:s}",
-                    reply.second, e.what());
-        error_counter.set(++_conn_error_count);
-        return nullptr;
-    }
-}
-
 #endif
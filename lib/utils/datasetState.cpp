@@ -34,6 +34,10 @@ std::string datasetState::type() const {
     return FACTORY(datasetState)::label(*this);
 }
 
+void datasetState::hash_data(HashBuilder& h) const {
+    h.add(data_to_json().dump());
+}
+
 std::ostream& operator<<(std::ostream& out, const datasetState& dt) {
     out << dt.type();
     return out;
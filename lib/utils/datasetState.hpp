@@ -1,7 +1,7 @@
 #ifndef DATASETSTATE_HPP
 #define DATASETSTATE_HPP
 
-#include "Hash.hpp"     // for Hash
+#include "Hash.hpp"     // for Hash, HashBuilder
 #include "factory.hpp"  // for REGISTER_NAMED_TYPE_WITH_FACTORY, CREATE_FACTORY, FACTORY, Factory
 #include "gateSpec.hpp" // for gateSpec, _factory_aliasgateSpec
 #include "visUtil.hpp"  // for prod_ctype, rstack_ctype, time_ctype, input_ctype, freq_ctype
@@ -17,6 +17,7 @@
 #include <numeric>   // for iota
 #include <stddef.h>  // for size_t
 #include <stdexcept> // for runtime_error, out_of_range
+#include <string.h>  // for strnlen
 #include <string>    // for string
 #include <utility>   // for pair
 #include <vector>    // for vector, vector<>::iterator
@@ -88,6 +89,18 @@ public:
     std::string type() const;
 
 private:
+    /**
+     * @brief Feed the internal data of this instance into a hash.
+     *
+     * This is used by the datasetManager to calculate state IDs without having
+     * to serialise the state. Derived classes should override it to add every
+     * field that `data_to_json` saves. The default adds the JSON dump, which
+     * is correct but slow.
+     *
+     * @param  h  The hash to add to.
+     **/
+    virtual void hash_data(HashBuilder& h) const;
+
     // Add as friend so it can walk the inner state
     friend datasetManager;
 };
@@ -148,6 +161,16 @@ private:
         return j;
     }
 
+    /// Add the data of this state to a hash
+    void hash_data(HashBuilder& h) const override {
+        h.add<uint64_t>(_freqs.size());
+        for (const auto& [id, freq] : _freqs) {
+            h.add(id);
+            h.add(freq.centre);
+            h.add(freq.width);
+        }
+    }
+
     /// IDs that describe the subset that this dataset state defines
     std::vector<std::pair<uint32_t, freq_ctype>> _freqs;
 };
@@ -197,6 +220,16 @@ private:
         return j;
     }
 
+    /// Add the data of this state to a hash
+    void hash_data(HashBuilder& h) const override {
+        h.add<uint64_t>(_inputs.size());
+        for (const auto& input : _inputs) {
+            h.add(input.chan_id);
+            h.add(std::string(input.correlator_input,
+                              strnlen(input.correlator_input, sizeof(input.correlator_input))));
+        }
+    }
+
     /// The subset that this dataset state defines
     std::vector<input_ctype> _inputs;
 };
@@ -246,6 +279,15 @@ private:
         return j;
     }
 
+    /// Add the data of this state to a hash
+    void hash_data(HashBuilder& h) const override {
+        h.add<uint64_t>(_prods.size());
+        for (const auto& prod : _prods) {
+            h.add(prod.input_a);
+            h.add(prod.input_b);
+        }
+    }
+
     /// IDs that describe the subset that this dataset state defines
     std::vector<prod_ctype> _prods;
 };
@@ -296,6 +338,15 @@ private:
         return j;
     }
 
+    /// Add the data of this state to a hash
+    void hash_data(HashBuilder& h) const override {
+        h.add<uint64_t>(_times.size());
+        for (const auto& time : _times) {
+            h.add(time.fpga_count);
+            h.add(time.ctime);
+        }
+    }
+
     /// Time index map of the dataset state.
     std::vector<time_ctype> _times;
 };
@@ -362,6 +413,11 @@ private:
         return j;
     }
 
+    /// Add the data of this state to a hash
+    void hash_data(HashBuilder& h) const override {
+        h.add(_ev);
+    }
+
     /// Eigenvalues of the dataset state.
     std::vector<uint32_t> _ev;
 };
@@ -446,6 +502,16 @@ public:
         return {{"rstack", _rstack_map}, {"num_stack", _num_stack}};
     }
 
+    /// Add the data of this state to a hash
+    void hash_data(HashBuilder& h) const override {
+        h.add(_num_stack);
+        h.add<uint64_t>(_rstack_map.size());
+        for (const auto& rstack : _rstack_map) {
+            h.add(rstack.stack);
+            h.add(rstack.conjugate);
+        }
+    }
+
 private:
     /// Total number of stacks
     uint32_t _num_stack;
@@ -532,6 +598,13 @@ private:
         return j;
     }
 
+    /// Add the data of this state to a hash
+    void hash_data(HashBuilder& h) const override {
+        h.add(_weight_type);
+        h.add(_instrument_name);
+        h.add(_git_version_tag);
+    }
+
     // the actual metadata
     std::string _weight_type, _instrument_name, _git_version_tag;
 };
@@ -570,6 +643,12 @@ public:
         return {{"type", gating_type}, {"data", gating_data}};
     }
 
+    /// Add the data of this state to a hash
+    void hash_data(HashBuilder& h) const override {
+        h.add(gating_type);
+        h.add(gating_data.dump());
+    }
+
     /// Type of gating
     const std::string gating_type;
 
@@ -631,6 +710,12 @@ private:
         return j;
     }
 
+    /// Add the data of this state to a hash
+    void hash_data(HashBuilder& h) const override {
+        h.add(_update_id);
+        h.add(_transition_interval);
+    }
+
     // The label for the gains
     std::string _update_id;
 
@@ -679,6 +764,11 @@ private:
         return j;
     }
 
+    /// Add the data of this state to a hash
+    void hash_data(HashBuilder& h) const override {
+        h.add(_update_id);
+    }
+
     // The label for the flags
     std::string _update_id;
 };
@@ -737,6 +827,11 @@ private:
         return j;
     }
 
+    /// Add the data of this state to a hash
+    void hash_data(HashBuilder& h) const override {
+        h.add(_beams);
+    }
+
     /// Time index map of the dataset state.
     std::vector<uint32_t> _beams;
 };
@@ -796,6 +891,11 @@ private:
         return j;
     }
 
+    /// Add the data of this state to a hash
+    void hash_data(HashBuilder& h) const override {
+        h.add(_subfreqs);
+    }
+
     /// Time index map of the dataset state.
     std::vector<uint32_t> _subfreqs;
 };
@@ -858,6 +958,16 @@ private:
         return j;
     }
 
+    /// Add the data of this state to a hash
+    void hash_data(HashBuilder& h) const override {
+        h.add(enabled);
+        h.add<uint64_t>(thresholds.size());
+        for (const auto& [a, b] : thresholds) {
+            h.add(a);
+            h.add(b);
+        }
+    }
+
     /// Tells if frame dropping is enabled in the RFIFrameDrop stage.
     bool enabled;
 
@@ -20,8 +20,9 @@
 #include <stdexcept>    // for runtime_error, out_of_range
 #include <string.h>     // for strerror
 #include <sys/stat.h>   // for S_IRGRP, S_IROTH, S_IRUSR, S_IWGRP, S_IWUSR
+#include <sys/uio.h>    // for iovec, pwritev
 #include <system_error> // for system_error
-#include <unistd.h>     // for close, pwrite, TEMP_FAILURE_RETRY
+#include <unistd.h>     // for close, pwrite, ssize_t, TEMP_FAILURE_RETRY
 #include <utility>      // for pair
 
 
@@ -120,6 +121,10 @@ hfbFileRaw::~hfbFileRaw() {
     metadata_file.write((const char*)&t[0], t.size());
     metadata_file.close();
 
+    // Let any queued writes and flushes finish before closing
+    if (async_writer)
+        async_writer->drain();
+
     // TODO: final sync of data file.
     close(fd);
 
@@ -130,7 +135,16 @@ size_t hfbFileRaw::num_time() {
     return times.size();
 }
 
+void hfbFileRaw::set_async_writer(std::shared_ptr<AsyncFileWriter> writer) {
+    async_writer = writer;
+}
+
 void hfbFileRaw::flush_raw_async(int ind) {
+    if (async_writer) {
+        size_t n = nfreq * frame_size;
+        async_writer->flush(fd, ind * n, n, false);
+        return;
+    }
 #ifdef __linux__
     size_t n = nfreq * frame_size;
     sync_file_range(fd, ind * n, n, SYNC_FILE_RANGE_WRITE);
@@ -140,6 +154,11 @@ void hfbFileRaw::flush_raw_async(int ind) {
 }
 
 void hfbFileRaw::flush_raw_sync(int ind) {
+    if (async_writer) {
+        size_t n = nfreq * frame_size;
+        async_writer->flush(fd, ind * n, n, true);
+        return;
+    }
 #ifdef __linux__
     size_t n = nfreq * frame_size;
     sync_file_range(fd, ind * n, n,
@@ -198,6 +217,20 @@ bool hfbFileRaw::write_raw(off_t offset, size_t nb, const void* data) {
     return true;
 }
 
+bool hfbFileRaw::write_raw(off_t offset, const std::vector<iovec>& iov) {
+
+    // Write in a retry macro loop incase the write was interrupted by a signal
+    ssize_t nbytes = TEMP_FAILURE_RETRY(pwritev(fd, iov.data(), iov.size(), offset));
+
+    if (nbytes < 0) {
+        ERROR("Write error attempting to write {:d} pieces at offset {:d} into file {:s}: {:s}",
+              iov.size(), offset, _name, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
 void hfbFileRaw::write_sample(uint32_t time_ind, uint32_t freq_ind, const FrameView& frame_view) {
 
     const HFBFrameView& frame = static_cast<const HFBFrameView&>(frame_view);
@@ -215,7 +248,15 @@ void hfbFileRaw::write_sample(uint32_t time_ind, uint32_t freq_ind, const FrameV
     // Write out data to the right place
     off_t offset = (time_ind * nfreq + freq_ind) * frame_size;
 
-    write_raw(offset, 1, &ONE);
-    write_raw(offset + 1, metadata_size, frame.metadata());
-    write_raw(offset + 1 + metadata_size, data_size, frame.data());
+    std::vector<iovec> iov = {{(void*)&ONE, 1},
+                              {(void*)frame.metadata(), metadata_size},
+                              {(void*)frame.data(), data_size}};
+
+    // The background writer copies the frame, so fill out the padding and
+    // write whole blocks
+    if (async_writer) {
+        async_writer->write(fd, offset, iov, frame_size);
+    } else {
+        write_raw(offset, iov);
+    }
 }
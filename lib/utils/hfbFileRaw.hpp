@@ -6,11 +6,12 @@
 #ifndef HFB_FILE_RAW_HPP
 #define HFB_FILE_RAW_HPP
 
-#include "FrameView.hpp"      // for FrameView
-#include "dataset.hpp"        // for dset_id_t
-#include "kotekanLogging.hpp" // for logLevel
-#include "visFile.hpp"        // for visFile
-#include "visUtil.hpp"        // for time_ctype
+#include "AsyncFileWriter.hpp" // for AsyncFileWriter
+#include "FrameView.hpp"       // for FrameView
+#include "dataset.hpp"         // for dset_id_t
+#include "kotekanLogging.hpp"  // for logLevel
+#include "visFile.hpp"         // for visFile
+#include "visUtil.hpp"         // for time_ctype
 
 #include "json.hpp" // for json
 
@@ -18,9 +19,11 @@
 #include <fcntl.h>     // for O_CREAT, O_EXCL, O_WRONLY
 #include <fstream>     // for ofstream
 #include <map>         // for map
+#include <memory>      // for shared_ptr
 #include <stddef.h>    // for size_t
 #include <string>      // for string
 #include <sys/types.h> // for off_t
+#include <sys/uio.h>   // for iovec
 #include <vector>      // for vector
 
 
@@ -102,6 +105,16 @@ public:
      **/
     void deactivate_time(uint32_t time_ind) override;
 
+    /**
+     * @brief Queue the writes and flushes on a background writer.
+     *
+     * Each sample is then written as a single zero padded block of
+     * `frame_size` bytes.
+     *
+     * @param writer The writer to use.
+     **/
+    void set_async_writer(std::shared_ptr<AsyncFileWriter> writer) override;
+
 protected:
     /**
      * @brief  Helper routine for writing data into the file
@@ -112,6 +125,14 @@ protected:
      **/
     bool write_raw(off_t offset, size_t nb, const void* data);
 
+    /**
+     * @brief  Helper routine for writing several pieces of data contiguously
+     *
+     * @param offset Offset of the data to write.
+     * @param iov    The pieces of data to write out.
+     **/
+    bool write_raw(off_t offset, const std::vector<iovec>& iov);
+
     /**
      * @brief Start an async flush to disk
      *
@@ -134,6 +155,7 @@ protected:
 
     // File descriptors and related
     int fd;
+    std::shared_ptr<AsyncFileWriter> async_writer;
     std::ofstream metadata_file;
     std::string lock_filename;
 
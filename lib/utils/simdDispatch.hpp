@@ -0,0 +1,61 @@
+/*****************************************
+@file
+@brief Runtime selection of SIMD kernel implementations.
+- simdLevel
+- simd_level
+- simd_level_name
+*****************************************/
+#ifndef SIMD_DISPATCH_HPP
+#define SIMD_DISPATCH_HPP
+
+/**
+ * @brief Instruction set levels that kernels can be specialised for.
+ *
+ * Levels are ordered, so a kernel implemented for a lower level can always be
+ * used when a higher one is available.
+ **/
+enum class simdLevel { scalar = 0, avx2 = 1, avx512 = 2 };
+
+/**
+ * @brief Query the CPU for the highest supported SIMD level.
+ *
+ * AVX-512 is only reported when the foundation, byte/word and double/quad word
+ * extensions are all available, as the kernels assume that set.
+ *
+ * @returns  The best level this CPU can run.
+ **/
+inline simdLevel detect_simd_level() {
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512dq"))
+        return simdLevel::avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return simdLevel::avx2;
+#endif
+    return simdLevel::scalar;
+}
+
+/**
+ * @brief The SIMD level used by default for kernel dispatch.
+ *
+ * This is detected once on first use and cached.
+ **/
+inline simdLevel simd_level() {
+    static const simdLevel level = detect_simd_level();
+    return level;
+}
+
+/// Get a printable name for a SIMD level.
+inline const char* simd_level_name(simdLevel level) {
+    switch (level) {
+        case simdLevel::avx512:
+            return "avx512";
+        case simdLevel::avx2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+#endif // SIMD_DISPATCH_HPP
@@ -0,0 +1,130 @@
+/*****************************************
+@file
+@brief Cache blocked transposition of frames into time ordered chunks.
+- tiledTranspose
+*****************************************/
+#ifndef TILED_TRANSPOSE_HPP
+#define TILED_TRANSPOSE_HPP
+
+#include <algorithm>   // for min
+#include <cstring>     // for memcpy
+#include <stddef.h>    // for size_t
+#include <type_traits> // for is_trivially_copyable_v
+#include <vector>      // for vector
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define TILED_TRANSPOSE_STREAM
+#include <immintrin.h> // for _mm_stream_si32, _mm_stream_si64, _mm_sfence
+#endif
+
+
+/**
+ * @class tiledTranspose
+ * @brief Transpose frames into a chunk with time as the fastest varying index.
+ *
+ * The chunk is laid out as `out[(f * n_val + i) * n_t + t]` for frequency `f`,
+ * value `i` within the frame and time `t`. Writing each frame straight into
+ * it touches a different cache line for every value, and each line has been
+ * evicted again by the time the next frame writes its neighbour.
+ *
+ * Instead this collects a tile of consecutive times for each frequency. The
+ * tile holds one cache line worth of times for every value, and for moderate
+ * frame sizes stays in cache. Once full the tile is transposed into the chunk
+ * in blocks of values, writing whole lines at a time with streaming stores as
+ * the chunk won't be read again until it is written out.
+ *
+ * Frames for each frequency must be added in time order, and the last time of
+ * the chunk (`n_t - 1`) must be added, which flushes what is left. Gaps in the
+ * times are allowed, the chunk is left untouched there.
+ **/
+template<typename T>
+class tiledTranspose {
+public:
+    /**
+     * @brief Set up the tiles.
+     *
+     * @param  n_val  Number of values in each frame.
+     * @param  n_f    Maximum number of frequencies in a chunk.
+     **/
+    tiledTranspose(size_t n_val = 0, size_t n_f = 0) :
+        n_val(n_val), staging(n_f * tile_len * n_val), tile_start(n_f, 0), tile_fill(n_f, 0) {}
+
+    /**
+     * @brief Add a frame to the chunk.
+     *
+     * @param  in   The values of the frame.
+     * @param  out  The chunk. Must be the same for every frame of the chunk.
+     * @param  f    Frequency index of the frame within the chunk.
+     * @param  t    Time index of the frame within the chunk.
+     * @param  n_t  Length of the time axis of the chunk.
+     **/
+    void add(const T* in, T* out, size_t f, size_t t, size_t n_t) {
+
+        // Flush anything that this frame does not follow on from
+        if (tile_fill[f] > 0 && t != tile_start[f] + tile_fill[f])
+            flush(out, f, n_t);
+
+        if (tile_fill[f] == 0)
+            tile_start[f] = t;
+
+        std::memcpy(&staging[(f * tile_len + tile_fill[f]) * n_val], in, n_val * sizeof(T));
+        tile_fill[f]++;
+
+        if (tile_fill[f] == tile_len || t == n_t - 1)
+            flush(out, f, n_t);
+    }
+
+    /// Number of times held in a tile before it is flushed.
+    static constexpr size_t tile_len = std::max<size_t>(64 / sizeof(T), 1);
+
+private:
+    /// Write out the tile for frequency `f`
+    void flush(T* out, size_t f, size_t n_t) {
+        const size_t m = tile_fill[f];
+        const T* tile = &staging[f * tile_len * n_val];
+        T* dst = out + f * n_val * n_t + tile_start[f];
+
+        // Small enough that the rows of the tile for a block stay in L1
+        const size_t block = 64;
+        for (size_t i0 = 0; i0 < n_val; i0 += block) {
+            size_t i1 = std::min(i0 + block, n_val);
+            for (size_t i = i0; i < i1; i++) {
+                for (size_t j = 0; j < m; j++) {
+                    stream(dst + i * n_t + j, tile[j * n_val + i]);
+                }
+            }
+        }
+#ifdef TILED_TRANSPOSE_STREAM
+        _mm_sfence();
+#endif
+
+        tile_fill[f] = 0;
+    }
+
+    /// Store a value, bypassing the cache where possible
+    static inline void stream(T* dst, const T& val) {
+#ifdef TILED_TRANSPOSE_STREAM
+        if constexpr (std::is_trivially_copyable_v<T> && sizeof(T) == 8) {
+            long long bits;
+            std::memcpy(&bits, &val, sizeof(bits));
+            _mm_stream_si64((long long*)dst, bits);
+            return;
+        } else if constexpr (std::is_trivially_copyable_v<T> && sizeof(T) == 4) {
+            int bits;
+            std::memcpy(&bits, &val, sizeof(bits));
+            _mm_stream_si32((int*)dst, bits);
+            return;
+        }
+#endif
+        *dst = val;
+    }
+
+    size_t n_val;
+
+    // Tiles for each frequency, laid out as [f][time in tile][value]
+    std::vector<T> staging;
+    std::vector<size_t> tile_start;
+    std::vector<size_t> tile_fill;
+};
+
+#endif // TILED_TRANSPOSE_HPP
@@ -0,0 +1,434 @@
+#include "truncateKernel.hpp"
+
+#include "simdDispatch.hpp" // for simdLevel
+#include "truncate.hpp"     // for bit_truncate_float, HIGH_BITS
+
+#include <cmath>   // for abs, sqrt
+#include <complex> // for complex
+#include <cstdint> // for int32_t
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define TRUNCATE_KERNEL_X86
+// GCC 12 gives false positives inside the AVX-512 headers (GCC bug 105593)
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h> // for __m256, __m512, _mm256_cvttps_epi32, _mm512_cvttps_epi32, ...
+#endif
+
+
+namespace {
+
+// Scalar versions. These are `bit_truncate_float` applied one at a time, which
+// the vectorised versions must reproduce, and also handle the tails.
+
+void truncate_scalar(float* val, const float* err, size_t start, size_t n) {
+    for (size_t i = start; i < n; i++) {
+        val[i] = bit_truncate_float(val[i], err[i]);
+    }
+}
+
+void truncate_complex_scalar(float* val, const float* err, size_t start, size_t n) {
+    for (size_t i = start; i < n; i++) {
+        val[2 * i] = bit_truncate_float(val[2 * i], err[i]);
+        val[2 * i + 1] = bit_truncate_float(val[2 * i + 1], err[i]);
+    }
+}
+
+void truncate_relative_scalar(float* val, float prec, size_t start, size_t n) {
+    for (size_t i = start; i < n; i++) {
+        val[i] = bit_truncate_float(val[i], std::abs(prec * val[i]));
+    }
+}
+
+// The maximum error for a value with weight `w`
+inline float weighted_err(float x, float w, float err_init, float prec) {
+    return (w == 0.0f) ? prec * std::abs(x) : std::sqrt(err_init / w);
+}
+
+bool truncate_weighted_scalar(float* val, float* weight, size_t start, size_t n, float err_init,
+                              float prec, float weight_prec) {
+    bool zero_weight = false;
+    for (size_t i = start; i < n; i++) {
+        float w = weight[i];
+        zero_weight |= (w == 0.0f);
+        val[i] = bit_truncate_float(val[i], weighted_err(val[i], w, err_init, prec));
+        weight[i] = bit_truncate_float(w, weight_prec * w);
+    }
+    return zero_weight;
+}
+
+bool truncate_weighted_complex_scalar(float* val, float* weight, size_t start, size_t n,
+                                      float err_init, float prec, float weight_prec) {
+    bool zero_weight = false;
+    for (size_t i = start; i < n; i++) {
+        float w = weight[i];
+        zero_weight |= (w == 0.0f);
+        val[2 * i] = bit_truncate_float(val[2 * i], weighted_err(val[2 * i], w, err_init, prec));
+        val[2 * i + 1] =
+            bit_truncate_float(val[2 * i + 1], weighted_err(val[2 * i + 1], w, err_init, prec));
+        weight[i] = bit_truncate_float(w, weight_prec * w);
+    }
+    return zero_weight;
+}
+
+#ifdef TRUNCATE_KERNEL_X86
+
+// AVX2 versions, processing 8 floats per iteration
+
+// `bit_truncate_float` on 8 values at once, step by step.
+//
+// The mantissa with its implicit bit is in [2**23, 2**24), and is rounded to a
+// multiple of a power of two, so the result is either 0, in [2**23, 2**24), or
+// exactly 2**24. That means the leading zero count is always 32, 8 or 7, and
+// renormalising is just a choice between those three.
+__attribute__((target("avx2"))) inline __m256 truncate_avx2(__m256 val, __m256 err) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i mask_man = _mm256_set1_epi32(8388607);
+
+    // Split into sign, exponent and mantissa (with the implicit bit)
+    __m256i bits = _mm256_castps_si256(val);
+    __m256i pre = _mm256_srai_epi32(bits, 23);
+    __m256i pow = _mm256_and_si256(pre, _mm256_set1_epi32(255));
+    __m256i sign = _mm256_srai_epi32(pre, 8);
+    __m256i man = _mm256_add_epi32(_mm256_and_si256(bits, mask_man), _mm256_set1_epi32(8388608));
+
+    // Scale the error by fast_pow(150 - pow), which takes an int8_t exponent
+    __m256i e = _mm256_sub_epi32(_mm256_set1_epi32(150), pow);
+    e = _mm256_srai_epi32(_mm256_slli_epi32(e, 24), 24);
+    __m256 scale =
+        _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(e, _mm256_set1_epi32(127)), 23));
+    __m256i int_err = _mm256_cvttps_epi32(_mm256_mul_ps(err, scale));
+    __m256i ok = _mm256_cmpeq_epi32(
+        _mm256_and_si256(int_err, _mm256_set1_epi32((int32_t)HIGH_BITS)), zero);
+    int_err = _mm256_blendv_epi8(_mm256_set1_epi32(1073741823), int_err, ok);
+
+    // bit_truncate
+    __m256i gran = int_err;
+    gran = _mm256_or_si256(gran, _mm256_srli_epi32(gran, 1));
+    gran = _mm256_or_si256(gran, _mm256_srli_epi32(gran, 2));
+    gran = _mm256_or_si256(gran, _mm256_srli_epi32(gran, 4));
+    gran = _mm256_or_si256(gran, _mm256_srli_epi32(gran, 8));
+    gran = _mm256_or_si256(gran, _mm256_srli_epi32(gran, 16));
+    gran = _mm256_add_epi32(gran, one);
+    __m256i bitmask = _mm256_sub_epi32(gran, one);
+    __m256i tie = _mm256_cmpeq_epi32(_mm256_slli_epi32(_mm256_and_si256(man, bitmask), 1), gran);
+    __m256i tr = _mm256_or_si256(_mm256_sub_epi32(man, _mm256_srai_epi32(gran, 1)), bitmask);
+    tr = _mm256_add_epi32(tr, one);
+    // The comparison is -1 where the error is zero
+    tr = _mm256_add_epi32(tr, _mm256_cmpeq_epi32(int_err, zero));
+    tr = _mm256_sub_epi32(tr, _mm256_and_si256(tr, _mm256_and_si256(tie, gran)));
+
+    // Renormalise, and put the sign and exponent back
+    __m256i round_zero = _mm256_cmpeq_epi32(tr, zero);
+    __m256i carry = _mm256_cmpgt_epi32(tr, _mm256_set1_epi32(16777215));
+    man = _mm256_andnot_si256(carry, _mm256_and_si256(tr, mask_man));
+    pow = _mm256_andnot_si256(round_zero, _mm256_sub_epi32(pow, carry));
+    bits = _mm256_or_si256(
+        man, _mm256_slli_epi32(_mm256_or_si256(pow, _mm256_slli_epi32(sign, 8)), 23));
+
+    return _mm256_castsi256_ps(bits);
+}
+
+__attribute__((target("avx2"))) inline __m256 abs_avx2(__m256 x) {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+}
+
+// The errors for 4 complex values, with each repeated for the real and imaginary parts
+__attribute__((target("avx2"))) inline __m256 expand_avx2(__m256 x, bool high) {
+    const __m256i lo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    const __m256i hi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+    return _mm256_permutevar8x32_ps(x, high ? hi : lo);
+}
+
+__attribute__((target("avx2"))) void truncate_avx2(float* val, const float* err, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(val + i);
+        _mm256_storeu_ps(val + i, truncate_avx2(x, _mm256_loadu_ps(err + i)));
+    }
+    truncate_scalar(val, err, i, n);
+}
+
+__attribute__((target("avx2"))) void truncate_complex_avx2(float* val, const float* err,
+                                                           size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 e = _mm256_loadu_ps(err + i);
+        for (int h = 0; h < 2; h++) {
+            float* v = val + 2 * i + 8 * h;
+            _mm256_storeu_ps(v, truncate_avx2(_mm256_loadu_ps(v), expand_avx2(e, h)));
+        }
+    }
+    truncate_complex_scalar(val, err, i, n);
+}
+
+__attribute__((target("avx2"))) void truncate_relative_avx2(float* val, float prec, size_t n) {
+    const __m256 p = _mm256_set1_ps(prec);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(val + i);
+        _mm256_storeu_ps(val + i, truncate_avx2(x, abs_avx2(_mm256_mul_ps(p, x))));
+    }
+    truncate_relative_scalar(val, prec, i, n);
+}
+
+__attribute__((target("avx2"))) inline __m256 weighted_err_avx2(__m256 x, __m256 w, __m256 e,
+                                                                __m256 p) {
+    __m256 zero_w = _mm256_cmp_ps(w, _mm256_setzero_ps(), _CMP_EQ_OQ);
+    return _mm256_blendv_ps(_mm256_sqrt_ps(_mm256_div_ps(e, w)), _mm256_mul_ps(p, abs_avx2(x)),
+                            zero_w);
+}
+
+__attribute__((target("avx2"))) bool truncate_weighted_avx2(float* val, float* weight, size_t n,
+                                                            float err_init, float prec,
+                                                            float weight_prec) {
+    const __m256 e = _mm256_set1_ps(err_init);
+    const __m256 p = _mm256_set1_ps(prec);
+    const __m256 wp = _mm256_set1_ps(weight_prec);
+    int zero_weight = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(val + i);
+        __m256 w = _mm256_loadu_ps(weight + i);
+        zero_weight |= _mm256_movemask_ps(_mm256_cmp_ps(w, _mm256_setzero_ps(), _CMP_EQ_OQ));
+        _mm256_storeu_ps(val + i, truncate_avx2(x, weighted_err_avx2(x, w, e, p)));
+        _mm256_storeu_ps(weight + i, truncate_avx2(w, _mm256_mul_ps(wp, w)));
+    }
+    bool tail = truncate_weighted_scalar(val, weight, i, n, err_init, prec, weight_prec);
+    return zero_weight || tail;
+}
+
+__attribute__((target("avx2"))) bool truncate_weighted_complex_avx2(float* val, float* weight,
+                                                                    size_t n, float err_init,
+                                                                    float prec,
+                                                                    float weight_prec) {
+    const __m256 e = _mm256_set1_ps(err_init);
+    const __m256 p = _mm256_set1_ps(prec);
+    const __m256 wp = _mm256_set1_ps(weight_prec);
+    int zero_weight = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 w = _mm256_loadu_ps(weight + i);
+        zero_weight |= _mm256_movemask_ps(_mm256_cmp_ps(w, _mm256_setzero_ps(), _CMP_EQ_OQ));
+        for (int h = 0; h < 2; h++) {
+            float* v = val + 2 * i + 8 * h;
+            __m256 x = _mm256_loadu_ps(v);
+            _mm256_storeu_ps(v, truncate_avx2(x, weighted_err_avx2(x, expand_avx2(w, h), e, p)));
+        }
+        _mm256_storeu_ps(weight + i, truncate_avx2(w, _mm256_mul_ps(wp, w)));
+    }
+    bool tail = truncate_weighted_complex_scalar(val, weight, i, n, err_init, prec, weight_prec);
+    return zero_weight || tail;
+}
+
+// AVX-512 versions, processing 16 floats per iteration
+
+// As truncate_avx2, with masks in place of the comparison vectors
+__attribute__((target("avx512f"))) inline __m512 truncate_avx512(__m512 val, __m512 err) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i mask_man = _mm512_set1_epi32(8388607);
+
+    // Split into sign, exponent and mantissa (with the implicit bit)
+    __m512i bits = _mm512_castps_si512(val);
+    __m512i pre = _mm512_srai_epi32(bits, 23);
+    __m512i pow = _mm512_and_si512(pre, _mm512_set1_epi32(255));
+    __m512i sign = _mm512_srai_epi32(pre, 8);
+    __m512i man = _mm512_add_epi32(_mm512_and_si512(bits, mask_man), _mm512_set1_epi32(8388608));
+
+    // Scale the error by fast_pow(150 - pow), which takes an int8_t exponent
+    __m512i e = _mm512_sub_epi32(_mm512_set1_epi32(150), pow);
+    e = _mm512_srai_epi32(_mm512_slli_epi32(e, 24), 24);
+    __m512 scale =
+        _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(e, _mm512_set1_epi32(127)), 23));
+    __m512i int_err = _mm512_cvttps_epi32(_mm512_mul_ps(err, scale));
+    __mmask16 over = _mm512_test_epi32_mask(int_err, _mm512_set1_epi32((int32_t)HIGH_BITS));
+    int_err = _mm512_mask_blend_epi32(over, int_err, _mm512_set1_epi32(1073741823));
+
+    // bit_truncate
+    __m512i gran = int_err;
+    gran = _mm512_or_si512(gran, _mm512_srli_epi32(gran, 1));
+    gran = _mm512_or_si512(gran, _mm512_srli_epi32(gran, 2));
+    gran = _mm512_or_si512(gran, _mm512_srli_epi32(gran, 4));
+    gran = _mm512_or_si512(gran, _mm512_srli_epi32(gran, 8));
+    gran = _mm512_or_si512(gran, _mm512_srli_epi32(gran, 16));
+    gran = _mm512_add_epi32(gran, one);
+    __m512i bitmask = _mm512_sub_epi32(gran, one);
+    __mmask16 tie =
+        _mm512_cmpeq_epi32_mask(_mm512_slli_epi32(_mm512_and_si512(man, bitmask), 1), gran);
+    __m512i tr = _mm512_or_si512(_mm512_sub_epi32(man, _mm512_srai_epi32(gran, 1)), bitmask);
+    tr = _mm512_add_epi32(tr, one);
+    tr = _mm512_mask_sub_epi32(tr, _mm512_cmpeq_epi32_mask(int_err, zero), tr, one);
+    tr = _mm512_sub_epi32(tr, _mm512_and_si512(tr, _mm512_maskz_mov_epi32(tie, gran)));
+
+    // Renormalise, and put the sign and exponent back
+    __mmask16 round_zero = _mm512_cmpeq_epi32_mask(tr, zero);
+    __mmask16 carry = _mm512_cmpgt_epi32_mask(tr, _mm512_set1_epi32(16777215));
+    man = _mm512_maskz_and_epi32(~carry, tr, mask_man);
+    pow = _mm512_maskz_mov_epi32(~round_zero, _mm512_mask_add_epi32(pow, carry, pow, one));
+    bits = _mm512_or_si512(
+        man, _mm512_slli_epi32(_mm512_or_si512(pow, _mm512_slli_epi32(sign, 8)), 23));
+
+    return _mm512_castsi512_ps(bits);
+}
+
+// The errors for 8 complex values, with each repeated for the real and imaginary parts
+__attribute__((target("avx512f"))) inline __m512 expand_avx512(__m512 x, bool high) {
+    const __m512i lo = _mm512_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7);
+    const __m512i hi =
+        _mm512_setr_epi32(8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15);
+    return _mm512_permutexvar_ps(high ? hi : lo, x);
+}
+
+__attribute__((target("avx512f"))) void truncate_avx512(float* val, const float* err, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 x = _mm512_loadu_ps(val + i);
+        _mm512_storeu_ps(val + i, truncate_avx512(x, _mm512_loadu_ps(err + i)));
+    }
+    truncate_scalar(val, err, i, n);
+}
+
+__attribute__((target("avx512f"))) void truncate_complex_avx512(float* val, const float* err,
+                                                                size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 e = _mm512_loadu_ps(err + i);
+        for (int h = 0; h < 2; h++) {
+            float* v = val + 2 * i + 16 * h;
+            _mm512_storeu_ps(v, truncate_avx512(_mm512_loadu_ps(v), expand_avx512(e, h)));
+        }
+    }
+    truncate_complex_scalar(val, err, i, n);
+}
+
+__attribute__((target("avx512f"))) void truncate_relative_avx512(float* val, float prec,
+                                                                 size_t n) {
+    const __m512 p = _mm512_set1_ps(prec);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 x = _mm512_loadu_ps(val + i);
+        _mm512_storeu_ps(val + i, truncate_avx512(x, _mm512_abs_ps(_mm512_mul_ps(p, x))));
+    }
+    truncate_relative_scalar(val, prec, i, n);
+}
+
+__attribute__((target("avx512f"))) inline __m512 weighted_err_avx512(__m512 x, __m512 w,
+                                                                     __m512 e, __m512 p) {
+    __mmask16 zero_w = _mm512_cmp_ps_mask(w, _mm512_setzero_ps(), _CMP_EQ_OQ);
+    return _mm512_mask_blend_ps(zero_w, _mm512_sqrt_ps(_mm512_div_ps(e, w)),
+                                _mm512_mul_ps(p, _mm512_abs_ps(x)));
+}
+
+__attribute__((target("avx512f"))) bool truncate_weighted_avx512(float* val, float* weight,
+                                                                 size_t n, float err_init,
+                                                                 float prec, float weight_prec) {
+    const __m512 e = _mm512_set1_ps(err_init);
+    const __m512 p = _mm512_set1_ps(prec);
+    const __m512 wp = _mm512_set1_ps(weight_prec);
+    __mmask16 zero_weight = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 x = _mm512_loadu_ps(val + i);
+        __m512 w = _mm512_loadu_ps(weight + i);
+        zero_weight |= _mm512_cmp_ps_mask(w, _mm512_setzero_ps(), _CMP_EQ_OQ);
+        _mm512_storeu_ps(val + i, truncate_avx512(x, weighted_err_avx512(x, w, e, p)));
+        _mm512_storeu_ps(weight + i, truncate_avx512(w, _mm512_mul_ps(wp, w)));
+    }
+    bool tail = truncate_weighted_scalar(val, weight, i, n, err_init, prec, weight_prec);
+    return zero_weight || tail;
+}
+
+__attribute__((target("avx512f"))) bool
+truncate_weighted_complex_avx512(float* val, float* weight, size_t n, float err_init, float prec,
+                                 float weight_prec) {
+    const __m512 e = _mm512_set1_ps(err_init);
+    const __m512 p = _mm512_set1_ps(prec);
+    const __m512 wp = _mm512_set1_ps(weight_prec);
+    __mmask16 zero_weight = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 w = _mm512_loadu_ps(weight + i);
+        zero_weight |= _mm512_cmp_ps_mask(w, _mm512_setzero_ps(), _CMP_EQ_OQ);
+        for (int h = 0; h < 2; h++) {
+            float* v = val + 2 * i + 16 * h;
+            __m512 x = _mm512_loadu_ps(v);
+            _mm512_storeu_ps(v,
+                             truncate_avx512(x, weighted_err_avx512(x, expand_avx512(w, h), e, p)));
+        }
+        _mm512_storeu_ps(weight + i, truncate_avx512(w, _mm512_mul_ps(wp, w)));
+    }
+    bool tail = truncate_weighted_complex_scalar(val, weight, i, n, err_init, prec, weight_prec);
+    return zero_weight || tail;
+}
+
+#endif // TRUNCATE_KERNEL_X86
+
+} // namespace
+
+
+void truncate_array(float* val, const float* err, size_t n, simdLevel level) {
+#ifdef TRUNCATE_KERNEL_X86
+    if (level == simdLevel::avx512)
+        return truncate_avx512(val, err, n);
+    if (level == simdLevel::avx2)
+        return truncate_avx2(val, err, n);
+#endif
+    (void)level;
+    truncate_scalar(val, err, 0, n);
+}
+
+void truncate_array(std::complex<float>* val, const float* err, size_t n, simdLevel level) {
+    float* v = reinterpret_cast<float*>(val);
+#ifdef TRUNCATE_KERNEL_X86
+    if (level == simdLevel::avx512)
+        return truncate_complex_avx512(v, err, n);
+    if (level == simdLevel::avx2)
+        return truncate_complex_avx2(v, err, n);
+#endif
+    (void)level;
+    truncate_complex_scalar(v, err, 0, n);
+}
+
+void truncate_array_relative(float* val, float prec, size_t n, simdLevel level) {
+#ifdef TRUNCATE_KERNEL_X86
+    if (level == simdLevel::avx512)
+        return truncate_relative_avx512(val, prec, n);
+    if (level == simdLevel::avx2)
+        return truncate_relative_avx2(val, prec, n);
+#endif
+    (void)level;
+    truncate_relative_scalar(val, prec, 0, n);
+}
+
+void truncate_array_relative(std::complex<float>* val, float prec, size_t n, simdLevel level) {
+    // Both parts are relative to themselves, so this is just an array twice as long
+    truncate_array_relative(reinterpret_cast<float*>(val), prec, 2 * n, level);
+}
+
+bool truncate_weighted(float* val, float* weight, size_t n, float err_sq_lim, float prec,
+                       float weight_prec, simdLevel level) {
+    const float err_init = 0.5f * err_sq_lim;
+#ifdef TRUNCATE_KERNEL_X86
+    if (level == simdLevel::avx512)
+        return truncate_weighted_avx512(val, weight, n, err_init, prec, weight_prec);
+    if (level == simdLevel::avx2)
+        return truncate_weighted_avx2(val, weight, n, err_init, prec, weight_prec);
+#endif
+    (void)level;
+    return truncate_weighted_scalar(val, weight, 0, n, err_init, prec, weight_prec);
+}
+
+bool truncate_weighted(std::complex<float>* val, float* weight, size_t n, float err_sq_lim,
+                       float prec, float weight_prec, simdLevel level) {
+    const float err_init = 0.5f * err_sq_lim;
+    float* v = reinterpret_cast<float*>(val);
+#ifdef TRUNCATE_KERNEL_X86
+    if (level == simdLevel::avx512)
+        return truncate_weighted_complex_avx512(v, weight, n, err_init, prec, weight_prec);
+    if (level == simdLevel::avx2)
+        return truncate_weighted_complex_avx2(v, weight, n, err_init, prec, weight_prec);
+#endif
+    (void)level;
+    return truncate_weighted_complex_scalar(v, weight, 0, n, err_init, prec, weight_prec);
+}
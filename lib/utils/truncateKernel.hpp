@@ -0,0 +1,107 @@
+/*****************************************
+@file
+@brief Vectorised kernels for truncating the precision of whole arrays.
+- truncate_array
+- truncate_array_relative
+- truncate_weighted
+*****************************************/
+#ifndef TRUNCATE_KERNEL_HPP
+#define TRUNCATE_KERNEL_HPP
+
+#include "simdDispatch.hpp" // for simdLevel, simd_level
+
+#include <complex> // for complex
+#include <cstddef> // for size_t
+
+// These apply `bit_truncate_float` from truncate.hpp to every element, and the
+// results are bit for bit identical to it for every SIMD level, including for
+// NaN, inf and denormal values. All of them work in place and dispatch on the
+// SIMD level given, which defaults to the best one the CPU supports.
+
+/**
+ * @brief Truncate an array, each element to its own maximum error.
+ *
+ * @param  val    Values to truncate.
+ * @param  err    Maximum error for each value.
+ * @param  n      Number of values.
+ * @param  level  SIMD implementation to use.
+ **/
+void truncate_array(float* val, const float* err, size_t n, simdLevel level = simd_level());
+
+/**
+ * @brief Truncate an array of complex values, each to its own maximum error.
+ *
+ * The real and imaginary parts are truncated separately, to the same error.
+ *
+ * @param  val    Values to truncate.
+ * @param  err    Maximum error for each complex value.
+ * @param  n      Number of complex values.
+ * @param  level  SIMD implementation to use.
+ **/
+void truncate_array(std::complex<float>* val, const float* err, size_t n,
+                    simdLevel level = simd_level());
+
+/**
+ * @brief Truncate an array to a fixed relative precision.
+ *
+ * Each value `x` is truncated with a maximum error of `|prec * x|`.
+ *
+ * @param  val    Values to truncate.
+ * @param  prec   Relative precision.
+ * @param  n      Number of values.
+ * @param  level  SIMD implementation to use.
+ **/
+void truncate_array_relative(float* val, float prec, size_t n, simdLevel level = simd_level());
+
+/**
+ * @brief Truncate an array of complex values to a fixed relative precision.
+ *
+ * The real and imaginary parts are each truncated relative to themselves.
+ *
+ * @param  val    Values to truncate.
+ * @param  prec   Relative precision.
+ * @param  n      Number of complex values.
+ * @param  level  SIMD implementation to use.
+ **/
+void truncate_array_relative(std::complex<float>* val, float prec, size_t n,
+                             simdLevel level = simd_level());
+
+/**
+ * @brief Truncate data to a precision set by its weights, and then the weights.
+ *
+ * Each value is truncated with a maximum error of `sqrt(0.5 * err_sq_lim / w)`,
+ * or `|prec * x|` where the weight `w` is zero. The weights are then truncated
+ * with a maximum error of `weight_prec * w`.
+ *
+ * @param  val          Values to truncate.
+ * @param  weight       Weights of the values, also truncated.
+ * @param  n            Number of values.
+ * @param  err_sq_lim   Limit on the squared error relative to the variance.
+ * @param  prec         Relative precision for values with zero weight.
+ * @param  weight_prec  Relative precision for the weights.
+ * @param  level        SIMD implementation to use.
+ *
+ * @returns Whether any of the weights were zero.
+ **/
+bool truncate_weighted(float* val, float* weight, size_t n, float err_sq_lim, float prec,
+                       float weight_prec, simdLevel level = simd_level());
+
+/**
+ * @brief Truncate complex data to a precision set by its weights, and then the weights.
+ *
+ * As above, with the real and imaginary parts of each value sharing a weight.
+ *
+ * @param  val          Values to truncate.
+ * @param  weight       Weights of the values, also truncated.
+ * @param  n            Number of complex values.
+ * @param  err_sq_lim   Limit on the squared error relative to the variance.
+ * @param  prec         Relative precision for values with zero weight.
+ * @param  weight_prec  Relative precision for the weights.
+ * @param  level        SIMD implementation to use.
+ *
+ * @returns Whether any of the weights were zero.
+ **/
+bool truncate_weighted(std::complex<float>* val, float* weight, size_t n, float err_sq_lim,
+                       float prec, float weight_prec, simdLevel level = simd_level());
+
+#endif // TRUNCATE_KERNEL_HPP
@@ -0,0 +1,293 @@
+#include "visAccumulateKernel.hpp"
+
+#include "simdDispatch.hpp" // for simdLevel
+
+#include <complex> // for complex
+#include <cstring> // for memcpy
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define VIS_KERNEL_X86
+// GCC 12 gives false positives inside the AVX-512 headers (GCC bug 105593)
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h> // for __m256i, __m512i, _mm256_add_epi32, _mm512_add_epi32, ...
+#endif
+
+
+namespace {
+
+// Scalar versions. These define the reference results which the vectorised
+// versions must reproduce, and also handle the tails.
+
+void accumulate_scalar(int32_t* acc, const int32_t* input, size_t start, size_t n) {
+    for (size_t i = start; i < n; i++) {
+        acc[i] += input[i];
+    }
+}
+
+void accumulate_even_scalar(int32_t* acc, int32_t* vis_even, const int32_t* input, size_t start,
+                            size_t num_prod) {
+    if (acc != nullptr)
+        accumulate_scalar(acc, input, 2 * start, 2 * num_prod);
+    std::memcpy(vis_even + 2 * start, input + 2 * start, 8 * (num_prod - start));
+}
+
+void accumulate_odd_scalar(int32_t* acc, float* var, const int32_t* vis_even,
+                           const int32_t* input, size_t start, size_t num_prod) {
+    if (acc != nullptr)
+        accumulate_scalar(acc, input, 2 * start, 2 * num_prod);
+    for (size_t i = start; i < num_prod; i++) {
+        // NOTE: avoid using the slow std::complex routines in here
+        float di = input[2 * i] - vis_even[2 * i];
+        float dr = input[2 * i + 1] - vis_even[2 * i + 1];
+        var[i] += (dr * dr + di * di);
+    }
+}
+
+void unpack_scalar(std::complex<float>* vis, float* weight, const uint32_t* plan, size_t start,
+                   size_t num_prod, const int32_t* vis1, const float* var, float iw, float w2) {
+    for (size_t pi = start; pi < num_prod; pi++) {
+        uint32_t bi = plan[pi] >> 1;
+        bool conj = plan[pi] & 1;
+        std::complex<float> t = {(float)vis1[2 * bi + 1], (float)vis1[2 * bi]};
+        t = !conj ? t : std::conj(t);
+        vis[pi] = iw * t;
+        weight[pi] = w2 / var[bi];
+    }
+}
+
+#ifdef VIS_KERNEL_X86
+
+// AVX2 versions, processing 8 products (16 values) per iteration
+
+__attribute__((target("avx2"))) void accumulate_avx2(int32_t* acc, const int32_t* input,
+                                                     size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(acc + i));
+        __m256i x = _mm256_loadu_si256((const __m256i*)(input + i));
+        _mm256_storeu_si256((__m256i*)(acc + i), _mm256_add_epi32(a, x));
+    }
+    accumulate_scalar(acc, input, i, n);
+}
+
+__attribute__((target("avx2"))) void accumulate_even_avx2(int32_t* acc, int32_t* vis_even,
+                                                          const int32_t* input,
+                                                          size_t num_prod) {
+    size_t i = 0;
+    for (; i + 4 <= num_prod; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(input + 2 * i));
+        _mm256_storeu_si256((__m256i*)(vis_even + 2 * i), x);
+        if (acc != nullptr) {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(acc + 2 * i));
+            _mm256_storeu_si256((__m256i*)(acc + 2 * i), _mm256_add_epi32(a, x));
+        }
+    }
+    accumulate_even_scalar(acc, vis_even, input, i, num_prod);
+}
+
+__attribute__((target("avx2"))) void accumulate_odd_avx2(int32_t* acc, float* var,
+                                                         const int32_t* vis_even,
+                                                         const int32_t* input, size_t num_prod) {
+    size_t i = 0;
+    for (; i + 8 <= num_prod; i += 8) {
+        __m256i x0 = _mm256_loadu_si256((const __m256i*)(input + 2 * i));
+        __m256i x1 = _mm256_loadu_si256((const __m256i*)(input + 2 * i + 8));
+
+        if (acc != nullptr) {
+            __m256i a0 = _mm256_loadu_si256((const __m256i*)(acc + 2 * i));
+            __m256i a1 = _mm256_loadu_si256((const __m256i*)(acc + 2 * i + 8));
+            _mm256_storeu_si256((__m256i*)(acc + 2 * i), _mm256_add_epi32(a0, x0));
+            _mm256_storeu_si256((__m256i*)(acc + 2 * i + 8), _mm256_add_epi32(a1, x1));
+        }
+
+        // Difference in integers, then square in floats (no FMA, to match the scalar code)
+        __m256i e0 = _mm256_loadu_si256((const __m256i*)(vis_even + 2 * i));
+        __m256i e1 = _mm256_loadu_si256((const __m256i*)(vis_even + 2 * i + 8));
+        __m256 d0 = _mm256_cvtepi32_ps(_mm256_sub_epi32(x0, e0));
+        __m256 d1 = _mm256_cvtepi32_ps(_mm256_sub_epi32(x1, e1));
+        __m256 s0 = _mm256_mul_ps(d0, d0);
+        __m256 s1 = _mm256_mul_ps(d1, d1);
+
+        // Sum the (imag, real) pairs. The horizontal add interleaves the two
+        // inputs per 128-bit lane, so swap the middle 64-bit blocks back.
+        __m256 h = _mm256_hadd_ps(s0, s1);
+        h = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(h), 0xD8));
+
+        __m256 v = _mm256_loadu_ps(var + i);
+        _mm256_storeu_ps(var + i, _mm256_add_ps(v, h));
+    }
+    accumulate_odd_scalar(acc, var, vis_even, input, i, num_prod);
+}
+
+// Gather 4 products per iteration. Each (imag, real) pair is fetched as a
+// single 64-bit element, converted, swapped to (real, imag) and then has the
+// imaginary sign bit flipped where the plan says to conjugate.
+__attribute__((target("avx2"))) void unpack_avx2(std::complex<float>* vis, float* weight,
+                                                 const uint32_t* plan, size_t num_prod,
+                                                 const int32_t* vis1, const float* var, float iw,
+                                                 float w2) {
+    const __m128i one = _mm_set1_epi32(1);
+    const __m256 iw_v = _mm256_set1_ps(iw);
+    const __m128 w2_v = _mm_set1_ps(w2);
+
+    size_t i = 0;
+    for (; i + 4 <= num_prod; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(plan + i));
+        __m128i bi = _mm_srli_epi32(p, 1);
+
+        __m256i pairs = _mm256_i32gather_epi64((const long long*)vis1, bi, 8);
+        __m256 t = _mm256_permute_ps(_mm256_cvtepi32_ps(pairs), 0xB1);
+        __m256i sign = _mm256_slli_epi64(_mm256_cvtepu32_epi64(_mm_and_si128(p, one)), 63);
+        t = _mm256_xor_ps(t, _mm256_castsi256_ps(sign));
+        _mm256_storeu_ps((float*)(vis + i), _mm256_mul_ps(iw_v, t));
+
+        __m128 v = _mm_i32gather_ps(var, bi, 4);
+        _mm_storeu_ps(weight + i, _mm_div_ps(w2_v, v));
+    }
+    unpack_scalar(vis, weight, plan, i, num_prod, vis1, var, iw, w2);
+}
+
+// AVX-512 versions, processing 16 products (32 values) per iteration
+
+__attribute__((target("avx512f"))) void accumulate_avx512(int32_t* acc, const int32_t* input,
+                                                          size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i a = _mm512_loadu_si512((const void*)(acc + i));
+        __m512i x = _mm512_loadu_si512((const void*)(input + i));
+        _mm512_storeu_si512((void*)(acc + i), _mm512_add_epi32(a, x));
+    }
+    accumulate_scalar(acc, input, i, n);
+}
+
+__attribute__((target("avx512f"))) void accumulate_even_avx512(int32_t* acc, int32_t* vis_even,
+                                                               const int32_t* input,
+                                                               size_t num_prod) {
+    size_t i = 0;
+    for (; i + 8 <= num_prod; i += 8) {
+        __m512i x = _mm512_loadu_si512((const void*)(input + 2 * i));
+        _mm512_storeu_si512((void*)(vis_even + 2 * i), x);
+        if (acc != nullptr) {
+            __m512i a = _mm512_loadu_si512((const void*)(acc + 2 * i));
+            _mm512_storeu_si512((void*)(acc + 2 * i), _mm512_add_epi32(a, x));
+        }
+    }
+    accumulate_even_scalar(acc, vis_even, input, i, num_prod);
+}
+
+__attribute__((target("avx512f"))) void accumulate_odd_avx512(int32_t* acc, float* var,
+                                                              const int32_t* vis_even,
+                                                              const int32_t* input,
+                                                              size_t num_prod) {
+    // Indices selecting the even and odd elements out of a pair of vectors
+    const __m512i idx_even =
+        _mm512_set_epi32(30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0);
+    const __m512i idx_odd =
+        _mm512_set_epi32(31, 29, 27, 25, 23, 21, 19, 17, 15, 13, 11, 9, 7, 5, 3, 1);
+
+    size_t i = 0;
+    for (; i + 16 <= num_prod; i += 16) {
+        __m512i x0 = _mm512_loadu_si512((const void*)(input + 2 * i));
+        __m512i x1 = _mm512_loadu_si512((const void*)(input + 2 * i + 16));
+
+        if (acc != nullptr) {
+            __m512i a0 = _mm512_loadu_si512((const void*)(acc + 2 * i));
+            __m512i a1 = _mm512_loadu_si512((const void*)(acc + 2 * i + 16));
+            _mm512_storeu_si512((void*)(acc + 2 * i), _mm512_add_epi32(a0, x0));
+            _mm512_storeu_si512((void*)(acc + 2 * i + 16), _mm512_add_epi32(a1, x1));
+        }
+
+        __m512i e0 = _mm512_loadu_si512((const void*)(vis_even + 2 * i));
+        __m512i e1 = _mm512_loadu_si512((const void*)(vis_even + 2 * i + 16));
+        __m512 d0 = _mm512_cvtepi32_ps(_mm512_sub_epi32(x0, e0));
+        __m512 d1 = _mm512_cvtepi32_ps(_mm512_sub_epi32(x1, e1));
+        __m512 s0 = _mm512_mul_ps(d0, d0);
+        __m512 s1 = _mm512_mul_ps(d1, d1);
+
+        // Deinterleave the squares into imag and real parts and sum them
+        __m512 si = _mm512_permutex2var_ps(s0, idx_even, s1);
+        __m512 sr = _mm512_permutex2var_ps(s0, idx_odd, s1);
+
+        __m512 v = _mm512_loadu_ps(var + i);
+        _mm512_storeu_ps(var + i, _mm512_add_ps(v, _mm512_add_ps(sr, si)));
+    }
+    accumulate_odd_scalar(acc, var, vis_even, input, i, num_prod);
+}
+
+// Gather 8 products per iteration, as for AVX2
+__attribute__((target("avx512f"))) void unpack_avx512(std::complex<float>* vis, float* weight,
+                                                      const uint32_t* plan, size_t num_prod,
+                                                      const int32_t* vis1, const float* var,
+                                                      float iw, float w2) {
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m512 iw_v = _mm512_set1_ps(iw);
+    const __m256 w2_v = _mm256_set1_ps(w2);
+
+    size_t i = 0;
+    for (; i + 8 <= num_prod; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(plan + i));
+        __m256i bi = _mm256_srli_epi32(p, 1);
+
+        __m512i pairs = _mm512_i32gather_epi64(bi, (const void*)vis1, 8);
+        __m512 t = _mm512_permute_ps(_mm512_cvtepi32_ps(pairs), 0xB1);
+        __m512i sign = _mm512_slli_epi64(_mm512_cvtepu32_epi64(_mm256_and_si256(p, one)), 63);
+        t = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(t), sign));
+        _mm512_storeu_ps((float*)(vis + i), _mm512_mul_ps(iw_v, t));
+
+        __m256 v = _mm256_i32gather_ps(var, bi, 4);
+        _mm256_storeu_ps(weight + i, _mm256_div_ps(w2_v, v));
+    }
+    unpack_scalar(vis, weight, plan, i, num_prod, vis1, var, iw, w2);
+}
+
+#endif // VIS_KERNEL_X86
+
+} // namespace
+
+
+void accumulate_vis(int32_t* acc, const int32_t* input, size_t n, simdLevel level) {
+#ifdef VIS_KERNEL_X86
+    if (level == simdLevel::avx512)
+        return accumulate_avx512(acc, input, n);
+    if (level == simdLevel::avx2)
+        return accumulate_avx2(acc, input, n);
+#endif
+    (void)level;
+    accumulate_scalar(acc, input, 0, n);
+}
+
+void accumulate_vis_even(int32_t* acc, int32_t* vis_even, const int32_t* input, size_t num_prod,
+                         simdLevel level) {
+#ifdef VIS_KERNEL_X86
+    if (level == simdLevel::avx512)
+        return accumulate_even_avx512(acc, vis_even, input, num_prod);
+    if (level == simdLevel::avx2)
+        return accumulate_even_avx2(acc, vis_even, input, num_prod);
+#endif
+    (void)level;
+    accumulate_even_scalar(acc, vis_even, input, 0, num_prod);
+}
+
+void accumulate_vis_odd(int32_t* acc, float* var, const int32_t* vis_even, const int32_t* input,
+                        size_t num_prod, simdLevel level) {
+#ifdef VIS_KERNEL_X86
+    if (level == simdLevel::avx512)
+        return accumulate_odd_avx512(acc, var, vis_even, input, num_prod);
+    if (level == simdLevel::avx2)
+        return accumulate_odd_avx2(acc, var, vis_even, input, num_prod);
+#endif
+    (void)level;
+    accumulate_odd_scalar(acc, var, vis_even, input, 0, num_prod);
+}
+
+void unpack_vis(std::complex<float>* vis, float* weight, const uint32_t* plan, size_t num_prod,
+                const int32_t* vis1, const float* var, float iw, float w2, simdLevel level) {
+#ifdef VIS_KERNEL_X86
+    if (level == simdLevel::avx512)
+        return unpack_avx512(vis, weight, plan, num_prod, vis1, var, iw, w2);
+    if (level == simdLevel::avx2)
+        return unpack_avx2(vis, weight, plan, num_prod, vis1, var, iw, w2);
+#endif
+    (void)level;
+    unpack_scalar(vis, weight, plan, 0, num_prod, vis1, var, iw, w2);
+}
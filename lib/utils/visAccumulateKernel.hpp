@@ -0,0 +1,92 @@
+/*****************************************
+@file
+@brief Vectorised kernels for accumulating GPU visibility frames.
+- accumulate_vis
+- accumulate_vis_even
+- accumulate_vis_odd
+- unpack_vis
+*****************************************/
+#ifndef VIS_ACCUMULATE_KERNEL_HPP
+#define VIS_ACCUMULATE_KERNEL_HPP
+
+#include "simdDispatch.hpp" // for simdLevel, simd_level
+
+#include <complex> // for complex
+#include <cstddef> // for size_t
+#include <cstdint> // for int32_t, uint32_t
+
+// The visibilities handled here are in the GPU packed format, i.e. an
+// interleaved array of (imag, real) int32 pairs, one for each product.
+//
+// All of these dispatch on the SIMD level given, which defaults to the best
+// one the CPU supports. The integer results are identical for every level, the
+// variance may differ in the last bit depending on whether the compiler fuses
+// the multiply-adds.
+
+/**
+ * @brief Add an input frame into an accumulator.
+ *
+ * @param  acc    Accumulated visibilities to update.
+ * @param  input  Visibilities to add.
+ * @param  n      Number of *int32 values* (i.e. twice the number of products).
+ * @param  level  SIMD implementation to use.
+ **/
+void accumulate_vis(int32_t* acc, const int32_t* input, size_t n,
+                    simdLevel level = simd_level());
+
+/**
+ * @brief Accumulate an even frame and save a copy for the variance estimate.
+ *
+ * Equivalent to `acc += input; vis_even = input` in a single pass.
+ *
+ * @param  acc       Accumulated visibilities to update. If `nullptr`, only the
+ *                   copy is made.
+ * @param  vis_even  Destination for the copy of the input.
+ * @param  input     Visibilities to add.
+ * @param  num_prod  Number of products.
+ * @param  level     SIMD implementation to use.
+ **/
+void accumulate_vis_even(int32_t* acc, int32_t* vis_even, const int32_t* input, size_t num_prod,
+                         simdLevel level = simd_level());
+
+/**
+ * @brief Accumulate an odd frame and the squared difference from the even one.
+ *
+ * Equivalent to `acc += input` and, for every product,
+ * `var += |input - vis_even|^2` with the difference taken in integers and
+ * squared in single precision, in a single pass.
+ *
+ * @param  acc       Accumulated visibilities to update. If `nullptr`, only the
+ *                   variance is updated.
+ * @param  var       Accumulated variance, one value per product.
+ * @param  vis_even  Visibilities saved from the previous even frame.
+ * @param  input     Visibilities to add.
+ * @param  num_prod  Number of products.
+ * @param  level     SIMD implementation to use.
+ **/
+void accumulate_vis_odd(int32_t* acc, float* var, const int32_t* vis_even, const int32_t* input,
+                        size_t num_prod, simdLevel level = simd_level());
+
+/**
+ * @brief Unpack the accumulated visibilities and variances into output order.
+ *
+ * This does the same as running `map_vis_triangle` over the data twice to fill
+ * the visibilities and weights, but from a precomputed plan and in one pass:
+ * `vis[pi] = iw * conj?(re, im)` and `weight[pi] = w2 / var`.
+ *
+ * @param  vis       Output visibilities, `num_prod` of them.
+ * @param  weight    Output weights, `num_prod` of them.
+ * @param  plan      Gather table from `vis_triangle_gather_plan`, starting at
+ *                   the first product to unpack.
+ * @param  num_prod  Number of products to unpack.
+ * @param  vis1      Accumulated visibilities for the frequency being unpacked.
+ * @param  var       Accumulated variances for the frequency being unpacked.
+ * @param  iw        Scaling applied to the visibilities.
+ * @param  w2        Numerator for inverting the variances.
+ * @param  level     SIMD implementation to use.
+ **/
+void unpack_vis(std::complex<float>* vis, float* weight, const uint32_t* plan, size_t num_prod,
+                const int32_t* vis1, const float* var, float iw, float w2,
+                simdLevel level = simd_level());
+
+#endif // VIS_ACCUMULATE_KERNEL_HPP
@@ -29,6 +29,11 @@ time_ctype visFileBundle::last_update() const {
 }
 
 
+void visFileBundle::set_async_writer(std::shared_ptr<AsyncFileWriter> writer) {
+    async_writer = writer;
+}
+
+
 bool visFileBundle::resolve_sample(time_ctype new_time) {
 
     if (vis_file_map.size() == 0) {
@@ -111,6 +116,8 @@ void visFileBundle::add_file(time_ctype first_time) {
 
     // Create the file, create room for the first sample and add into the file map
     auto file = mk_file(file_name, acq_name, root_path);
+    if (async_writer)
+        file->set_async_writer(async_writer);
     auto ind = file->extend_time(first_time);
     vis_file_map[first_time] = std::make_pair(file, ind);
 }
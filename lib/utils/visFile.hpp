@@ -7,11 +7,12 @@
 #ifndef VIS_FILE_HPP
 #define VIS_FILE_HPP
 
-#include "FrameView.hpp"      // for FrameView
-#include "dataset.hpp"        // for dset_id_t
-#include "factory.hpp"        // for CREATE_FACTORY, FACTORY, Factory, REGISTER_NAMED_TYPE_WITH...
-#include "kotekanLogging.hpp" // for logLevel, kotekanLogging, DEBUG
-#include "visUtil.hpp"        // for time_ctype, operator<
+#include "AsyncFileWriter.hpp" // for AsyncFileWriter
+#include "FrameView.hpp"       // for FrameView
+#include "dataset.hpp"         // for dset_id_t
+#include "factory.hpp"         // for CREATE_FACTORY, FACTORY, Factory, REGISTER_NAMED_TYPE_WIT...
+#include "kotekanLogging.hpp"  // for logLevel, kotekanLogging, DEBUG, WARN
+#include "visUtil.hpp"         // for time_ctype, operator<
 
 #include <cstdint>    // for uint32_t
 #include <functional> // for function
@@ -86,6 +87,19 @@ public:
      **/
     virtual size_t num_time() = 0;
 
+    /**
+     * @brief Hand the writes into this file over to a background writer.
+     *
+     * This must be called before any samples are written. File types that
+     * can't write asynchronously ignore this and keep writing synchronously.
+     *
+     * @param writer The writer to use.
+     **/
+    virtual void set_async_writer(std::shared_ptr<AsyncFileWriter> writer) {
+        (void)writer;
+        WARN("visFile::set_async_writer: not supported by this file type, writing synchronously.");
+    };
+
 protected:
     // Save the size for when we are outside of HDF5 space
     size_t nfreq, nprod, ninput, nev, ntime = 0;
@@ -159,6 +173,13 @@ public:
      **/
     time_ctype last_update() const;
 
+    /**
+     * @brief Write all files created from now on with a background writer.
+     *
+     * @param  writer  The writer to use. If null, write synchronously.
+     **/
+    void set_async_writer(std::shared_ptr<AsyncFileWriter> writer);
+
 protected:
     // Add a file if we need to
     virtual void add_file(time_ctype first_time);
@@ -183,6 +204,9 @@ protected:
 
     // Flag to force moving to a new file
     bool change_file = false;
+
+    // Background writer given to each new file
+    std::shared_ptr<AsyncFileWriter> async_writer;
 };
 
 // NOTE: in this we need to pass the variadic arguments by value and not attempt
@@ -37,6 +37,11 @@ uint32_t visFileRing::extend_time(time_ctype new_time) {
 
         // Insert new time at current position in file
         times[cur_pos] = new_time;
+        // Writes from the last time round the ring must land before we
+        // overwrite them
+        if (async_writer)
+            async_writer->drain();
+
         // Erase data in this row
         size_t nb = nfreq * frame_size;
         std::vector<char> zeros(frame_size, 0);
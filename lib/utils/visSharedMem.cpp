@@ -0,0 +1,317 @@
+#include "visSharedMem.hpp"
+
+#include "fmt.hpp" // for format
+
+#include <algorithm>  // for max, sort
+#include <cstring>    // for memcpy, memcmp, memset, strerror
+#include <errno.h>    // for errno
+#include <fcntl.h>    // for O_RDONLY
+#include <stdexcept>  // for runtime_error
+#include <sys/mman.h> // for mmap, munmap, shm_open, MAP_FAILED, MAP_SHARED, PROT_READ
+#include <sys/stat.h> // for fstat, stat
+#include <thread>     // for yield
+#include <unistd.h>   // for close
+#include <utility>    // for pair
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free
+                  && sizeof(std::atomic<uint64_t>) == sizeof(uint64_t),
+              "Atomics in the shared memory region must be plain lock free words");
+
+// Number of times to try reading a slot that is being written to
+static const int max_read_attempts = 16;
+
+size_t visSharedMemRing::region_size(const Structure& s) {
+    size_t nslot = s.ntime * s.nfreq;
+    return sizeof(uint64_t) * num_writes_num + sizeof(Structure) + nslot * sizeof(int64_t)
+           + nslot * s.frame_size + nslot * sizeof(uint64_t);
+}
+
+visSharedMemRing::visSharedMemRing(uint8_t* addr, const Structure& s) : rbs(s) {
+    set_layout(addr);
+
+    num_writes_addr->store(0, std::memory_order_relaxed);
+    std::memcpy(base_addr + sizeof(uint64_t) * num_writes_num, &rbs, sizeof(Structure));
+    for (size_t i = 0; i < rbs.ntime * rbs.nfreq; i++) {
+        access_record_addr[i].store(invalid, std::memory_order_relaxed);
+        seq_addr[i].store(0, std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+visSharedMemRing::visSharedMemRing(const uint8_t* addr) {
+    std::memcpy(&rbs, addr + sizeof(uint64_t) * num_writes_num, sizeof(Structure));
+    set_layout(addr);
+}
+
+void visSharedMemRing::set_layout(const uint8_t* addr) {
+    // Readers never write through these, even though they aren't const
+    base_addr = const_cast<uint8_t*>(addr);
+    num_writes_addr = (std::atomic<uint64_t>*)base_addr;
+    access_record_addr =
+        (std::atomic<int64_t>*)(base_addr + sizeof(uint64_t) * num_writes_num + sizeof(Structure));
+    buf_addr = (uint8_t*)(access_record_addr + rbs.ntime * rbs.nfreq);
+    seq_addr = (std::atomic<uint64_t>*)(buf_addr + rbs.ntime * rbs.nfreq * rbs.frame_size);
+}
+
+bool visSharedMemRing::structure_changed() const {
+    return std::memcmp(&rbs, base_addr + sizeof(uint64_t) * num_writes_num, sizeof(Structure))
+           != 0;
+}
+
+void visSharedMemRing::write(size_t time_ind, size_t freq_ind, int64_t fpga_seq,
+                             const void* metadata, const void* data) {
+
+    size_t i = time_ind * rbs.nfreq + freq_ind;
+    uint8_t* frame = buf_addr + i * rbs.frame_size;
+
+    // Mark the slot as being written to. The fence stops the writes below
+    // from becoming visible before this.
+    uint64_t seq = seq_addr[i].load(std::memory_order_relaxed);
+    seq_addr[i].store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    access_record_addr[i].store(invalid, std::memory_order_relaxed);
+
+    // first write the valid byte, then the metadata, then the data
+    frame[0] = 1;
+    std::memcpy(frame + valid_size, metadata, rbs.metadata_size);
+    std::memcpy(frame + valid_size + rbs.metadata_size, data, rbs.data_size);
+
+    // Document the fpga sequence counter for that frame in the access record
+    access_record_addr[i].store(fpga_seq, std::memory_order_relaxed);
+
+    // ... and release the slot
+    seq_addr[i].store(seq + 2, std::memory_order_release);
+
+    num_writes_addr->store(num_writes_addr->load(std::memory_order_relaxed) + 1,
+                           std::memory_order_release);
+}
+
+void visSharedMemRing::reset(size_t time_ind) {
+
+    for (size_t f = 0; f < rbs.nfreq; f++) {
+        size_t i = time_ind * rbs.nfreq + f;
+
+        uint64_t seq = seq_addr[i].load(std::memory_order_relaxed);
+        seq_addr[i].store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        access_record_addr[i].store(invalid, std::memory_order_relaxed);
+        std::memset(buf_addr + i * rbs.frame_size, 0, rbs.frame_size);
+
+        seq_addr[i].store(seq + 2, std::memory_order_release);
+    }
+}
+
+void visSharedMemRing::close() {
+    num_writes_addr->store(0, std::memory_order_release);
+}
+
+bool visSharedMemRing::read(size_t time_ind, size_t freq_ind, uint8_t* frame,
+                            int64_t& fpga_seq) const {
+
+    size_t i = time_ind * rbs.nfreq + freq_ind;
+    const uint8_t* src = buf_addr + i * rbs.frame_size;
+
+    for (int attempt = 0; attempt < max_read_attempts; attempt++) {
+        uint64_t seq = seq_addr[i].load(std::memory_order_acquire);
+
+        // Being written to right now, give the writer a chance to finish
+        if (seq & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        fpga_seq = access_record_addr[i].load(std::memory_order_relaxed);
+        if (fpga_seq == invalid)
+            return false;
+
+        std::memcpy(frame, src, valid_size + rbs.metadata_size + rbs.data_size);
+
+        // Only keep the copy if nothing was written in the meantime
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq_addr[i].load(std::memory_order_relaxed) == seq)
+            return frame[0] != 0;
+    }
+
+    return false;
+}
+
+
+// Open and map a shared memory region read only
+static uint8_t* map_region(const std::string& name, int& fd, size_t& size) {
+
+    fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+        throw std::runtime_error(
+            fmt::format(fmt("The shared memory {:s} was not created yet by the writer: {:s}"),
+                        name, strerror(errno)));
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < visSharedMemRing::region_size({})) {
+        ::close(fd);
+        throw std::runtime_error(fmt::format(fmt("The shared memory {:s} is too small."), name));
+    }
+    size = st.st_size;
+
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        int err = errno;
+        ::close(fd);
+        throw std::runtime_error(fmt::format(fmt("Failed to map shared memory {:s}: {:s}"), name,
+                                             strerror(err)));
+    }
+
+    return (uint8_t*)addr;
+}
+
+visSharedMemReader::visSharedMemReader(const std::string& name, size_t view_size) :
+    name(name),
+    fd(-1),
+    mapped_size(0),
+    addr(map_region(name, fd, mapped_size)),
+    ring(addr),
+    view_size(view_size) {
+
+    const auto& s = structure();
+    if (visSharedMemRing::region_size(s) != mapped_size) {
+        munmap(addr, mapped_size);
+        ::close(fd);
+        throw std::runtime_error(
+            fmt::format(fmt("Expected shared memory {:s} to have size {:d} (but has {:d})."), name,
+                        visSharedMemRing::region_size(s), mapped_size));
+    }
+
+    if (this->view_size == 0 || this->view_size > s.ntime)
+        this->view_size = s.ntime;
+
+    // Keep each copy 8 byte aligned
+    local_frame_size = (visSharedMemRing::valid_size + s.metadata_size + s.data_size + 7) / 8 * 8;
+    frames.resize(frame_offset + this->view_size * s.nfreq * local_frame_size, 0);
+    slot_time.resize(this->view_size, visSharedMemRing::invalid);
+    last_access_record.resize(s.ntime * s.nfreq, visSharedMemRing::invalid);
+    last_num_writes = ring.num_writes();
+}
+
+visSharedMemReader::~visSharedMemReader() {
+    munmap(addr, mapped_size);
+    ::close(fd);
+}
+
+size_t visSharedMemReader::new_time_slot(int64_t fpga_seq) {
+
+    size_t slot;
+    if (next_slot < view_size) {
+        slot = next_slot++;
+    } else {
+        // Overwrite the oldest time sample
+        auto oldest = time_slot.begin();
+        slot = oldest->second;
+        time_slot.erase(oldest);
+    }
+
+    // Mark frames at all frequencies for this time slot as invalid
+    for (size_t f = 0; f < structure().nfreq; f++)
+        *slot_frame(slot, f) = 0;
+
+    slot_time[slot] = fpga_seq;
+    time_slot[fpga_seq] = slot;
+    return slot;
+}
+
+size_t visSharedMemReader::update() {
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_nlink == 0)
+        throw std::runtime_error(
+            fmt::format(fmt("The shared memory {:s} was unlinked by the writer."), name));
+
+    uint64_t num_writes = ring.num_writes();
+    if (num_writes == 0 && last_num_writes > 0)
+        throw std::runtime_error(
+            fmt::format(fmt("The shared memory {:s} was marked as invalid by the writer."), name));
+    last_num_writes = num_writes;
+
+    if (ring.structure_changed())
+        throw std::runtime_error(
+            fmt::format(fmt("The structure of the shared memory {:s} has changed."), name));
+
+    const auto& s = structure();
+
+    // Take a snapshot of the access record, and find the latest time in each
+    // time index of the ring buffer
+    std::vector<int64_t> record(s.ntime * s.nfreq);
+    std::vector<std::pair<int64_t, size_t>> latest;
+    for (size_t t = 0; t < s.ntime; t++) {
+        int64_t max_ts = visSharedMemRing::invalid;
+        for (size_t f = 0; f < s.nfreq; f++) {
+            record[t * s.nfreq + f] = ring.access_record(t, f);
+            max_ts = std::max(max_ts, record[t * s.nfreq + f]);
+        }
+        if (max_ts != visSharedMemRing::invalid)
+            latest.push_back({max_ts, t});
+    }
+
+    // Only look at the last view_size times
+    std::sort(latest.begin(), latest.end());
+    size_t first = latest.size() > view_size ? latest.size() - view_size : 0;
+
+    size_t copied = 0;
+    for (size_t j = first; j < latest.size(); j++) {
+        auto [ts, t] = latest[j];
+
+        // Copy only the frames that changed since last time
+        std::vector<size_t> changed;
+        for (size_t f = 0; f < s.nfreq; f++) {
+            int64_t r = record[t * s.nfreq + f];
+            if (r != visSharedMemRing::invalid && r != last_access_record[t * s.nfreq + f])
+                changed.push_back(f);
+        }
+        if (changed.empty())
+            continue;
+
+        auto it = time_slot.find(ts);
+        size_t slot = (it != time_slot.end()) ? it->second : new_time_slot(ts);
+
+        for (auto f : changed) {
+            uint8_t* dst = slot_frame(slot, f);
+            int64_t fpga_seq;
+
+            // The frame may have been replaced by a later time since the snapshot
+            if (ring.read(t, f, dst, fpga_seq) && fpga_seq == ts) {
+                last_access_record[t * s.nfreq + f] = fpga_seq;
+                copied++;
+            } else {
+                *dst = 0;
+                last_access_record[t * s.nfreq + f] = visSharedMemRing::invalid;
+            }
+        }
+    }
+
+    order.clear();
+    for (auto& [ts, slot] : time_slot)
+        order.push_back(slot);
+
+    return copied;
+}
+
+std::vector<int64_t> visSharedMemReader::fpga_seqs() const {
+    std::vector<int64_t> seqs;
+    for (auto slot : order)
+        seqs.push_back(slot_time[slot]);
+    return seqs;
+}
+
+gsl::span<const cfloat> visSharedMemReader::vis(size_t t, size_t f) const {
+    auto m = metadata(t, f);
+    auto layout = VisFrameView::calculate_buffer_layout(m->num_elements, m->num_prod, m->num_ev);
+    auto [start, end] = layout.second[VisField::vis];
+    return {(const cfloat*)(data(t, f) + start), (end - start) / sizeof(cfloat)};
+}
+
+gsl::span<const float> visSharedMemReader::weight(size_t t, size_t f) const {
+    auto m = metadata(t, f);
+    auto layout = VisFrameView::calculate_buffer_layout(m->num_elements, m->num_prod, m->num_ev);
+    auto [start, end] = layout.second[VisField::weight];
+    return {(const float*)(data(t, f) + start), (end - start) / sizeof(float)};
+}
@@ -0,0 +1,283 @@
+/*****************************************
+@file
+@brief Lock free ring buffer of visibility frames in shared memory.
+- visSharedMemRing
+- visSharedMemReader
+*****************************************/
+#ifndef VIS_SHARED_MEM_HPP
+#define VIS_SHARED_MEM_HPP
+
+#include "visBuffer.hpp" // for VisMetadata
+#include "visUtil.hpp"   // for cfloat
+
+#include "gsl-lite.hpp" // for span
+
+#include <atomic>   // for atomic
+#include <cstdint>  // for uint64_t, int64_t, uint8_t
+#include <map>      // for map
+#include <stddef.h> // for size_t
+#include <string>   // for string
+#include <vector>   // for vector
+
+/**
+ * @class visSharedMemRing
+ * @brief The layout of the shared memory ring buffer and the protocol for
+ *        accessing it.
+ *
+ * The region is made up of:
+ *
+ *  - The structured data: the number of writes (0 once the writer has shut
+ *    down) followed by the Structure below, all as uint64.
+ *  - The access record: the FPGA sequence number of the frame in each
+ *    (time, freq) slot as int64, or -1 if there is no valid frame.
+ *  - The data: one frame per slot, made up of a valid byte, padding up to
+ *    `valid_size`, the metadata and the data, padded to `frame_size`.
+ *  - The sequence numbers: one uint64 per slot.
+ *
+ * There is a single writer and any number of readers, and nobody ever takes
+ * a lock. Each slot is protected by a seqlock: the writer makes the slot's
+ * sequence number odd before touching the slot and even again afterwards.
+ * A reader copies the slot out, and keeps the copy only if the sequence
+ * number was even and unchanged across the copy. So the writer is never
+ * held up by a reader, however slow, and a reader only has to retry if the
+ * slot it wanted was being overwritten at the time.
+ *
+ * This class doesn't own the memory, it just wraps an existing mapping.
+ **/
+class visSharedMemRing {
+
+public:
+    /// Parameters that define the structure of the ring buffer
+    struct Structure {
+        /// The number of time samples contained in the ring buffer
+        uint64_t ntime;
+        /// The number of frequencies contained in each time sample
+        uint64_t nfreq;
+        /// The size of each frame (valid byte + metadata + data + page alignment padding)
+        uint64_t frame_size;
+        /// The size of each metadata section
+        uint64_t metadata_size;
+        /// The size of each data section
+        uint64_t data_size;
+    };
+
+    /// Space the valid byte and its padding take up at the start of a frame
+    static constexpr size_t valid_size = 4;
+
+    /// Marks an empty slot in the access record
+    static constexpr int64_t invalid = -1;
+
+    /**
+     * @brief Total size of a region with this structure.
+     **/
+    static size_t region_size(const Structure& s);
+
+    /**
+     * @brief Set up a new region for writing.
+     *
+     * Records the structure and marks every slot as empty.
+     *
+     * @param  addr  Start of the mapped region, at least `region_size(s)`
+     *               long and zero filled.
+     * @param  s     The structure of the ring buffer.
+     **/
+    visSharedMemRing(uint8_t* addr, const Structure& s);
+
+    /**
+     * @brief Wrap an existing region for reading.
+     *
+     * @param  addr  Start of the mapped region.
+     **/
+    explicit visSharedMemRing(const uint8_t* addr);
+
+    /// The structure of the ring buffer
+    const Structure& structure() const {
+        return rbs;
+    }
+
+    /// Whether the structure in the region differs from the one we started with
+    bool structure_changed() const;
+
+    /// Number of frames written, or 0 if the writer has shut down
+    uint64_t num_writes() const {
+        return num_writes_addr->load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Write a frame into a slot.
+     *
+     * @param  time_ind  Time index of the slot.
+     * @param  freq_ind  Frequency index of the slot.
+     * @param  fpga_seq  FPGA sequence number to put in the access record.
+     * @param  metadata  The frame's metadata (`metadata_size` bytes).
+     * @param  data      The frame's data (`data_size` bytes).
+     **/
+    void write(size_t time_ind, size_t freq_ind, int64_t fpga_seq, const void* metadata,
+               const void* data);
+
+    /**
+     * @brief Mark every frequency of a time index empty and zero it.
+     *
+     * @param  time_ind  Time index to reset.
+     **/
+    void reset(size_t time_ind);
+
+    /**
+     * @brief Tell the readers that the writer has gone away.
+     **/
+    void close();
+
+    /**
+     * @brief Get an entry of the access record.
+     *
+     * This is only a hint, the frame may have changed by the time it is read.
+     **/
+    int64_t access_record(size_t time_ind, size_t freq_ind) const {
+        return access_record_addr[time_ind * rbs.nfreq + freq_ind].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Copy a consistent frame out of a slot.
+     *
+     * @param  time_ind  Time index of the slot.
+     * @param  freq_ind  Frequency index of the slot.
+     * @param  frame     Where to copy the frame to (`valid_size + metadata_size
+     *                   + data_size` bytes).
+     * @param  fpga_seq  Set to the access record of the frame that was copied.
+     *
+     * @returns True if a valid frame was copied. False if the slot is empty,
+     *          or was rewritten during every attempt to read it.
+     **/
+    bool read(size_t time_ind, size_t freq_ind, uint8_t* frame, int64_t& fpga_seq) const;
+
+private:
+    void set_layout(const uint8_t* addr);
+
+    Structure rbs;
+
+    uint8_t* base_addr;
+    std::atomic<uint64_t>* num_writes_addr;
+    std::atomic<int64_t>* access_record_addr;
+    uint8_t* buf_addr;
+    std::atomic<uint64_t>* seq_addr;
+
+    // Number of elements before the structure in the structured data
+    static constexpr size_t num_writes_num = 1;
+};
+
+
+/**
+ * @class visSharedMemReader
+ * @brief Read the most recent time samples out of a shared memory ring buffer.
+ *
+ * This mirrors the Python `SharedMemoryReader`. Each call to `update` copies
+ * any frames that changed since the last call into a local buffer of the last
+ * `view_size` time samples, which can then be accessed in time order.
+ *
+ * Frames that could not be read consistently are marked invalid rather than
+ * waiting on the writer.
+ **/
+class visSharedMemReader {
+
+public:
+    /**
+     * @brief Open the shared memory region.
+     *
+     * @param  name       Name of the shared memory region.
+     * @param  view_size  Number of time samples to keep. 0 (or more than the
+     *                    ring buffer holds) keeps as many as the ring buffer.
+     *
+     * @throws  std::runtime_error  If the region doesn't exist or is invalid.
+     **/
+    visSharedMemReader(const std::string& name, size_t view_size = 0);
+    ~visSharedMemReader();
+
+    visSharedMemReader(const visSharedMemReader&) = delete;
+    visSharedMemReader& operator=(const visSharedMemReader&) = delete;
+
+    /**
+     * @brief Copy any new frames out of the ring buffer.
+     *
+     * @returns The number of frames copied.
+     *
+     * @throws  std::runtime_error  If the writer has shut down, or the
+     *                              structure of the region has changed.
+     **/
+    size_t update();
+
+    /// The structure of the ring buffer
+    const visSharedMemRing::Structure& structure() const {
+        return ring.structure();
+    }
+
+    /// Number of time samples currently held, at most `view_size`
+    size_t num_time() const {
+        return order.size();
+    }
+
+    /// FPGA sequence number of each time sample held, oldest first
+    std::vector<int64_t> fpga_seqs() const;
+
+    /// Whether there is a valid frame at time `t` (oldest first) and freq index `f`
+    bool valid(size_t t, size_t f) const {
+        return *frame(t, f) != 0;
+    }
+
+    /// The metadata of a frame
+    const VisMetadata* metadata(size_t t, size_t f) const {
+        return (const VisMetadata*)(frame(t, f) + visSharedMemRing::valid_size);
+    }
+
+    /// The data of a frame
+    const uint8_t* data(size_t t, size_t f) const {
+        return frame(t, f) + visSharedMemRing::valid_size + structure().metadata_size;
+    }
+
+    /// The visibilities of a frame
+    gsl::span<const cfloat> vis(size_t t, size_t f) const;
+
+    /// The weights of a frame
+    gsl::span<const float> weight(size_t t, size_t f) const;
+
+private:
+    const uint8_t* frame(size_t t, size_t f) const {
+        return &frames[frame_offset + (order[t] * structure().nfreq + f) * local_frame_size];
+    }
+
+    // The copy of a frame in a local time slot
+    uint8_t* slot_frame(size_t slot, size_t f) {
+        return &frames[frame_offset + (slot * structure().nfreq + f) * local_frame_size];
+    }
+
+    // Offset of the first copy, so that the metadata of each is 8 byte aligned
+    static constexpr size_t frame_offset = 8 - visSharedMemRing::valid_size;
+
+    // Get the slot for a new time sample, dropping the oldest if needed
+    size_t new_time_slot(int64_t fpga_seq);
+
+    std::string name;
+    int fd;
+    size_t mapped_size;
+    uint8_t* addr;
+    visSharedMemRing ring;
+
+    size_t view_size;
+    size_t local_frame_size;
+
+    // Copies of the frames, [view_size][nfreq]
+    std::vector<uint8_t> frames;
+    // FPGA sequence number of each local time slot, or -1 if unused
+    std::vector<int64_t> slot_time;
+    // Local slot for each time held
+    std::map<int64_t, size_t> time_slot;
+    // Local slots in time order
+    std::vector<size_t> order;
+    // Next local slot to fill
+    size_t next_slot = 0;
+
+    // The access record when each frame was last copied
+    std::vector<int64_t> last_access_record;
+    uint64_t last_num_writes;
+};
+
+#endif // VIS_SHARED_MEM_HPP
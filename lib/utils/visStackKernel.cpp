@@ -0,0 +1,326 @@
+#include "visStackKernel.hpp"
+
+#include "simdDispatch.hpp" // for simdLevel
+#include "visUtil.hpp"      // for fast_norm, prod_ctype, rstack_ctype
+
+#include "fmt.hpp" // for format, fmt
+
+#include <algorithm> // for fill
+#include <complex>   // for complex, conj, norm
+#include <cstddef>   // for size_t
+#include <stdexcept> // for invalid_argument
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define STACK_KERNEL_X86
+// GCC 12 gives false positives inside the AVX-512 headers (GCC bug 105593)
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h> // for __m256, __m512, _mm256_loadu_ps, _mm512_loadu_ps, ...
+#endif
+
+
+using cf = std::complex<float>;
+
+stackPlan make_stack_plan(const std::vector<rstack_ctype>& stack_map,
+                          const std::vector<prod_ctype>& prods, uint32_t num_stack) {
+
+    if (stack_map.size() != prods.size())
+        throw std::invalid_argument(
+            fmt::format(fmt("Stack map has {:d} entries but there are {:d} products."),
+                        stack_map.size(), prods.size()));
+
+    stackPlan plan{(uint32_t)prods.size(), num_stack, {}};
+
+    for (uint32_t pi = 0; pi < plan.num_prod; pi++) {
+        const auto& s = stack_map[pi];
+        const auto& p = prods[pi];
+
+        if (s.stack >= num_stack)
+            throw std::invalid_argument(
+                fmt::format(fmt("Product {:d} maps to stack {:d}, but there are only {:d}."), pi,
+                            s.stack, num_stack));
+
+        // Extend the last run if this product continues it
+        if (!plan.runs.empty()) {
+            auto& r = plan.runs.back();
+            int64_t ds = (int64_t)s.stack - r.stack;
+            bool fits = (p.input_a == r.input_a) && (p.input_b == r.input_b + r.length)
+                        && (s.conjugate == r.conjugate);
+
+            if (fits && r.length == 1 && (ds == 1 || ds == -1)) {
+                r.step = ds;
+                r.length++;
+                continue;
+            }
+            if (fits && r.length > 1 && ds == (int64_t)r.step * r.length) {
+                r.length++;
+                continue;
+            }
+        }
+        plan.runs.push_back({pi, s.stack, 1, 1, p.input_a, p.input_b, s.conjugate});
+    }
+
+    return plan;
+}
+
+
+namespace {
+
+// Running totals for every stack
+struct stackTotals {
+    cf* vis;
+    float* inv_weight;
+    float* v2;
+    float* norm;
+};
+
+// Each of these adds the products [start, length) of a run into the totals.
+
+// Scalar version. This adds the products in exactly the same way as the
+// original loop over products, and also handles the tails.
+void add_run_scalar(const stackTotals& t, const stackRun& r, uint32_t start, const cf* in_vis,
+                    const float* in_weight, const float* flags) {
+
+    if (flags[r.input_a] == 0)
+        return;
+
+    for (uint32_t k = start; k < r.length; k++) {
+        uint32_t pi = r.prod + k;
+        uint32_t s = r.stack + r.step * (int32_t)k;
+        float weight = in_weight[pi];
+
+        // If the weight is zero, completely skip this product
+        if (weight == 0 || flags[r.input_b + k] == 0)
+            continue;
+
+        cf vis = r.conjugate ? std::conj(in_vis[pi]) : in_vis[pi];
+
+        // First summation of the visibilities (dividing by the total weight will be done later)
+        t.vis[s] += vis;
+
+        // Accumulate the square for variance calculation
+        t.v2[s] += fast_norm(vis);
+
+        // Accumulate the weighted *variances*. Normalising and inversion
+        // will be done later
+        t.inv_weight[s] += (1.0 / weight);
+
+        // Accumulate the weights so we can normalize correctly
+        t.norm[s] += 1.0;
+    }
+}
+
+#ifdef STACK_KERNEL_X86
+
+// Each stack gets at most one product from a run, so the vectorised versions
+// add exactly the same values in the same order as the scalar one. The
+// inverse weights are computed and summed in double precision for the same
+// reason.
+
+// 8 products per iteration
+__attribute__((target("avx2,fma"))) void add_run_avx2(const stackTotals& t, const stackRun& r,
+                                                      const cf* in_vis, const float* in_weight,
+                                                      const float* flags) {
+
+    if (flags[r.input_a] == 0)
+        return;
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256d one_d = _mm256_set1_pd(1.0);
+    const __m256i rev = _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 conj = r.conjugate ? _mm256_castsi256_ps(_mm256_set1_epi64x(1ll << 63)) : zero;
+
+    const float* vis = (const float*)(in_vis + r.prod);
+    const float* weight = in_weight + r.prod;
+    const float* flags_b = flags + r.input_b;
+
+    uint32_t k = 0;
+    for (; k + 8 <= r.length; k += 8) {
+        __m256 w = _mm256_loadu_ps(weight + k);
+        __m256 fb = _mm256_loadu_ps(flags_b + k);
+        __m256 v0 = _mm256_loadu_ps(vis + 2 * k);
+        __m256 v1 = _mm256_loadu_ps(vis + 2 * k + 8);
+
+        // For a descending run, reverse the products so they line up with
+        // ascending stacks
+        uint32_t s = r.stack + r.step * (int32_t)k;
+        if (r.step < 0) {
+            s -= 7;
+            w = _mm256_permutevar8x32_ps(w, rev);
+            fb = _mm256_permutevar8x32_ps(fb, rev);
+            __m256 tmp = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v1), 0x1B));
+            v1 = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v0), 0x1B));
+            v0 = tmp;
+        }
+
+        // Skip anything with zero weight or a flagged input. Unordered
+        // comparisons so that NaNs are kept as in the scalar code.
+        __m256 use = _mm256_and_ps(_mm256_cmp_ps(w, zero, _CMP_NEQ_UQ),
+                                   _mm256_cmp_ps(fb, zero, _CMP_NEQ_UQ));
+        __m256i use_i = _mm256_castps_si256(use);
+        __m256i use0 = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(use_i));
+        __m256i use1 = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(use_i, 1));
+
+        v0 = _mm256_and_ps(_mm256_xor_ps(v0, conj), _mm256_castsi256_ps(use0));
+        v1 = _mm256_and_ps(_mm256_xor_ps(v1, conj), _mm256_castsi256_ps(use1));
+
+        float* tv = (float*)(t.vis + s);
+        _mm256_storeu_ps(tv, _mm256_add_ps(_mm256_loadu_ps(tv), v0));
+        _mm256_storeu_ps(tv + 8, _mm256_add_ps(_mm256_loadu_ps(tv + 8), v1));
+
+        // Sum the (real, imag) squares. The horizontal add interleaves the two
+        // inputs per 128-bit lane, so swap the middle 64-bit blocks back.
+        __m256 n2 = _mm256_hadd_ps(_mm256_mul_ps(v0, v0), _mm256_mul_ps(v1, v1));
+        n2 = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(n2), 0xD8));
+        _mm256_storeu_ps(t.v2 + s, _mm256_add_ps(_mm256_loadu_ps(t.v2 + s), n2));
+
+        _mm256_storeu_ps(t.norm + s,
+                         _mm256_add_ps(_mm256_loadu_ps(t.norm + s), _mm256_and_ps(use, one)));
+
+        __m256 iw = _mm256_loadu_ps(t.inv_weight + s);
+        __m256d w0 = _mm256_cvtps_pd(_mm256_castps256_ps128(w));
+        __m256d w1 = _mm256_cvtps_pd(_mm256_extractf128_ps(w, 1));
+        __m256d r0 = _mm256_and_pd(_mm256_castsi256_pd(use0), _mm256_div_pd(one_d, w0));
+        __m256d r1 = _mm256_and_pd(_mm256_castsi256_pd(use1), _mm256_div_pd(one_d, w1));
+        r0 = _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(iw)), r0);
+        r1 = _mm256_add_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(iw, 1)), r1);
+        _mm256_storeu_ps(t.inv_weight + s,
+                         _mm256_set_m128(_mm256_cvtpd_ps(r1), _mm256_cvtpd_ps(r0)));
+    }
+    add_run_scalar(t, r, k, in_vis, in_weight, flags);
+}
+
+// 16 products per iteration, as for AVX2 but with mask registers
+__attribute__((target("avx512f"))) void add_run_avx512(const stackTotals& t, const stackRun& r,
+                                                       const cf* in_vis, const float* in_weight,
+                                                       const float* flags) {
+
+    if (flags[r.input_a] == 0)
+        return;
+
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512d one_d = _mm512_set1_pd(1.0);
+    const __m512i rev16 =
+        _mm512_set_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i rev8 = _mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m512i conj = _mm512_set1_epi64(r.conjugate ? (1ll << 63) : 0);
+    // Indices selecting the even and odd elements out of a pair of vectors
+    const __m512i idx_even =
+        _mm512_set_epi32(30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0);
+    const __m512i idx_odd =
+        _mm512_set_epi32(31, 29, 27, 25, 23, 21, 19, 17, 15, 13, 11, 9, 7, 5, 3, 1);
+
+    const float* vis = (const float*)(in_vis + r.prod);
+    const float* weight = in_weight + r.prod;
+    const float* flags_b = flags + r.input_b;
+
+    uint32_t k = 0;
+    for (; k + 16 <= r.length; k += 16) {
+        __m512 w = _mm512_loadu_ps(weight + k);
+        __m512 fb = _mm512_loadu_ps(flags_b + k);
+        __m512i v0 = _mm512_loadu_si512((const void*)(vis + 2 * k));
+        __m512i v1 = _mm512_loadu_si512((const void*)(vis + 2 * k + 16));
+
+        uint32_t s = r.stack + r.step * (int32_t)k;
+        if (r.step < 0) {
+            s -= 15;
+            w = _mm512_permutexvar_ps(rev16, w);
+            fb = _mm512_permutexvar_ps(rev16, fb);
+            __m512i tmp = _mm512_permutexvar_epi64(rev8, v1);
+            v1 = _mm512_permutexvar_epi64(rev8, v0);
+            v0 = tmp;
+        }
+
+        __mmask16 use = _mm512_cmp_ps_mask(w, zero, _CMP_NEQ_UQ)
+                        & _mm512_cmp_ps_mask(fb, zero, _CMP_NEQ_UQ);
+        __mmask8 use0 = use, use1 = use >> 8;
+
+        __m512 x0 = _mm512_castsi512_ps(_mm512_maskz_xor_epi64(use0, v0, conj));
+        __m512 x1 = _mm512_castsi512_ps(_mm512_maskz_xor_epi64(use1, v1, conj));
+
+        float* tv = (float*)(t.vis + s);
+        _mm512_storeu_ps(tv, _mm512_add_ps(_mm512_loadu_ps(tv), x0));
+        _mm512_storeu_ps(tv + 16, _mm512_add_ps(_mm512_loadu_ps(tv + 16), x1));
+
+        // Deinterleave the squares into real and imag parts and sum them
+        __m512 sq0 = _mm512_mul_ps(x0, x0);
+        __m512 sq1 = _mm512_mul_ps(x1, x1);
+        __m512 n2 = _mm512_add_ps(_mm512_permutex2var_ps(sq0, idx_even, sq1),
+                                  _mm512_permutex2var_ps(sq0, idx_odd, sq1));
+        _mm512_storeu_ps(t.v2 + s, _mm512_add_ps(_mm512_loadu_ps(t.v2 + s), n2));
+
+        __m512 n = _mm512_loadu_ps(t.norm + s);
+        _mm512_storeu_ps(t.norm + s, _mm512_mask_add_ps(n, use, n, one));
+
+        __m512 iw = _mm512_loadu_ps(t.inv_weight + s);
+        __m256 w_lo = _mm512_castps512_ps256(w);
+        __m256 w_hi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(w), 1));
+        __m256 iw_lo = _mm512_castps512_ps256(iw);
+        __m256 iw_hi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(iw), 1));
+        __m512d r0 = _mm512_maskz_div_pd(use0, one_d, _mm512_cvtps_pd(w_lo));
+        __m512d r1 = _mm512_maskz_div_pd(use1, one_d, _mm512_cvtps_pd(w_hi));
+        iw_lo = _mm512_cvtpd_ps(_mm512_add_pd(_mm512_cvtps_pd(iw_lo), r0));
+        iw_hi = _mm512_cvtpd_ps(_mm512_add_pd(_mm512_cvtps_pd(iw_hi), r1));
+        iw = _mm512_castpd_ps(
+            _mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(iw_lo)),
+                               _mm256_castps_pd(iw_hi), 1));
+        _mm512_storeu_ps(t.inv_weight + s, iw);
+    }
+    add_run_scalar(t, r, k, in_vis, in_weight, flags);
+}
+
+#endif // STACK_KERNEL_X86
+
+} // namespace
+
+
+float stack_vis(cf* out_vis, float* out_weight, const stackPlan& plan, const cf* in_vis,
+                const float* in_weight, const float* flags, simdLevel level) {
+
+    const uint32_t num_stack = plan.num_stack;
+    std::vector<float> stack_norm(num_stack, 0.0);
+    std::vector<float> stack_v2(num_stack, 0.0);
+    std::fill(out_vis, out_vis + num_stack, 0.0);
+    std::fill(out_weight, out_weight + num_stack, 0.0);
+
+    // Sum up each run of products
+    stackTotals t{out_vis, out_weight, stack_v2.data(), stack_norm.data()};
+#ifdef STACK_KERNEL_X86
+    if (level == simdLevel::avx512) {
+        for (const auto& r : plan.runs)
+            add_run_avx512(t, r, in_vis, in_weight, flags);
+    } else if (level == simdLevel::avx2) {
+        for (const auto& r : plan.runs)
+            add_run_avx2(t, r, in_vis, in_weight, flags);
+    } else
+#endif
+    {
+        (void)level;
+        for (const auto& r : plan.runs)
+            add_run_scalar(t, r, 0, in_vis, in_weight, flags);
+    }
+
+    // Loop over the stacks and normalise (and invert the variances)
+    float vart = 0.0;
+    float normt = 0.0;
+    for (uint32_t stack_ind = 0; stack_ind < num_stack; stack_ind++) {
+
+        // Calculate the mean and accumulate weight and place in the frame
+        float norm = stack_norm[stack_ind];
+
+        // Invert norm if set, otherwise use zero to set data to zero.
+        float inorm = (norm != 0.0) ? (1.0 / norm) : 0.0;
+        float iwgt = (out_weight[stack_ind] != 0.0) ? (1.0 / out_weight[stack_ind]) : 0.0;
+
+        out_vis[stack_ind] *= inorm;
+        out_weight[stack_ind] = norm * norm * iwgt;
+
+        // Accumulate to calculate the variance of the residuals
+        vart += stack_v2[stack_ind] - std::norm(out_vis[stack_ind]) * norm;
+        normt += norm;
+    }
+
+    // Calculate residuals (return zero if no data)
+    return (normt != 0.0) ? (vart / normt) : 0.0;
+}
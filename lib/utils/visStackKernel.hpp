@@ -0,0 +1,107 @@
+/*****************************************
+@file
+@brief Vectorised kernel for stacking redundant baselines.
+- stackRun
+- stackPlan
+- make_stack_plan
+- stack_vis
+*****************************************/
+#ifndef VIS_STACK_KERNEL_HPP
+#define VIS_STACK_KERNEL_HPP
+
+#include "simdDispatch.hpp" // for simdLevel, simd_level
+#include "visUtil.hpp"      // for prod_ctype, rstack_ctype
+
+#include <complex> // for complex
+#include <cstdint> // for uint32_t, uint16_t, int32_t
+#include <vector>  // for vector
+
+/**
+ * @brief A run of consecutive products that go into consecutive stacks.
+ *
+ * Product `prod + k` is between inputs `input_a` and `input_b + k`, and goes
+ * into stack `stack + step * k`, for `k` in [0, length).
+ **/
+struct stackRun {
+    /// First product in the run.
+    uint32_t prod;
+    /// Stack of the first product.
+    uint32_t stack;
+    /// Number of products.
+    uint32_t length;
+    /// Direction through the stacks, either +1 or -1.
+    int32_t step;
+    /// Input shared by every product.
+    uint16_t input_a;
+    /// Second input of the first product.
+    uint16_t input_b;
+    /// Whether the products must be conjugated before stacking.
+    bool conjugate;
+};
+
+/**
+ * @brief Precomputed description of how a frame is stacked.
+ *
+ * Along a row of the correlation triangle the baseline separation changes by
+ * one feed per product, and the stacks are ordered by separation, so the
+ * products of a row map onto contiguous runs of stacks. Splitting the
+ * products into these runs turns the scattered accumulation into contiguous
+ * vector loads and stores. For a full CHIME correlator the runs average ~200
+ * products.
+ *
+ * This depends only on the stack and product definitions, so should be built
+ * once per stackState and reused for every frame.
+ **/
+struct stackPlan {
+    /// Number of products in the input frames.
+    uint32_t num_prod;
+    /// Number of stacks in the output frames.
+    uint32_t num_stack;
+    /// The runs, in product order, covering every product.
+    std::vector<stackRun> runs;
+};
+
+/**
+ * @brief Build the plan for a stack definition.
+ *
+ * Any stack definition is accepted. Products that don't fit into a run with
+ * their neighbours just become runs of length one.
+ *
+ * @param  stack_map   Stack and conjugation for every product.
+ * @param  prods       Inputs of every product.
+ * @param  num_stack   Total number of stacks.
+ *
+ * @returns The plan.
+ **/
+stackPlan make_stack_plan(const std::vector<rstack_ctype>& stack_map,
+                          const std::vector<prod_ctype>& prods, uint32_t num_stack);
+
+/**
+ * @brief Average the products of a frame into stacks.
+ *
+ * Products with zero weight, or with either input flagged out, are skipped.
+ * Each stack is the mean of its products, and its weight is the inverse of
+ * the mean variance, i.e. `norm^2 / sum(1 / weight)`. Stacks with no products
+ * are set to zero.
+ *
+ * Every stack sums its products in product order, as a plain loop over the
+ * products would. The stacked visibilities and weights are identical for all
+ * SIMD levels, the residual may differ in the last bits depending on whether
+ * the compiler fuses the multiply-adds.
+ *
+ * @param  out_vis    Stacked visibilities, `num_stack` of them.
+ * @param  out_weight Stacked weights.
+ * @param  plan       Plan from `make_stack_plan`.
+ * @param  in_vis     Input visibilities, `num_prod` of them.
+ * @param  in_weight  Input weights.
+ * @param  flags      Input flags, zero if the input should be excluded.
+ * @param  level      SIMD implementation to use.
+ *
+ * @returns The variance of the residuals about the stacked values, or zero
+ *          if no products were used.
+ **/
+float stack_vis(std::complex<float>* out_vis, float* out_weight, const stackPlan& plan,
+                const std::complex<float>* in_vis, const float* in_weight, const float* flags,
+                simdLevel level = simd_level());
+
+#endif // VIS_STACK_KERNEL_HPP
@@ -147,6 +147,25 @@ void map_vis_triangle(const std::vector<uint32_t>& inputmap, size_t block, size_
     }
 }
 
+std::vector<uint32_t> vis_triangle_gather_plan(const std::vector<uint32_t>& inputmap,
+                                               size_t block, size_t N) {
+
+    std::vector<uint32_t> plan;
+    plan.reserve(inputmap.size() * (inputmap.size() + 1) / 2);
+
+    // The packed index must have room for the conjugation bit
+    if (gpu_N2_size(N, block) > (1u << 31)) {
+        throw std::invalid_argument("Visibility triangle too large for a gather plan.");
+    }
+
+    map_vis_triangle(inputmap, block, N, 0, [&plan](int32_t pi, int32_t bi, bool conj) {
+        (void)pi;
+        plan.push_back(((uint32_t)bi << 1) | (uint32_t)conj);
+    });
+
+    return plan;
+}
+
 
 std::tuple<uint32_t, uint32_t, std::string> parse_reorder_single(json j) {
     if (!j.is_array() || j.size() != 3) {
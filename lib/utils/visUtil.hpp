@@ -390,6 +390,24 @@ void copy_vis_triangle(const int32_t* inputdata, const std::vector<uint32_t>& in
                        size_t block, size_t N, gsl::span<cfloat> output);
 
 
+/**
+ * @brief Flatten the mapping done by `map_vis_triangle` into a table.
+ *
+ * Each entry corresponds to a product in the correlation triangle and holds
+ * the index of that product in the *GPU packed data* shifted up by one bit,
+ * with the lowest bit set if it must be conjugated, i.e. `(bi << 1) | conj`.
+ * The indices are for the first frequency, add `freq * gpu_N2_size(N, block)`
+ * for later ones.
+ *
+ * @param inputmap  Vector of feed indices to use.
+ * @param block     Block size.
+ * @param N         Number of inputs in input data.
+ * @returns         The table, with one entry for every product.
+ */
+std::vector<uint32_t> vis_triangle_gather_plan(const std::vector<uint32_t>& inputmap,
+                                               size_t block, size_t N);
+
+
 /**
  * @brief Apply a function over the visibility triangle.
  *
@@ -56,6 +56,10 @@ class SharedMemoryReader:
     The reader keeps a copy of frames in a buffer between calls and only copies new frames on the
     next `update()` call.
 
+    No locks are taken: each frame in the shared memory has a sequence number that the writer
+    makes odd while it writes the frame. Frames whose sequence number was odd, or changed while
+    they were copied, are marked invalid.
+
     Parameters
     ----------
     shared_memory_name : int
@@ -72,6 +76,7 @@ class SharedMemoryReader:
     num_structural_params = 6
     size_structural_data = SIZE_UINT64_T * num_structural_params
     size_access_record_entry = SIZE_UINT64_T
+    size_seq_entry = SIZE_UINT64_T
     valid_field_padding = 3
     size_valid_field = 1
     invalid_value = -1
@@ -86,7 +91,6 @@ class SharedMemoryReader:
         self.shared_mem_name = shared_memory_name
 
         try:
-            self.semaphore = posix_ipc.Semaphore(shared_memory_name)
             self.shared_mem_file = posix_ipc.SharedMemory(shared_memory_name)
         except posix_ipc.ExistentialError:
             raise SharedMemoryError(
@@ -140,6 +144,9 @@ class SharedMemoryReader:
         self.size_data = self.len_data * self.size_frame
         self.pos_data = self.pos_access_record + self.size_access_record
 
+        self.size_seq = self.len_data * self.size_seq_entry
+        self.pos_seq = self.pos_data + self.size_data
+
         self._initial_validation()
 
         # Assign simplified frame structure to data in order to access valid field.
@@ -173,7 +180,10 @@ class SharedMemoryReader:
 
     def _initial_validation(self):
         shared_mem_size = (
-            self.size_structural_data + self.size_access_record + self.size_data
+            self.size_structural_data
+            + self.size_access_record
+            + self.size_data
+            + self.size_seq
         )
         if shared_mem_size != self.shared_mem.size():
             raise SharedMemoryError(
@@ -186,9 +196,6 @@ class SharedMemoryReader:
         return Structure.from_buffer_copy(self.shared_mem)
 
     def __del__(self):
-        if hasattr(self, "semaphore"):
-            self.semaphore.release()
-
         if hasattr(self, "shared_mem_file"):
             os.close(self.shared_mem_file.fd)
 
@@ -229,7 +236,7 @@ class SharedMemoryReader:
         times = self._filter_last(access_record, self.view_size)
         logger.debug("Reading last {} time slots: {}".format(self.view_size, times))
 
-        self._copy_from_shm(times, access_record)
+        torn = self._copy_from_shm(times, access_record)
 
         # check if any data became invalid while reading it
         access_record_after_copy = self._access_record()
@@ -263,6 +270,10 @@ class SharedMemoryReader:
             self._last_access_record = np.ndarray((self.num_time, self.num_freq))
         self._last_access_record[times, :] = access_record_after_copy[times, :]
 
+        # make sure torn frames are copied again next time
+        for (idx_shm, torn_freqs) in torn:
+            self._last_access_record[idx_shm, torn_freqs] = self.invalid_value
+
         # TODO: make sure this works when there's no data in the buffer yet
         # if self._time_index_map == {}:
         #     return None
@@ -373,6 +384,15 @@ class SharedMemoryReader:
             )
 
     def _copy_from_shm(self, times, access_record):
+        """
+        Copy the changed time slots from the shared memory.
+
+        Returns
+        -------
+        list((int, numpy array))
+            Time index in the shared memory and mask of the frequencies that were written to while
+            being copied, and so were marked as invalid.
+        """
 
         # time indexes of data to copy from and to
         time_samples_to_copy = []
@@ -414,22 +434,37 @@ class SharedMemoryReader:
             order="C",
         )
 
+        seq = np.ndarray(
+            (self.num_time, self.num_freq),
+            np.uint64,
+            self.shared_mem,
+            self.pos_seq,
+            order="C",
+        )
+
         # copy all data
+        torn_frames = []
         for (idx_shm, idx_data) in time_samples_to_copy:
             logger.debug("Copying from time index {} to {}.".format(idx_data, idx_shm))
+            seq_before = seq[idx_shm, :].copy()
             self._data[idx_data, :] = tmp[idx_shm, :]
+            seq_after = seq[idx_shm, :].copy()
 
-    def _access_record(self):
-        try:
-            self.semaphore.acquire(120)
-        except posix_ipc.BusyError:
-            raise SharedMemoryError(
-                "Timed out while waiting for the shared memory resources referenced by '{}'.".format(
-                    self.shared_mem_name
+            # drop frames that were being written to while we copied them
+            torn = ((seq_before % 2) == 1) | (seq_before != seq_after)
+            if torn.any():
+                logger.debug(
+                    "{} frames were written to while copying time index {}.".format(
+                        torn.sum(), idx_shm
+                    )
                 )
-            )
+                self._data["valid"][idx_data, torn] = 0
+                torn_frames.append((idx_shm, torn))
 
-        record = np.ndarray(
+        return torn_frames
+
+    def _access_record(self):
+        return np.ndarray(
             (self.num_time, self.num_freq),
             np.int64,
             self.shared_mem,
@@ -437,9 +472,6 @@ class SharedMemoryReader:
             order="C",
         ).copy()
 
-        self.semaphore.release()
-        return record
-
     def _validate_shm(self):
         """
         Validate the shared memory.
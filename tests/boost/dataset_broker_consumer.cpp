@@ -55,6 +55,65 @@ int read_from_argv() {
     return broker_port;
 }
 
+BOOST_FIXTURE_TEST_CASE(_prefetch_ancestors, CompareCTypes) {
+    int broker_port = read_from_argv();
+
+    _global_log_level = 4;
+    __enable_syslog = 0;
+
+    json json_config;
+    json json_config_dm;
+    json_config_dm["use_dataset_broker"] = true;
+    json_config_dm["ds_broker_port"] = broker_port;
+    json_config["dataset_manager"] = json_config_dm;
+
+    Config conf;
+    conf.update_config(json_config);
+    datasetManager& dm = datasetManager::instance(conf);
+
+    // the states of the dataset written by the first producer
+    std::vector<input_ctype> inputs = {input_ctype(1, "1"), input_ctype(2, "2"),
+                                       input_ctype(3, "3")};
+    std::vector<prod_ctype> prods = {{1, 1}, {2, 2}, {3, 3}};
+    std::vector<std::pair<uint32_t, freq_ctype>> freqs = {
+        {1, {1.1, 1}}, {2, {2, 2.2}}, {3, {3, 3}}};
+
+    // read ds_id from file
+    std::string line;
+    std::ifstream file("DS_ID.txt");
+    if (file.is_open()) {
+        if (!std::getline(file, line))
+            std::cout << "Unable to read from file DS_ID.txt\n";
+        file.close();
+    } else
+        std::cout << "Unable to open file DS_ID.txt\n";
+    dset_id_t ds_id;
+    ds_id.set_from_string(line);
+
+    // This must return straight away, the broker is asked in the background.
+    // Asking for a state while the prefetch is running joins the same request.
+    dm.prefetch(ds_id);
+    auto p = dm.dataset_state<prodState>(ds_id);
+    check_equal(p->get_prods(), prods);
+
+    // By now all the other states of the ancestors have been requested too
+    auto datasets = dm.datasets();
+    for (dset_id_t id = ds_id;; id = datasets.at(id).base_dset()) {
+        BOOST_CHECK(dm.fetch_state(datasets.at(id).state()).get() != nullptr);
+        if (datasets.at(id).is_root())
+            break;
+    }
+
+    auto i = dm.dataset_state<inputState>(ds_id);
+    check_equal(i->get_inputs(), inputs);
+
+    auto f = dm.dataset_state<freqState>(ds_id);
+    check_equal(f->get_freqs(), freqs);
+
+    // wait a bit, to make sure we see errors in any late callbacks
+    usleep(WAIT_TIME);
+}
+
 BOOST_FIXTURE_TEST_CASE(_ask_broker_for_ancestors, CompareCTypes) {
     int broker_port = read_from_argv();
 
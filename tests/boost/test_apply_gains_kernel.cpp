@@ -0,0 +1,179 @@
+#define BOOST_TEST_MODULE "test_apply_gains_kernel"
+
+#include "applyGainsKernel.hpp" // for apply_gains_vis
+#include "simdDispatch.hpp"     // for simdLevel, simd_level, simd_level_name
+#include "visUtil.hpp"          // for cfloat
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK_EQUAL_COLLECTIONS
+#include <chrono>                            // for duration, high_resolution_clock, time_point
+#include <cmath>                             // for abs, INFINITY
+#include <complex>                           // for conj, operator*
+#include <random>                            // for mt19937, uniform_real_distribution
+#include <stddef.h>                          // for size_t
+#include <vector>                            // for vector
+
+// Odd number of elements so that the rows exercise every tail length
+const size_t num_elements = 259;
+const size_t num_prod = num_elements * (num_elements + 1) / 2;
+
+// Levels available on this machine
+std::vector<simdLevel> levels() {
+    std::vector<simdLevel> l;
+    for (auto level : {simdLevel::scalar, simdLevel::avx2, simdLevel::avx512}) {
+        if (level <= simd_level())
+            l.push_back(level);
+    }
+    return l;
+}
+
+struct gains_data {
+    std::vector<cfloat> vis;
+    std::vector<float> weight;
+    std::vector<cfloat> gain, gain_conj;
+    std::vector<float> weight_factor;
+};
+
+gains_data random_data(size_t N, int seed) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dis(-10.0f, 10.0f);
+    size_t np = N * (N + 1) / 2;
+
+    gains_data d;
+    d.vis.resize(np);
+    d.weight.resize(np);
+    for (size_t i = 0; i < np; i++) {
+        d.vis[i] = {dis(gen), dis(gen)};
+        d.weight[i] = std::abs(dis(gen));
+    }
+    for (size_t i = 0; i < N; i++) {
+        d.gain.push_back({dis(gen), dis(gen)});
+        d.gain_conj.push_back(std::conj(d.gain[i]));
+        d.weight_factor.push_back(std::abs(dis(gen)));
+    }
+
+    // Turn some inputs off, and give some products infinite weight
+    for (size_t i = 0; i < N; i += 7)
+        d.weight_factor[i] = 0.0f;
+    for (size_t i = 0; i < np; i += 13)
+        d.weight[i] = INFINITY;
+
+    return d;
+}
+
+// The loop from applyGains before the kernel was introduced
+void reference(cfloat* out_vis, float* out_weight, const gains_data& d, size_t N) {
+    size_t idx = 0;
+    for (size_t ii = 0; ii < N; ii++) {
+        for (size_t jj = ii; jj < N; jj++) {
+            out_vis[idx] = d.vis[idx] * d.gain[ii] * d.gain_conj[jj];
+            float wp = d.weight_factor[ii] * d.weight_factor[jj];
+            out_weight[idx] = (wp == 0 ? 0.0 : d.weight[idx] * wp);
+            idx++;
+        }
+    }
+}
+
+// The complex products may round differently if the compiler contracts to FMAs
+void check_vis(const std::vector<cfloat>& vis, const std::vector<cfloat>& ref_vis) {
+    BOOST_REQUIRE_EQUAL(vis.size(), ref_vis.size());
+    for (size_t i = 0; i < vis.size(); i++) {
+        BOOST_CHECK_SMALL(std::abs(vis[i] - ref_vis[i]), 1e-5f * (1 + std::abs(ref_vis[i])));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(_apply_gains_matches_reference) {
+    auto d = random_data(num_elements, 1);
+
+    std::vector<cfloat> ref_vis(num_prod);
+    std::vector<float> ref_weight(num_prod);
+    reference(ref_vis.data(), ref_weight.data(), d, num_elements);
+
+    for (auto level : levels()) {
+        BOOST_TEST_MESSAGE("Testing " << simd_level_name(level));
+
+        std::vector<cfloat> vis(num_prod);
+        std::vector<float> weight(num_prod);
+        apply_gains_vis(vis.data(), weight.data(), d.vis.data(), d.weight.data(), d.gain.data(),
+                        d.gain_conj.data(), d.weight_factor.data(), num_elements, level);
+
+        check_vis(vis, ref_vis);
+        BOOST_CHECK_EQUAL_COLLECTIONS(weight.begin(), weight.end(), ref_weight.begin(),
+                                      ref_weight.end());
+
+        // In place must give exactly the same as out of place
+        auto vis_ip = d.vis;
+        auto weight_ip = d.weight;
+        apply_gains_vis(vis_ip.data(), weight_ip.data(), vis_ip.data(), weight_ip.data(),
+                        d.gain.data(), d.gain_conj.data(), d.weight_factor.data(), num_elements,
+                        level);
+        BOOST_CHECK(vis_ip == vis);
+        BOOST_CHECK_EQUAL_COLLECTIONS(weight_ip.begin(), weight_ip.end(), weight.begin(),
+                                      weight.end());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(_apply_gains_small) {
+    // Fewer elements than a single vector
+    for (size_t N : {1, 2, 5}) {
+        auto d = random_data(N, 2);
+        size_t np = N * (N + 1) / 2;
+        std::vector<cfloat> ref_vis(np);
+        std::vector<float> ref_weight(np);
+        reference(ref_vis.data(), ref_weight.data(), d, N);
+
+        for (auto level : levels()) {
+            std::vector<cfloat> vis(np);
+            std::vector<float> weight(np);
+            apply_gains_vis(vis.data(), weight.data(), d.vis.data(), d.weight.data(),
+                            d.gain.data(), d.gain_conj.data(), d.weight_factor.data(), N, level);
+            check_vis(vis, ref_vis);
+            BOOST_CHECK_EQUAL_COLLECTIONS(weight.begin(), weight.end(), ref_weight.begin(),
+                                          ref_weight.end());
+        }
+    }
+}
+
+// Microbenchmark of a full sized frame against the original loop
+BOOST_AUTO_TEST_CASE(_apply_gains_speed) {
+    const size_t N = 2048;
+    const int n_iter = 5;
+
+    auto d = random_data(N, 3);
+
+    // Unit gains so that repeatedly applying them in place doesn't overflow
+    for (size_t i = 0; i < N; i++) {
+        d.gain[i] /= std::abs(d.gain[i]);
+        d.gain_conj[i] = std::conj(d.gain[i]);
+        d.weight_factor[i] = (d.weight_factor[i] == 0.0f ? 0.0f : 1.0f);
+    }
+    std::vector<cfloat> vis(d.vis.size());
+    std::vector<float> weight(d.weight.size());
+
+    auto time_it = [&](auto&& f) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < n_iter; i++) {
+            f();
+        }
+        std::chrono::duration<double> t = std::chrono::high_resolution_clock::now() - start;
+        return t.count() / n_iter;
+    };
+
+    double t_ref = time_it([&]() { reference(vis.data(), weight.data(), d, N); });
+    BOOST_TEST_MESSAGE("reference: " << t_ref * 1e3 << " ms per frame");
+
+    for (auto level : levels()) {
+        double t = time_it([&]() {
+            apply_gains_vis(vis.data(), weight.data(), d.vis.data(), d.weight.data(),
+                            d.gain.data(), d.gain_conj.data(), d.weight_factor.data(), N,
+                            level);
+        });
+        double t_ip = time_it([&]() {
+            apply_gains_vis(d.vis.data(), d.weight.data(), d.vis.data(), d.weight.data(),
+                            d.gain.data(), d.gain_conj.data(), d.weight_factor.data(), N,
+                            level);
+        });
+        BOOST_TEST_MESSAGE(simd_level_name(level) << ": " << t * 1e3 << " ms per frame ("
+                                                  << t_ref / t << "x), in place " << t_ip * 1e3
+                                                  << " ms (" << t_ref / t_ip << "x)");
+    }
+}
@@ -0,0 +1,155 @@
+#define BOOST_TEST_MODULE "test_async_file_writer"
+
+#include "AsyncFileWriter.hpp" // for AsyncFileWriter
+#include "kotekanLogging.hpp"  // for logLevel, logLevel::WARN
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK_EQUAL, BOOST_...
+#include <chrono>                            // for duration, high_resolution_clock, time_point
+#include <cstdint>                           // for uint8_t
+#include <fcntl.h>                           // for open, O_CREAT, O_RDWR
+#include <memory>                            // for shared_ptr
+#include <random>                            // for mt19937, uniform_int_distribution
+#include <stddef.h>                          // for size_t
+#include <stdexcept>                         // for invalid_argument
+#include <stdlib.h>                          // for mkstemp
+#include <string>                            // for string
+#include <sys/uio.h>                         // for iovec
+#include <unistd.h>                          // for close, pread, unlink
+#include <vector>                            // for vector
+
+const kotekan::logLevel log_level = kotekan::logLevel::WARN;
+
+// A temporary file that is removed at the end of the test
+struct tmpFile {
+    tmpFile() {
+        char name[] = "/tmp/test_async_file_writerXXXXXX";
+        fd = mkstemp(name);
+        BOOST_REQUIRE(fd >= 0);
+        unlink(name);
+    }
+    ~tmpFile() {
+        close(fd);
+    }
+    int fd;
+};
+
+// Write frames made of a flag byte, a header and a body, as the raw files do,
+// then read them back and check every byte including the padding.
+void check_frames(const std::string& backend, size_t max_inflight) {
+    const size_t num_frames = 50;
+    const size_t header_size = 40;
+    const size_t body_size = 100000;
+    const size_t frame_size = 4096 * 25;
+
+    auto writer = AsyncFileWriter::create(backend, 3, max_inflight, log_level);
+    BOOST_TEST_MESSAGE("Testing " << writer->backend() << " with at most " << max_inflight
+                                  << " bytes in flight");
+    tmpFile file;
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dis(0, 255);
+    std::vector<std::vector<uint8_t>> expected;
+
+    const uint8_t ONE = 1;
+    std::vector<uint8_t> header(header_size), body(body_size);
+    for (size_t i = 0; i < num_frames; i++) {
+        for (auto& b : header)
+            b = dis(gen);
+        for (auto& b : body)
+            b = dis(gen);
+
+        // Write the frames out of order
+        size_t ind = (i * 7) % num_frames;
+        writer->write(file.fd, ind * frame_size,
+                      {{(void*)&ONE, 1}, {header.data(), header_size}, {body.data(), body_size}},
+                      frame_size);
+
+        std::vector<uint8_t> frame(frame_size, 0);
+        frame[0] = 1;
+        std::copy(header.begin(), header.end(), frame.begin() + 1);
+        std::copy(body.begin(), body.end(), frame.begin() + 1 + header_size);
+        expected.push_back(frame);
+
+        // The caller can reuse its memory straight away
+        std::fill(header.begin(), header.end(), 0);
+        std::fill(body.begin(), body.end(), 0);
+
+        if (i % 10 == 9)
+            writer->flush(file.fd, 0, num_frames * frame_size, i % 20 == 19);
+
+        BOOST_CHECK(writer->inflight_bytes() <= std::max(max_inflight, frame_size));
+    }
+    writer->drain();
+    BOOST_CHECK_EQUAL(writer->inflight_bytes(), 0);
+    BOOST_CHECK(writer->completion_time() > 0);
+
+    std::vector<uint8_t> frame(frame_size);
+    for (size_t i = 0; i < num_frames; i++) {
+        size_t ind = (i * 7) % num_frames;
+        BOOST_REQUIRE_EQUAL(pread(file.fd, frame.data(), frame_size, ind * frame_size),
+                            (ssize_t)frame_size);
+        BOOST_CHECK(frame == expected[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(_write_threads) {
+    check_frames("threads", 1 << 24);
+    // Less than a single frame, so every write must wait for the last
+    check_frames("threads", 1000);
+}
+
+BOOST_AUTO_TEST_CASE(_write_io_uring) {
+    // Falls back to the thread backend if io_uring is not available
+    check_frames("io_uring", 1 << 24);
+    check_frames("io_uring", 1000);
+}
+
+BOOST_AUTO_TEST_CASE(_bad_arguments) {
+    BOOST_CHECK_THROW(AsyncFileWriter::create("carrier_pigeon", 1, 1024, log_level),
+                      std::invalid_argument);
+
+    auto writer = AsyncFileWriter::create("threads", 1, 1024, log_level);
+    tmpFile file;
+    std::vector<uint8_t> data(100);
+    BOOST_CHECK_THROW(writer->write(file.fd, 0, {{data.data(), data.size()}}, 10),
+                      std::invalid_argument);
+}
+
+// Time how long the caller is blocked for compared with writing directly. On
+// a fast disk (or tmpfs) this mostly measures the cost of the copy.
+BOOST_AUTO_TEST_CASE(_write_speed) {
+    const size_t num_frames = 64;
+    const size_t frame_size = 1 << 22;
+
+    std::vector<uint8_t> data(frame_size, 7);
+    auto time_it = [&](auto&& f) {
+        auto start = std::chrono::high_resolution_clock::now();
+        f();
+        std::chrono::duration<double> t = std::chrono::high_resolution_clock::now() - start;
+        return t.count();
+    };
+
+    {
+        tmpFile file;
+        double t = time_it([&]() {
+            for (size_t i = 0; i < num_frames; i++)
+                pwrite(file.fd, data.data(), frame_size, i * frame_size);
+        });
+        BOOST_TEST_MESSAGE("pwrite: " << num_frames * frame_size / t / 1e6 << " MB/s");
+    }
+
+    for (auto backend : {"threads", "io_uring"}) {
+        tmpFile file;
+        auto writer = AsyncFileWriter::create(backend, 2, 1 << 28, log_level);
+        double t_queue, t_drain;
+        t_queue = time_it([&]() {
+            for (size_t i = 0; i < num_frames; i++)
+                writer->write(file.fd, i * frame_size, {{data.data(), frame_size}}, frame_size);
+        });
+        t_drain = time_it([&]() { writer->drain(); });
+        BOOST_TEST_MESSAGE(writer->backend()
+                           << ": caller " << num_frames * frame_size / t_queue / 1e6
+                           << " MB/s, total " << num_frames * frame_size / (t_queue + t_drain) / 1e6
+                           << " MB/s");
+    }
+}
@@ -0,0 +1,110 @@
+#define BOOST_TEST_MODULE "test_buffer_handles"
+
+#include "buffer.h" // for Buffer, create_buffer, register_consumer, register_producer, consu...
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK_EQUAL, BOOST_...
+#include <chrono>                            // for duration, high_resolution_clock
+#include <stdlib.h>                          // for free
+#include <string>                            // for string, to_string
+
+BOOST_AUTO_TEST_CASE(_handles) {
+    for (bool lock_free : {false, true}) {
+        struct Buffer* buf = create_buffer(4, 64, nullptr, "handle_buf", "standard", 0, false,
+                                           false, true, lock_free, 0);
+
+        // Padding stages so the handles aren't all zero
+        register_consumer(buf, "other_consumer");
+        register_producer(buf, "other_producer");
+        int producer_id = register_producer(buf, "producer");
+        int consumer_id = register_consumer(buf, "consumer");
+        BOOST_CHECK_EQUAL(producer_id, 1);
+        BOOST_CHECK_EQUAL(consumer_id, 1);
+        BOOST_CHECK_EQUAL(get_producer_id(buf, "producer"), producer_id);
+        BOOST_CHECK_EQUAL(get_consumer_id(buf, "consumer"), consumer_id);
+        BOOST_CHECK_EQUAL(get_consumer_id(buf, "missing"), -1);
+
+        // The handles and the names can be mixed
+        BOOST_CHECK(producer_wait_for_empty_frame(buf, producer_id, 0) != nullptr);
+        producer_mark_frame_full(buf, producer_id, 0);
+        BOOST_CHECK(wait_for_empty_frame(buf, "other_producer", 0) != nullptr);
+        BOOST_CHECK(is_frame_producer_done(buf, producer_id, 0));
+        mark_frame_full(buf, "other_producer", 0);
+        BOOST_CHECK(!is_frame_empty(buf, 0));
+
+        BOOST_CHECK(consumer_wait_for_full_frame(buf, consumer_id, 0) != nullptr);
+        consumer_mark_frame_empty(buf, consumer_id, 0);
+        BOOST_CHECK(is_frame_consumer_done(buf, consumer_id, 0));
+        BOOST_CHECK(!is_frame_empty(buf, 0));
+        BOOST_CHECK(wait_for_full_frame(buf, "other_consumer", 0) != nullptr);
+        mark_frame_empty(buf, "other_consumer", 0);
+        BOOST_CHECK(is_frame_empty(buf, 0));
+
+        // And the batched versions
+        BOOST_CHECK_EQUAL(producer_wait_for_empty_frames(buf, producer_id, 1, 3), 3);
+        producer_mark_frames_full(buf, producer_id, 1, 3);
+        BOOST_CHECK_EQUAL(wait_for_empty_frames(buf, "other_producer", 1, 3), 3);
+        mark_frames_full(buf, "other_producer", 1, 3);
+        BOOST_CHECK_EQUAL(consumer_wait_for_full_frames(buf, consumer_id, 1, 4, nullptr), 3);
+        consumer_mark_frames_empty(buf, consumer_id, 1, 3);
+        struct timespec timeout = {0, 0};
+        BOOST_CHECK_EQUAL(consumer_wait_for_full_frame_timeout(buf, consumer_id, 1, timeout), 1);
+        mark_frames_empty(buf, "other_consumer", 1, 3);
+        BOOST_CHECK_EQUAL(get_num_full_frames(buf), 0);
+
+        delete_buffer(buf);
+        free(buf);
+    }
+}
+
+// The cost of passing frames through a buffer with several consumers, by name and by handle
+BOOST_AUTO_TEST_CASE(_cost) {
+    const int num_frames = 200000;
+    const int num_consumers = 4;
+    const std::string prefix = "/telescope/correlator/post_process/";
+
+    for (bool lock_free : {false, true}) {
+        double time_per_frame[2];
+        for (bool use_handles : {false, true}) {
+            struct Buffer* buf = create_buffer(4, 64, nullptr, "cost_buf", "standard", 0, false,
+                                               false, true, lock_free, 0);
+            std::string producer = prefix + "producer";
+            int producer_id = register_producer(buf, producer.c_str());
+            std::string consumers[num_consumers];
+            int consumer_ids[num_consumers];
+            for (int i = 0; i < num_consumers; i++) {
+                consumers[i] = prefix + "consumer_" + std::to_string(i);
+                consumer_ids[i] = register_consumer(buf, consumers[i].c_str());
+            }
+
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int n = 0; n < num_frames; n++) {
+                int id = n % buf->num_frames;
+                if (use_handles) {
+                    producer_wait_for_empty_frame(buf, producer_id, id);
+                    producer_mark_frame_full(buf, producer_id, id);
+                    for (int i = 0; i < num_consumers; i++) {
+                        consumer_wait_for_full_frame(buf, consumer_ids[i], id);
+                        consumer_mark_frame_empty(buf, consumer_ids[i], id);
+                    }
+                } else {
+                    wait_for_empty_frame(buf, producer.c_str(), id);
+                    mark_frame_full(buf, producer.c_str(), id);
+                    for (int i = 0; i < num_consumers; i++) {
+                        wait_for_full_frame(buf, consumers[i].c_str(), id);
+                        mark_frame_empty(buf, consumers[i].c_str(), id);
+                    }
+                }
+            }
+            std::chrono::duration<double> elapsed =
+                std::chrono::high_resolution_clock::now() - start;
+            time_per_frame[use_handles] = elapsed.count() / num_frames * 1e9;
+
+            BOOST_CHECK_EQUAL(get_num_full_frames(buf), 0);
+            delete_buffer(buf);
+            free(buf);
+        }
+        BOOST_TEST_MESSAGE((lock_free ? "lock free" : "locking")
+                           << ": ns per frame by name " << time_per_frame[0] << ", by handle "
+                           << time_per_frame[1]);
+    }
+}
@@ -0,0 +1,169 @@
+#define BOOST_TEST_MODULE "test_buffer_latency"
+
+#include "buffer.h"          // for Buffer, create_buffer, register_consumer, register_producer
+#include "bufferLatency.hpp" // for get_buffer_latency, BufferLatency, StageLatency
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK_EQUAL, BOOST_...
+#include <chrono>                            // for duration, high_resolution_clock, milliseconds
+#include <stdlib.h>                          // for free
+#include <thread>                            // for sleep_for, thread
+#include <vector>                            // for vector
+
+using kotekan::BufferLatency;
+using kotekan::get_buffer_latency;
+using kotekan::StageLatency;
+
+struct testBuffer {
+    testBuffer(bool lock_free, int event_log_size, int num_frames = 4) {
+        buf = create_buffer(num_frames, 64, nullptr, "test_buf", "standard", 0, false, false, true,
+                            lock_free, event_log_size);
+        register_producer(buf, "producer");
+        register_consumer(buf, "consumer");
+    }
+
+    ~testBuffer() {
+        delete_buffer(buf);
+        free(buf);
+    }
+
+    const StageLatency& stage(const BufferLatency& latency, bool producer) {
+        for (const auto& s : latency.stages) {
+            if (s.producer == producer)
+                return s;
+        }
+        BOOST_FAIL("Stage not found");
+        return latency.stages[0];
+    }
+
+    struct Buffer* buf;
+};
+
+BOOST_AUTO_TEST_CASE(_event_log) {
+    for (bool lock_free : {false, true}) {
+        testBuffer t(lock_free, 5);
+        // Rounded up to a power of two
+        BOOST_CHECK_EQUAL(t.buf->event_log_size, 8);
+
+        BOOST_CHECK(wait_for_empty_frame(t.buf, "producer", 0) != nullptr);
+        mark_frame_full(t.buf, "producer", 0);
+        BOOST_CHECK(wait_for_full_frame(t.buf, "consumer", 0) != nullptr);
+        mark_frame_empty(t.buf, "consumer", 0);
+
+        std::vector<BufferEvent> events(16);
+        BOOST_CHECK_EQUAL(get_buffer_events(t.buf, events.data(), events.size()), 5);
+        std::vector<uint16_t> types = {BUFFER_EVENT_PRODUCER_ACQUIRE,
+                                       BUFFER_EVENT_PRODUCER_RELEASE, BUFFER_EVENT_FRAME_FULL,
+                                       BUFFER_EVENT_CONSUMER_ACQUIRE,
+                                       BUFFER_EVENT_CONSUMER_RELEASE};
+        for (size_t i = 0; i < types.size(); i++) {
+            BOOST_CHECK_EQUAL(events[i].type, types[i]);
+            BOOST_CHECK_EQUAL(events[i].frame_id, 0);
+            BOOST_CHECK_EQUAL(events[i].stage_id, (i == 2) ? -1 : 0);
+            if (i > 0)
+                BOOST_CHECK(events[i].time >= events[i - 1].time);
+        }
+
+        // Only the newest events are kept, oldest first
+        for (int i = 1; i < 4; i++) {
+            wait_for_empty_frame(t.buf, "producer", i);
+            mark_frame_full(t.buf, "producer", i);
+        }
+        BOOST_CHECK_EQUAL(get_buffer_events(t.buf, events.data(), events.size()), 8);
+        BOOST_CHECK_EQUAL(events[7].type, BUFFER_EVENT_FRAME_FULL);
+        BOOST_CHECK_EQUAL(events[7].frame_id, 3);
+        BOOST_CHECK_EQUAL(events[0].frame_id, 1);
+        BOOST_CHECK_EQUAL(get_buffer_events(t.buf, events.data(), 2), 2);
+        BOOST_CHECK_EQUAL(events[1].frame_id, 3);
+    }
+
+    // Turned off
+    testBuffer t(false, 0);
+    BOOST_CHECK(t.buf->event_log == nullptr);
+    wait_for_empty_frame(t.buf, "producer", 0);
+    mark_frame_full(t.buf, "producer", 0);
+    BufferEvent event;
+    BOOST_CHECK_EQUAL(get_buffer_events(t.buf, &event, 1), 0);
+    BOOST_CHECK(get_buffer_latency(t.buf).stages.empty());
+}
+
+// A fast producer and a consumer which holds each frame for `hold`
+void run_pipeline(struct Buffer* buf, int num_frames, std::chrono::milliseconds hold) {
+    std::thread producer([&]() {
+        for (int i = 0; i < num_frames; i++) {
+            int id = i % buf->num_frames;
+            if (wait_for_empty_frame(buf, "producer", id) == nullptr)
+                return;
+            mark_frame_full(buf, "producer", id);
+        }
+    });
+
+    for (int i = 0; i < num_frames; i++) {
+        int id = i % buf->num_frames;
+        if (wait_for_full_frame(buf, "consumer", id) == nullptr)
+            break;
+        std::this_thread::sleep_for(hold);
+        mark_frame_empty(buf, "consumer", id);
+    }
+    producer.join();
+}
+
+BOOST_AUTO_TEST_CASE(_slow_consumer) {
+    for (bool lock_free : {false, true}) {
+        testBuffer t(lock_free, 1024);
+        auto start = std::chrono::high_resolution_clock::now();
+        run_pipeline(t.buf, 40, std::chrono::milliseconds(5));
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        auto latency = get_buffer_latency(t.buf);
+        BOOST_CHECK_EQUAL(latency.stages.size(), 2);
+        BOOST_CHECK(latency.window >= elapsed.count() * 0.9);
+
+        // The consumer is the bottleneck: it holds each frame for 5 ms and never waits,
+        // while the frames queue up for it and the producer is stuck waiting for them.
+        auto& consumer = t.stage(latency, false);
+        BOOST_CHECK_EQUAL(consumer.name, "consumer");
+        BOOST_CHECK_EQUAL(consumer.num_frames, 40);
+        BOOST_CHECK(consumer.hold_time >= 0.005 && consumer.hold_time < 0.02);
+        BOOST_CHECK(consumer.wait_time < 0.002);
+        BOOST_CHECK(consumer.queue_time > 0.01);
+        BOOST_CHECK(consumer.frame_rate > 100 && consumer.frame_rate <= 200);
+
+        auto& producer = t.stage(latency, true);
+        BOOST_CHECK_EQUAL(producer.num_frames, 40);
+        BOOST_CHECK(producer.hold_time < 0.002);
+        BOOST_CHECK(producer.wait_time > 0.002);
+
+        BOOST_TEST_MESSAGE((lock_free ? "lock free" : "locking")
+                           << ": consumer hold " << consumer.hold_time * 1e3 << " ms, wait "
+                           << consumer.wait_time * 1e3 << " ms, queue "
+                           << consumer.queue_time * 1e3 << " ms; producer wait "
+                           << producer.wait_time * 1e3 << " ms; " << consumer.frame_rate
+                           << " frames/s");
+    }
+}
+
+// The cost of logging the events, passing frames through a buffer on one thread so that
+// nothing ever blocks
+BOOST_AUTO_TEST_CASE(_overhead) {
+    const int num_frames = 200000;
+    for (bool lock_free : {false, true}) {
+        double time_per_frame[2];
+        for (int log_size : {0, DEFAULT_EVENT_LOG_SIZE}) {
+            testBuffer t(lock_free, log_size, 64);
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < num_frames; i++) {
+                int id = i % t.buf->num_frames;
+                wait_for_empty_frame(t.buf, "producer", id);
+                mark_frame_full(t.buf, "producer", id);
+                wait_for_full_frame(t.buf, "consumer", id);
+                mark_frame_empty(t.buf, "consumer", id);
+            }
+            std::chrono::duration<double> elapsed =
+                std::chrono::high_resolution_clock::now() - start;
+            time_per_frame[log_size > 0] = elapsed.count() / num_frames * 1e9;
+        }
+        BOOST_TEST_MESSAGE((lock_free ? "lock free" : "locking")
+                           << " (ns per frame): without log " << time_per_frame[0]
+                           << ", with log " << time_per_frame[1]);
+    }
+}
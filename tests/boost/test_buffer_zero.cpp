@@ -0,0 +1,150 @@
+#define BOOST_TEST_MODULE "test_buffer_zero"
+
+#include "buffer.h" // for Buffer, create_buffer, zero_frames, set_zero_policy, get_zero_stats
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK_EQUAL, BOOST_...
+#include <chrono>                            // for duration, high_resolution_clock
+#include <stdint.h>                          // for uint8_t
+#include <stdlib.h>                          // for free
+#include <string.h>                          // for memset
+#include <thread>                            // for thread
+
+const int frame_size = 4096;
+
+struct testBuffer {
+    testBuffer(bool lock_free, int num_frames = 4) {
+        buf = create_buffer(num_frames, frame_size, nullptr, "zero_buf", "standard", 0, false,
+                            false, true, lock_free, 0);
+        register_producer(buf, "producer");
+        register_consumer(buf, "consumer");
+    }
+
+    ~testBuffer() {
+        delete_buffer(buf);
+        free(buf);
+    }
+
+    // Fill a frame with ones, pass it through the consumer and get it back from the producer
+    uint8_t* cycle_frame(int id, bool dirty = false) {
+        uint8_t* frame = wait_for_empty_frame(buf, "producer", id);
+        memset(frame, 1, frame_size);
+        if (dirty)
+            mark_frame_dirty(buf, id, 100, 200);
+        mark_frame_full(buf, "producer", id);
+        wait_for_full_frame(buf, "consumer", id);
+        mark_frame_empty(buf, "consumer", id);
+        return wait_for_empty_frame(buf, "producer", id);
+    }
+
+    struct Buffer* buf;
+};
+
+// The number of bytes in [start, end) which are zero
+int num_zeros(const uint8_t* frame, int start = 0, int end = frame_size) {
+    int n = 0;
+    for (int i = start; i < end; i++)
+        n += (frame[i] == 0);
+    return n;
+}
+
+BOOST_AUTO_TEST_CASE(_full_frame) {
+    for (bool lock_free : {false, true}) {
+        testBuffer t(lock_free);
+        zero_frames(t.buf);
+
+        // The settings can't change once the workers are running
+        BOOST_CHECK_EQUAL(set_zero_policy(t.buf, ZERO_DIRTY, 0, 0), -1);
+        BOOST_CHECK_EQUAL(set_zero_threads(t.buf, 2, nullptr, 0), -1);
+
+        uint8_t* frame = t.cycle_frame(0);
+        BOOST_CHECK_EQUAL(num_zeros(frame), frame_size);
+        mark_frame_full(t.buf, "producer", 0);
+
+        ZeroStats stats;
+        get_zero_stats(t.buf, &stats);
+        BOOST_CHECK_EQUAL(stats.num_frames, 1);
+        BOOST_CHECK_EQUAL(stats.num_bytes, frame_size);
+        BOOST_CHECK_EQUAL(stats.backlog, 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(_strided) {
+    for (bool lock_free : {false, true}) {
+        testBuffer t(lock_free);
+        BOOST_CHECK_EQUAL(set_zero_policy(t.buf, ZERO_STRIDED, 40, 30), -1);
+        // Blocks of 1000 bytes, the last one cut short by the end of the frame
+        BOOST_CHECK_EQUAL(set_zero_policy(t.buf, ZERO_STRIDED, 100, 1000), 0);
+        zero_frames(t.buf);
+
+        uint8_t* frame = t.cycle_frame(1);
+        BOOST_CHECK_EQUAL(num_zeros(frame), 4 * 100 + 96);
+        for (int block = 0; block < 4; block++)
+            BOOST_CHECK_EQUAL(num_zeros(frame, block * 1000, block * 1000 + 100), 100);
+        BOOST_CHECK_EQUAL(num_zeros(frame, 4000, frame_size), 96);
+        mark_frame_full(t.buf, "producer", 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(_dirty) {
+    for (bool lock_free : {false, true}) {
+        testBuffer t(lock_free);
+        BOOST_CHECK_EQUAL(set_zero_policy(t.buf, ZERO_DIRTY, 0, 0), 0);
+        zero_frames(t.buf);
+
+        // Only the declared region is zeroed
+        uint8_t* frame = t.cycle_frame(2, true);
+        BOOST_CHECK_EQUAL(num_zeros(frame), 200);
+        BOOST_CHECK_EQUAL(num_zeros(frame, 100, 300), 200);
+        mark_frame_full(t.buf, "producer", 2);
+
+        // A frame with nothing declared is left alone, since the range is reset
+        wait_for_full_frame(t.buf, "consumer", 2);
+        mark_frame_empty(t.buf, "consumer", 2);
+        frame = wait_for_empty_frame(t.buf, "producer", 2);
+        memset(frame, 1, frame_size);
+        mark_frame_full(t.buf, "producer", 2);
+        wait_for_full_frame(t.buf, "consumer", 2);
+        mark_frame_empty(t.buf, "consumer", 2);
+        frame = wait_for_empty_frame(t.buf, "producer", 2);
+        BOOST_CHECK_EQUAL(num_zeros(frame), 0);
+        mark_frame_full(t.buf, "producer", 2);
+    }
+}
+
+// Frames keep flowing through a producer and consumer thread with several workers
+BOOST_AUTO_TEST_CASE(_pipeline) {
+    for (bool lock_free : {false, true}) {
+        testBuffer t(lock_free, 8);
+        BOOST_CHECK_EQUAL(set_zero_threads(t.buf, 3, nullptr, 0), 0);
+        zero_frames(t.buf);
+
+        const int num_frames = 2000;
+        int bad_frames = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        std::thread producer([&]() {
+            for (int i = 0; i < num_frames; i++) {
+                int id = i % t.buf->num_frames;
+                uint8_t* frame = wait_for_empty_frame(t.buf, "producer", id);
+                // Every frame after the first lap must come back zeroed
+                if (i >= t.buf->num_frames && num_zeros(frame) != frame_size)
+                    bad_frames++;
+                memset(frame, 1, frame_size);
+                mark_frame_full(t.buf, "producer", id);
+            }
+        });
+        for (int i = 0; i < num_frames; i++) {
+            int id = i % t.buf->num_frames;
+            wait_for_full_frame(t.buf, "consumer", id);
+            mark_frame_empty(t.buf, "consumer", id);
+        }
+        producer.join();
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        BOOST_CHECK_EQUAL(bad_frames, 0);
+        ZeroStats stats;
+        get_zero_stats(t.buf, &stats);
+        BOOST_CHECK(stats.num_frames >= num_frames - (uint64_t)t.buf->num_frames);
+        BOOST_TEST_MESSAGE((lock_free ? "lock free" : "locking")
+                           << ": " << elapsed.count() / num_frames * 1e6 << " us per frame");
+    }
+}
@@ -0,0 +1,148 @@
+#define BOOST_TEST_MODULE "test_config_value"
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK_EQUAL, BOOST_...
+#include <chrono>                            // for duration, high_resolution_clock
+#include <stdexcept>                         // for runtime_error
+#include <stdint.h>                          // for uint32_t
+#include <string>                            // for string, to_string
+#include <vector>                            // for vector
+
+// the code to test:
+#include "Config.hpp"      // for Config
+#include "ConfigValue.hpp" // for ConfigValue
+
+#include "json.hpp" // for json
+
+using kotekan::Config;
+using kotekan::ConfigValue;
+
+using json = nlohmann::json;
+
+json test_config() {
+    return {{"num_elements", 2048},
+            {"pi", 3.141},
+            {"telescope",
+             {{"cpu_affinity", {2, 3}},
+              {"correlator",
+               {{"num_elements", 16},
+                {"two_pi", "2 * pi"},
+                {"updatable_config", {{"gains", "/updatable_config/gains"}}},
+                {"inputs", {{{"name", "a"}}, {{"name", "b"}}}}}}}}};
+}
+
+BOOST_AUTO_TEST_CASE(_lookup) {
+    Config config;
+    config.update_config(test_config());
+    const std::string stage = "/telescope/correlator";
+
+    // Searched for from the stage up to the root
+    BOOST_CHECK_EQUAL(ConfigValue<uint32_t>(config, stage, "num_elements").get(), 16);
+    BOOST_CHECK_EQUAL(ConfigValue<uint32_t>(config, "/telescope", "num_elements").get(), 2048);
+    BOOST_CHECK(ConfigValue<std::vector<int>>(config, stage, "cpu_affinity").get()
+                == std::vector<int>({2, 3}));
+    BOOST_CHECK_CLOSE(ConfigValue<double>(config, stage, "two_pi").get(), 6.282, 1e-6);
+
+    // Paths in the name and array indices
+    BOOST_CHECK_EQUAL(ConfigValue<std::string>(config, stage, "updatable_config/gains").get(),
+                      "/updatable_config/gains");
+    BOOST_CHECK_EQUAL(ConfigValue<std::string>(config, stage, "inputs/1/name").get(), "b");
+
+    // A stage path which isn't in the config still finds the values above it
+    BOOST_CHECK_EQUAL(ConfigValue<uint32_t>(config, stage + "/missing", "num_elements").get(),
+                      16);
+
+    // Defaults and missing values
+    BOOST_CHECK_EQUAL(ConfigValue<uint32_t>(config, stage, "num_freq", 1024).get(), 1024);
+    BOOST_CHECK_EQUAL(ConfigValue<uint32_t>(config, stage, "num_elements", 1024).get(), 16);
+    BOOST_CHECK_THROW(ConfigValue<uint32_t>(config, stage, "num_freq"), std::runtime_error);
+    BOOST_CHECK_THROW(ConfigValue<uint32_t>(config, stage, "inputs/2/name"), std::runtime_error);
+
+    BOOST_CHECK(config.exists(stage, "inputs/0/name"));
+    BOOST_CHECK(config.exists("/", "pi"));
+    BOOST_CHECK(!config.exists(stage, "pi"));
+    BOOST_CHECK(!config.exists(stage + "/missing", "num_elements"));
+}
+
+BOOST_AUTO_TEST_CASE(_refresh) {
+    Config config;
+    config.update_config(test_config());
+    const std::string stage = "/telescope/correlator";
+
+    ConfigValue<uint32_t> num_elements(config, stage, "num_elements");
+    ConfigValue<double> two_pi(config, stage, "two_pi");
+    ConfigValue<uint32_t> num_freq(config, stage, "num_freq", 1024);
+    uint64_t generation = config.get_generation();
+
+    config.update_value(stage, "num_elements", 32);
+    config.update_value("", "pi", 3.0);
+    BOOST_CHECK(config.get_generation() != generation);
+    BOOST_CHECK_EQUAL(num_elements.get(), 32);
+    BOOST_CHECK_EQUAL(two_pi.get(), 6.0);
+    BOOST_CHECK_EQUAL(num_freq.get(), 1024);
+
+    // A whole new config
+    json updated = test_config();
+    updated["num_freq"] = 16;
+    config.update_config(updated);
+    BOOST_CHECK_EQUAL(num_elements.get(), 16);
+    BOOST_CHECK_EQUAL(num_freq.get(), 16);
+    const uint32_t& value = num_freq;
+    BOOST_CHECK_EQUAL(value, 16);
+}
+
+// The cost of setting up a large pipeline, where every stage looks up its settings and a few
+// optional ones which aren't there, and then of reading a setting for every frame.
+BOOST_AUTO_TEST_CASE(_cost) {
+    const int num_stages = 300;
+    const std::vector<std::string> required = {"num_elements", "num_local_freq",
+                                               "samples_per_data_set", "cpu_affinity"};
+    const std::vector<std::string> optional = {"sk_step", "rfi_combined", "zero_frames",
+                                               "num_threads"};
+
+    json stages;
+    for (int i = 0; i < num_stages; i++)
+        stages["stage_" + std::to_string(i)] = {{"kotekan_stage", "testStage"},
+                                                {"num_local_freq", 1},
+                                                {"in_buf", "buf_" + std::to_string(i)}};
+    json root = {{"num_elements", 2048},
+                 {"samples_per_data_set", 32768},
+                 {"cpu_affinity", {2, 3, 8, 9}},
+                 {"telescope", {{"correlator", stages}}}};
+    Config config;
+    config.update_config(root);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < num_stages; i++) {
+        std::string unique_name = "/telescope/correlator/stage_" + std::to_string(i);
+        for (auto& name : required)
+            BOOST_REQUIRE(config.exists("/", name) || config.exists(unique_name, name));
+        BOOST_REQUIRE_EQUAL(config.get<uint32_t>(unique_name, "num_local_freq"), 1);
+        BOOST_REQUIRE_EQUAL(config.get<uint32_t>(unique_name, "samples_per_data_set"), 32768);
+        BOOST_REQUIRE_EQUAL(config.get<std::vector<int>>(unique_name, "cpu_affinity").size(), 4);
+        for (auto& name : optional)
+            BOOST_REQUIRE_EQUAL(config.get_default<uint32_t>(unique_name, name, 7), 7);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    BOOST_TEST_MESSAGE("Config lookups for " << num_stages << " stages: " << elapsed.count() * 1e3
+                                             << " ms");
+
+    const int num_frames = 100000;
+    const std::string unique_name = "/telescope/correlator/stage_0";
+    double time_per_frame[2];
+    for (bool cached : {false, true}) {
+        ConfigValue<std::vector<int>> cpu_affinity(config, unique_name, "cpu_affinity");
+        int total = 0;
+        start = std::chrono::high_resolution_clock::now();
+        for (int n = 0; n < num_frames; n++) {
+            if (cached)
+                total += cpu_affinity.get()[n % 4];
+            else
+                total += config.get<std::vector<int>>(unique_name, "cpu_affinity")[n % 4];
+        }
+        elapsed = std::chrono::high_resolution_clock::now() - start;
+        BOOST_CHECK_EQUAL(total, num_frames / 4 * (2 + 3 + 8 + 9));
+        time_per_frame[cached] = elapsed.count() / num_frames * 1e9;
+    }
+    BOOST_TEST_MESSAGE("ns per frame reading cpu_affinity with Config::get "
+                       << time_per_frame[0] << ", with ConfigValue " << time_per_frame[1]);
+}
@@ -1,23 +1,25 @@
 #define BOOST_TEST_MODULE "test_datasetManager"
 
 #include "Config.hpp"         // for Config
-#include "Hash.hpp"           // for operator<<
+#include "Hash.hpp"           // for operator<<, Hash, hash
 #include "dataset.hpp"        // for dataset
 #include "datasetManager.hpp" // for state_id_t, datasetManager, dset_id_t
-#include "datasetState.hpp"   // for inputState, prodState, freqState, datasetState
+#include "datasetState.hpp"   // for inputState, prodState, freqState, datasetState, stackS...
 #include "errors.h"           // for _global_log_level, __enable_syslog
 #include "test_utils.hpp"     // for CompareCTypes
-#include "visUtil.hpp"        // for input_ctype, prod_ctype, freq_ctype
+#include "visUtil.hpp"        // for input_ctype, prod_ctype, freq_ctype, rstack_ctype
 
 #include "json.hpp" // for basic_json<>::object_t, basic_json<>::value...
 
 #include <algorithm>                         // for max
 #include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_PP_IIF_0, BOOST_PP_BO...
+#include <chrono>                            // for steady_clock, duration, seconds
 #include <exception>                         // for exception
+#include <future>                            // for future_status, shared_future
 #include <iostream>                          // for endl, operator<<, ostream, basic_ostream, cout
 #include <map>                               // for map
 #include <memory>                            // for allocator, make_unique, unique_ptr
-#include <stdexcept>                         // for out_of_range
+#include <stdexcept>                         // for out_of_range, invalid_argument
 #include <stdint.h>                          // for uint32_t
 #include <string>                            // for string, operator<<, string_literals
 #include <utility>                           // for pair
@@ -250,3 +252,142 @@ BOOST_FIXTURE_TEST_CASE(_equal_states, CompareCTypes) {
     BOOST_CHECK_EQUAL(input_state.second->to_json().dump(),
                       std::make_unique<inputState>(inputs)->to_json().dump());
 }
+
+BOOST_AUTO_TEST_CASE(_state_cache) {
+    _global_log_level = 4;
+    json json_config;
+    json json_config_dm;
+    json_config_dm["use_dataset_broker"] = false;
+    json_config["dataset_manager"] = json_config_dm;
+    Config conf;
+    conf.update_config(json_config);
+    datasetManager& dm = datasetManager::instance(conf);
+
+    std::vector<input_ctype> inputs = {input_ctype(5, "5"), input_ctype(6, "6")};
+    std::vector<prod_ctype> prods = {{0, 1}};
+    auto input_state = dm.create_state<inputState>(inputs);
+    dset_id_t root_ds_id = dm.add_dataset(input_state.first);
+
+    // A miss followed by a hit must give the same state
+    const inputState* first = dm.dataset_state<inputState>(root_ds_id);
+    const inputState* second = dm.dataset_state<inputState>(root_ds_id);
+    BOOST_CHECK_EQUAL(first, input_state.second);
+    BOOST_CHECK_EQUAL(second, input_state.second);
+
+    // Unsuccessful lookups must not be cached, as a later dataset may add the state
+    BOOST_CHECK(dm.dataset_state<prodState>(root_ds_id) == nullptr);
+    auto prod_state = dm.create_state<prodState>(prods);
+    dset_id_t child_ds_id = dm.add_dataset(prod_state.first, root_ds_id);
+    BOOST_CHECK_EQUAL(dm.dataset_state<prodState>(child_ds_id), prod_state.second);
+    BOOST_CHECK_EQUAL(dm.dataset_state<prodState>(child_ds_id), prod_state.second);
+
+    // Cached entries are per dataset and type
+    BOOST_CHECK_EQUAL(dm.dataset_state<inputState>(child_ds_id), input_state.second);
+    BOOST_CHECK(dm.dataset_state<prodState>(root_ds_id) == nullptr);
+}
+
+datasetManager& dm_with_hash_mode(const std::string& mode) {
+    json json_config;
+    json json_config_dm;
+    json_config_dm["use_dataset_broker"] = false;
+    json_config_dm["hash_mode"] = mode;
+    json_config["dataset_manager"] = json_config_dm;
+    Config conf;
+    conf.update_config(json_config);
+    return datasetManager::instance(conf);
+}
+
+BOOST_AUTO_TEST_CASE(_hash_modes) {
+    _global_log_level = 4;
+
+    std::vector<input_ctype> inputs = {input_ctype(7, "7"), input_ctype(8, "8")};
+
+    // The compatibility mode must give the IDs derived from the JSON serialisation
+    datasetManager& dm = dm_with_hash_mode("json");
+    auto json_state = dm.add_state(std::make_unique<inputState>(inputs));
+    BOOST_CHECK_EQUAL(json_state.first, hash(json_state.second->to_json().dump()));
+    dset_id_t json_ds = dm.add_dataset(json_state.first);
+    BOOST_CHECK_EQUAL(json_ds, hash(dataset(json_state.first, "inputs").to_json().dump()));
+
+    // The binary IDs are different, but must not change between versions as
+    // they are stored in the data
+    dm_with_hash_mode("binary");
+    auto bin_state = dm.add_state(std::make_unique<inputState>(inputs));
+    BOOST_CHECK_NE(bin_state.first, json_state.first);
+    BOOST_CHECK_EQUAL(bin_state.first, Hash::from_string("b130e4bbd4b15ea9f47a733b2dfdbdf0"));
+    dset_id_t bin_ds = dm.add_dataset(bin_state.first);
+    BOOST_CHECK_EQUAL(bin_ds, Hash::from_string("7ddc56de44ee6ccaa29289b10274ba7e"));
+    BOOST_CHECK_EQUAL(dm.add_dataset(bin_state.first, bin_ds),
+                      Hash::from_string("5bb2c4d1bb415f540899afb3d676dbf5"));
+
+    // Any change to the state data must change the ID
+    inputs[1] = input_ctype(8, "9");
+    BOOST_CHECK_NE(dm.add_state(std::make_unique<inputState>(inputs)).first, bin_state.first);
+    inputs[1] = input_ctype(9, "8");
+    BOOST_CHECK_NE(dm.add_state(std::make_unique<inputState>(inputs)).first, bin_state.first);
+
+    BOOST_CHECK_THROW(dm_with_hash_mode("md5"), std::invalid_argument);
+    dm_with_hash_mode("binary");
+}
+
+// Benchmark registering large states with each hash mode
+BOOST_AUTO_TEST_CASE(_hash_speed) {
+    _global_log_level = 4;
+
+    const uint16_t num_elements = 512;
+    const int n_iter = 3;
+
+    std::vector<prod_ctype> prods;
+    for (uint16_t i = 0; i < num_elements; i++) {
+        for (uint16_t j = i; j < num_elements; j++)
+            prods.push_back({i, j});
+    }
+    std::vector<rstack_ctype> rstack(prods.size());
+    for (size_t i = 0; i < rstack.size(); i++)
+        rstack[i] = {(uint32_t)(i / 4), (i % 3) == 0};
+
+    for (std::string mode : {"json", "binary"}) {
+        datasetManager& dm = dm_with_hash_mode(mode);
+
+        double t_prod = 0, t_stack = 0;
+        for (int i = 0; i < n_iter; i++) {
+            // Make every state unique so they are actually added
+            prods[0].input_b = i + (mode == "json" ? 0 : n_iter);
+            auto prod_state = std::make_unique<prodState>(prods);
+            auto stack_state = std::make_unique<stackState>(prods.size() / 4 + i,
+                                                            std::vector<rstack_ctype>(rstack));
+
+            auto start = std::chrono::steady_clock::now();
+            dm.add_state(std::move(prod_state));
+            auto mid = std::chrono::steady_clock::now();
+            dm.add_state(std::move(stack_state));
+            auto end = std::chrono::steady_clock::now();
+
+            t_prod += std::chrono::duration<double>(mid - start).count();
+            t_stack += std::chrono::duration<double>(end - mid).count();
+        }
+        BOOST_TEST_MESSAGE(mode << " hash: prodState " << t_prod / n_iter * 1e3
+                                << " ms, stackState " << t_stack / n_iter * 1e3 << " ms ("
+                                << prods.size() << " products)");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(_fetch_state) {
+    _global_log_level = 4;
+    datasetManager& dm = dm_with_hash_mode("binary");
+
+    std::vector<input_ctype> inputs = {input_ctype(10, "10")};
+    auto input_state = dm.create_state<inputState>(inputs);
+
+    // Without a broker the futures are ready straight away
+    auto known = dm.fetch_state(input_state.first);
+    BOOST_CHECK(known.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    BOOST_CHECK_EQUAL(known.get(), input_state.second);
+
+    auto unknown = dm.fetch_state(Hash::from_string("0123456789abcdef0123456789abcdef"));
+    BOOST_CHECK(unknown.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    BOOST_CHECK(unknown.get() == nullptr);
+
+    // This has nothing to do without a broker
+    dm.prefetch(dm.add_dataset(input_state.first));
+}
@@ -1,18 +1,23 @@
 #define BOOST_TEST_MODULE "test_config"
 
-#include "Hash.hpp" // for Hash, hash
+#include "Hash.hpp" // for Hash, hash, HashBuilder
 
-#include "fmt.hpp"  // for format
-#include "json.hpp" // for json
+#include "fmt.hpp"      // for format
+#include "gsl-lite.hpp" // for span
+#include "json.hpp"     // for json
 
+#include <algorithm>                         // for min
 #include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_PP_IIF_0, BOOST_PP_BO...
-#include <stdint.h>                          // for uint64_t
+#include <stdint.h>                          // for uint64_t, uint32_t, uint8_t
 #include <stdlib.h>                          // for strtoull
-#include <string>                            // for string, allocator
+#include <string.h>                          // for memcpy
+#include <string>                            // for string, allocator, string_literals
 
 
 using json = nlohmann::json;
 
+using namespace std::string_literals;
+
 BOOST_AUTO_TEST_CASE(_test_serialise) {
 
     /* The hash was calculated in python using:
@@ -55,3 +60,40 @@ BOOST_AUTO_TEST_CASE(_test_hash) {
     BOOST_CHECK_EQUAL(h1.h, high);
     BOOST_CHECK_EQUAL(h1.l, low);
 }
+
+
+BOOST_AUTO_TEST_CASE(_test_hash_builder) {
+
+    std::string s;
+    for (int i = 0; i < 100; i++)
+        s += (char)(i * 7 + 3);
+
+    // Streaming any prefix in pieces of any size must match the one shot hash,
+    // this checks every combination of partial blocks and tails
+    for (size_t len = 0; len <= s.size(); len++) {
+        std::string sub = s.substr(0, len);
+        for (size_t piece = 1; piece <= 33; piece++) {
+            HashBuilder h;
+            for (size_t i = 0; i < len; i += piece)
+                h.add_bytes(sub.data() + i, std::min(piece, len - i));
+            BOOST_CHECK_EQUAL(h.finalize(), hash(sub));
+        }
+    }
+
+    // Strings are length prefixed so the split between them matters
+    HashBuilder h1, h2;
+    h1.add("ab"s);
+    h1.add("c"s);
+    h2.add("a"s);
+    h2.add("bc"s);
+    BOOST_CHECK_NE(h1.finalize(), h2.finalize());
+
+    // Values are added by their memory representation
+    HashBuilder h3;
+    h3.add<uint32_t>(1);
+    h3.add(2.5);
+    uint8_t bytes[12] = {1, 0, 0, 0};
+    double d = 2.5;
+    memcpy(bytes + 4, &d, 8);
+    BOOST_CHECK_EQUAL(h3.finalize(), hash(gsl::span<const uint8_t>(bytes, 12)));
+}
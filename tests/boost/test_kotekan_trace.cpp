@@ -0,0 +1,179 @@
+#define BOOST_TEST_MODULE "test_kotekan_trace"
+
+#include "buffer.h"         // for Buffer, create_buffer, register_consumer, register_producer
+#include "kotekanTrace.hpp" // for KotekanTrace, TraceSpan, kotekan_trace_set_thread_name
+
+#include "json.hpp" // for json
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK_EQUAL, BOOST_...
+#include <chrono>                            // for duration, high_resolution_clock, milliseconds
+#include <stdlib.h>                          // for free
+#include <string>                            // for string
+#include <thread>                            // for sleep_for, thread
+
+using kotekan::KotekanTrace;
+using kotekan::TraceSpan;
+using nlohmann::json;
+
+// The events with the given phase and name
+json find_events(const json& trace, const std::string& phase, const std::string& name) {
+    json events = json::array();
+    for (const auto& e : trace["traceEvents"]) {
+        if (e["ph"] == phase && e["name"] == name)
+            events.push_back(e);
+    }
+    return events;
+}
+
+// The tid of the thread shown with the given name, or -1
+int64_t find_thread(const json& trace, const std::string& name) {
+    for (const auto& e : find_events(trace, "M", "thread_name")) {
+        if (e["args"]["name"] == name)
+            return e["tid"];
+    }
+    return -1;
+}
+
+BOOST_AUTO_TEST_CASE(_spans) {
+    KotekanTrace& trace = KotekanTrace::instance();
+    trace.set_enabled(true);
+
+    {
+        TraceSpan span("outer", "test", "arg", "value", 3);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    std::thread worker([]() {
+        kotekan_trace_set_thread_name("worker");
+        for (int i = 0; i < 3; i++)
+            TraceSpan span("inner", "test");
+    });
+    worker.join();
+
+    json j = trace.get_json();
+    auto outer = find_events(j, "X", "outer");
+    BOOST_CHECK_EQUAL(outer.size(), 1);
+    BOOST_CHECK(outer[0]["dur"].get<double>() >= 2000);
+    BOOST_CHECK_EQUAL(outer[0]["cat"], "test");
+    BOOST_CHECK_EQUAL(outer[0]["args"]["arg"], "value");
+    BOOST_CHECK_EQUAL(outer[0]["args"]["frame_id"], 3);
+
+    // The events of a thread are kept after it exits
+    auto inner = find_events(j, "X", "inner");
+    BOOST_CHECK_EQUAL(inner.size(), 3);
+    BOOST_CHECK(find_thread(j, "worker") != -1);
+    for (const auto& e : inner) {
+        BOOST_CHECK_EQUAL(e["tid"], find_thread(j, "worker"));
+        BOOST_CHECK(!e["args"].contains("frame_id"));
+    }
+    BOOST_CHECK(outer[0]["tid"] != inner[0]["tid"]);
+
+    // Nothing is recorded while turned off
+    trace.set_enabled(false);
+    { TraceSpan span("off", "test"); }
+    BOOST_CHECK(find_events(trace.get_json(), "X", "off").empty());
+
+    // Turning it back on drops the old events
+    trace.set_enabled(true);
+    { TraceSpan span("on", "test"); }
+    j = trace.get_json();
+    BOOST_CHECK(find_events(j, "X", "outer").empty());
+    BOOST_CHECK_EQUAL(find_events(j, "X", "on").size(), 1);
+    trace.set_enabled(false);
+}
+
+BOOST_AUTO_TEST_CASE(_ring_wrap) {
+    KotekanTrace& trace = KotekanTrace::instance();
+    trace.set_buffer_size(5);
+    trace.set_enabled(true);
+
+    // Only the newest events are kept, in a ring rounded up to 8 events
+    std::thread worker([]() {
+        kotekan_trace_set_thread_name("wrap");
+        for (int i = 0; i < 20; i++)
+            kotekan_trace_record(TRACE_PHASE_INSTANT, "event", "test", nullptr, nullptr, 0, i,
+                                 kotekan_trace_time(), 0);
+    });
+    worker.join();
+
+    auto events = find_events(trace.get_json(), "i", "event");
+    BOOST_CHECK_EQUAL(events.size(), 8);
+    for (size_t i = 0; i < events.size(); i++)
+        BOOST_CHECK_EQUAL(events[i]["args"]["frame_id"], 12 + i);
+
+    trace.set_enabled(false);
+    trace.set_buffer_size(16384);
+}
+
+BOOST_AUTO_TEST_CASE(_buffer_events) {
+    struct Buffer* buf = create_buffer(2, 64, nullptr, "trace_buf", "standard", 0, false, false,
+                                       true, false, 0);
+    register_producer(buf, "producer");
+    register_consumer(buf, "consumer");
+
+    KotekanTrace& trace = KotekanTrace::instance();
+    trace.set_enabled(true);
+
+    // The consumer has to wait for each frame
+    const int num_frames = 4;
+    std::thread producer([&]() {
+        kotekan_trace_set_thread_name("producer");
+        for (int i = 0; i < num_frames; i++) {
+            wait_for_empty_frame(buf, "producer", i % 2);
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            mark_frame_full(buf, "producer", i % 2);
+        }
+    });
+    kotekan_trace_set_thread_name("consumer");
+    for (int i = 0; i < num_frames; i++) {
+        wait_for_full_frame(buf, "consumer", i % 2);
+        mark_frame_empty(buf, "consumer", i % 2);
+    }
+    producer.join();
+
+    json j = trace.get_json();
+    trace.set_enabled(false);
+
+    auto waits = find_events(j, "X", "wait_for_full_frame");
+    BOOST_CHECK_EQUAL(waits.size(), num_frames);
+    for (const auto& e : waits) {
+        BOOST_CHECK_EQUAL(e["args"]["buffer"], "trace_buf");
+        BOOST_CHECK(e["dur"].get<double>() > 500);
+        BOOST_CHECK_EQUAL(e["tid"], find_thread(j, "consumer"));
+    }
+    BOOST_CHECK_EQUAL(find_events(j, "i", "frame_full").size(), num_frames);
+
+    // Each frame a stage holds is an async span, matched up by its id
+    for (std::string stage : {"producer", "consumer"}) {
+        auto begin = find_events(j, "b", stage);
+        auto end = find_events(j, "e", stage);
+        BOOST_CHECK_EQUAL(begin.size(), num_frames);
+        BOOST_CHECK_EQUAL(end.size(), num_frames);
+        for (size_t i = 0; i < begin.size() && i < end.size(); i++) {
+            BOOST_CHECK_EQUAL(begin[i]["id"], end[i]["id"]);
+            BOOST_CHECK_EQUAL(begin[i]["args"]["frame_id"], i % 2);
+            BOOST_CHECK(end[i]["ts"].get<double>() >= begin[i]["ts"].get<double>());
+        }
+    }
+
+    delete_buffer(buf);
+    free(buf);
+}
+
+// The cost of a span, turned off and on
+BOOST_AUTO_TEST_CASE(_overhead) {
+    const int num_spans = 1000000;
+    KotekanTrace& trace = KotekanTrace::instance();
+    double time_per_span[2];
+    for (bool enabled : {false, true}) {
+        trace.set_enabled(enabled);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < num_spans; i++)
+            TraceSpan span("span", "test", nullptr, nullptr, i);
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        time_per_span[enabled] = elapsed.count() / num_spans * 1e9;
+    }
+    trace.set_enabled(false);
+    BOOST_TEST_MESSAGE("ns per span: turned off " << time_per_span[0] << ", turned on "
+                                                  << time_per_span[1]);
+}
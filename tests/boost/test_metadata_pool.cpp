@@ -0,0 +1,169 @@
+#define BOOST_TEST_MODULE "test_metadata_pool"
+
+#include "buffer.h"   // for Buffer, allocate_new_metadata_object, create_buffer, get_metadata
+#include "metadata.h" // for metadataPool, metadataContainer, create_metadata_pool, request_...
+
+#include <atomic>                            // for atomic
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK_EQUAL, BOOST_...
+#include <chrono>                            // for duration, high_resolution_clock
+#include <set>                               // for set
+#include <stdint.h>                          // for uint64_t
+#include <stdlib.h>                          // for free
+#include <string>                            // for string, to_string
+#include <thread>                            // for thread
+#include <vector>                            // for vector
+
+// The metadata used in the tests, the owner and sequence number of the frame it is attached to
+struct testMetadata {
+    uint64_t tag;
+};
+
+// Every container in the pool is free and zeroed, and can be handed out once
+void check_all_free(struct metadataPool* pool) {
+    for (unsigned int i = 0; i < pool->pool_size; i++)
+        BOOST_CHECK_EQUAL(pool->in_use[i], 0);
+
+    std::set<struct metadataContainer*> containers;
+    for (unsigned int i = 0; i < pool->pool_size; i++) {
+        struct metadataContainer* mc = request_metadata_object(pool);
+        BOOST_CHECK_EQUAL(mc->ref_count, 1);
+        BOOST_CHECK_EQUAL(((testMetadata*)mc->metadata)->tag, 0);
+        containers.insert(mc);
+    }
+    BOOST_CHECK_EQUAL(containers.size(), pool->pool_size);
+    for (auto mc : containers)
+        decrement_metadata_ref_count(mc);
+}
+
+BOOST_AUTO_TEST_CASE(_request_return) {
+    struct metadataPool* pool = create_metadata_pool(3, sizeof(testMetadata), "pool", "test");
+
+    struct metadataContainer* a = request_metadata_object(pool);
+    struct metadataContainer* b = request_metadata_object(pool);
+    BOOST_CHECK(a != b);
+    ((testMetadata*)a->metadata)->tag = 42;
+
+    // Only returned once every reference is gone, and then zeroed
+    increment_metadata_ref_count(a);
+    BOOST_CHECK_EQUAL(a->ref_count, 2);
+    decrement_metadata_ref_count(a);
+    BOOST_CHECK_EQUAL(a->ref_count, 1);
+    BOOST_CHECK_EQUAL(((testMetadata*)a->metadata)->tag, 42);
+    decrement_metadata_ref_count(a);
+    BOOST_CHECK_EQUAL(((testMetadata*)a->metadata)->tag, 0);
+
+    // The most recently returned container is reused first, while it is still in cache
+    BOOST_CHECK(request_metadata_object(pool) == a);
+    decrement_metadata_ref_count(a);
+    decrement_metadata_ref_count(b);
+
+    check_all_free(pool);
+    delete_metadata_pool(pool);
+    free(pool);
+}
+
+// Several producers fill buffers sharing one pool, each read by several consumers, so
+// containers are requested and returned from many threads at once.
+BOOST_AUTO_TEST_CASE(_stress) {
+    const int num_producers = 4;
+    const int num_consumers = 3;
+    const int num_frames = 4;
+    const int frames_per_producer = 20000;
+
+    for (bool lock_free : {false, true}) {
+        // Exactly enough containers for every frame to hold one
+        struct metadataPool* pool = create_metadata_pool(
+            num_producers * num_frames, sizeof(testMetadata), "stress_pool", "test");
+
+        std::vector<struct Buffer*> bufs;
+        for (int p = 0; p < num_producers; p++) {
+            std::string name = "stress_buf_" + std::to_string(p);
+            struct Buffer* buf = create_buffer(num_frames, 64, pool, name.c_str(), "standard", 0,
+                                               false, false, true, lock_free, 0);
+            register_producer(buf, "producer");
+            for (int c = 0; c < num_consumers; c++)
+                register_consumer(buf, ("consumer_" + std::to_string(c)).c_str());
+            bufs.push_back(buf);
+        }
+
+        std::atomic<int> bad_tags(0);
+        std::vector<std::thread> threads;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int p = 0; p < num_producers; p++) {
+            struct Buffer* buf = bufs[p];
+            threads.emplace_back([=, &bad_tags]() {
+                for (int n = 0; n < frames_per_producer; n++) {
+                    int id = n % num_frames;
+                    wait_for_empty_frame(buf, "producer", id);
+                    allocate_new_metadata_object(buf, id);
+                    testMetadata* metadata = (testMetadata*)get_metadata(buf, id);
+                    // A container handed out twice would have been tagged by someone else
+                    if (metadata->tag != 0)
+                        bad_tags++;
+                    metadata->tag = ((uint64_t)p << 32) | (n + 1);
+                    mark_frame_full(buf, "producer", id);
+                }
+            });
+            for (int c = 0; c < num_consumers; c++) {
+                threads.emplace_back([=, &bad_tags]() {
+                    std::string name = "consumer_" + std::to_string(c);
+                    for (int n = 0; n < frames_per_producer; n++) {
+                        int id = n % num_frames;
+                        wait_for_full_frame(buf, name.c_str(), id);
+                        testMetadata* metadata = (testMetadata*)get_metadata(buf, id);
+                        if (metadata->tag != (((uint64_t)p << 32) | (n + 1)))
+                            bad_tags++;
+                        mark_frame_empty(buf, name.c_str(), id);
+                    }
+                });
+            }
+        }
+        for (auto& t : threads)
+            t.join();
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        BOOST_CHECK_EQUAL(bad_tags, 0);
+        for (auto buf : bufs) {
+            delete_buffer(buf);
+            free(buf);
+        }
+        check_all_free(pool);
+        delete_metadata_pool(pool);
+        free(pool);
+
+        BOOST_TEST_MESSAGE((lock_free ? "lock free" : "locking")
+                           << " buffers: "
+                           << elapsed.count() / (num_producers * frames_per_producer) * 1e9
+                           << " ns per frame");
+    }
+}
+
+// The cost of requesting and returning a container, from one and from several threads
+BOOST_AUTO_TEST_CASE(_cost) {
+    const int num_requests = 1000000;
+    struct metadataPool* pool = create_metadata_pool(4096, sizeof(testMetadata), "pool", "test");
+
+    for (int num_threads : {1, 4}) {
+        std::vector<std::thread> threads;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int t = 0; t < num_threads; t++) {
+            threads.emplace_back([=]() {
+                for (int n = 0; n < num_requests / num_threads; n++) {
+                    struct metadataContainer* mc = request_metadata_object(pool);
+                    increment_metadata_ref_count(mc);
+                    decrement_metadata_ref_count(mc);
+                    decrement_metadata_ref_count(mc);
+                }
+            });
+        }
+        for (auto& t : threads)
+            t.join();
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        BOOST_TEST_MESSAGE(num_threads << " threads: " << elapsed.count() / num_requests * 1e9
+                                       << " ns per request and return");
+    }
+
+    check_all_free(pool);
+    delete_metadata_pool(pool);
+    free(pool);
+}
@@ -3,10 +3,20 @@
 #include "prometheusMetrics.hpp" // for Metrics, MetricFamily, Counter, Gauge
 
 #include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK, BOOST_PP_BOOL_2
+#include <chrono>                            // for duration, high_resolution_clock, time_point
 #include <cmath>                             // for sqrt, log
 #include <iostream>                          // for cout, ostream
+#include <mutex>                             // for mutex, lock_guard
+#include <limits>                            // for numeric_limits
+#include <stddef.h>                          // for size_t
+#include <stdexcept>                         // for invalid_argument
+#include <stdint.h>                          // for uint64_t
 #include <string>                            // for string, allocator, basic_string, operator==
+#include <thread>                            // for thread
+#include <vector>                            // for vector
 
+using kotekan::prometheus::Counter;
+using kotekan::prometheus::Histogram;
 using kotekan::prometheus::Metrics;
 
 
@@ -150,3 +160,185 @@ BOOST_AUTO_TEST_CASE(gauges_with_labels) {
     BOOST_CHECK(multi_metrics.find("bar_with_labels{stage_name=\"foo\",quux=\"baz\"} 42.0")
                 != std::string::npos);
 }
+
+
+BOOST_AUTO_TEST_CASE(concurrent_updates) {
+    Metrics& metrics = Metrics::instance();
+
+    auto& total = metrics.add_counter("concurrent_total", "concurrent");
+    auto& family = metrics.add_counter("concurrent_freq_total", "concurrent", {"freq_id"});
+    auto& gauge = metrics.add_gauge("concurrent_gauge", "concurrent");
+
+    // More threads than shards, all updating the same metrics, and adding new
+    // label values while the others are incrementing
+    const size_t num_threads = 2 * Counter::num_shards + 1;
+    const uint64_t num_inc = 20000;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            auto& mine = family.labels({std::to_string(t)});
+            for (uint64_t i = 0; i < num_inc; i++) {
+                total.inc();
+                mine.inc(2);
+                family.labels({"shared"}).inc();
+                gauge.set(t);
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    BOOST_CHECK_EQUAL(total.value(), num_threads * num_inc);
+    BOOST_CHECK_EQUAL(family.labels({"shared"}).value(), num_threads * num_inc);
+    for (size_t t = 0; t < num_threads; t++)
+        BOOST_CHECK_EQUAL(family.labels({std::to_string(t)}).value(), 2 * num_inc);
+    BOOST_CHECK(gauge.value() >= 0 && gauge.value() < num_threads);
+
+    auto out = metrics.serialize();
+    BOOST_CHECK(out.find("concurrent_total{stage_name=\"concurrent\"} "
+                         + std::to_string(num_threads * num_inc) + "\n")
+                != std::string::npos);
+    BOOST_CHECK(out.find("concurrent_freq_total{stage_name=\"concurrent\",freq_id=\"shared\"} "
+                         + std::to_string(num_threads * num_inc) + "\n")
+                != std::string::npos);
+
+    metrics.remove_stage_metrics("concurrent");
+}
+
+
+BOOST_AUTO_TEST_CASE(histograms) {
+    Metrics& metrics = Metrics::instance();
+
+    auto& h = metrics.add_histogram("foo_duration_seconds", "hist", {0.1, 0.5, 1});
+    h.observe(0.05);
+    h.observe(0.1); // the bounds are inclusive
+    h.observe(0.7);
+    h.observe(3);
+    h.observe(std::numeric_limits<double>::quiet_NaN()); // counted in +Inf, but NaN sum
+
+    BOOST_CHECK_EQUAL(h.count(), 5);
+    BOOST_CHECK(h.bucket_counts() == std::vector<uint64_t>({2, 2, 3, 5}));
+
+    auto out = metrics.serialize();
+    BOOST_CHECK(out.find("# HELP foo_duration_seconds\n# TYPE foo_duration_seconds histogram\n"
+                         "foo_duration_seconds_bucket{stage_name=\"hist\",le=\"0.1\"} 2\n"
+                         "foo_duration_seconds_bucket{stage_name=\"hist\",le=\"0.5\"} 2\n"
+                         "foo_duration_seconds_bucket{stage_name=\"hist\",le=\"1\"} 3\n"
+                         "foo_duration_seconds_bucket{stage_name=\"hist\",le=\"+Inf\"} 5\n"
+                         "foo_duration_seconds_sum{stage_name=\"hist\"} NaN\n"
+                         "foo_duration_seconds_count{stage_name=\"hist\"} 5\n")
+                != std::string::npos);
+
+    // With labels, each combination gets the family's buckets
+    auto& f = metrics.add_histogram("bar_duration_seconds", "hist", {"freq_id"}, {1, 2});
+    f.labels({"3"}).observe(1.5);
+    f.labels({"3"}).observe(0.25);
+    f.labels({"7"}).observe(10);
+    BOOST_CHECK_EQUAL(f.labels({"3"}).sum(), 1.75);
+    out = metrics.serialize();
+    BOOST_CHECK(
+        out.find("bar_duration_seconds_bucket{stage_name=\"hist\",freq_id=\"3\",le=\"2\"} 2\n")
+        != std::string::npos);
+    BOOST_CHECK(out.find("bar_duration_seconds_sum{stage_name=\"hist\",freq_id=\"3\"} 1.75\n")
+                != std::string::npos);
+    BOOST_CHECK(out.find("bar_duration_seconds_bucket{stage_name=\"hist\",freq_id=\"7\","
+                         "le=\"+Inf\"} 1\n")
+                != std::string::npos);
+
+    // Default time buckets come out as round numbers
+    out = metrics.add_histogram("baz_duration_seconds", "hist").to_string();
+    BOOST_CHECK_EQUAL(out, "0");
+    out = metrics.serialize();
+    BOOST_CHECK(out.find("le=\"0.0002\"") != std::string::npos);
+    BOOST_CHECK(out.find("le=\"0.005\"") != std::string::npos);
+    BOOST_CHECK(out.find("le=\"50\"") != std::string::npos);
+
+    BOOST_CHECK(Histogram::linear_buckets(1, 0.5, 3) == std::vector<double>({1, 1.5, 2}));
+    BOOST_CHECK(Histogram::exponential_buckets(1, 2, 4) == std::vector<double>({1, 2, 4, 8}));
+    BOOST_CHECK(Histogram::log_linear_buckets(1, 2, 3)
+                == std::vector<double>({1, 4, 7, 10, 40, 70, 100}));
+    BOOST_CHECK_THROW(Histogram({}, {1, 1}), std::invalid_argument);
+
+    metrics.remove_stage_metrics("hist");
+}
+
+
+// A counter the way they used to be, with a lock around the value
+struct lockedCounter {
+    void inc() {
+        std::lock_guard<std::mutex> lock(m);
+        value++;
+    }
+    std::mutex m;
+    uint64_t value = 0;
+};
+
+// Time `num_threads` threads each calling `f` `n` times, in ns per call
+template<typename F>
+double time_per_call(size_t num_threads, uint64_t n, F&& f) {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&]() {
+            for (uint64_t i = 0; i < n; i++)
+                f(i);
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    return elapsed.count() / (num_threads * n) * 1e9;
+}
+
+// How much updating a metric costs on the hot path
+BOOST_AUTO_TEST_CASE(update_speed) {
+    Metrics& metrics = Metrics::instance();
+
+    auto& counter = metrics.add_counter("speed_total", "speed");
+    auto& gauge = metrics.add_gauge("speed_gauge", "speed");
+    auto& hist = metrics.add_histogram("speed_duration_seconds", "speed");
+
+    // A family with a label for each CHIME frequency, like the per frequency
+    // counters in the stages
+    auto& family = metrics.add_counter("speed_freq_total", "speed", {"freq_id", "kind"});
+    std::vector<std::string> freqs;
+    for (size_t f = 0; f < 1024; f++) {
+        freqs.push_back(std::to_string(f));
+        family.labels({freqs.back(), "age"});
+    }
+    std::vector<Counter*> handles;
+    for (auto& f : freqs)
+        handles.push_back(&family.labels({f, "age"}));
+
+    const uint64_t n = 1000000;
+    for (size_t num_threads : {1, 4}) {
+        lockedCounter locked;
+        double t_locked = time_per_call(num_threads, n, [&](uint64_t) { locked.inc(); });
+        double t_inc = time_per_call(num_threads, n, [&](uint64_t) { counter.inc(); });
+        double t_set = time_per_call(num_threads, n, [&](uint64_t i) { gauge.set(i); });
+        double t_observe =
+            time_per_call(num_threads, n, [&](uint64_t i) { hist.observe((i % 1000) * 1e-3); });
+        double t_labels = time_per_call(num_threads, n / 10, [&](uint64_t i) {
+            family.labels({freqs[i % 1024], "age"}).inc();
+        });
+        double t_handle =
+            time_per_call(num_threads, n, [&](uint64_t i) { handles[i % 1024]->inc(); });
+
+        BOOST_TEST_MESSAGE(num_threads
+                           << " threads (ns per update): locked counter " << t_locked
+                           << ", Counter::inc " << t_inc << ", Gauge::set " << t_set
+                           << ", Histogram::observe " << t_observe
+                           << ", labels().inc " << t_labels << ", cached handle inc " << t_handle);
+    }
+
+    BOOST_CHECK_EQUAL(counter.value(), 5 * n);
+    BOOST_CHECK_EQUAL(hist.count(), 5 * n);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    auto out = metrics.serialize();
+    std::chrono::duration<double> t_scrape = std::chrono::high_resolution_clock::now() - start;
+    BOOST_TEST_MESSAGE("serialize with " << freqs.size() + 2 << " metrics: "
+                                         << t_scrape.count() * 1e3 << " ms");
+
+    metrics.remove_stage_metrics("speed");
+}
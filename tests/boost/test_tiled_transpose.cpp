@@ -0,0 +1,120 @@
+#define BOOST_TEST_MODULE "test_tiled_transpose"
+
+#include "tiledTranspose.hpp" // for tiledTranspose
+#include "visUtil.hpp"        // for cfloat
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK_EQUAL_COLLECTIONS
+#include <chrono>                            // for duration, high_resolution_clock, time_point
+#include <cstdint>                           // for uint32_t
+#include <random>                            // for mt19937, uniform_real_distribution
+#include <stddef.h>                          // for size_t
+#include <vector>                            // for vector
+
+// The strided_copy loop VisTranspose used, writing a single frame into the chunk
+template<typename T>
+void strided_copy(const T* in, T* out, size_t offset, size_t stride, size_t n_val) {
+    for (size_t i = 0; i < n_val; i++) {
+        out[offset + i * stride] = in[i];
+    }
+}
+
+template<typename T>
+std::vector<T> random_frames(size_t n, int seed) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dis(0.0f, 100.0f);
+    std::vector<T> frames(n);
+    for (auto& v : frames)
+        v = T(dis(gen));
+    return frames;
+}
+
+// Fill a chunk with frames in the order the transpose stages receive them,
+// frequency fastest, with one time sample per frame
+template<typename T, typename F>
+void fill_chunk(const std::vector<T>& frames, size_t n_val, size_t n_f, size_t n_t,
+                size_t t_first, F&& add) {
+    for (size_t t = t_first; t < n_t; t++) {
+        for (size_t f = 0; f < n_f; f++) {
+            add(&frames[((t * n_f + f) * n_val) % (frames.size() - n_val + 1)], f, t);
+        }
+    }
+}
+
+template<typename T>
+void check_transpose(size_t n_val, size_t n_f, size_t n_t, size_t t_first = 0) {
+    auto frames = random_frames<T>(n_f * n_t * n_val, 1);
+
+    std::vector<T> ref(n_f * n_t * n_val, T(-1));
+    fill_chunk(frames, n_val, n_f, n_t, t_first, [&](const T* in, size_t f, size_t t) {
+        strided_copy(in, ref.data(), f * n_val * n_t + t, n_t, n_val);
+    });
+
+    std::vector<T> out(n_f * n_t * n_val, T(-1));
+    tiledTranspose<T> tiles(n_val, n_f);
+    fill_chunk(frames, n_val, n_f, n_t, t_first,
+               [&](const T* in, size_t f, size_t t) { tiles.add(in, out.data(), f, t, n_t); });
+
+    BOOST_CHECK_EQUAL_COLLECTIONS(out.begin(), out.end(), ref.begin(), ref.end());
+
+    // Reusing the tiles for a second, shorter chunk (like at the edge of the data)
+    std::fill(ref.begin(), ref.end(), T(-1));
+    std::fill(out.begin(), out.end(), T(-1));
+    fill_chunk(frames, n_val, n_f, n_t / 2, 0, [&](const T* in, size_t f, size_t t) {
+        strided_copy(in, ref.data(), f * n_val * (n_t / 2) + t, n_t / 2, n_val);
+        tiles.add(in, out.data(), f, t, n_t / 2);
+    });
+    BOOST_CHECK_EQUAL_COLLECTIONS(out.begin(), out.end(), ref.begin(), ref.end());
+}
+
+BOOST_AUTO_TEST_CASE(_tiled_transpose) {
+    // Time lengths that are and aren't multiples of the tile
+    check_transpose<float>(100, 3, 64);
+    check_transpose<float>(131, 5, 37);
+    check_transpose<cfloat>(131, 5, 37);
+    check_transpose<uint32_t>(7, 2, 3);
+
+    // Missing frames at the start of the chunk (skipped empty frames) must
+    // leave the chunk untouched
+    check_transpose<cfloat>(131, 4, 50, 11);
+}
+
+// Benchmark against strided_copy for chunk sizes like the archive uses
+BOOST_AUTO_TEST_CASE(_tiled_transpose_speed) {
+    // Products in a frame (the CHIME cylinder stacking gives ~17k) and
+    // (freq, time) sizes of the chunk
+    const size_t n_val = 16384;
+    const std::vector<std::pair<size_t, size_t>> chunks = {{16, 64}, {16, 256}, {64, 64}};
+
+    for (auto [n_f, n_t] : chunks) {
+        auto frames = random_frames<cfloat>(4 * n_val, 2);
+        std::vector<cfloat> out(n_f * n_t * n_val);
+        // Touch the chunk once so both versions start from the same state
+        std::fill(out.begin(), out.end(), cfloat(0));
+
+        auto time_it = [&](auto&& f) {
+            auto start = std::chrono::high_resolution_clock::now();
+            f();
+            std::chrono::duration<double> t = std::chrono::high_resolution_clock::now() - start;
+            return t.count();
+        };
+
+        double t_ref = time_it([&]() {
+            fill_chunk(frames, n_val, n_f, n_t, 0, [&](const cfloat* in, size_t f, size_t t) {
+                strided_copy(in, out.data(), f * n_val * n_t + t, n_t, n_val);
+            });
+        });
+
+        tiledTranspose<cfloat> tiles(n_val, n_f);
+        double t_tiled = time_it([&]() {
+            fill_chunk(frames, n_val, n_f, n_t, 0, [&](const cfloat* in, size_t f, size_t t) {
+                tiles.add(in, out.data(), f, t, n_t);
+            });
+        });
+
+        double frames_per_chunk = n_f * n_t;
+        BOOST_TEST_MESSAGE("chunk (" << n_f << ", " << n_val << ", " << n_t << "): strided_copy "
+                                     << t_ref / frames_per_chunk * 1e6 << " us/frame, tiled "
+                                     << t_tiled / frames_per_chunk * 1e6 << " us/frame ("
+                                     << t_ref / t_tiled << "x)");
+    }
+}
@@ -1,10 +1,19 @@
 #define BOOST_TEST_MODULE "test_truncate"
 
-#include "truncate.hpp" // for fast_pow, bit_truncate_float, count_zeros
+#include "simdDispatch.hpp"   // for simdLevel, simd_level, simd_level_name
+#include "truncate.hpp"       // for fast_pow, bit_truncate_float, count_zeros
+#include "truncateKernel.hpp" // for truncate_array, truncate_weighted, truncate_array_relative
 
 #include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_PP_IIF_0, BOOST_PP_BO...
+#include <chrono>                            // for duration, high_resolution_clock, time_point
+#include <cmath>                             // for abs, sqrt
+#include <complex>                           // for complex
+#include <cstring>                           // for memcpy
 #include <limits>                            // for numeric_limits
+#include <random>                            // for mt19937, uniform_int_distribution, unifor...
+#include <stddef.h>                          // for size_t
 #include <stdint.h>                          // for INT8_MAX, INT32_MAX, INT32_MIN, INT8_MIN
+#include <vector>                            // for vector
 
 
 BOOST_AUTO_TEST_CASE(_fast_pow) {
@@ -56,3 +65,206 @@ BOOST_AUTO_TEST_CASE(_bit_truncate_float) {
     BOOST_CHECK_EQUAL(bit_truncate_float(std::numeric_limits<float>::min(), 0.01),
                       std::numeric_limits<float>::min());
 }
+
+// Levels available on this machine
+std::vector<simdLevel> levels() {
+    std::vector<simdLevel> l;
+    for (auto level : {simdLevel::scalar, simdLevel::avx2, simdLevel::avx512}) {
+        if (level <= simd_level())
+            l.push_back(level);
+    }
+    return l;
+}
+
+// Count the values that aren't bit for bit identical
+size_t count_mismatches(const float* a, const float* b, size_t n) {
+    size_t bad = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t x, y;
+        std::memcpy(&x, &a[i], sizeof(x));
+        std::memcpy(&y, &b[i], sizeof(y));
+        bad += (x != y);
+    }
+    return bad;
+}
+
+// Values with random bit patterns, so every sign and exponent comes up
+// including denormals, inf and NaN, mixed with ordinary values
+std::vector<float> random_values(size_t n, std::mt19937& gen) {
+    std::uniform_int_distribution<uint32_t> bits;
+    std::uniform_real_distribution<float> dis(-100.0f, 100.0f);
+    std::vector<float> v(n);
+    for (size_t i = 0; i < n; i++) {
+        if (i % 2) {
+            uint32_t b = bits(gen);
+            std::memcpy(&v[i], &b, sizeof(b));
+        } else {
+            v[i] = dis(gen);
+        }
+    }
+    return v;
+}
+
+// Errors spanning far more than the range the truncation can represent, and
+// including zero, negative and non finite errors
+std::vector<float> random_errors(const std::vector<float>& val, std::mt19937& gen) {
+    std::uniform_real_distribution<float> exponent(-40.0f, 40.0f);
+    std::uniform_int_distribution<int> kind(0, 9);
+    std::vector<float> err(val.size());
+    for (size_t i = 0; i < val.size(); i++) {
+        switch (kind(gen)) {
+            case 0:
+                err[i] = 0.0f;
+                break;
+            case 1:
+                err[i] = -std::abs(val[i]);
+                break;
+            case 2:
+                err[i] = std::numeric_limits<float>::infinity();
+                break;
+            case 3:
+                err[i] = std::numeric_limits<float>::quiet_NaN();
+                break;
+            case 4:
+            case 5:
+                err[i] = std::abs(val[i]) * std::pow(2.0f, exponent(gen) / 4);
+                break;
+            default:
+                err[i] = std::pow(2.0f, exponent(gen));
+        }
+    }
+    return err;
+}
+
+BOOST_AUTO_TEST_CASE(_truncate_array) {
+    std::mt19937 gen(1);
+
+    // Lengths that do and don't fill the vectors
+    for (size_t n : {1, 7, 15, 16, 33, 1000, 100003}) {
+        auto val = random_values(n, gen);
+        auto err = random_errors(val, gen);
+
+        std::vector<float> ref(n);
+        for (size_t i = 0; i < n; i++)
+            ref[i] = bit_truncate_float(val[i], err[i]);
+
+        std::vector<float> ref_rel(n);
+        for (size_t i = 0; i < n; i++)
+            ref_rel[i] = bit_truncate_float(val[i], std::abs(0.01f * val[i]));
+
+        // Complex values have one error for both parts
+        std::vector<float> ref_cplx(val);
+        for (size_t i = 0; i < n / 2; i++) {
+            ref_cplx[2 * i] = bit_truncate_float(val[2 * i], err[i]);
+            ref_cplx[2 * i + 1] = bit_truncate_float(val[2 * i + 1], err[i]);
+        }
+
+        for (auto level : levels()) {
+            BOOST_TEST_CHECKPOINT(simd_level_name(level) << ", n = " << n);
+
+            std::vector<float> out(val);
+            truncate_array(out.data(), err.data(), n, level);
+            BOOST_CHECK_EQUAL(count_mismatches(out.data(), ref.data(), n), 0);
+
+            out = val;
+            truncate_array_relative(out.data(), 0.01f, n, level);
+            BOOST_CHECK_EQUAL(count_mismatches(out.data(), ref_rel.data(), n), 0);
+
+            out = val;
+            truncate_array((std::complex<float>*)out.data(), err.data(), n / 2, level);
+            BOOST_CHECK_EQUAL(count_mismatches(out.data(), ref_cplx.data(), n), 0);
+        }
+    }
+}
+
+// The loop the truncation stages ran per element
+void weighted_reference(float* val, float* weight, size_t n, size_t n_per_weight,
+                        float err_sq_lim, float prec, float weight_prec) {
+    const float err_init = 0.5 * err_sq_lim;
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < n_per_weight; j++) {
+            float& x = val[i * n_per_weight + j];
+            float err = (weight[i] == 0.) ? prec * std::abs(x) : std::sqrt(err_init / weight[i]);
+            x = bit_truncate_float(x, err);
+        }
+        weight[i] = bit_truncate_float(weight[i], weight_prec * weight[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(_truncate_weighted) {
+    std::mt19937 gen(2);
+    std::uniform_real_distribution<float> dis(0.0f, 1e4f);
+
+    for (size_t n : {1, 7, 15, 16, 33, 1000, 100003}) {
+        auto val = random_values(2 * n, gen);
+        std::vector<float> weight(n);
+        bool any_zero = false;
+        for (size_t i = 0; i < n; i++) {
+            weight[i] = (i % 13 == 5) ? 0.0f : dis(gen);
+            any_zero |= (weight[i] == 0.0f);
+        }
+
+        std::vector<float> ref(val), ref_w(weight);
+        weighted_reference(ref.data(), ref_w.data(), n, 1, 1e-3, 1e-4, 1e-3);
+        std::vector<float> ref_cplx(val), ref_cplx_w(weight);
+        weighted_reference(ref_cplx.data(), ref_cplx_w.data(), n, 2, 1e-3, 1e-4, 1e-3);
+
+        for (auto level : levels()) {
+            BOOST_TEST_CHECKPOINT(simd_level_name(level) << ", n = " << n);
+
+            std::vector<float> out(val), out_w(weight);
+            bool zero = truncate_weighted(out.data(), out_w.data(), n, 1e-3, 1e-4, 1e-3, level);
+            BOOST_CHECK_EQUAL(zero, any_zero);
+            BOOST_CHECK_EQUAL(count_mismatches(out.data(), ref.data(), n), 0);
+            BOOST_CHECK_EQUAL(count_mismatches(out_w.data(), ref_w.data(), n), 0);
+
+            out = val;
+            out_w = weight;
+            zero = truncate_weighted((std::complex<float>*)out.data(), out_w.data(), n, 1e-3,
+                                     1e-4, 1e-3, level);
+            BOOST_CHECK_EQUAL(zero, any_zero);
+            BOOST_CHECK_EQUAL(count_mismatches(out.data(), ref_cplx.data(), 2 * n), 0);
+            BOOST_CHECK_EQUAL(count_mismatches(out_w.data(), ref_cplx_w.data(), n), 0);
+        }
+    }
+}
+
+// Throughput on a frame of visibilities the size of a stacked CHIME frame
+BOOST_AUTO_TEST_CASE(_truncate_speed) {
+    const size_t num_prod = 17000;
+    const int reps = 200;
+
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<float> dis(-100.0f, 100.0f), wdis(1.0f, 1e4f);
+    std::vector<float> vis(2 * num_prod), weight(num_prod);
+    for (auto& v : vis)
+        v = dis(gen);
+    for (auto& w : weight)
+        w = wdis(gen);
+
+    auto time_it = [&](auto&& f) {
+        std::vector<float> v(vis), w(weight);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int r = 0; r < reps; r++) {
+            // Truncating is idempotent, so repeats do the same work
+            f(v.data(), w.data());
+        }
+        std::chrono::duration<double> t = std::chrono::high_resolution_clock::now() - start;
+        return t.count() / reps;
+    };
+
+    double t_ref = time_it([&](float* v, float* w) {
+        weighted_reference(v, w, num_prod, 2, 1e-3, 1e-4, 1e-3);
+    });
+    BOOST_TEST_MESSAGE("per element: " << t_ref * 1e6 << " us/frame, "
+                                       << 3 * num_prod / t_ref / 1e6 << " Mvalues/s");
+
+    for (auto level : levels()) {
+        double t = time_it([&](float* v, float* w) {
+            truncate_weighted((std::complex<float>*)v, w, num_prod, 1e-3, 1e-4, 1e-3, level);
+        });
+        BOOST_TEST_MESSAGE(simd_level_name(level)
+                           << ": " << t * 1e6 << " us/frame, " << 3 * num_prod / t / 1e6
+                           << " Mvalues/s (" << t_ref / t << "x)");
+    }
+}
@@ -0,0 +1,249 @@
+#define BOOST_TEST_MODULE "test_vis_accumulate_kernel"
+
+#include "simdDispatch.hpp"        // for simdLevel, simd_level, simd_level_name
+#include "visAccumulateKernel.hpp" // for accumulate_vis, accumulate_vis_even, accumulate_vis_odd
+#include "visUtil.hpp"             // for cfloat, map_vis_triangle, vis_triangle_gather_plan, gpu...
+
+#include <algorithm>                         // for shuffle
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK_EQUAL_COLLECTIONS
+#include <chrono>                            // for duration, high_resolution_clock, time_point
+#include <complex>                           // for conj
+#include <cstdint>                           // for int32_t
+#include <cstring>                           // for memcpy
+#include <numeric>                           // for iota
+#include <random>                            // for mt19937, uniform_int_distribution
+#include <stddef.h>                          // for size_t
+#include <vector>                            // for vector
+
+// Odd product count to exercise the scalar tails of every implementation
+const size_t num_prod = 2048 * 2049 / 2 + 3;
+
+// Levels available on this machine
+std::vector<simdLevel> levels() {
+    std::vector<simdLevel> l;
+    for (auto level : {simdLevel::scalar, simdLevel::avx2, simdLevel::avx512}) {
+        if (level <= simd_level())
+            l.push_back(level);
+    }
+    return l;
+}
+
+std::vector<int32_t> random_vis(size_t n, int seed) {
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int32_t> dis(-1000000, 1000000);
+    std::vector<int32_t> v(n);
+    for (auto& x : v)
+        x = dis(gen);
+    return v;
+}
+
+// The variance may round differently if the compiler contracts to FMAs
+void check_var(const std::vector<float>& var, const std::vector<float>& ref_var) {
+    BOOST_REQUIRE_EQUAL(var.size(), ref_var.size());
+    for (size_t i = 0; i < var.size(); i++) {
+        BOOST_CHECK_CLOSE(var[i], ref_var[i], 1e-4);
+    }
+}
+
+// The loops from visAccumulate before the kernels were introduced
+void reference_even(int32_t* acc, int32_t* vis_even, const int32_t* input) {
+    for (size_t i = 0; i < 2 * num_prod; i++) {
+        acc[i] += input[i];
+    }
+    std::memcpy(vis_even, input, 8 * num_prod);
+}
+
+void reference_odd(int32_t* acc, float* var, const int32_t* vis_even, const int32_t* input) {
+    for (size_t i = 0; i < 2 * num_prod; i++) {
+        acc[i] += input[i];
+    }
+    for (size_t i = 0; i < num_prod; i++) {
+        float di = input[2 * i] - vis_even[2 * i];
+        float dr = input[2 * i + 1] - vis_even[2 * i + 1];
+        var[i] += (dr * dr + di * di);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(_accumulate_matches_reference) {
+    auto in0 = random_vis(2 * num_prod, 1);
+    auto in1 = random_vis(2 * num_prod, 2);
+
+    std::vector<int32_t> ref_acc = random_vis(2 * num_prod, 3), ref_even(2 * num_prod);
+    std::vector<float> ref_var(num_prod, 1.0f);
+    auto init_acc = ref_acc;
+    auto init_var = ref_var;
+
+    reference_even(ref_acc.data(), ref_even.data(), in0.data());
+    reference_odd(ref_acc.data(), ref_var.data(), ref_even.data(), in1.data());
+
+    for (auto level : levels()) {
+        BOOST_TEST_MESSAGE("Testing " << simd_level_name(level));
+
+        auto acc = init_acc;
+        auto var = init_var;
+        std::vector<int32_t> even(2 * num_prod);
+
+        accumulate_vis_even(acc.data(), even.data(), in0.data(), num_prod, level);
+        accumulate_vis_odd(acc.data(), var.data(), even.data(), in1.data(), num_prod, level);
+
+        BOOST_CHECK_EQUAL_COLLECTIONS(even.begin(), even.end(), ref_even.begin(), ref_even.end());
+        BOOST_CHECK_EQUAL_COLLECTIONS(acc.begin(), acc.end(), ref_acc.begin(), ref_acc.end());
+        check_var(var, ref_var);
+
+        // Plain accumulation
+        acc = init_acc;
+        accumulate_vis(acc.data(), in0.data(), 2 * num_prod, level);
+        accumulate_vis(acc.data(), in1.data(), 2 * num_prod, level);
+        BOOST_CHECK_EQUAL_COLLECTIONS(acc.begin(), acc.end(), ref_acc.begin(), ref_acc.end());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(_accumulate_without_acc) {
+    auto in0 = random_vis(2 * num_prod, 4);
+    auto in1 = random_vis(2 * num_prod, 5);
+
+    std::vector<int32_t> ref_acc(2 * num_prod), ref_even(2 * num_prod);
+    std::vector<float> ref_var(num_prod, 0.0f);
+    reference_even(ref_acc.data(), ref_even.data(), in0.data());
+    reference_odd(ref_acc.data(), ref_var.data(), ref_even.data(), in1.data());
+
+    for (auto level : levels()) {
+        std::vector<int32_t> even(2 * num_prod);
+        std::vector<float> var(num_prod, 0.0f);
+
+        accumulate_vis_even(nullptr, even.data(), in0.data(), num_prod, level);
+        accumulate_vis_odd(nullptr, var.data(), even.data(), in1.data(), num_prod, level);
+
+        BOOST_CHECK_EQUAL_COLLECTIONS(even.begin(), even.end(), ref_even.begin(), ref_even.end());
+        check_var(var, ref_var);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(_unpack_matches_map_vis_triangle) {
+    const size_t N = 64, block = 16, num_freq = 2;
+
+    // Scramble the inputs so that some products are conjugated
+    std::vector<uint32_t> inputmap(N);
+    std::iota(inputmap.begin(), inputmap.end(), 0);
+    std::shuffle(inputmap.begin(), inputmap.end(), std::mt19937(8));
+
+    const size_t num_gpu = gpu_N2_size(N, block);
+    const size_t num_prod = N * (N + 1) / 2;
+    auto vis1 = random_vis(2 * num_gpu * num_freq, 9);
+    std::vector<float> var(num_gpu * num_freq);
+    for (size_t i = 0; i < var.size(); i++)
+        var[i] = 1.0f + i;
+
+    const float iw = 0.125f, w = 17.0f;
+    const auto plan = vis_triangle_gather_plan(inputmap, block, N);
+    BOOST_REQUIRE_EQUAL(plan.size(), num_prod);
+
+    for (uint32_t freq = 0; freq < num_freq; freq++) {
+
+        // What visAccumulate did before the plan existed
+        std::vector<cfloat> ref_vis(num_prod);
+        std::vector<float> ref_weight(num_prod);
+        map_vis_triangle(inputmap, block, N, freq, [&](int32_t pi, int32_t bi, bool conj) {
+            cfloat t = {(float)vis1[2 * bi + 1], (float)vis1[2 * bi]};
+            t = !conj ? t : std::conj(t);
+            ref_vis[pi] = iw * t;
+            ref_weight[pi] = w * w / var[bi];
+        });
+
+        for (auto level : levels()) {
+            std::vector<cfloat> out_vis(num_prod);
+            std::vector<float> out_weight(num_prod);
+            unpack_vis(out_vis.data(), out_weight.data(), plan.data(), num_prod,
+                       vis1.data() + 2 * freq * num_gpu, var.data() + freq * num_gpu, iw, w * w,
+                       level);
+
+            BOOST_CHECK_EQUAL_COLLECTIONS(out_vis.begin(), out_vis.end(), ref_vis.begin(),
+                                          ref_vis.end());
+            BOOST_CHECK_EQUAL_COLLECTIONS(out_weight.begin(), out_weight.end(),
+                                          ref_weight.begin(), ref_weight.end());
+        }
+    }
+}
+
+// Microbenchmark of an even/odd frame pair against the original loops
+BOOST_AUTO_TEST_CASE(_accumulate_speed) {
+    const int n_iter = 20;
+
+    auto in0 = random_vis(2 * num_prod, 6);
+    auto in1 = random_vis(2 * num_prod, 7);
+    std::vector<int32_t> acc(2 * num_prod), even(2 * num_prod);
+    std::vector<float> var(num_prod);
+
+    auto time_it = [&](auto&& f) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < n_iter; i++) {
+            f();
+        }
+        std::chrono::duration<double> t = std::chrono::high_resolution_clock::now() - start;
+        return t.count() / n_iter;
+    };
+
+    double t_ref = time_it([&]() {
+        reference_even(acc.data(), even.data(), in0.data());
+        reference_odd(acc.data(), var.data(), even.data(), in1.data());
+    });
+    BOOST_TEST_MESSAGE("reference: " << t_ref * 1e3 << " ms per frame pair");
+
+    for (auto level : levels()) {
+        double t = time_it([&]() {
+            accumulate_vis_even(acc.data(), even.data(), in0.data(), num_prod, level);
+            accumulate_vis_odd(acc.data(), var.data(), even.data(), in1.data(), num_prod, level);
+        });
+        BOOST_TEST_MESSAGE(simd_level_name(level) << ": " << t * 1e3 << " ms per frame pair ("
+                                                  << t_ref / t << "x)");
+    }
+}
+
+// Microbenchmark of the end of integration unpacking against map_vis_triangle
+BOOST_AUTO_TEST_CASE(_unpack_speed) {
+    const size_t N = 2048, block = 32;
+    const int n_iter = 5;
+
+    std::vector<uint32_t> inputmap(N);
+    std::iota(inputmap.begin(), inputmap.end(), 0);
+    std::shuffle(inputmap.begin(), inputmap.end(), std::mt19937(10));
+
+    const size_t num_gpu = gpu_N2_size(N, block);
+    const size_t num_prod = N * (N + 1) / 2;
+    auto vis1 = random_vis(2 * num_gpu, 11);
+    std::vector<float> var(num_gpu, 3.0f);
+    std::vector<cfloat> out_vis(num_prod);
+    std::vector<float> out_weight(num_prod);
+    const float iw = 0.5f, w = 2.0f;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < n_iter; i++) {
+        map_vis_triangle(inputmap, block, N, 0, [&](int32_t pi, int32_t bi, bool conj) {
+            cfloat t = {(float)vis1[2 * bi + 1], (float)vis1[2 * bi]};
+            t = !conj ? t : std::conj(t);
+            out_vis[pi] = iw * t;
+        });
+        map_vis_triangle(inputmap, block, N, 0, [&](int32_t pi, int32_t bi, bool conj) {
+            (void)conj;
+            out_weight[pi] = w * w / var[bi];
+        });
+    }
+    std::chrono::duration<double> t_ref = std::chrono::high_resolution_clock::now() - start;
+    BOOST_TEST_MESSAGE("map_vis_triangle: " << t_ref.count() / n_iter * 1e3 << " ms per frame");
+
+    start = std::chrono::high_resolution_clock::now();
+    const auto plan = vis_triangle_gather_plan(inputmap, block, N);
+    std::chrono::duration<double> t_plan = std::chrono::high_resolution_clock::now() - start;
+    BOOST_TEST_MESSAGE("building plan: " << t_plan.count() * 1e3 << " ms (once)");
+
+    for (auto level : levels()) {
+        start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < n_iter; i++) {
+            unpack_vis(out_vis.data(), out_weight.data(), plan.data(), num_prod, vis1.data(),
+                       var.data(), iw, w * w, level);
+        }
+        std::chrono::duration<double> t = std::chrono::high_resolution_clock::now() - start;
+        BOOST_TEST_MESSAGE(simd_level_name(level) << ": " << t.count() / n_iter * 1e3
+                                                  << " ms per frame (" << t_ref / t << "x)");
+    }
+}
@@ -0,0 +1,203 @@
+#define BOOST_TEST_MODULE "test_vis_shared_mem"
+
+#include "visBuffer.hpp"    // for VisFrameView, VisMetadata
+#include "visSharedMem.hpp" // for visSharedMemRing, visSharedMemReader
+
+#include <algorithm>                         // for fill
+#include <atomic>                            // for atomic, atomic_bool
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK_EQUAL, BOOST_...
+#include <chrono>                            // for duration, high_resolution_clock, time_point
+#include <cstdint>                           // for uint8_t, int64_t, uint64_t
+#include <fcntl.h>                           // for O_CREAT, O_RDWR, O_EXCL
+#include <memory>                            // for unique_ptr, make_unique
+#include <stddef.h>                          // for size_t
+#include <stdexcept>                         // for runtime_error
+#include <string>                            // for string, to_string
+#include <sys/mman.h>                        // for mmap, munmap, shm_open, shm_unlink, MAP_...
+#include <thread>                            // for thread
+#include <unistd.h>                          // for ftruncate, close, getpid
+#include <vector>                            // for vector
+
+// A shared memory region set up the way VisSharedMemWriter does it
+struct shmRing {
+    shmRing(size_t ntime, size_t nfreq, uint32_t num_elements) :
+        name("test_vis_shared_mem_" + std::to_string(getpid())) {
+
+        num_prod = num_elements * (num_elements + 1) / 2;
+        rbs.ntime = ntime;
+        rbs.nfreq = nfreq;
+        rbs.metadata_size = sizeof(VisMetadata);
+        rbs.data_size = VisFrameView::calculate_frame_size(num_elements, num_prod, 0);
+        rbs.frame_size = (rbs.data_size + rbs.metadata_size + visSharedMemRing::valid_size + 4095)
+                         / 4096 * 4096;
+        size = visSharedMemRing::region_size(rbs);
+
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        BOOST_REQUIRE(fd >= 0);
+        BOOST_REQUIRE(ftruncate(fd, size) == 0);
+        addr = (uint8_t*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        BOOST_REQUIRE(addr != MAP_FAILED);
+        close(fd);
+
+        ring = std::make_unique<visSharedMemRing>(addr, rbs);
+
+        metadata.num_elements = num_elements;
+        metadata.num_prod = num_prod;
+        metadata.num_ev = 0;
+        data.resize(rbs.data_size);
+    }
+
+    ~shmRing() {
+        munmap(addr, size);
+        shm_unlink(name.c_str());
+    }
+
+    // Write time sample `t` the way the writer stage does, dropping the
+    // oldest time once the ring is full
+    void write_time(size_t t) {
+        size_t time_ind = t % rbs.ntime;
+        if (t >= rbs.ntime)
+            ring->reset(time_ind);
+        for (size_t f = 0; f < rbs.nfreq; f++) {
+            metadata.fpga_seq_start = fpga_seq(t);
+            metadata.freq_id = f;
+            std::fill(data.begin(), data.end(), pattern(fpga_seq(t), f));
+            ring->write(time_ind, f, fpga_seq(t), &metadata, data.data());
+        }
+    }
+
+    static int64_t fpga_seq(size_t t) {
+        return 1000 + 390625 * t;
+    }
+
+    static uint8_t pattern(int64_t fpga_seq, size_t f) {
+        return (uint8_t)(fpga_seq / 390625 * 31 + f * 7 + 1);
+    }
+
+    std::string name;
+    visSharedMemRing::Structure rbs;
+    size_t size;
+    uint8_t* addr;
+    std::unique_ptr<visSharedMemRing> ring;
+
+    uint32_t num_prod;
+    VisMetadata metadata;
+    std::vector<uint8_t> data;
+};
+
+// Check every valid frame the reader holds is a single, whole write. Returns
+// the number of valid frames.
+size_t check_frames(const visSharedMemReader& reader, size_t& bad) {
+    size_t num_valid = 0;
+    auto seqs = reader.fpga_seqs();
+    const auto& s = reader.structure();
+    for (size_t t = 0; t < reader.num_time(); t++) {
+        if (t > 0 && seqs[t] <= seqs[t - 1])
+            bad++;
+        for (size_t f = 0; f < s.nfreq; f++) {
+            if (!reader.valid(t, f))
+                continue;
+            num_valid++;
+            auto m = reader.metadata(t, f);
+            uint8_t p = shmRing::pattern(m->fpga_seq_start, f);
+            const uint8_t* d = reader.data(t, f);
+            bool ok = ((int64_t)m->fpga_seq_start == seqs[t]) && (m->freq_id == f);
+            for (size_t i = 0; i < s.data_size; i++)
+                ok &= (d[i] == p);
+            if (!ok)
+                bad++;
+        }
+    }
+    return num_valid;
+}
+
+BOOST_AUTO_TEST_CASE(_read_write) {
+    shmRing shm(5, 3, 4);
+    visSharedMemReader reader(shm.name, 3);
+
+    BOOST_CHECK_EQUAL(reader.update(), 0);
+    BOOST_CHECK_EQUAL(reader.num_time(), 0);
+
+    // Fill the ring and then go round it once more
+    for (size_t t = 0; t < 4; t++)
+        shm.write_time(t);
+    BOOST_CHECK_EQUAL(reader.update(), 3 * 3);
+    BOOST_CHECK_EQUAL(reader.update(), 0);
+
+    for (size_t t = 4; t < 9; t++)
+        shm.write_time(t);
+    BOOST_CHECK_EQUAL(reader.update(), 3 * 3);
+
+    size_t bad = 0;
+    BOOST_CHECK_EQUAL(check_frames(reader, bad), 3 * 3);
+    BOOST_CHECK_EQUAL(bad, 0);
+    BOOST_CHECK(reader.fpga_seqs() == std::vector<int64_t>({shm.fpga_seq(6), shm.fpga_seq(7),
+                                                            shm.fpga_seq(8)}));
+    BOOST_CHECK_EQUAL(reader.vis(0, 0).size(), shm.num_prod);
+
+    // Readers notice the writer going away, and can't open a region that doesn't exist
+    shm.ring->close();
+    BOOST_CHECK_THROW(reader.update(), std::runtime_error);
+    BOOST_CHECK_THROW(visSharedMemReader("test_vis_shared_mem_missing"), std::runtime_error);
+}
+
+// Run a writer flat out with a number of readers polling all the time
+void run_readers(size_t num_readers, size_t num_times, bool report) {
+    const size_t ntime = 16, nfreq = 32;
+    shmRing shm(ntime, nfreq, 16);
+
+    std::atomic_bool done(false);
+    std::atomic<size_t> bad(0), copied(0), updates(0);
+
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < num_readers; i++) {
+        readers.emplace_back([&]() {
+            visSharedMemReader reader(shm.name, 8);
+            size_t my_bad = 0;
+            while (!done) {
+                copied += reader.update();
+                updates++;
+                check_frames(reader, my_bad);
+            }
+            bad += my_bad;
+        });
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t t = 0; t < num_times; t++)
+        shm.write_time(t);
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    done = true;
+    for (auto& r : readers)
+        r.join();
+
+    BOOST_CHECK_EQUAL(bad, 0);
+
+    // Once the writer stops everything can be read
+    visSharedMemReader reader(shm.name, 8);
+    reader.update();
+    size_t final_bad = 0;
+    BOOST_CHECK_EQUAL(check_frames(reader, final_bad), 8 * nfreq);
+    BOOST_CHECK_EQUAL(final_bad, 0);
+
+    if (report) {
+        double frames = num_times * nfreq;
+        BOOST_TEST_MESSAGE(num_readers
+                           << " readers: writer " << frames / elapsed.count() << " frames/s ("
+                           << frames * shm.rbs.data_size / elapsed.count() / 1e6 << " MB/s), readers "
+                           << copied / elapsed.count() << " frames/s in "
+                           << updates / elapsed.count() << " updates/s");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(_concurrent_readers) {
+    run_readers(4, 2000, false);
+}
+
+// How much readers slow down the writer, and how much they can read
+BOOST_AUTO_TEST_CASE(_reader_throughput) {
+    for (size_t num_readers : {0, 1, 4, 16})
+        run_readers(num_readers, 4000, true);
+}
@@ -0,0 +1,226 @@
+#define BOOST_TEST_MODULE "test_vis_stack_kernel"
+
+#include "Stack.hpp"          // for stack_chime_in_cyl, stack_diagonal
+#include "simdDispatch.hpp"   // for simdLevel, simd_level, simd_level_name
+#include "visStackKernel.hpp" // for stackPlan, stackRun, make_stack_plan, stack_vis
+#include "visUtil.hpp"        // for cfloat, input_ctype, prod_ctype, rstack_ctype, fast_norm
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK_CLOSE
+#include <chrono>                            // for duration, high_resolution_clock, time_point
+#include <complex>                           // for conj, norm
+#include <cstdint>                           // for uint32_t, uint16_t, int32_t
+#include <functional>                        // for function
+#include <random>                            // for mt19937, uniform_real_distribution, unif...
+#include <stddef.h>                          // for size_t
+#include <stdexcept>                         // for invalid_argument
+#include <string>                            // for string
+#include <utility>                           // for pair, make_pair
+#include <vector>                            // for vector
+
+// Levels available on this machine
+std::vector<simdLevel> levels() {
+    std::vector<simdLevel> l;
+    for (auto level : {simdLevel::scalar, simdLevel::avx2, simdLevel::avx512}) {
+        if (level <= simd_level())
+            l.push_back(level);
+    }
+    return l;
+}
+
+// Every `step`th CHIME input, with the full triangle of products
+std::pair<std::vector<input_ctype>, std::vector<prod_ctype>> chime_inputs(uint16_t step) {
+    std::vector<input_ctype> inputs;
+    for (uint16_t i = 0; i < 2048; i += step)
+        inputs.emplace_back(i, std::to_string(i));
+
+    std::vector<prod_ctype> prods;
+    for (uint16_t i = 0; i < inputs.size(); i++)
+        for (uint16_t j = i; j < inputs.size(); j++)
+            prods.push_back({i, j});
+
+    return {inputs, prods};
+}
+
+struct frame_data {
+    std::vector<cfloat> vis;
+    std::vector<float> weight;
+    std::vector<float> flags;
+};
+
+frame_data random_frame(size_t num_elements, size_t num_prod, int seed) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dis(-10.0f, 10.0f);
+
+    frame_data f;
+    for (size_t i = 0; i < num_prod; i++) {
+        f.vis.push_back({dis(gen), dis(gen)});
+        // Some of the products have zero weight
+        f.weight.push_back(i % 11 == 0 ? 0.0f : std::abs(dis(gen)));
+    }
+    f.flags.assign(num_elements, 1.0f);
+    for (size_t i = 3; i < num_elements; i += 17)
+        f.flags[i] = 0.0f;
+
+    return f;
+}
+
+// The loop from baselineCompression before the kernel was introduced
+float reference(cfloat* out_vis, float* out_weight, uint32_t num_stack,
+                const std::vector<rstack_ctype>& stack_map, const std::vector<prod_ctype>& prods,
+                const frame_data& f) {
+    std::vector<float> stack_norm(num_stack, 0.0);
+    std::vector<float> stack_v2(num_stack, 0.0);
+    std::fill(out_vis, out_vis + num_stack, 0.0);
+    std::fill(out_weight, out_weight + num_stack, 0.0);
+
+    for (uint32_t prod_ind = 0; prod_ind < prods.size(); prod_ind++) {
+        cfloat vis = f.vis[prod_ind];
+        float weight = f.weight[prod_ind];
+
+        auto& p = prods[prod_ind];
+        auto& s = stack_map[prod_ind];
+
+        if (weight == 0 || f.flags[p.input_a] == 0 || f.flags[p.input_b] == 0)
+            continue;
+
+        vis = s.conjugate ? conj(vis) : vis;
+        out_vis[s.stack] += vis;
+        stack_v2[s.stack] += fast_norm(vis);
+        out_weight[s.stack] += (1.0 / weight);
+        stack_norm[s.stack] += 1.0;
+    }
+
+    float vart = 0.0;
+    float normt = 0.0;
+    for (uint32_t stack_ind = 0; stack_ind < num_stack; stack_ind++) {
+        float norm = stack_norm[stack_ind];
+        float inorm = (norm != 0.0) ? (1.0 / norm) : 0.0;
+        float iwgt = (out_weight[stack_ind] != 0.0) ? (1.0 / out_weight[stack_ind]) : 0.0;
+        out_vis[stack_ind] *= inorm;
+        out_weight[stack_ind] = norm * norm * iwgt;
+        vart += stack_v2[stack_ind] - std::norm(out_vis[stack_ind]) * norm;
+        normt += norm;
+    }
+    return (normt != 0.0) ? (vart / normt) : 0.0;
+}
+
+// Only the residual may round differently between implementations
+void check_stack(const std::vector<cfloat>& vis, const std::vector<float>& weight, float residual,
+                 const std::vector<cfloat>& ref_vis, const std::vector<float>& ref_weight,
+                 float ref_residual) {
+    BOOST_CHECK(vis == ref_vis);
+    BOOST_CHECK_EQUAL_COLLECTIONS(weight.begin(), weight.end(), ref_weight.begin(),
+                                  ref_weight.end());
+    BOOST_CHECK_CLOSE(residual, ref_residual, 1e-3);
+}
+
+BOOST_AUTO_TEST_CASE(_plan_runs) {
+    // Rows of three inputs. The first row ascends through the stacks, the
+    // second descends and the last can't be joined onto it.
+    std::vector<prod_ctype> prods = {{0, 0}, {0, 1}, {0, 2}, {1, 1}, {1, 2}, {2, 2}};
+    std::vector<rstack_ctype> stack_map = {{2, false}, {3, false}, {4, false},
+                                           {1, true},  {0, true},  {5, true}};
+
+    auto plan = make_stack_plan(stack_map, prods, 6);
+    BOOST_CHECK_EQUAL(plan.num_prod, 6);
+    BOOST_CHECK_EQUAL(plan.num_stack, 6);
+    BOOST_REQUIRE_EQUAL(plan.runs.size(), 3);
+
+    auto check_run = [](const stackRun& r, uint32_t prod, uint32_t stack, uint32_t length,
+                        int32_t step, uint16_t a, uint16_t b, bool conj) {
+        BOOST_CHECK_EQUAL(r.prod, prod);
+        BOOST_CHECK_EQUAL(r.stack, stack);
+        BOOST_CHECK_EQUAL(r.length, length);
+        BOOST_CHECK_EQUAL(r.step, step);
+        BOOST_CHECK_EQUAL(r.input_a, a);
+        BOOST_CHECK_EQUAL(r.input_b, b);
+        BOOST_CHECK_EQUAL(r.conjugate, conj);
+    };
+    check_run(plan.runs[0], 0, 2, 3, 1, 0, 0, false);
+    check_run(plan.runs[1], 3, 1, 2, -1, 1, 1, true);
+    check_run(plan.runs[2], 5, 5, 1, 1, 2, 2, true);
+
+    // Stack out of range
+    stack_map[2].stack = 6;
+    BOOST_CHECK_THROW(make_stack_plan(stack_map, prods, 6), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(_stack_matches_reference) {
+    auto [inputs, prods] = chime_inputs(8);
+    auto f = random_frame(inputs.size(), prods.size(), 1);
+
+    // A stack definition without any structure, so almost every run has length one
+    auto stack_random = [](const std::vector<input_ctype>&, const std::vector<prod_ctype>& p) {
+        std::mt19937 gen(3);
+        std::uniform_int_distribution<uint32_t> dis(0, 99);
+        std::vector<rstack_ctype> stack_map;
+        for (size_t i = 0; i < p.size(); i++)
+            stack_map.push_back({dis(gen), dis(gen) % 2 == 0});
+        return std::make_pair(100u, stack_map);
+    };
+
+    std::vector<std::function<std::pair<uint32_t, std::vector<rstack_ctype>>(
+        const std::vector<input_ctype>&, const std::vector<prod_ctype>&)>>
+        stack_fns = {stack_chime_in_cyl, stack_diagonal, stack_random};
+
+    for (auto& stack_fn : stack_fns) {
+        auto [num_stack, stack_map] = stack_fn(inputs, prods);
+        auto plan = make_stack_plan(stack_map, prods, num_stack);
+
+        std::vector<cfloat> ref_vis(num_stack);
+        std::vector<float> ref_weight(num_stack);
+        float ref_residual = reference(ref_vis.data(), ref_weight.data(), num_stack, stack_map,
+                                       prods, f);
+
+        for (auto level : levels()) {
+            BOOST_TEST_MESSAGE("Testing " << simd_level_name(level) << ", " << num_stack
+                                          << " stacks in " << plan.runs.size() << " runs");
+
+            std::vector<cfloat> vis(num_stack);
+            std::vector<float> weight(num_stack);
+            float residual = stack_vis(vis.data(), weight.data(), plan, f.vis.data(),
+                                       f.weight.data(), f.flags.data(), level);
+            check_stack(vis, weight, residual, ref_vis, ref_weight, ref_residual);
+        }
+    }
+}
+
+// Benchmark of full CHIME frames against the original loop
+BOOST_AUTO_TEST_CASE(_stack_speed) {
+    const int n_iter = 5;
+
+    auto [inputs, prods] = chime_inputs(1);
+    auto [num_stack, stack_map] = stack_chime_in_cyl(inputs, prods);
+    auto f = random_frame(inputs.size(), prods.size(), 2);
+
+    std::vector<cfloat> vis(num_stack);
+    std::vector<float> weight(num_stack);
+
+    auto time_it = [&](auto&& fn) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < n_iter; i++) {
+            fn();
+        }
+        std::chrono::duration<double> t = std::chrono::high_resolution_clock::now() - start;
+        return t.count() / n_iter;
+    };
+
+    double t_ref =
+        time_it([&]() { reference(vis.data(), weight.data(), num_stack, stack_map, prods, f); });
+    BOOST_TEST_MESSAGE("reference: " << 1.0 / t_ref << " frames/s");
+
+    auto start = std::chrono::high_resolution_clock::now();
+    auto plan = make_stack_plan(stack_map, prods, num_stack);
+    std::chrono::duration<double> t_plan = std::chrono::high_resolution_clock::now() - start;
+    BOOST_TEST_MESSAGE("building plan: " << t_plan.count() * 1e3 << " ms (once per stack), "
+                                       << plan.runs.size() << " runs");
+
+    for (auto level : levels()) {
+        double t = time_it([&]() {
+            stack_vis(vis.data(), weight.data(), plan, f.vis.data(), f.weight.data(),
+                      f.flags.data(), level);
+        });
+        BOOST_TEST_MESSAGE(simd_level_name(level)
+                           << ": " << 1.0 / t << " frames/s (" << t_ref / t << "x)");
+    }
+}